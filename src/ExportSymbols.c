@@ -10,9 +10,10 @@ static const R_CallMethodDef CallEntries[] = {
   {"Cpp_BW", (DL_FUNC) &_collapse_BWCpp, 10},
   {"Cpp_BWm", (DL_FUNC) &_collapse_BWmCpp, 10},
   {"Cpp_BWl", (DL_FUNC) &_collapse_BWlCpp, 10},
-  {"C_TRA", (DL_FUNC) &TRAC, 5},
-  {"C_TRAm", (DL_FUNC) &TRAmC, 5},
-  {"C_TRAl", (DL_FUNC) &TRAlC, 5},
+  {"C_TRA", (DL_FUNC) &TRAC, 6},
+  {"C_TRAm", (DL_FUNC) &TRAmC, 6},
+  {"C_TRAl", (DL_FUNC) &TRAlC, 6},
+  {"C_fusedTRA", (DL_FUNC) &fusedTRAC, 6},
   {"C_fndistinct", (DL_FUNC) &fndistinctC, 4},
   {"C_fndistinctl", (DL_FUNC) &fndistinctlC, 5},
   {"C_fndistinctm", (DL_FUNC) &fndistinctmC, 5},
@@ -54,6 +55,31 @@ static const R_CallMethodDef CallEntries[] = {
   {"C_fnthm", (DL_FUNC) &fnthmC, 8},
   {"C_fnthl", (DL_FUNC) &fnthlC, 8},
   {"C_fquantile", (DL_FUNC) &fquantileC, 8},
+  {"C_fquantileg", (DL_FUNC) &fquantilegC, 10},
+  {"C_qsketch", (DL_FUNC) &qsketchC, 6},
+  {"C_qsketch_merge", (DL_FUNC) &qsketch_mergeC, 5},
+  {"C_qsketch_quantile", (DL_FUNC) &qsketch_quantileC, 2},
+  {"C_fndistinct_approx", (DL_FUNC) &fndistinct_approxC, 5},
+  {"C_fndistinct_approxl", (DL_FUNC) &fndistinct_approxlC, 6},
+  {"C_fndistinct_approxm", (DL_FUNC) &fndistinct_approxmC, 6},
+  {"C_dsketch", (DL_FUNC) &dsketchC, 5},
+  {"C_dsketch_merge", (DL_FUNC) &dsketch_mergeC, 5},
+  {"C_dsketch_count", (DL_FUNC) &dsketch_countC, 2},
+  {"C_fstate", (DL_FUNC) &fstateC, 6},
+  {"C_fstate_merge", (DL_FUNC) &fstate_mergeC, 5},
+  {"C_fmmap", (DL_FUNC) &fmmapC, 6},
+  {"C_arrow_alloc", (DL_FUNC) &arrow_allocC, 0},
+  {"C_arrow_import", (DL_FUNC) &arrow_importC, 2},
+  {"C_arrow_export", (DL_FUNC) &arrow_exportC, 3},
+  {"C_arrow_test", (DL_FUNC) &arrow_testC, 3},
+  {"C_pwcorcov", (DL_FUNC) &pwcorcovC, 5},
+  {"C_fcov", (DL_FUNC) &fcovC, 8},
+  {"C_fhdwithin", (DL_FUNC) &fhdwithinC, 8},
+  {"C_flm", (DL_FUNC) &flmC, 4},
+  {"C_flmg", (DL_FUNC) &flmgC, 7},
+  {"C_psacf", (DL_FUNC) &psacfC, 7},
+  {"C_psmat", (DL_FUNC) &psmatC, 7},
+  {"C_qsu_panel", (DL_FUNC) &qsu_panelC, 9},
   {"C_fprod", (DL_FUNC) &fprodC, 5},
   {"C_fprodm", (DL_FUNC) &fprodmC, 6},
   {"C_fprodl", (DL_FUNC) &fprodlC, 6},
@@ -68,7 +94,6 @@ static const R_CallMethodDef CallEntries[] = {
   {"Cpp_fvarsdl", (DL_FUNC) &_collapse_fvarsdlCpp, 9},
   {"Cpp_mrtl", (DL_FUNC) &_collapse_mrtl, 3},
   {"Cpp_mctl", (DL_FUNC) &_collapse_mctl, 3},
-  {"Cpp_psmat", (DL_FUNC) &_collapse_psmatCpp, 5},
   {"Cpp_qF", (DL_FUNC) &_collapse_qFCpp, 5},
   {"Cpp_sortunique", (DL_FUNC) &_collapse_sortuniqueCpp, 1},
   {"Cpp_fdroplevels", (DL_FUNC) &_collapse_fdroplevelsCpp, 2},
@@ -121,6 +146,7 @@ static const R_CallMethodDef CallEntries[] = {
   {"C_alloc", (DL_FUNC) &falloc, 3},
   {"C_frange", (DL_FUNC) &frange, 3},
   {"C_fdist", (DL_FUNC) &fdist, 4},
+  {"C_fdistp", (DL_FUNC) &fdistpC, 5},
   {"C_fnrow", (DL_FUNC) &fnrowC, 1},
   {"C_createeptr", (DL_FUNC) &createeptr, 1},
   {"C_geteptr", (DL_FUNC) &geteptr, 1},
@@ -144,6 +170,9 @@ static const R_CallMethodDef CallEntries[] = {
   {"C_fcumsum", (DL_FUNC) &fcumsumC, 6},
   {"C_fcumsumm", (DL_FUNC) &fcumsummC, 6},
   {"C_fcumsuml", (DL_FUNC) &fcumsumlC, 6},
+  {"C_fewma", (DL_FUNC) &fewmaC, 9},
+  {"C_fewmam", (DL_FUNC) &fewmamC, 10},
+  {"C_fewmal", (DL_FUNC) &fewmalC, 10},
   {NULL, NULL, 0}
 };
 
@@ -151,6 +180,8 @@ void R_init_collapse(DllInfo *dll) {
   R_registerRoutines(dll, CEntries, CallEntries, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
   R_forceSymbols(dll, TRUE);
+  fmmap_init(dll); // ALTREP classes of memory-mapped vectors
+  arrow_init(dll); // ALTREP classes of zero-copy Arrow vectors
 
   /* C API
 
@@ -165,7 +196,7 @@ void R_init_collapse(DllInfo *dll) {
      regarding the arguments and use of certain C functions. */
 
   // Functions that fully operate on R vectors (SEXP)                           // Corresponding R function(s)
-  R_RegisterCCallable("collapse", "cp_TRA", (DL_FUNC) &TRAC);                  // TRA.default()
+  R_RegisterCCallable("collapse", "cp_TRA", (DL_FUNC) &TRAC1);                 // TRA.default()
   R_RegisterCCallable("collapse", "cp_setop", (DL_FUNC) &setop);               // setop()
   R_RegisterCCallable("collapse", "cp_range", (DL_FUNC) &frange);              // frange()
   R_RegisterCCallable("collapse", "cp_dist", (DL_FUNC) &fdist);                // fdist()
@@ -381,21 +381,6 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
-// psmatCpp
-SEXP psmatCpp(const SEXP& x, const IntegerVector& g, const SEXP& t, bool transpose, const SEXP& fill);
-RcppExport SEXP _collapse_psmatCpp(SEXP xSEXP, SEXP gSEXP, SEXP tSEXP, SEXP transposeSEXP, SEXP fillSEXP) {
-BEGIN_RCPP
-    Rcpp::RObject rcpp_result_gen;
-    Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const SEXP& >::type x(xSEXP);
-    Rcpp::traits::input_parameter< const IntegerVector& >::type g(gSEXP);
-    Rcpp::traits::input_parameter< const SEXP& >::type t(tSEXP);
-    Rcpp::traits::input_parameter< bool >::type transpose(transposeSEXP);
-    Rcpp::traits::input_parameter< const SEXP& >::type fill(fillSEXP);
-    rcpp_result_gen = Rcpp::wrap(psmatCpp(x, g, t, transpose, fill));
-    return rcpp_result_gen;
-END_RCPP
-}
 // pwnobsmCpp
 IntegerMatrix pwnobsmCpp(SEXP x);
 RcppExport SEXP _collapse_pwnobsmCpp(SEXP xSEXP) {
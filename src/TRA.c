@@ -63,34 +63,26 @@ int TtI(SEXP x) {
 }
 
 
-SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set) {
-  int tx = TYPEOF(x), txAG = TYPEOF(xAG), l = length(x), gs = length(g);
-  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
-
-  int *pg = &l, nog = gs <= 1;
-  if(nog) {
-    if(length(xAG) != 1) error("If g = NULL, NROW(STATS) needs to be 1");
-  } else {
-    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
-    if(gs != l) error("length(g) must match NROW(x)");
-    pg = INTEGER(g);
-  }
-
-  if(set && txAG != tx) error("if set = TRUE with option 'replace_fill', x and STATS need to have identical data types");
+// Multithreading: The ret*_impl() functions below compute the transformation, filling the (preallocated) result out of length l.
+// Their type checks come before any computations, and ret*_setup() calls them with l = 0 after checking the lengths and
+// allocating the result. Afterwards they make no allocating or error-raising R API calls, and can thus be called for
+// different columns in parallel (with nthreads = 1). If nthreads > 1, the loops themselves are parallelized over rows.
 
-  SEXP out = set == 0 ? PROTECT(allocVector(txAG, l)) : x;
+static void ret1_impl(SEXP out, SEXP xAG, SEXP g, int l, int nthreads) {
+  int *pg = &l, nog = length(g) <= 1;
+  if(!nog) pg = INTEGER(g);
 
-  switch(txAG) {
+  switch(TYPEOF(xAG)) {
     case REALSXP:
     {
       double *pout = REAL(out);
       if(nog) {
         double AG = asReal(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG;
       } else {
         double *AG = REAL(xAG)-1;
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG[pg[i]];
       }
       break;
@@ -101,11 +93,11 @@ SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set) {
       int *pout = INTEGER(out);
       if(nog) {
         int AG = asInteger(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG;
       } else {
         int *AG = INTEGER(xAG)-1;
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG[pg[i]];
       }
       break;
@@ -115,7 +107,7 @@ SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set) {
       Rcomplex *pout = COMPLEX(out);
       if(nog) {
         Rcomplex AG = asComplex(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG;
       } else {
         Rcomplex *AG = COMPLEX(xAG)-1;
@@ -128,11 +120,11 @@ SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set) {
       SEXP *pout = SEXPPTR(out);
       if(nog) {
         SEXP AG = asChar(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG;
       } else {
         const SEXP *AG = SEXPPTR_RO(xAG)-1;
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG[pg[i]];
       }
       break;
@@ -153,17 +145,34 @@ SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set) {
       Rbyte *pout = RAW(out);
       if(nog) {
         Rbyte AG = RAW_ELT(xAG, 0);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG;
       } else {
         Rbyte *AG = RAW(xAG)-1;
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = AG[pg[i]];
       }
       break;
     }
     default: error("Not supported SEXP type!");
   }
+}
+
+static SEXP ret1_setup(SEXP x, SEXP xAG, SEXP g, int set) {
+  int tx = TYPEOF(x), txAG = TYPEOF(xAG), l = length(x), gs = length(g);
+  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
+
+  if(gs <= 1) {
+    if(length(xAG) != 1) error("If g = NULL, NROW(STATS) needs to be 1");
+  } else {
+    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
+    if(gs != l) error("length(g) must match NROW(x)");
+  }
+
+  if(set && txAG != tx) error("if set = TRUE with option 'replace_fill', x and STATS need to have identical data types");
+
+  SEXP out = set == 0 ? PROTECT(allocVector(txAG, l)) : x;
+  ret1_impl(out, xAG, g, 0, 1); // Type checks
 
   // Attribute Handling - 4 Situations:
   // 1 - x is classed (factor, date, time series), xAG is not classed. i.e. vector of fnobs, fmean etc.
@@ -186,25 +195,19 @@ SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set) {
   return out;
 }
 
-SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
-  int l = length(x), gs = length(g), tx = TYPEOF(x), txAG = TYPEOF(xAG);
-
-  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
-
-  int *pg = &l, nog = gs <= 1;
-  if(nog) {
-    if(length(xAG) != 1) error("If g = NULL, NROW(STATS) needs to be 1");
-  } else {
-    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
-    if(gs != l) error("length(g) must match NROW(x)");
-    pg = INTEGER(g); // Wmaybe uninitialized
-  }
-
-  if(set && txAG != tx) error("if set = TRUE with option 'replace', x and STATS need to have identical data types");
+SEXP ret1(SEXP x, SEXP xAG, SEXP g, int set, int nthreads) {
+  SEXP out = PROTECT(ret1_setup(x, xAG, g, set));
+  int l = length(x);
+  if(l > 0) ret1_impl(out, xAG, g, l, nthreads);
+  UNPROTECT(1);
+  return out;
+}
 
-  SEXP out = set == 0 ? PROTECT(allocVector(txAG, l)) : x;
+static void ret2_impl(SEXP out, SEXP x, SEXP xAG, SEXP g, int l, int nthreads) {
+  int *pg = &l, nog = length(g) <= 1, txAG = TYPEOF(xAG);
+  if(!nog) pg = INTEGER(g); // Wmaybe uninitialized
 
-  switch(tx) {
+  switch(TYPEOF(x)) {
   case REALSXP:
   {
     double *px = REAL(x);
@@ -213,11 +216,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         double *pout = REAL(out);
         if(nog) {
           double AG = asReal(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? NA_REAL : AG;
         } else {
           double *AG = REAL(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? NA_REAL : AG[pg[i]];
         }
         break;
@@ -227,11 +230,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         int *pout = INTEGER(out);
         if(nog) {
           int AG = asInteger(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? NA_INTEGER : AG;
         } else {
           int *AG = INTEGER(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? NA_INTEGER : AG[pg[i]];
         }
         break;
@@ -240,11 +243,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         SEXP *pout = SEXPPTR(out);
         if(nog) {
           SEXP AG = asChar(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? NA_STRING : AG;
         } else {
           const SEXP *AG = SEXPPTR_RO(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? NA_STRING : AG[pg[i]];
         }
         break;
@@ -263,11 +266,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         double *pout = REAL(out);
         if(nog) {
           double AG = asReal(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_REAL : AG;
         } else {
           double *AG = REAL(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_REAL : AG[pg[i]];
         }
         break;
@@ -277,11 +280,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         int *pout = INTEGER(out);
         if(nog) {
           int AG = asInteger(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_INTEGER : AG;
         } else {
           int *AG = INTEGER(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_INTEGER : AG[pg[i]];
         }
         break;
@@ -290,11 +293,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         SEXP *pout = SEXPPTR(out);
         if(nog) {
           SEXP AG = asChar(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_STRING : AG;
         } else {
           const SEXP *AG = SEXPPTR_RO(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_STRING : AG[pg[i]];
         }
         break;
@@ -312,11 +315,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         double *pout = REAL(out);
         if(nog) {
           double AG = asReal(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? NA_REAL : AG;
         } else {
           double *AG = REAL(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? NA_REAL : AG[pg[i]];
         }
         break;
@@ -326,11 +329,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         int *pout = INTEGER(out);
         if(nog) {
           int AG = asInteger(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? NA_INTEGER : AG;
         } else {
           int *AG = INTEGER(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? NA_INTEGER : AG[pg[i]];
         }
         break;
@@ -339,11 +342,11 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
         SEXP *pout = SEXPPTR(out);
         if(nog) {
           SEXP AG = asChar(xAG);
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? NA_STRING : AG;
         } else {
           const SEXP *AG = SEXPPTR_RO(xAG)-1;
-          #pragma omp simd
+          #pragma omp parallel for simd num_threads(nthreads)
           for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? NA_STRING : AG[pg[i]];
         }
         break;
@@ -356,6 +359,24 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
   default:
     error("Not supported SEXP type!");
   }
+}
+
+static SEXP ret2_setup(SEXP x, SEXP xAG, SEXP g, int set) {
+  int l = length(x), gs = length(g), tx = TYPEOF(x), txAG = TYPEOF(xAG);
+
+  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
+
+  if(gs <= 1) {
+    if(length(xAG) != 1) error("If g = NULL, NROW(STATS) needs to be 1");
+  } else {
+    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
+    if(gs != l) error("length(g) must match NROW(x)");
+  }
+
+  if(set && txAG != tx) error("if set = TRUE with option 'replace', x and STATS need to have identical data types");
+
+  SEXP out = set == 0 ? PROTECT(allocVector(txAG, l)) : x;
+  ret2_impl(out, x, xAG, g, 0, 1); // Type checks
 
   if(set == 0) {
     if(isObject(xAG)) SHALLOW_DUPLICATE_ATTRIB(out, xAG);
@@ -370,43 +391,40 @@ SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set) {
   return out;
 }
 
-// New: Option "replace_NA"
-SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set) {
-  int l = length(x), gs = length(g), tx = TYPEOF(x), txAG = TYPEOF(xAG);
-  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
-
-  int *pg = &l, nog = gs <= 1;
-  if(nog) {
-    if(length(xAG) != 1) error("If g = NULL, NROW(STATS) needs to be 1");
-  } else {
-    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
-    if(gs != l) error("length(g) must match NROW(x)");
-    pg = INTEGER(g); // Wmaybe uninitialized
-  }
+SEXP ret2(SEXP x, SEXP xAG, SEXP g, int set, int nthreads) {
+  SEXP out = PROTECT(ret2_setup(x, xAG, g, set));
+  int l = length(x);
+  if(l > 0) ret2_impl(out, x, xAG, g, l, nthreads);
+  UNPROTECT(1);
+  return out;
+}
 
-  SEXP out = set == 0 ? PROTECT(allocVector(tx, l)) : x;
+// New: Option "replace_NA"
+static void ret0_impl(SEXP out, SEXP x, SEXP xAG, SEXP g, int l, int nthreads) {
+  int *pg = &l, nog = length(g) <= 1, txAG = TYPEOF(xAG);
+  if(!nog) pg = INTEGER(g); // Wmaybe uninitialized
 
-  switch(tx) {
+  switch(TYPEOF(x)) {
     case REALSXP:
     {
       double *px = REAL(x), *pout = REAL(out);
       if(nog) {
         if(txAG != REALSXP && txAG != INTSXP && txAG != LGLSXP) error("STATS needs to be numeric to replace NA's in numeric data!");
         double AG = asReal(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? AG : px[i];
       } else {
         switch(txAG) {
           case REALSXP: {
             double *AG = REAL(xAG)-1;
-            #pragma omp simd
+            #pragma omp parallel for simd num_threads(nthreads)
             for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? AG[pg[i]] : px[i];
             break;
           }
           case LGLSXP:
           case INTSXP: {
             int *AG = INTEGER(xAG)-1;
-            #pragma omp simd
+            #pragma omp parallel for simd num_threads(nthreads)
             for(int i = 0; i < l; ++i) pout[i] = ISNAN(px[i]) ? AG[pg[i]] : px[i];
             break;
           }
@@ -423,20 +441,20 @@ SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set) {
       if(nog) {
         if(txAG != REALSXP && txAG != INTSXP && txAG != LGLSXP) error("STATS needs to be numeric to replace NA's in numeric data!");
         int AG = asInteger(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? AG : px[i];
       } else {
         switch(txAG) {
           case REALSXP: {
             double *AG = REAL(xAG)-1;
-            #pragma omp simd
+            #pragma omp parallel for simd num_threads(nthreads)
             for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? AG[pg[i]] : px[i];
             break;
           }
           case LGLSXP:
           case INTSXP: {
             int *AG = INTEGER(xAG)-1;
-            #pragma omp simd
+            #pragma omp parallel for simd num_threads(nthreads)
             for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_INTEGER) ? AG[pg[i]] : px[i];
             break;
           }
@@ -452,7 +470,7 @@ SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set) {
       SEXP *pout = SEXPPTR(out);
       if(nog) {
         SEXP AG = asChar(xAG);
-        #pragma omp simd
+        #pragma omp parallel for simd num_threads(nthreads)
         for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? AG : px[i];
       } else {
         switch(txAG) {
@@ -461,7 +479,7 @@ SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set) {
           case INTSXP: error("Cannot replace missing values in string with numeric data");
           case STRSXP: {
             const SEXP *AG = SEXPPTR_RO(xAG)-1;
-            #pragma omp simd
+            #pragma omp parallel for simd num_threads(nthreads)
             for(int i = 0; i < l; ++i) pout[i] = (px[i] == NA_STRING) ? AG[pg[i]] : px[i];
             break;
           }
@@ -473,6 +491,21 @@ SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set) {
     default:
       error("Not supported SEXP type!");
   }
+}
+
+static SEXP ret0_setup(SEXP x, SEXP xAG, SEXP g, int set) {
+  int l = length(x), gs = length(g);
+  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
+
+  if(gs <= 1) {
+    if(length(xAG) != 1) error("If g = NULL, NROW(STATS) needs to be 1");
+  } else {
+    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
+    if(gs != l) error("length(g) must match NROW(x)");
+  }
+
+  SEXP out = set == 0 ? PROTECT(allocVector(TYPEOF(x), l)) : x;
+  ret0_impl(out, x, xAG, g, 0, 1); // Type checks
 
   if(set == 0) {
     SHALLOW_DUPLICATE_ATTRIB(out, x);
@@ -481,50 +514,54 @@ SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set) {
   return out;
 }
 
-// TODO: allow integer input ??
-SEXP retoth(SEXP x, SEXP xAG, SEXP g, int ret, int set) {
-  int gs = length(g), l = length(x), txAG = TYPEOF(xAG);
-  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
+SEXP ret0(SEXP x, SEXP xAG, SEXP g, int set, int nthreads) {
+  SEXP out = PROTECT(ret0_setup(x, xAG, g, set));
+  int l = length(x);
+  if(l > 0) ret0_impl(out, x, xAG, g, l, nthreads);
+  UNPROTECT(1);
+  return out;
+}
 
-  SEXP out = set == 0 ? PROTECT(allocVector(REALSXP, l)) : x;
+// TODO: allow integer input ??
+static void retoth_impl(SEXP out, SEXP x, SEXP xAG, SEXP g, int ret, int set, int l, int nthreads) {
+  int txAG = TYPEOF(xAG);
 
-  if(gs <= 1) {
-      if(length(xAG) != 1) error("If g = NULL, STATS needs to be an atomic element!");
+  if(length(g) <= 1) {
       if(txAG != REALSXP && txAG != INTSXP && txAG != LGLSXP) error("for these transformations STATS needs to be numeric!");
 
   #define NOGOPLOOP                                                                    \
       switch(ret) {                                                                    \
       case 3:                                                                          \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = px[i] - AGx;                              \
         break;                                                                         \
       case 4: error("This transformation can only be performed with groups!");         \
       case 5: {                                                                        \
         double v = 1 / AGx;                                                            \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = px[i] * v;                                \
         break;                                                                         \
       }                                                                                \
       case 6: {                                                                        \
         double v = 100 / AGx;                                                          \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = px[i] * v;                                \
         break;                                                                         \
       }                                                                                \
       case 7:                                                                          \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = px[i] + AGx;                              \
         break;                                                                         \
       case 8:                                                                          \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = px[i] * AGx;                              \
         break;                                                                         \
       case 9:                                                                          \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = modulus_impl(px[i], AGx);                 \
         break;                                                                         \
       case 10:                                                                         \
-        _Pragma("omp simd")                                                            \
+        _Pragma("omp parallel for simd num_threads(nthreads)")                         \
         for(int i = 0; i < l; ++i) pout[i] = remainder_impl(px[i], AGx);               \
         break;                                                                         \
       default: error("Unknown Transformation");                                        \
@@ -554,14 +591,12 @@ SEXP retoth(SEXP x, SEXP xAG, SEXP g, int ret, int set) {
 
 
   } else {
-      if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
-      if(gs != l) error("length(g) must match nrow(x)");
       int *pg = INTEGER(g);
 
     #define GOPLOOP                                                           \
       switch(ret) {                                                           \
         case 3:                                                               \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = px[i] - pAG[pg[i]];            \
           break;                                                              \
         case 4:                                                               \
@@ -579,32 +614,32 @@ SEXP retoth(SEXP x, SEXP xAG, SEXP g, int ret, int set) {
             }                                                                 \
             OM /= n;                                                          \
             double dOM = (double)OM;                                          \
-            _Pragma("omp simd")                                               \
+            _Pragma("omp parallel for simd num_threads(nthreads)")            \
             for(int i = 0; i < l; ++i) pout[i] += dOM;                        \
             break;                                                            \
           }                                                                   \
         case 5:                                                               \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = px[i] / pAG[pg[i]];            \
           break;                                                              \
         case 6:                                                               \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = px[i] / pAG[pg[i]] * 100;      \
           break;                                                              \
         case 7:                                                               \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = px[i] + pAG[pg[i]];            \
           break;                                                              \
         case 8:                                                               \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = px[i] * pAG[pg[i]];            \
           break;                                                              \
         case 9:                                                               \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = modulus_impl(px[i], pAG[pg[i]]);     \
           break;                                                              \
         case 10:                                                              \
-          _Pragma("omp simd")                                                 \
+          _Pragma("omp parallel for simd num_threads(nthreads)")              \
           for(int i = 0; i < l; ++i) pout[i] = remainder_impl(px[i], pAG[pg[i]]);  \
           break;                                                              \
         default: error("Unknown Transformation");                             \
@@ -648,6 +683,22 @@ SEXP retoth(SEXP x, SEXP xAG, SEXP g, int ret, int set) {
       }
 
   }
+}
+
+static SEXP retoth_setup(SEXP x, SEXP xAG, SEXP g, int ret, int set) {
+  int gs = length(g), l = length(x);
+  if(l < 1) return x; // Prevents seqfault for numeric(0) #101
+
+  if(gs <= 1) {
+    if(length(xAG) != 1) error("If g = NULL, STATS needs to be an atomic element!");
+  } else {
+    if(TYPEOF(g) != INTSXP) error("g must be integer typed, please report this as g should have been internally grouped");
+    if(gs != l) error("length(g) must match nrow(x)");
+  }
+
+  SEXP out = set == 0 ? PROTECT(allocVector(REALSXP, l)) : x;
+  retoth_impl(out, x, xAG, g, ret, set, 0, 1); // Type checks
+
   if(set == 0) {
     SHALLOW_DUPLICATE_ATTRIB(out, x);
     UNPROTECT(1);
@@ -655,95 +706,139 @@ SEXP retoth(SEXP x, SEXP xAG, SEXP g, int ret, int set) {
   return out;
 }
 
-SEXP TRAC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
+SEXP retoth(SEXP x, SEXP xAG, SEXP g, int ret, int set, int nthreads) {
+  SEXP out = PROTECT(retoth_setup(x, xAG, g, ret, set));
+  int l = length(x);
+  if(l > 0) retoth_impl(out, x, xAG, g, ret, set, l, nthreads);
+  UNPROTECT(1);
+  return out;
+}
+
+// Threads are capped at max_threads, and not used for small data (< 100000 elements)
+static int TRA_nthreads(SEXP Rnthreads, double size, int maxt) {
+  int nthreads = asInteger(Rnthreads);
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > maxt) nthreads = maxt;
+  if(size < 100000) nthreads = 1;
+  return nthreads < 1 ? 1 : nthreads;
+}
+
+static SEXP TRA_impl(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, int nthreads) {
   if(length(Rret) != 1) error("can only perform one transformation at a time");
   int ret = (TYPEOF(Rret) == STRSXP) ? TtI(Rret) : asInteger(Rret), set = asLogical(Rset);
+  if(set) arrow_check_writeable(x);
   switch(ret) {
-    case 0: return ret0(x, xAG, g, set);
-    case 1: return ret1(x, xAG, g, set);
-    case 2: return ret2(x, xAG, g, set);
-    default: return retoth(x, xAG, g, ret, set);
+    case 0: return ret0(x, xAG, g, set, nthreads);
+    case 1: return ret1(x, xAG, g, set, nthreads);
+    case 2: return ret2(x, xAG, g, set, nthreads);
+    default: return retoth(x, xAG, g, ret, set, nthreads);
   }
 }
 
-SEXP TRAlC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
+// Vectors: parallel over rows
+SEXP TRAC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads) {
+  return TRA_impl(x, xAG, g, Rret, Rset, TRA_nthreads(Rnthreads, length(x), INT_MAX));
+}
+
+// Single-threaded, with the argument list of the C API (cp_TRA)
+SEXP TRAC1(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
+  return TRA_impl(x, xAG, g, Rret, Rset, 1);
+}
+
+// Lists: parallel over columns. The result columns are allocated and checked first (serially), then filled in parallel.
+SEXP TRAlC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads) {
   if(length(Rret) != 1) error("can only perform one transformation at a time");
-  int l = length(x), set = asLogical(Rset),
+  int l = length(x), set = asLogical(Rset), nog = length(g) <= 1,
     ret = (TYPEOF(Rret) == STRSXP) ? TtI(Rret) : asInteger(Rret);
 
   if(length(xAG) != l) error("NCOL(x) must match NCOL(STATS)");
+  if(l < 1) return x;
+  if(set) arrow_check_writeable(x);
 
   // This is allocated anyway, but not returned if set = TRUE
-  SEXP out = PROTECT(allocVector(VECSXP, l));
+  SEXP out = PROTECT(allocVector(VECSXP, l)), AG = PROTECT(allocVector(VECSXP, l));
   const SEXP *px = SEXPPTR_RO(x);
 
-  // Need SET_VECTOR_ELT here because we are allocating... (otherwise sometimes segfault)
-#define RETLOOPS(v)                                                                       \
-  switch(ret) {                                                                           \
-  case 0:                                                                                 \
-    for(int j = 0; j != l; ++j) {                                                         \
-      SET_VECTOR_ELT(out, j, ret0(px[j], PROTECT(v), g, set)); UNPROTECT(1);              \
-    }                                                                                     \
-    break;                                                                                \
-  case 1:                                                                                 \
-    for(int j = 0; j != l; ++j) {                                                         \
-      SET_VECTOR_ELT(out, j, ret1(px[j], PROTECT(v), g, set)); UNPROTECT(1);              \
-    }                                                                                     \
-    break;                                                                                \
-  case 2:                                                                                 \
-    for(int j = 0; j != l; ++j) {                                                         \
-      SET_VECTOR_ELT(out, j, ret2(px[j], PROTECT(v), g, set)); UNPROTECT(1);              \
-    }                                                                                     \
-    break;                                                                                \
-  default:                                                                                \
-    for(int j = 0; j != l; ++j) {                                                         \
-      SET_VECTOR_ELT(out, j, retoth(px[j], PROTECT(v), g, ret, set)); UNPROTECT(1);       \
-    }                                                                                     \
-  }
-
+  // Statistics for each column. Need SET_VECTOR_ELT here because we are allocating... (otherwise sometimes segfault)
   switch(TYPEOF(xAG)) {
     case VECSXP: {
       const SEXP *pAG = SEXPPTR_RO(xAG);
-      RETLOOPS(pAG[j])
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(AG, j, pAG[j]);
       break;
     }
     case REALSXP: {
       double *pAG = REAL(xAG);
-      RETLOOPS(ScalarReal(pAG[j]))
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(AG, j, ScalarReal(pAG[j]));
       break;
     }
     case LGLSXP:
     case INTSXP: {
       int *pAG = INTEGER(xAG);
-      RETLOOPS(ScalarInteger(pAG[j]))
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(AG, j, ScalarInteger(pAG[j]));
       break;
     }
     case CPLXSXP: {
       Rcomplex *pAG = COMPLEX(xAG);
-      RETLOOPS(ScalarComplex(pAG[j]))
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(AG, j, ScalarComplex(pAG[j]));
       break;
     }
     case RAWSXP: {
       Rbyte *pAG = RAW(xAG);
-      RETLOOPS(ScalarRaw(pAG[j]))
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(AG, j, ScalarRaw(pAG[j]));
       break;
     }
     case STRSXP: {
       const SEXP *pAG = SEXPPTR_RO(xAG);
-      RETLOOPS(ScalarString(pAG[j]))
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(AG, j, ScalarString(pAG[j]));
       break;
     }
     default: error("Not supported SEXP type!");
   }
 
+  const SEXP *pAG = SEXPPTR_RO(AG);
+  double size = 0.0;
+  for(int j = 0; j != l; ++j) {
+    SEXP xj = px[j], AGj = pAG[j];
+    int txj = TYPEOF(xj);
+    size += length(xj);
+    // Without groups the ret*_impl() functions extract the scalar statistic with asReal() etc. Conversions
+    // that can allocate (asChar() of numbers) or warn (asInteger() of large doubles) are done here.
+    if(nog && length(AGj) == 1) {
+      if(ret == 0 && txj == STRSXP && TYPEOF(AGj) != STRSXP) SET_VECTOR_ELT(AG, j, ScalarString(asChar(AGj)));
+      else if((txj == INTSXP || txj == LGLSXP) && TYPEOF(AGj) == REALSXP && (ret == 0 || (ret > 2 && set)))
+        SET_VECTOR_ELT(AG, j, ScalarInteger(asInteger(AGj)));
+      AGj = pAG[j];
+    }
+    switch(ret) {
+      case 0: SET_VECTOR_ELT(out, j, ret0_setup(xj, AGj, g, set)); break;
+      case 1: SET_VECTOR_ELT(out, j, ret1_setup(xj, AGj, g, set)); break;
+      case 2: SET_VECTOR_ELT(out, j, ret2_setup(xj, AGj, g, set)); break;
+      default: SET_VECTOR_ELT(out, j, retoth_setup(xj, AGj, g, ret, set));
+    }
+  }
+
+  int nthreads = TRA_nthreads(Rnthreads, size, l);
+  const SEXP *pout = SEXPPTR_RO(out);
+  #pragma omp parallel for num_threads(nthreads)
+  for(int j = 0; j < l; ++j) {
+    int lj = length(px[j]);
+    if(lj == 0) continue;
+    switch(ret) {
+      case 0: ret0_impl(pout[j], px[j], pAG[j], g, lj, 1); break;
+      case 1: ret1_impl(pout[j], pAG[j], g, lj, 1); break;
+      case 2: ret2_impl(pout[j], px[j], pAG[j], g, lj, 1); break;
+      default: retoth_impl(pout[j], px[j], pAG[j], g, ret, set, lj, 1);
+    }
+  }
+
   if(set == 0) SHALLOW_DUPLICATE_ATTRIB(out, x);
-  UNPROTECT(1);
+  UNPROTECT(2);
   return set ? x : out;
 }
 
 // TODO: "replace" method for matrices is a bit slower than before, but overall pretty good!
 
-SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
+SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads) {
   SEXP dim = getAttrib(x, R_DimSymbol);
   if(isNull(dim)) error("x is not a matrix");
   if(length(Rret) != 1) error("can only perform one transformation at a time");
@@ -751,8 +846,9 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     row = INTEGER(dim)[0], col = INTEGER(dim)[1], *pg = &gs, ng = 0,
     set = asLogical(Rset),
     ret = (TYPEOF(Rret) == STRSXP) ? TtI(Rret) : asInteger(Rret),
-    nog = gs <= 1;
+    nog = gs <= 1, nthreads = TRA_nthreads(Rnthreads, (double)row * col, col); // Parallel over columns
 
+  if(set) arrow_check_writeable(x);
   if(nog) {
     if(length(xAG) != col) error("If g = NULL, NROW(STATS) needs to be 1");
   } else {
@@ -778,14 +874,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
           {
             double *pout = REAL(out), *pAG = REAL(xAG);
             if(nog) {
-              for(int j = 0; j != col; ++j) {
+              #pragma omp parallel for num_threads(nthreads)
+              for(int j = 0; j < col; ++j) {
                 int s = j * row, e = s + row;
                 double AGj = pAG[j];
                 #pragma omp simd
                 for(int i = s; i < e; ++i) pout[i] = AGj;
               }
             } else {
-              for(int j = 0; j != col; ++j) {
+              #pragma omp parallel for num_threads(nthreads)
+              for(int j = 0; j < col; ++j) {
                 int s = j * row;
                 double *AG = pAG + j * ng - 1;
                 #pragma omp simd
@@ -799,13 +897,15 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
           {
             int *pout = INTEGER(out), *pAG = INTEGER(xAG);
             if(nog) {
-              for(int j = 0; j != col; ++j) {
+              #pragma omp parallel for num_threads(nthreads)
+              for(int j = 0; j < col; ++j) {
                 int s = j * row, e = s + row, AGj = pAG[j];
                 #pragma omp simd
                 for(int i = s; i < e; ++i) pout[i] = AGj;
               }
             } else {
-              for(int j = 0; j != col; ++j) {
+              #pragma omp parallel for num_threads(nthreads)
+              for(int j = 0; j < col; ++j) {
                 int s = j * row, *AG = pAG + j * ng - 1;
                 #pragma omp simd
                 for(int i = 0; i < row; ++i) pout[i + s] = AG[pg[i]];
@@ -818,14 +918,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
             SEXP *pout = SEXPPTR(out);
             const SEXP *pAG = SEXPPTR_RO(xAG);
             if(nog) {
-              for(int j = 0; j != col; ++j) {
+              #pragma omp parallel for num_threads(nthreads)
+              for(int j = 0; j < col; ++j) {
                 int s = j * row, e = s + row;
                 SEXP AGj = pAG[j];
                 #pragma omp simd
                 for(int i = s; i < e; ++i) pout[i] = AGj;
               }
             } else {
-              for(int j = 0; j != col; ++j) {
+              #pragma omp parallel for num_threads(nthreads)
+              for(int j = 0; j < col; ++j) {
                 int s = j * row;
                 const SEXP *AG = pAG + j * ng - 1;
                 #pragma omp simd
@@ -848,14 +950,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
               {
                 double *pout = REAL(out), *pAG = REAL(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row;
                     double AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (ISNAN(px[i])) ? NA_REAL : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row;
                     double *AG = pAG + j * ng - 1;
                     #pragma omp simd
@@ -869,13 +973,15 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
               {
                 int *pout = INTEGER(out), *pAG = INTEGER(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row, AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (ISNAN(px[i])) ? NA_INTEGER : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, *AG = pAG + j * ng - 1;
                     #pragma omp simd
                     for(int i = 0; i < row; ++i) pout[i + s] = (ISNAN(px[i + s])) ? NA_INTEGER : AG[pg[i]];
@@ -888,14 +994,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
                 SEXP *pout = SEXPPTR(out);
                 const SEXP *pAG = SEXPPTR_RO(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row;
                     SEXP AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (ISNAN(px[i])) ? NA_STRING : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row;
                     const SEXP *AG = pAG + j * ng - 1;
                     #pragma omp simd
@@ -917,14 +1025,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
               {
                 double *pout = REAL(out), *pAG = REAL(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row;
                     double AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_REAL : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row;
                     double *AG = pAG + j * ng - 1;
                     #pragma omp simd
@@ -938,13 +1048,15 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
               {
                 int *pout = INTEGER(out), *pAG = INTEGER(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row, AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_INTEGER : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, *AG = pAG + j * ng - 1;
                     #pragma omp simd
                     for(int i = 0; i < row; ++i) pout[i + s] = (px[i + s] == NA_INTEGER) ? NA_INTEGER : AG[pg[i]];
@@ -957,14 +1069,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
                 SEXP *pout = SEXPPTR(out);
                 const SEXP *pAG = SEXPPTR_RO(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row;
                     SEXP AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_INTEGER) ? NA_STRING : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row;
                     const SEXP *AG = pAG + j * ng - 1;
                     #pragma omp simd
@@ -985,14 +1099,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
               {
                 double *pout = REAL(out), *pAG = REAL(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row;
                     double AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_STRING) ? NA_REAL : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row;
                     double *AG = pAG + j * ng - 1;
                     #pragma omp simd
@@ -1006,13 +1122,15 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
               {
                 int *pout = INTEGER(out), *pAG = INTEGER(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row, AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_STRING) ? NA_INTEGER : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, *AG = pAG + j * ng - 1;
                     #pragma omp simd
                     for(int i = 0; i < row; ++i) pout[i + s] = (px[i + s] == NA_STRING) ? NA_INTEGER : AG[pg[i]];
@@ -1025,14 +1143,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
                 SEXP *pout = SEXPPTR(out);
                 const SEXP *pAG = SEXPPTR_RO(xAG);
                 if(nog) {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row, e = s + row;
                     SEXP AGj = pAG[j];
                     #pragma omp simd
                     for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_STRING) ? NA_STRING : AGj;
                   }
                 } else {
-                  for(int j = 0; j != col; ++j) {
+                  #pragma omp parallel for num_threads(nthreads)
+                  for(int j = 0; j < col; ++j) {
                     int s = j * row;
                     const SEXP *AG = pAG + j * ng - 1;
                     #pragma omp simd
@@ -1079,14 +1199,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
         {
           double *pAG = REAL(xAG);
           if(nog) {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, e = s + row;
               double AGj = pAG[j];
               #pragma omp simd
               for(int i = s; i < e; ++i) pout[i] = (ISNAN(px[i])) ? AGj : px[i];
             }
           } else {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row;
               double *AG = pAG + j * ng - 1;
               #pragma omp simd
@@ -1100,14 +1222,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
         {
           int *pAG = INTEGER(xAG);
           if(nog) {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, e = s + row;
               double AGj = pAG[j];
               #pragma omp simd
               for(int i = s; i < e; ++i) pout[i] = (ISNAN(px[i])) ? AGj : px[i];
             }
           } else {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, *AG = pAG + j * ng - 1;
               #pragma omp simd
               for(int i = 0; i < row; ++i) pout[i + s] = (ISNAN(px[i + s])) ? AG[pg[i]] : px[i + s];
@@ -1129,13 +1253,15 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
         {
           double *pAG = REAL(xAG);
           if(nog) {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, e = s + row, AGj = pAG[j];
               #pragma omp simd
               for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_INTEGER) ? AGj : px[i];
             }
           } else {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row;
               double *AG = pAG + j * ng - 1;
               #pragma omp simd
@@ -1149,13 +1275,15 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
         {
           int *pAG = INTEGER(xAG);
           if(nog) {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, e = s + row, AGj = pAG[j];
               #pragma omp simd
               for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_INTEGER) ? AGj : px[i];
             }
           } else {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, *AG = pAG + j * ng - 1;
               #pragma omp simd
               for(int i = 0; i < row; ++i) pout[i + s] = (px[i + s] == NA_INTEGER) ? AG[pg[i]] : px[i + s];
@@ -1180,14 +1308,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
         {
           const SEXP *pAG = SEXPPTR_RO(xAG);
           if(nog) {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row, e = s + row;
               SEXP AGj = pAG[j];
               #pragma omp simd
               for(int i = s; i < e; ++i) pout[i] = (px[i] == NA_STRING) ? AGj : px[i];
             }
           } else {
-            for(int j = 0; j != col; ++j) {
+            #pragma omp parallel for num_threads(nthreads)
+            for(int j = 0; j < col; ++j) {
               int s = j * row;
               const SEXP *AG = pAG + j * ng - 1;
               #pragma omp simd
@@ -1230,14 +1360,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
   switch(ret) {                                                                    \
     case 3: {                                                                      \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = pAG[j];                                                       \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = px[i] - AGj;                          \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1248,7 +1380,8 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 4: {                                                                      \
       if(nog) error("This transformation can only be computed with groups!");      \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, n = 0;                                                    \
         long double OM = 0;                                                        \
         double *AG = pAG + j * ng - 1;                                             \
@@ -1270,14 +1403,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 5: {                                                                      \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = 1 / pAG[j];                                                   \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = px[i] * AGj;                          \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1288,14 +1423,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 6: {                                                                      \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = 100 / pAG[j];                                                 \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = px[i] * AGj;                          \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1306,14 +1443,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 7: {                                                                      \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = pAG[j];                                                       \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = px[i] + AGj;                          \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1324,14 +1463,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 8: {                                                                      \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = pAG[j];                                                       \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = px[i] * AGj;                          \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1342,14 +1483,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 9: {                                                                      \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = pAG[j];                                                       \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = modulus_impl(px[i], AGj);             \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1360,14 +1503,16 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
     }                                                                              \
     case 10: {                                                                     \
       if(nog) {                                                                    \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row, e = s + row;                                              \
         double AGj = pAG[j];                                                       \
         _Pragma("omp simd")                                                        \
         for(int i = s; i < e; ++i) pout[i] = remainder_impl(px[i], AGj);           \
       }                                                                            \
     } else {                                                                       \
-      for(int j = 0; j != col; ++j) {                                              \
+      _Pragma("omp parallel for num_threads(nthreads)")                            \
+      for(int j = 0; j < col; ++j) {                                               \
         int s = j * row;                                                           \
         double *AG = pAG + j * ng - 1;                                             \
         _Pragma("omp simd")                                                        \
@@ -1414,3 +1559,189 @@ SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset) {
 
 
 
+
+// Fused aggregation and transformation --------------------------------------------------------------------------------
+// If the data is sorted by groups, each group occupies a contiguous segment, so the statistic can be computed and the
+// segment transformed while it is still in cache, instead of computing all statistics first and then making a second
+// pass over the data (in TRAC()). Supported for double data without classes and all transformations except "-+".
+// The statistics are computed exactly as in the respective grouped functions (e.g. fmean_double_g_impl()).
+
+// Statistics: 1- mean, 2- sum, 3- nth element / quantile Q (median), 4- min, 5- max, 6- first, 7- last
+// x_cc: scratch space of size n for stat = 3 (as in the grouped fnth())
+static double fused_stat(const double *restrict px, double *x_cc, const int n, const int stat, const int narm, const int ties, const double Q) {
+  switch(stat) {
+    case 1: {
+      double sum = 0.0;
+      if(narm) {
+        int k = 0;
+        for(int i = 0; i != n; ++i) {
+          if(ISNAN(px[i])) continue;
+          sum += px[i];
+          ++k;
+        }
+        return k == 0 ? NA_REAL : sum / k;
+      }
+      for(int i = n; i--; ) sum += px[i];
+      return sum / n;
+    }
+    case 2: {
+      double sum = narm == 1 ? NA_REAL : 0.0; // narm = 2 if fill = TRUE
+      if(narm == 1) {
+        for(int i = 0; i != n; ++i) {
+          if(ISNAN(px[i])) continue;
+          if(ISNAN(sum)) sum = px[i];
+          else sum += px[i];
+        }
+      } else if(narm == 2) {
+        for(int i = 0; i != n; ++i) if(NISNAN(px[i])) sum += px[i];
+      } else {
+        for(int i = 0; i != n; ++i) sum += px[i];
+      }
+      return sum;
+    }
+    case 3: return nth_double_noalloc(px, NULL, x_cc, n, 1, narm, ties, Q);
+    case 4: {
+      double min;
+      if(narm) {
+        min = NA_REAL;
+        for(int i = n; i--; ) if(min > px[i] || ISNAN(min)) min = px[i];
+      } else {
+        min = 1.0/0.0;
+        for(int i = n; i--; ) if(min > px[i] || ISNAN(px[i])) min = px[i];
+      }
+      return min;
+    }
+    case 5: {
+      double max;
+      if(narm) {
+        max = NA_REAL;
+        for(int i = n; i--; ) if(max < px[i] || ISNAN(max)) max = px[i];
+      } else {
+        max = -1.0/0.0;
+        for(int i = n; i--; ) if(max < px[i] || ISNAN(px[i])) max = px[i];
+      }
+      return max;
+    }
+    case 6:
+      if(narm) {
+        for(int i = 0; i != n; ++i) if(NISNAN(px[i])) return px[i];
+        return NA_REAL;
+      }
+      return px[0];
+    case 7:
+      if(narm) {
+        for(int i = n; i--; ) if(NISNAN(px[i])) return px[i];
+        return NA_REAL;
+      }
+      return px[n-1];
+    default: return NA_REAL; // Checked in fusedTRAC()
+  }
+}
+
+// Same formulas as in ret0_impl(), ret1_impl(), ret2_impl() and retoth_impl() for grouped data. pout can be px (set = TRUE).
+static void fused_apply(double *pout, const double *px, const int n, const double AG, const int ret) {
+  switch(ret) {
+    case 0: for(int i = 0; i != n; ++i) pout[i] = ISNAN(px[i]) ? AG : px[i]; break;
+    case 1: for(int i = 0; i != n; ++i) pout[i] = AG; break;
+    case 2: for(int i = 0; i != n; ++i) pout[i] = ISNAN(px[i]) ? NA_REAL : AG; break;
+    case 3: for(int i = 0; i != n; ++i) pout[i] = px[i] - AG; break;
+    case 5: for(int i = 0; i != n; ++i) pout[i] = px[i] / AG; break;
+    case 6: for(int i = 0; i != n; ++i) pout[i] = px[i] / AG * 100; break;
+    case 7: for(int i = 0; i != n; ++i) pout[i] = px[i] + AG; break;
+    case 8: for(int i = 0; i != n; ++i) pout[i] = px[i] * AG; break;
+    case 9: for(int i = 0; i != n; ++i) pout[i] = modulus_impl(px[i], AG); break;
+    case 10: for(int i = 0; i != n; ++i) pout[i] = remainder_impl(px[i], AG); break;
+  }
+}
+
+// fuse = list(stat, narm[, Q, ties]). Works for vectors, matrices and lists, and returns NULL if the fused computation
+// is not applicable (unsorted groups, non-double or classed data, unsupported transformation or probability), in which
+// case the statistic is computed and TRAC(), TRAmC() or TRAlC() is called. Parallel over groups (and columns).
+SEXP fusedTRAC(SEXP x, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads, SEXP fuse) {
+  const int row = length(g);
+  if(row <= 1 || TYPEOF(g) != INTSXP || length(Rret) != 1 || TYPEOF(fuse) != VECSXP || length(fuse) < 2) return R_NilValue;
+  const int ret = (TYPEOF(Rret) == STRSXP) ? TtI(Rret) : asInteger(Rret), stat = asInteger(VECTOR_ELT(fuse, 0)),
+    narm = asInteger(VECTOR_ELT(fuse, 1)), set = asLogical(Rset), islist = TYPEOF(x) == VECSXP;
+  if(ret < 0 || ret == 4 || ret > 10 || stat < 1 || stat > 7 || narm == NA_INTEGER) return R_NilValue;
+  double Q = 0.5;
+  int ties = 1;
+  if(stat == 3 && length(fuse) > 3) {
+    Q = asReal(VECTOR_ELT(fuse, 2));
+    if(!(Q > 0.0 && Q < 1.0)) return R_NilValue;
+    ties = Rties2int(VECTOR_ELT(fuse, 3));
+    if(ties == 10) return R_NilValue; // Approximate quantiles are computed from sketches, see qsketch.c
+  }
+
+  // Check the data
+  // Dimensions that do not match the groups are left to the checked path, which raises the usual error
+  int col = 1;
+  if(islist) col = length(x);
+  else {
+    SEXP dim = getAttrib(x, R_DimSymbol);
+    if(isNull(dim)) {
+      if(length(x) != row) return R_NilValue;
+    } else if(length(dim) == 2 && INTEGER(dim)[0] == row) col = INTEGER(dim)[1];
+    else return R_NilValue;
+  }
+  if(col < 1) return R_NilValue;
+  if(islist) {
+    const SEXP *px = SEXPPTR_RO(x);
+    for(int j = 0; j != col; ++j)
+      if(TYPEOF(px[j]) != REALSXP || isObject(px[j]) || length(px[j]) != row) return R_NilValue;
+  } else if(TYPEOF(x) != REALSXP || isObject(x)) return R_NilValue;
+  if(set) arrow_check_writeable(x);
+
+  // Check that the groups are sorted and compute the group starts
+  const int *pg = INTEGER(g);
+  int ng = 1;
+  if(pg[0] < 1) return R_NilValue; // NA_INTEGER is negative
+  for(int i = 1; i != row; ++i) {
+    if(pg[i] == pg[i-1]) continue;
+    if(pg[i] < pg[i-1]) return R_NilValue;
+    ++ng;
+  }
+  int *pst = (int*)R_alloc(ng+1, sizeof(int));
+  pst[0] = 0; pst[ng] = row;
+  for(int i = 1, k = 1; i != row; ++i) if(pg[i] != pg[i-1]) pst[k++] = i;
+
+  // Allocate the result
+  SEXP out = x;
+  if(set == 0) {
+    if(islist) {
+      out = PROTECT(allocVector(VECSXP, col));
+      const SEXP *px = SEXPPTR_RO(x);
+      for(int j = 0; j != col; ++j) {
+        SET_VECTOR_ELT(out, j, allocVector(REALSXP, row));
+        SHALLOW_DUPLICATE_ATTRIB(VECTOR_ELT(out, j), px[j]);
+      }
+    } else out = PROTECT(allocVector(REALSXP, length(x)));
+    SHALLOW_DUPLICATE_ATTRIB(out, x);
+  }
+
+  const double **ppx = (const double**)R_alloc(col, sizeof(double*));
+  double **ppout = (double**)R_alloc(col, sizeof(double*));
+  for(int j = 0; j != col; ++j) {
+    ppx[j] = islist ? REAL(VECTOR_ELT(x, j)) : REAL(x) + (size_t)j * row;
+    ppout[j] = islist ? REAL(VECTOR_ELT(out, j)) : REAL(out) + (size_t)j * row;
+  }
+
+  const double ntasks = (double)ng * col;
+  int nthreads = TRA_nthreads(Rnthreads, (double)row * col, ntasks > INT_MAX ? INT_MAX : (int)ntasks);
+  // Scratch space for the nth element: allocated here once for each thread, with the size of the largest group
+  int maxgrpn = 0;
+  double *x_cc = NULL;
+  if(stat == 3) {
+    for(int gr = 0; gr != ng; ++gr) if(pst[gr+1] - pst[gr] > maxgrpn) maxgrpn = pst[gr+1] - pst[gr];
+    x_cc = (double*)R_alloc((size_t)nthreads * maxgrpn, sizeof(double));
+  }
+  #pragma omp parallel for num_threads(nthreads)
+  for(R_xlen_t k = 0; k < (R_xlen_t)ntasks; ++k) {
+    const int j = k / ng, gr = k % ng, s = pst[gr], n = pst[gr+1] - s;
+    const double *px = ppx[j] + s;
+    double *pcc = x_cc ? x_cc + (size_t)OMP_THREAD_NUM * maxgrpn : NULL;
+    fused_apply(ppout[j] + s, px, n, fused_stat(px, pcc, n, stat, narm, ties, Q), ret);
+  }
+
+  if(set == 0) UNPROTECT(1);
+  return out;
+}
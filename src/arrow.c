@@ -0,0 +1,724 @@
+#include "collapse_c.h"
+#include <R_ext/Altrep.h>
+#include "arrow_abi.h"
+
+/*
+ Import and export of data through the Arrow C Data Interface, used by from_arrow() and to_arrow(). Only the ABI structs
+ are needed (arrow_abi.h), so there is no dependency on an Arrow library.
+
+ Import: the ArrowArray is moved into an external pointer whose finalizer calls its release callback. Primitive int32 and
+ float64 columns without nulls are wrapped zero-copy as ALTREP vectors whose data pointer is the Arrow buffer (keeping the
+ array alive through the protected field of the external pointer in data1), so that all C code reading the vectors with
+ INTEGER() / REAL() (GRP(), fsum(), join() etc.) reads the Arrow memory directly. R has no validity bitmaps, so columns
+ with nulls and other types are converted to R vectors with NA's. The vectors are marked as not mutable, so that R
+ duplicates them before modifying them. Since INTEGER() / REAL() always request a writeable pointer, Dataptr cannot
+ materialize a copy on write without copying on every read; collapse functions modifying their input in place therefore
+ reject these vectors through arrow_check_writeable().
+
+ Export: integer and double vectors are exported zero-copy (the vector is preserved until the consumer calls release,
+ which may happen on any thread, see below), with a validity bitmap computed if there are NA's. Other types are copied.
+*/
+
+/*
+ The R API can only be used on the main thread, but consumers may call release on any thread. The preserved vectors of
+ arrays released on other threads are therefore pushed to a lock-free stack, which is emptied (releasing the vectors)
+ on the main thread at the next call to from_arrow() / to_arrow(), or when an Arrow external pointer is finalized.
+*/
+typedef struct arrow_pending {
+  SEXP x;
+  struct arrow_pending *next;
+} arrow_pending;
+
+static arrow_pending *arrow_pending_head = NULL;
+static _Thread_local int arrow_main_thread = 0; // Set in arrow_init()
+
+static void arrow_release_pending(void) {
+  arrow_pending *node = __atomic_exchange_n(&arrow_pending_head, NULL, __ATOMIC_ACQUIRE);
+  while(node) {
+    arrow_pending *next = node->next;
+    R_ReleaseObject(node->x);
+    free(node);
+    node = next;
+  }
+}
+
+// Called from release callbacks: no R API (including R_Calloc(), which may raise an error) off the main thread
+static void arrow_release_object(SEXP x) {
+  if(arrow_main_thread) {
+    R_ReleaseObject(x);
+    return;
+  }
+  arrow_pending *node = (arrow_pending *)malloc(sizeof(arrow_pending));
+  if(node == NULL) return; // Out of memory: the vector stays preserved
+  node->x = x;
+  node->next = __atomic_load_n(&arrow_pending_head, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&arrow_pending_head, &node->next, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Address of an ArrowArray / ArrowSchema: an external pointer, or an address passed as double or character string
+static void *arrow_address(SEXP p, const char *what) {
+  void *res = NULL;
+  switch(TYPEOF(p)) {
+    case EXTPTRSXP: res = R_ExternalPtrAddr(p); break;
+    case REALSXP: if(length(p) == 1) res = (void *)(uintptr_t)REAL(p)[0]; break;
+    case STRSXP: if(length(p) == 1) res = (void *)(uintptr_t)strtoull(CHAR(STRING_ELT(p, 0)), NULL, 0); break;
+    default: error("%s must be an external pointer or an address (double or character)", what);
+  }
+  if(res == NULL) error("%s is a NULL pointer", what);
+  return res;
+}
+
+static void arrow_array_finalizer(SEXP eptr) {
+  arrow_release_pending();
+  struct ArrowArray *a = (struct ArrowArray *)R_ExternalPtrAddr(eptr);
+  if(!a) return;
+  if(a->release) a->release(a);
+  R_Free(a);
+  R_ClearExternalPtr(eptr);
+}
+
+static void arrow_schema_finalizer(SEXP eptr) {
+  struct ArrowSchema *s = (struct ArrowSchema *)R_ExternalPtrAddr(eptr);
+  if(!s) return;
+  if(s->release) s->release(s);
+  R_Free(s);
+  R_ClearExternalPtr(eptr);
+}
+
+// Allocates an (empty) ArrowArray and ArrowSchema to export data to. Unless moved by a consumer, they are released with the pointers.
+SEXP arrow_allocC(void) {
+  arrow_release_pending();
+  SEXP res = PROTECT(allocVector(VECSXP, 2)), nam = PROTECT(allocVector(STRSXP, 2));
+  SEXP ea = SET_VECTOR_ELT(res, 0, R_MakeExternalPtr(R_Calloc(1, struct ArrowArray), R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ea, arrow_array_finalizer, TRUE);
+  SEXP es = SET_VECTOR_ELT(res, 1, R_MakeExternalPtr(R_Calloc(1, struct ArrowSchema), R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(es, arrow_schema_finalizer, TRUE);
+  SET_STRING_ELT(nam, 0, mkChar("array"));
+  SET_STRING_ELT(nam, 1, mkChar("schema"));
+  namesgets(res, nam);
+  UNPROTECT(2);
+  return res;
+}
+
+/*
+ ****************************************
+ Import
+ ****************************************
+*/
+
+static R_altrep_class_t arrow_int_class, arrow_real_class;
+
+// data1 is an external pointer to the first element, data2 the length (double)
+static R_xlen_t arrow_Length(SEXP x) { return (R_xlen_t)REAL(R_altrep_data2(x))[0]; }
+
+static void *arrow_Dataptr(SEXP x, Rboolean writeable) { return R_ExternalPtrAddr(R_altrep_data1(x)); }
+
+static const void *arrow_Dataptr_or_null(SEXP x) { return R_ExternalPtrAddr(R_altrep_data1(x)); }
+
+static int arrow_int_Elt(SEXP x, R_xlen_t i) { return ((const int *)R_ExternalPtrAddr(R_altrep_data1(x)))[i]; }
+
+static double arrow_real_Elt(SEXP x, R_xlen_t i) { return ((const double *)R_ExternalPtrAddr(R_altrep_data1(x)))[i]; }
+
+static R_xlen_t arrow_int_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+  const R_xlen_t l = arrow_Length(x);
+  if(n > l - i) n = l - i;
+  if(n > 0) memcpy(buf, (const int *)R_ExternalPtrAddr(R_altrep_data1(x)) + i, n * sizeof(int));
+  return n;
+}
+
+static R_xlen_t arrow_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+  const R_xlen_t l = arrow_Length(x);
+  if(n > l - i) n = l - i;
+  if(n > 0) memcpy(buf, (const double *)R_ExternalPtrAddr(R_altrep_data1(x)) + i, n * sizeof(double));
+  return n;
+}
+
+static Rboolean arrow_Inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+  Rprintf(" zero-copy Arrow %s array\n", TYPEOF(x) == REALSXP ? "float64" : "int32");
+  return TRUE;
+}
+
+static inline int is_arrow_altrep(SEXP x) {
+  return ALTREP(x) && (R_altrep_inherits(x, arrow_int_class) || R_altrep_inherits(x, arrow_real_class));
+}
+
+// The Arrow buffers belong to the producer, so functions modifying their input in place (set = TRUE) call this first
+void arrow_check_writeable(SEXP x) {
+  if(TYPEOF(x) == VECSXP) {
+    const SEXP *px = SEXPPTR_RO(x);
+    for(R_xlen_t i = 0, l = XLENGTH(x); i != l; ++i) {
+      if(is_arrow_altrep(px[i])) error("Cannot modify column %lld in place: it is a zero-copy Arrow vector, see ?from_arrow", (long long)i + 1);
+    }
+  } else if(is_arrow_altrep(x)) error("Cannot modify a zero-copy Arrow vector in place, see ?from_arrow");
+}
+
+// Called from R_init_collapse()
+void arrow_init(DllInfo *dll) {
+  arrow_main_thread = 1;
+  arrow_int_class = R_make_altinteger_class("arrow_int32", "collapse", dll);
+  R_set_altrep_Length_method(arrow_int_class, arrow_Length);
+  R_set_altrep_Inspect_method(arrow_int_class, arrow_Inspect);
+  R_set_altvec_Dataptr_method(arrow_int_class, arrow_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(arrow_int_class, arrow_Dataptr_or_null);
+  R_set_altinteger_Elt_method(arrow_int_class, arrow_int_Elt);
+  R_set_altinteger_Get_region_method(arrow_int_class, arrow_int_Get_region);
+
+  arrow_real_class = R_make_altreal_class("arrow_float64", "collapse", dll);
+  R_set_altrep_Length_method(arrow_real_class, arrow_Length);
+  R_set_altrep_Inspect_method(arrow_real_class, arrow_Inspect);
+  R_set_altvec_Dataptr_method(arrow_real_class, arrow_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(arrow_real_class, arrow_Dataptr_or_null);
+  R_set_altreal_Elt_method(arrow_real_class, arrow_real_Elt);
+  R_set_altreal_Get_region_method(arrow_real_class, arrow_real_Get_region);
+}
+
+static inline int arrow_valid(const uint8_t *v, const int64_t i) { return v == NULL || (v[i >> 3] >> (i & 7)) & 1; }
+
+// Buffer i of an array of the given format: it must exist, and may only be NULL if the array is empty
+static const void *arrow_buffer(const struct ArrowArray *a, const int i, const int64_t n, const char *fmt) {
+  if(a->n_buffers <= i || a->buffers == NULL)
+    error("Array of format '%s' has %d buffers, expected %d", fmt, (int)a->n_buffers, i + 1);
+  if(a->buffers[i] == NULL && n > 0) error("Array of format '%s' has a NULL data buffer", fmt);
+  return a->buffers[i];
+}
+
+// Validity bitmap of elements [off, off + n) of an array, or NULL if they contain no nulls
+static const uint8_t *arrow_validity(const struct ArrowArray *a, const int64_t off, const int64_t n) {
+  if(a->null_count == 0 || a->n_buffers == 0 || a->buffers == NULL || a->buffers[0] == NULL) return NULL;
+  const uint8_t *v = (const uint8_t *)a->buffers[0];
+  for(int64_t i = off, end = off + n; i < end; ++i) if(!arrow_valid(v, i)) return v;
+  return NULL;
+}
+
+// Integer value i of a buffer of (signed or unsigned) integers given by the format character
+static inline double arrow_int_value(const void *buf, const char fmt, const int64_t i) {
+  switch(fmt) {
+    case 'c': return ((const int8_t *)buf)[i];
+    case 'C': return ((const uint8_t *)buf)[i];
+    case 's': return ((const int16_t *)buf)[i];
+    case 'S': return ((const uint16_t *)buf)[i];
+    case 'i': return ((const int32_t *)buf)[i];
+    case 'I': return ((const uint32_t *)buf)[i];
+    case 'l': return (double)((const int64_t *)buf)[i];
+    case 'L': return (double)((const uint64_t *)buf)[i];
+  }
+  return NA_REAL;
+}
+
+static SEXP arrow_altrep(R_altrep_class_t cls, const void *data, const int64_t n, SEXP root) {
+  SEXP eptr = PROTECT(R_MakeExternalPtr((void *)data, R_NilValue, root));
+  SEXP len = PROTECT(ScalarReal((double)n));
+  SEXP res = R_new_altrep(cls, eptr, len);
+  MARK_NOT_MUTABLE(res);
+  UNPROTECT(2);
+  return res;
+}
+
+static SEXP arrow_strings(const struct ArrowArray *a, const int64_t off, const int64_t n, const int large) {
+  const char *fmt = large ? "U" : "u";
+  const int32_t *o32 = (const int32_t *)arrow_buffer(a, 1, n, fmt);
+  const int64_t *o64 = (const int64_t *)o32;
+  const char *data = (const char *)arrow_buffer(a, 2, 0, fmt); // NULL if all strings are empty
+  const uint8_t *v = arrow_validity(a, off, n);
+  SEXP res = PROTECT(allocVector(STRSXP, n));
+  for(int64_t i = 0; i < n; ++i) {
+    const int64_t j = off + i;
+    if(!arrow_valid(v, j)) {
+      SET_STRING_ELT(res, i, NA_STRING);
+      continue;
+    }
+    const int64_t start = large ? o64[j] : o32[j], len = (large ? o64[j+1] : o32[j+1]) - start;
+    if(start < 0 || len < 0 || (len > 0 && data == NULL)) error("Invalid string offsets in array of format '%s'", fmt);
+    if(len > INT_MAX) error("Strings longer than 2^31-1 bytes are not supported");
+    SET_STRING_ELT(res, i, mkCharLenCE(data + start, (int)len, CE_UTF8));
+  }
+  UNPROTECT(1);
+  return res;
+}
+
+// Converts elements [off, off + n) of an array to an R vector (or a list of vectors for struct arrays at the top level)
+static SEXP arrow_to_R(const struct ArrowSchema *s, const struct ArrowArray *a, const int64_t off, const int64_t n, SEXP root, const int depth) {
+  const char *fmt = s->format;
+  if(fmt == NULL) error("Invalid Arrow format string");
+  if(n > R_XLEN_T_MAX) error("Arrays with more than 2^52 elements are not supported");
+
+  // Dictionary encoded arrays of strings become factors
+  if(s->dictionary) {
+    if(!a->dictionary) error("Dictionary encoded array without dictionary");
+    if(fmt[0] == '\0' || fmt[1] != '\0' || !strchr("cCsSiIlL", fmt[0])) error("Invalid dictionary index type: '%s'", fmt);
+    const struct ArrowArray *d = a->dictionary;
+    SEXP levs = PROTECT(arrow_to_R(s->dictionary, d, d->offset, d->length, root, depth + 1));
+    if(TYPEOF(levs) != STRSXP) error("Only dictionaries of strings (factors) are supported, found format '%s'", s->dictionary->format);
+    const void *buf = arrow_buffer(a, 1, n, fmt);
+    const uint8_t *v = arrow_validity(a, off, n);
+    SEXP res = PROTECT(allocVector(INTSXP, n));
+    int *pres = INTEGER(res);
+    for(int64_t i = 0; i < n; ++i) pres[i] = arrow_valid(v, off + i) ? (int)arrow_int_value(buf, fmt[0], off + i) + 1 : NA_INTEGER;
+    setAttrib(res, R_LevelsSymbol, levs);
+    if(s->flags & ARROW_FLAG_DICTIONARY_ORDERED) {
+      SEXP cl = PROTECT(allocVector(STRSXP, 2));
+      SET_STRING_ELT(cl, 0, mkChar("ordered"));
+      SET_STRING_ELT(cl, 1, mkChar("factor"));
+      classgets(res, cl);
+      UNPROTECT(1);
+    } else classgets(res, mkString("factor"));
+    UNPROTECT(2);
+    return res;
+  }
+
+  if(strcmp(fmt, "+s") == 0) {
+    if(depth > 0) error("Nested struct arrays are not supported");
+    if(a->n_children != s->n_children) error("The array and schema have a different number of children");
+    const int k = (int)s->n_children;
+    if(k > 0 && (a->children == NULL || s->children == NULL)) error("Struct array without children");
+    SEXP res = PROTECT(allocVector(VECSXP, k)), nam = PROTECT(allocVector(STRSXP, k));
+    for(int j = 0; j < k; ++j) {
+      const struct ArrowArray *c = a->children[j];
+      if(c->length < off + n) error("Child array %d is shorter than its parent", j + 1);
+      SET_VECTOR_ELT(res, j, arrow_to_R(s->children[j], c, c->offset + off, n, root, depth + 1));
+      SET_STRING_ELT(nam, j, s->children[j]->name ? mkCharCE(s->children[j]->name, CE_UTF8) : R_BlankString);
+    }
+    namesgets(res, nam);
+    UNPROTECT(2);
+    return res;
+  }
+
+  if(fmt[0] == '\0') error("Invalid Arrow format string");
+  if(fmt[1] == '\0') {
+    // Fixed-width types: buffer 1 holds the data (strings are checked in arrow_strings())
+    const void *buf = strchr("bcCsSiIlLgf", fmt[0]) ? arrow_buffer(a, 1, n, fmt) : NULL;
+    const uint8_t *v = arrow_validity(a, off, n);
+    SEXP res;
+    switch(fmt[0]) {
+      case 'n': { // Null type
+        res = allocVector(LGLSXP, n);
+        int *pres = LOGICAL(res);
+        for(int64_t i = 0; i < n; ++i) pres[i] = NA_LOGICAL;
+        return res;
+      }
+      case 'b': {
+        res = allocVector(LGLSXP, n);
+        int *pres = LOGICAL(res);
+        const uint8_t *pb = (const uint8_t *)buf;
+        for(int64_t i = 0; i < n; ++i) pres[i] = arrow_valid(v, off + i) ? arrow_valid(pb, off + i) : NA_LOGICAL;
+        return res;
+      }
+      case 'i':
+        if(v == NULL && n > 0 && (uintptr_t)((const int32_t *)buf + off) % sizeof(int) == 0)
+          return arrow_altrep(arrow_int_class, (const int32_t *)buf + off, n, root);
+        // fall through
+      case 'c': case 'C': case 's': case 'S': {
+        res = allocVector(INTSXP, n);
+        int *pres = INTEGER(res);
+        for(int64_t i = 0; i < n; ++i) pres[i] = arrow_valid(v, off + i) ? (int)arrow_int_value(buf, fmt[0], off + i) : NA_INTEGER;
+        return res;
+      }
+      case 'I': case 'l': case 'L': { // Integers that may not fit into R integers
+        res = allocVector(REALSXP, n);
+        double *pres = REAL(res);
+        for(int64_t i = 0; i < n; ++i) pres[i] = arrow_valid(v, off + i) ? arrow_int_value(buf, fmt[0], off + i) : NA_REAL;
+        return res;
+      }
+      case 'g':
+        if(v == NULL && n > 0 && (uintptr_t)((const double *)buf + off) % sizeof(double) == 0)
+          return arrow_altrep(arrow_real_class, (const double *)buf + off, n, root);
+        // fall through
+      case 'f': {
+        res = allocVector(REALSXP, n);
+        double *pres = REAL(res);
+        if(fmt[0] == 'g') for(int64_t i = 0; i < n; ++i) pres[i] = arrow_valid(v, off + i) ? ((const double *)buf)[off + i] : NA_REAL;
+        else for(int64_t i = 0; i < n; ++i) pres[i] = arrow_valid(v, off + i) ? (double)((const float *)buf)[off + i] : NA_REAL;
+        return res;
+      }
+      case 'u': return arrow_strings(a, off, n, 0);
+      case 'U': return arrow_strings(a, off, n, 1);
+    }
+  } else if(strcmp(fmt, "tdD") == 0 || strcmp(fmt, "tdm") == 0) { // Dates (days or milliseconds since the epoch)
+    const void *buf = arrow_buffer(a, 1, n, fmt);
+    const uint8_t *v = arrow_validity(a, off, n);
+    const int days = fmt[2] == 'D';
+    SEXP res = PROTECT(allocVector(REALSXP, n));
+    double *pres = REAL(res);
+    for(int64_t i = 0; i < n; ++i) pres[i] = !arrow_valid(v, off + i) ? NA_REAL : days ? (double)((const int32_t *)buf)[off + i] :
+                                               floor((double)((const int64_t *)buf)[off + i] / 86400000.0);
+    classgets(res, mkString("Date"));
+    UNPROTECT(1);
+    return res;
+  }
+  error("Unsupported Arrow format: '%s'", fmt);
+  return R_NilValue;
+}
+
+/*
+ array, schema: pointers to an ArrowArray and ArrowSchema. Both are moved (i.e. collapse takes ownership and releases them).
+ Returns a vector, or a list of vectors if the array is a struct array (record batch).
+*/
+SEXP arrow_importC(SEXP Rarray, SEXP Rschema) {
+  arrow_release_pending();
+  struct ArrowArray *src = (struct ArrowArray *)arrow_address(Rarray, "array");
+  struct ArrowSchema *ssrc = (struct ArrowSchema *)arrow_address(Rschema, "schema");
+  if(src->release == NULL) error("The array has already been released or moved");
+  if(ssrc->release == NULL) error("The schema has already been released or moved");
+  struct ArrowArray *a = R_Calloc(1, struct ArrowArray);
+  struct ArrowSchema *s = R_Calloc(1, struct ArrowSchema);
+  *a = *src;
+  src->release = NULL;
+  *s = *ssrc;
+  ssrc->release = NULL;
+  SEXP root = PROTECT(R_MakeExternalPtr(a, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(root, arrow_array_finalizer, TRUE);
+  SEXP sroot = PROTECT(R_MakeExternalPtr(s, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(sroot, arrow_schema_finalizer, TRUE);
+  SEXP res = arrow_to_R(s, a, a->offset, a->length, root, 0);
+  UNPROTECT(2);
+  return res;
+}
+
+/*
+ ****************************************
+ Export
+ ****************************************
+*/
+
+typedef struct {
+  SEXP x;                       // R vector referenced by the buffers (preserved until release), or R_NilValue
+  const void *buffers[3];
+  void *owned[3];               // Buffers allocated for the export, freed on release
+  struct ArrowArray *children;  // Storage of the children
+  struct ArrowArray **pchildren;
+  struct ArrowArray *dictionary;
+} arrow_array_private;
+
+typedef struct {
+  char *name;
+  struct ArrowSchema *children;
+  struct ArrowSchema **pchildren;
+  struct ArrowSchema *dictionary;
+} arrow_schema_private;
+
+static void arrow_release_array(struct ArrowArray *a) {
+  arrow_array_private *p = (arrow_array_private *)a->private_data;
+  for(int64_t j = 0; j < a->n_children; ++j) if(p->children[j].release) p->children[j].release(p->children + j);
+  if(p->dictionary) {
+    if(p->dictionary->release) p->dictionary->release(p->dictionary);
+    R_Free(p->dictionary);
+  }
+  for(int b = 0; b < 3; ++b) if(p->owned[b]) R_Free(p->owned[b]);
+  if(p->children) R_Free(p->children);
+  if(p->pchildren) R_Free(p->pchildren);
+  if(p->x != R_NilValue) arrow_release_object(p->x);
+  R_Free(p);
+  a->release = NULL;
+}
+
+static void arrow_release_schema(struct ArrowSchema *s) {
+  arrow_schema_private *p = (arrow_schema_private *)s->private_data;
+  for(int64_t j = 0; j < s->n_children; ++j) if(p->children[j].release) p->children[j].release(p->children + j);
+  if(p->dictionary) {
+    if(p->dictionary->release) p->dictionary->release(p->dictionary);
+    R_Free(p->dictionary);
+  }
+  if(p->children) R_Free(p->children);
+  if(p->pchildren) R_Free(p->pchildren);
+  if(p->name) R_Free(p->name);
+  R_Free(p);
+  s->release = NULL;
+}
+
+static void arrow_init_schema(struct ArrowSchema *s, const char *format, SEXP name) {
+  arrow_schema_private *p = R_Calloc(1, arrow_schema_private);
+  const char *nam = name == R_NilValue ? "" : translateCharUTF8(name);
+  p->name = R_Calloc(strlen(nam) + 1, char);
+  strcpy(p->name, nam);
+  s->format = format;
+  s->name = p->name;
+  s->metadata = NULL;
+  s->flags = ARROW_FLAG_NULLABLE;
+  s->n_children = 0;
+  s->children = NULL;
+  s->dictionary = NULL;
+  s->release = arrow_release_schema;
+  s->private_data = p;
+}
+
+static arrow_array_private *arrow_init_array(struct ArrowArray *a, const int64_t n) {
+  arrow_array_private *p = R_Calloc(1, arrow_array_private);
+  p->x = R_NilValue;
+  a->length = n;
+  a->null_count = 0;
+  a->offset = 0;
+  a->n_buffers = 2;
+  a->n_children = 0;
+  a->buffers = p->buffers;
+  a->children = NULL;
+  a->dictionary = NULL;
+  a->release = arrow_release_array;
+  a->private_data = p;
+  return p;
+}
+
+// Zero-copy reference to the data of x: preserved until release and marked as not mutable, so that R copies it before modifying it
+static const void *arrow_reference(arrow_array_private *p, SEXP x) {
+  R_PreserveObject(x);
+  MARK_NOT_MUTABLE(x);
+  p->x = x;
+  return DATAPTR_RO(x);
+}
+
+#define BITMAP_BYTES(n) (((n) + 7) / 8)
+#define BITMAP_CLEAR(v, i) (v)[(i) >> 3] &= (uint8_t)~(1 << ((i) & 7))
+
+// Validity bitmap (buffer 0) clearing bit i, allocated on the first null
+static inline void arrow_set_null(struct ArrowArray *a, arrow_array_private *p, const int64_t i) {
+  if(!p->owned[0]) {
+    p->owned[0] = R_Calloc(BITMAP_BYTES(a->length), uint8_t);
+    memset(p->owned[0], 0xFF, BITMAP_BYTES(a->length));
+    p->buffers[0] = p->owned[0];
+  }
+  BITMAP_CLEAR((uint8_t *)p->owned[0], i);
+  ++a->null_count;
+}
+
+static void arrow_export_strings(SEXP x, struct ArrowArray *a, struct ArrowSchema *s, SEXP name) {
+  const int64_t n = xlength(x);
+  const SEXP *px = SEXPPTR_RO(x);
+  int64_t total = 0;
+  for(int64_t i = 0; i < n; ++i) if(px[i] != NA_STRING) total += strlen(translateCharUTF8(px[i]));
+  const int large = total > INT_MAX;
+  arrow_init_schema(s, large ? "U" : "u", name);
+  arrow_array_private *p = arrow_init_array(a, n);
+  a->n_buffers = 3;
+  char *data = R_Calloc(total + 1, char);
+  p->owned[1] = large ? (void *)R_Calloc(n + 1, int64_t) : (void *)R_Calloc(n + 1, int32_t);
+  p->owned[2] = data;
+  p->buffers[1] = p->owned[1];
+  p->buffers[2] = data;
+  int64_t pos = 0;
+  for(int64_t i = 0; i < n; ++i) {
+    if(large) ((int64_t *)p->owned[1])[i] = pos;
+    else ((int32_t *)p->owned[1])[i] = (int32_t)pos;
+    if(px[i] == NA_STRING) {
+      arrow_set_null(a, p, i);
+      continue;
+    }
+    const char *str = translateCharUTF8(px[i]);
+    const size_t len = strlen(str);
+    memcpy(data + pos, str, len);
+    pos += len;
+  }
+  if(large) ((int64_t *)p->owned[1])[n] = pos;
+  else ((int32_t *)p->owned[1])[n] = (int32_t)pos;
+}
+
+// Checks that x can be exported, before anything is allocated
+static void arrow_check(SEXP x, const int depth) {
+  switch(TYPEOF(x)) {
+    case LGLSXP: case INTSXP: case REALSXP: case STRSXP: return;
+    case VECSXP: {
+      if(depth > 0) error("Cannot export list columns");
+      const SEXP *px = SEXPPTR_RO(x);
+      for(int j = 0, k = length(x); j < k; ++j) {
+        arrow_check(px[j], 1);
+        if(xlength(px[j]) != xlength(px[0])) error("All columns must have the same length");
+      }
+      return;
+    }
+    default: error("Cannot export vectors of type '%s'", type2char(TYPEOF(x)));
+  }
+}
+
+static void arrow_from_R(SEXP x, struct ArrowArray *a, struct ArrowSchema *s, SEXP name) {
+  const int64_t n = xlength(x);
+  arrow_array_private *p;
+  switch(TYPEOF(x)) {
+    case LGLSXP: {
+      arrow_init_schema(s, "b", name);
+      p = arrow_init_array(a, n);
+      const int *px = LOGICAL(x);
+      uint8_t *val = R_Calloc(BITMAP_BYTES(n) + 1, uint8_t);
+      p->owned[1] = val;
+      p->buffers[1] = val;
+      for(int64_t i = 0; i < n; ++i) {
+        if(px[i] == NA_LOGICAL) arrow_set_null(a, p, i);
+        else if(px[i]) val[i >> 3] |= (uint8_t)(1 << (i & 7));
+      }
+      break;
+    }
+    case INTSXP: {
+      const int *px = INTEGER(x);
+      if(isFactor(x)) { // Dictionary encoded: 0-based indices and a dictionary of strings
+        arrow_init_schema(s, "i", name);
+        if(inherits(x, "ordered")) s->flags |= ARROW_FLAG_DICTIONARY_ORDERED;
+        p = arrow_init_array(a, n);
+        int32_t *ind = R_Calloc(n + 1, int32_t);
+        p->owned[1] = ind;
+        p->buffers[1] = ind;
+        for(int64_t i = 0; i < n; ++i) {
+          if(px[i] == NA_INTEGER) arrow_set_null(a, p, i);
+          else ind[i] = px[i] - 1;
+        }
+        arrow_schema_private *ps = (arrow_schema_private *)s->private_data;
+        ps->dictionary = R_Calloc(1, struct ArrowSchema);
+        p->dictionary = R_Calloc(1, struct ArrowArray);
+        arrow_export_strings(getAttrib(x, R_LevelsSymbol), p->dictionary, ps->dictionary, R_NilValue);
+        s->dictionary = ps->dictionary;
+        a->dictionary = p->dictionary;
+        break;
+      }
+      arrow_init_schema(s, inherits(x, "Date") ? "tdD" : "i", name);
+      p = arrow_init_array(a, n);
+      p->buffers[1] = arrow_reference(p, x);
+      for(int64_t i = 0; i < n; ++i) if(px[i] == NA_INTEGER) arrow_set_null(a, p, i);
+      break;
+    }
+    case REALSXP: {
+      const double *px = REAL(x);
+      if(inherits(x, "Date")) { // Days since the epoch as int32
+        arrow_init_schema(s, "tdD", name);
+        p = arrow_init_array(a, n);
+        int32_t *days = R_Calloc(n + 1, int32_t);
+        p->owned[1] = days;
+        p->buffers[1] = days;
+        for(int64_t i = 0; i < n; ++i) {
+          if(ISNAN(px[i])) arrow_set_null(a, p, i);
+          else days[i] = (int32_t)floor(px[i]);
+        }
+        break;
+      }
+      arrow_init_schema(s, "g", name);
+      p = arrow_init_array(a, n);
+      p->buffers[1] = arrow_reference(p, x);
+      for(int64_t i = 0; i < n; ++i) if(R_IsNA(px[i])) arrow_set_null(a, p, i);
+      break;
+    }
+    case STRSXP:
+      arrow_export_strings(x, a, s, name);
+      break;
+    case VECSXP: { // Struct array (record batch) with the columns as children
+      const int k = length(x);
+      const SEXP *px = SEXPPTR_RO(x);
+      SEXP nam = getAttrib(x, R_NamesSymbol);
+      arrow_init_schema(s, "+s", name);
+      s->flags = 0;
+      p = arrow_init_array(a, k ? xlength(px[0]) : 0);
+      a->n_buffers = 1;
+      arrow_schema_private *ps = (arrow_schema_private *)s->private_data;
+      ps->children = R_Calloc(k + 1, struct ArrowSchema);
+      ps->pchildren = R_Calloc(k + 1, struct ArrowSchema *);
+      p->children = R_Calloc(k + 1, struct ArrowArray);
+      p->pchildren = R_Calloc(k + 1, struct ArrowArray *);
+      for(int j = 0; j < k; ++j) {
+        ps->pchildren[j] = ps->children + j;
+        p->pchildren[j] = p->children + j;
+        arrow_from_R(px[j], p->children + j, ps->children + j, isNull(nam) ? R_BlankString : STRING_ELT(nam, j));
+        s->n_children = a->n_children = j + 1;
+      }
+      s->children = ps->pchildren;
+      a->children = p->pchildren;
+      break;
+    }
+  }
+}
+
+/*
+ x: atomic vector or list of columns (data frame), array, schema: pointers to an ArrowArray and ArrowSchema to export to.
+ The caller (consumer) takes ownership of the exported structs and must release them.
+*/
+SEXP arrow_exportC(SEXP x, SEXP Rarray, SEXP Rschema) {
+  arrow_release_pending();
+  struct ArrowArray *a = (struct ArrowArray *)arrow_address(Rarray, "array");
+  struct ArrowSchema *s = (struct ArrowSchema *)arrow_address(Rschema, "schema");
+  if(a->release || s->release) error("The array or schema already contains data that has not been released");
+  arrow_check(x, 0);
+  arrow_from_R(x, a, s, R_NilValue);
+  return R_NilValue;
+}
+
+/*
+ ****************************************
+ Test helper
+ ****************************************
+*/
+
+typedef struct {
+  const void *buffers[3];
+  void *data[3];
+} arrow_test_private;
+
+static void arrow_test_release_array(struct ArrowArray *a) {
+  arrow_test_private *p = (arrow_test_private *)a->private_data;
+  for(int b = 0; b < 3; ++b) free(p->data[b]);
+  free(p);
+  a->release = NULL;
+}
+
+static void arrow_test_release_schema(struct ArrowSchema *s) { s->release = NULL; }
+
+/*
+ Builds an array of an integer, double or character vector x by hand (independently of the export code above), to test
+ the import: the buffers start with 'offset' padding elements which are marked as null, and NA's are marked as null in
+ the validity bitmap. broken = 1 gives the array too few buffers, and broken = 2 a NULL data buffer.
+ Returns list(array, schema) like arrow_allocC().
+*/
+SEXP arrow_testC(SEXP x, SEXP Roffset, SEXP Rbroken) {
+  const int n = length(x), off = asInteger(Roffset), broken = asInteger(Rbroken), tx = TYPEOF(x), l = n + off;
+  if(off < 0 || !(tx == INTSXP || tx == REALSXP || tx == STRSXP) || isObject(x)) error("Unsupported input");
+  SEXP res = PROTECT(arrow_allocC());
+  struct ArrowArray *a = (struct ArrowArray *)R_ExternalPtrAddr(VECTOR_ELT(res, 0));
+  struct ArrowSchema *s = (struct ArrowSchema *)R_ExternalPtrAddr(VECTOR_ELT(res, 1));
+  arrow_test_private *p = (arrow_test_private *)calloc(1, sizeof(arrow_test_private));
+  uint8_t *v = (uint8_t *)calloc(BITMAP_BYTES(l) + 1, 1);
+  int64_t nulls = off;
+  for(int i = 0; i < n; ++i) {
+    const int na = tx == INTSXP ? INTEGER(x)[i] == NA_INTEGER : tx == REALSXP ? R_IsNA(REAL(x)[i]) : STRING_ELT(x, i) == NA_STRING;
+    if(na) ++nulls;
+    else v[(off + i) >> 3] |= (uint8_t)(1 << ((off + i) & 7));
+  }
+  p->data[0] = v;
+  if(tx == STRSXP) {
+    int32_t *o = (int32_t *)calloc(l + 1, sizeof(int32_t)), pos = 0;
+    for(int i = 0; i < n; ++i) if(STRING_ELT(x, i) != NA_STRING) pos += (int32_t)strlen(translateCharUTF8(STRING_ELT(x, i)));
+    char *data = (char *)calloc(pos + off + 1, 1);
+    pos = 0;
+    for(int i = 0; i < l; ++i) {
+      o[i] = pos;
+      if(i < off) data[pos++] = 'x'; // Padding strings
+      else if(STRING_ELT(x, i - off) != NA_STRING) {
+        const char *si = translateCharUTF8(STRING_ELT(x, i - off));
+        memcpy(data + pos, si, strlen(si));
+        pos += (int32_t)strlen(si);
+      }
+    }
+    o[l] = pos;
+    p->data[1] = o;
+    p->data[2] = data;
+  } else {
+    const size_t size = tx == INTSXP ? sizeof(int) : sizeof(double);
+    char *data = (char *)calloc(l ? l : 1, size);
+    memcpy(data + off * size, DATAPTR_RO(x), n * size);
+    p->data[1] = data;
+  }
+  for(int b = 0; b < 3; ++b) p->buffers[b] = p->data[b];
+  if(broken == 2) p->buffers[1] = NULL;
+  a->length = n;
+  a->offset = off;
+  a->null_count = nulls - off;
+  a->n_buffers = (tx == STRSXP ? 3 : 2) - (broken == 1);
+  a->n_children = 0;
+  a->buffers = p->buffers;
+  a->children = NULL;
+  a->dictionary = NULL;
+  a->release = arrow_test_release_array;
+  a->private_data = p;
+  s->format = tx == INTSXP ? "i" : tx == REALSXP ? "g" : "u";
+  s->name = "";
+  s->metadata = NULL;
+  s->flags = ARROW_FLAG_NULLABLE;
+  s->n_children = 0;
+  s->children = NULL;
+  s->dictionary = NULL;
+  s->release = arrow_test_release_schema;
+  s->private_data = NULL;
+  UNPROTECT(1);
+  return res;
+}
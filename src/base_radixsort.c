@@ -2156,3 +2156,12 @@ void dradixsort(int *o, Rboolean NA_last, Rboolean decreasing, int n, double *x)
   free(otmp);                otmp=NULL;          otmp_alloc=0;
 }
 
+// Order of x within the groups given by the integer group-id vector g, i.e. radixorder(g, x). Being stable, identical
+// values within a group are in order of appearance. Used by grouped fndistinct and fmode for many tiny groups. Not thread safe.
+SEXP gx_radixorder(SEXP g, SEXP x) {
+  SEXP decreasing = PROTECT(allocVector(LGLSXP, 2)), args = PROTECT(list2(g, x));
+  LOGICAL(decreasing)[0] = LOGICAL(decreasing)[1] = FALSE;
+  SEXP o = Cradixsort(ScalarLogical(TRUE), decreasing, ScalarLogical(FALSE), ScalarLogical(FALSE), ScalarLogical(TRUE), args);
+  UNPROTECT(2);
+  return o;
+}
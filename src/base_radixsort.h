@@ -12,3 +12,4 @@ SEXP Cradixsort(SEXP NA_last, SEXP decreasing, SEXP RETstrt, SEXP RETgs, SEXP SO
 void num1radixsort(int *o, Rboolean NA_last, Rboolean decreasing, SEXP x);
 void iradixsort(int *o, Rboolean NA_last, Rboolean decreasing, int n, int *x);
 void dradixsort(int *o, Rboolean NA_last, Rboolean decreasing, int n, double *x);
+SEXP gx_radixorder(SEXP g, SEXP x);
@@ -6,10 +6,12 @@
   #define OMP_NUM_PROCS omp_get_num_procs()
   #define OMP_THREAD_LIMIT omp_get_thread_limit()
   #define OMP_MAX_THREADS omp_get_max_threads()
+  #define OMP_THREAD_NUM omp_get_thread_num()
 #else
   #define OMP_NUM_PROCS 1
   #define OMP_THREAD_LIMIT 1
   #define OMP_MAX_THREADS 1
+  #define OMP_THREAD_NUM 0
 #endif
 
 #include <R.h>
@@ -40,6 +42,7 @@ SEXP Cradixsort(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 void num1radixsort(int *, Rboolean, Rboolean, SEXP);
 void iradixsort(int *, Rboolean, Rboolean, int, int *);
 void dradixsort(int *, Rboolean, Rboolean, int, double *);
+SEXP gx_radixorder(SEXP, SEXP);
 
 // from stats_mAR.c
 void multi_yw(void *, void *, void *, void *, void *, void *, void *, void *, void *, void *);
@@ -66,6 +69,7 @@ void DFcopyAttr(SEXP out, SEXP x, int ng);
 SEXP falloc(SEXP, SEXP, SEXP);
 SEXP frange(SEXP x, SEXP Rnarm, SEXP Rfinite);
 SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads);
+SEXP fdistpC(SEXP x, SEXP vec, SEXP Rret, SEXP Rp, SEXP Rnthreads);
 SEXP fnrowC(SEXP x);
 // SEXP CasChar(SEXP x);
 SEXP setAttributes(SEXP x, SEXP a);
@@ -155,10 +159,20 @@ SEXP fmaxlC(SEXP x, SEXP Rng, SEXP g, SEXP Rnarm, SEXP Rdrop);
 SEXP fcumsumC(SEXP x, SEXP Rng, SEXP g, SEXP o, SEXP Rnarm, SEXP Rfill);
 SEXP fcumsummC(SEXP x, SEXP Rng, SEXP g, SEXP o, SEXP Rnarm, SEXP Rfill);
 SEXP fcumsumlC(SEXP x, SEXP Rng, SEXP g, SEXP o, SEXP Rnarm, SEXP Rfill);
+// Added fewmean and fewvar, written in C:
+SEXP fewmaC(SEXP x, SEXP Rng, SEXP g, SEXP t, SEXP Rdecay, SEXP Radjust, SEXP Rvar, SEXP Rnarm, SEXP Rfill);
+SEXP fewmamC(SEXP x, SEXP Rng, SEXP g, SEXP t, SEXP Rdecay, SEXP Radjust, SEXP Rvar, SEXP Rnarm, SEXP Rfill, SEXP Rnthreads);
+SEXP fewmalC(SEXP x, SEXP Rng, SEXP g, SEXP t, SEXP Rdecay, SEXP Radjust, SEXP Rvar, SEXP Rnarm, SEXP Rfill, SEXP Rnthreads);
+// Time indexing for irregular time series and panels, in time_index.c (the lag index is declared in time_index.h):
+int order_gt(int *po, const int *pg, const int *pt, const int ng, const int l);
+void time_lag_index(int *pidx, const int *po, const int *pg, const int *pt, const int ng, const int n, const int l);
 // TRA, rewritten in C and extended:
-SEXP TRAC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset);
-SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset);
-SEXP TRAlC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset);
+int TtI(SEXP x);
+SEXP TRAC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads);
+SEXP TRAC1(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset);
+SEXP TRAmC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads);
+SEXP TRAlC(SEXP x, SEXP xAG, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads);
+SEXP fusedTRAC(SEXP x, SEXP g, SEXP Rret, SEXP Rset, SEXP Rnthreads, SEXP fuse);
 // fndistinct, rewritten in C:
 SEXP fndistinctC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rnthreads);
 SEXP fndistinctlC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads);
@@ -173,6 +187,45 @@ SEXP fnthlC(SEXP x, SEXP p, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, S
 SEXP fnthmC(SEXP x, SEXP p, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnthreads);
 // New: fquantile:
 SEXP fquantileC(SEXP x, SEXP Rprobs, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEXP Rnames, SEXP checko);
+SEXP fquantilegC(SEXP x, SEXP Rprobs, SEXP g, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEXP Rnames, SEXP checko, SEXP Rnthreads);
+int Rties2int(SEXP x);
+// Approximate quantiles from mergeable t-digest sketches (qsketch.c):
+SEXP qsketchC(SEXP x, SEXP g, SEXP w, SEXP Rdelta, SEXP Rnarm, SEXP Rnthreads);
+SEXP qsketch_mergeC(SEXP sketches, SEXP maps, SEXP Rng, SEXP Rdelta, SEXP Rnthreads);
+SEXP qsketch_quantileC(SEXP sketch, SEXP Rprobs);
+void nth_approx(double *pres, const void *px, const int tx, const int l, const double *pw, const int *pg, const int ng,
+                const int narm, const double Q, const int nthreads);
+SEXP nth_approx_impl(SEXP x, SEXP g, const double *pw, const int narm, const double Q, const int nthreads);
+SEXP nth_approx_mat(SEXP x, SEXP g, const double *pw, const int narm, const double Q, const int nthreads, int *ng);
+// Approximate distinct value counts from mergeable HyperLogLog sketches (dsketch.c):
+SEXP fndistinct_approxC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rp, SEXP Rnthreads);
+SEXP fndistinct_approxlC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rp, SEXP Rnthreads);
+SEXP fndistinct_approxmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rp, SEXP Rnthreads);
+SEXP dsketchC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rp, SEXP Rnthreads);
+SEXP dsketch_mergeC(SEXP sketches, SEXP maps, SEXP Rng, SEXP Rp, SEXP Rnthreads);
+SEXP dsketch_countC(SEXP sketch, SEXP Rp);
+// Mergeable accumulator states for streaming aggregation (fstate.c):
+SEXP fstateC(SEXP x, SEXP Rng, SEXP g, SEXP w, SEXP Rnarm, SEXP Rnthreads);
+SEXP fstate_mergeC(SEXP states, SEXP ids, SEXP Rng, SEXP Rnarm, SEXP Rnthreads);
+// Memory-mapped binary columns as ALTREP vectors (fmmap.c):
+SEXP fmmapC(SEXP file, SEXP Rdouble, SEXP Roffset, SEXP Rn, SEXP Radvice, SEXP Rhuge);
+void fmmap_init(DllInfo *dll);
+// Import and export through the Arrow C Data Interface (arrow.c):
+SEXP arrow_allocC(void);
+SEXP arrow_importC(SEXP Rarray, SEXP Rschema);
+SEXP arrow_exportC(SEXP x, SEXP Rarray, SEXP Rschema);
+SEXP arrow_testC(SEXP x, SEXP Roffset, SEXP Rbroken);
+void arrow_check_writeable(SEXP x);
+void arrow_init(DllInfo *dll);
+// Pairwise-complete (weighted) covariances and correlations (pwcor.c):
+SEXP pwcorcovC(SEXP X, SEXP w, SEXP Rcor, SEXP RN, SEXP Rnthreads);
+SEXP fcovC(SEXP x, SEXP y, SEXP Rng, SEXP g, SEXP w, SEXP Rcor, SEXP Rnarm, SEXP Rnthreads);
+SEXP fhdwithinC(SEXP x, SEXP fl, SEXP slvars, SEXP slflag, SEXP w, SEXP Rtol, SEXP Riter, SEXP Rnthreads);
+SEXP flmC(SEXP X, SEXP y, SEXP w, SEXP Rnthreads);
+SEXP flmgC(SEXP X, SEXP y, SEXP Rng, SEXP g, SEXP w, SEXP TRA, SEXP Rnthreads);
+SEXP psacfC(SEXP x, SEXP y, SEXP Rng, SEXP g, SEXP t, SEXP Rlag, SEXP Rnthreads);
+SEXP psmatC(SEXP x, SEXP g, SEXP t, SEXP Rtranspose, SEXP fill, SEXP Rarray, SEXP Rnthreads);
+SEXP qsu_panelC(SEXP x, SEXP Rext, SEXP Rng, SEXP g, SEXP Rnpg, SEXP pg, SEXP w, SEXP gn, SEXP Rnthreads);
 // Helper functions for C API
 double dquickselect_elem(double *x, const int n, const unsigned int elem, double h);
 double iquickselect_elem(int *x, const int n, const unsigned int elem, double h);
@@ -180,6 +233,7 @@ double dquickselect(double *x, const int n, const int ret, const double Q);
 double iquickselect(int *x, const int n, const int ret, const double Q);
 double nth_int(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret, const double Q);
 double nth_double(const double *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret, const double Q);
+double nth_double_noalloc(const double *restrict px, const int *restrict po, double *x_cc, const int l, const int sorted, const int narm, const int ret, const double Q);
 double nth_int_ord(const int *restrict px, const int *restrict po, int l, const int narm, const int ret, const double Q);
 double nth_double_ord(const double *restrict px, const int *restrict po, int l, const int narm, const int ret, const double Q);
 double w_nth_int_ord(const int *restrict px, const double *restrict pw, const int *restrict po, double h, int l, const int narm, const int ret, const double Q);
@@ -0,0 +1,465 @@
+#include "collapse_c.h"
+#include <stdint.h>
+
+/*
+ Approximate distinct value counts from mergeable HyperLogLog sketches (Flajolet et al., 2007), with the improved
+ estimator of Ertl (2017) which needs no empirical bias correction: https://arxiv.org/abs/1702.01284
+ A sketch with precision p has m = 2^p registers, holding the maximum rank (number of leading zeros + 1) of the hashes
+ that fall into them, and the relative standard error of the count is about 1.04 / sqrt(m). Each group starts with a
+ sparse list of (register, rank) pairs and switches to a dense array of m registers once the list would use more memory,
+ so millions of small groups are cheap. Sketches are merged by taking the maximum of each register.
+ Values are hashed by content (not by pointer or factor code), so sketches from different sessions or datasets can be
+ merged: integers are hashed as doubles, factors by their levels and strings by their bytes.
+*/
+
+typedef struct {
+  unsigned char *reg; // Dense registers, or NULL if sparse
+  int *sp;            // Sparse entries: (register << 6) | rank
+  int n, cap;
+} hll;
+
+#define HLL_NA  0x9e3779b97f4a7c15ULL // Hash of missing values of all types (including NaN)
+
+static inline uint64_t hll_mix(uint64_t h) { // MurmurHash3 64-bit finalizer
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t hll_hash_double(double x) {
+  if(ISNAN(x)) return HLL_NA; // All NaN payloads are one (missing) value, as in fndistinct()
+  if(x == 0.0) x = 0.0; // -0 and 0 are the same value
+  uint64_t u;
+  memcpy(&u, &x, sizeof(double));
+  return hll_mix(u);
+}
+
+static inline uint64_t hll_hash_int(const int x) {
+  return x == NA_INTEGER ? HLL_NA : hll_hash_double((double)x);
+}
+
+static inline uint64_t hll_hash_string(SEXP x) {
+  if(x == NA_STRING) return HLL_NA;
+  const unsigned char *s = (const unsigned char *)CHAR(x);
+  uint64_t h = 14695981039346656037ULL; // FNV-1a
+  while(*s) {
+    h ^= *s++;
+    h *= 1099511628211ULL;
+  }
+  return hll_mix(h);
+}
+
+static inline void hll_free(hll *h) {
+  if(h->reg) R_Free(h->reg);
+  if(h->cap) R_Free(h->sp);
+  h->n = h->cap = 0;
+}
+
+// Sorts the sparse entries and keeps the largest rank for each register
+static void hll_compact(hll *h) {
+  int *sp = h->sp, n = h->n, k = 0;
+  if(n <= 1) return;
+  R_isort(sp, n);
+  for(int i = 0; i != n; ++i) {
+    if(i+1 < n && (sp[i+1] >> 6) == (sp[i] >> 6)) continue;
+    sp[k++] = sp[i];
+  }
+  h->n = k;
+}
+
+static void hll_densify(hll *h, const int p) {
+  unsigned char *reg = (unsigned char*)R_Calloc((size_t)1 << p, unsigned char);
+  for(int i = 0, r; i != h->n; ++i) {
+    r = h->sp[i] & 63;
+    if(r > reg[h->sp[i] >> 6]) reg[h->sp[i] >> 6] = (unsigned char)r;
+  }
+  if(h->cap) R_Free(h->sp);
+  h->sp = NULL;
+  h->n = h->cap = 0;
+  h->reg = reg;
+}
+
+static void hll_set(hll *h, const int idx, const int rank, const int p) {
+  if(h->reg) {
+    if(rank > h->reg[idx]) h->reg[idx] = (unsigned char)rank;
+    return;
+  }
+  if(h->n == h->cap) {
+    const int maxcap = (1 << p) / 4; // The same memory as the dense registers
+    if(h->cap < maxcap) {
+      int cap = h->cap ? 2 * h->cap : 8;
+      if(cap > maxcap) cap = maxcap;
+      h->sp = h->cap ? (int*)R_Realloc(h->sp, cap, int) : (int*)R_Calloc(cap, int);
+      h->cap = cap;
+    } else {
+      hll_compact(h);
+      if(h->n > maxcap / 2) {
+        hll_densify(h, p);
+        if(rank > h->reg[idx]) h->reg[idx] = (unsigned char)rank;
+        return;
+      }
+    }
+  }
+  h->sp[h->n++] = idx << 6 | rank;
+}
+
+static inline void hll_add(hll *h, const uint64_t hash, const int p) {
+  const uint64_t w = (hash << p) | ((uint64_t)1 << (p - 1)); // Remaining bits, with a stop bit
+  hll_set(h, (int)(hash >> (64 - p)), __builtin_clzll(w) + 1, p);
+}
+
+static void hll_merge(hll *dst, const hll *src, const int p) {
+  if(src->reg) {
+    if(!dst->reg) hll_densify(dst, p);
+    unsigned char *restrict rd = dst->reg;
+    const unsigned char *restrict rs = src->reg;
+    for(int i = 0, m = 1 << p; i != m; ++i) if(rs[i] > rd[i]) rd[i] = rs[i];
+  } else {
+    for(int i = 0; i != src->n; ++i) hll_set(dst, src->sp[i] >> 6, src->sp[i] & 63, p);
+  }
+}
+
+static double hll_sigma(double x) {
+  if(x == 1.0) return R_PosInf;
+  double y = 1.0, z = x, zp;
+  do {
+    x *= x;
+    zp = z;
+    z += x * y;
+    y += y;
+  } while(zp != z);
+  return z;
+}
+
+static double hll_tau(double x) {
+  if(x == 0.0 || x == 1.0) return 0.0;
+  double y = 1.0, z = 1.0 - x, zp;
+  do {
+    x = sqrt(x);
+    zp = z;
+    y *= 0.5;
+    z -= (1.0 - x) * (1.0 - x) * y;
+  } while(zp != z);
+  return z / 3.0;
+}
+
+// Expects a compacted sketch
+static double hll_estimate(const hll *h, const int p) {
+  const int m = 1 << p, q = 64 - p;
+  int c[66] = {0}; // Histogram of the register values 0...q+1
+  if(h->reg) {
+    for(int i = 0; i != m; ++i) ++c[h->reg[i]];
+  } else {
+    for(int i = 0; i != h->n; ++i) ++c[h->sp[i] & 63];
+    c[0] = m - h->n;
+  }
+  if(c[0] == m) return 0.0;
+  double z = m * hll_tau(1.0 - (double)c[q+1] / m);
+  for(int k = q; k >= 1; --k) z = 0.5 * (z + c[k]);
+  z += m * hll_sigma((double)c[0] / m);
+  return (double)m * m / (2.0 * M_LN2 * z);
+}
+
+#undef HLL_BUILD_LOOP
+#define HLL_BUILD_LOOP(ISNA, HASH)                         \
+  for(int i = start; i < end; ++i) {                       \
+    if(narm && ISNA(px[i])) continue;                      \
+    hll_add(ng ? hc + pg[i]-1 : hc, HASH(px[i]), p);       \
+  }
+
+#undef ISNA_INT
+#define ISNA_INT(x) ((x) == NA_INTEGER)
+#undef ISNA_STR
+#define ISNA_STR(x) ((x) == NA_STRING)
+#undef HASH_FCT
+#define HASH_FCT(x) ((x) == NA_INTEGER ? HLL_NA : plev[(x)-1])
+
+/*
+ Computes ng sketches (one if ng = 0) from l elements of x starting at offset off (for matrix columns), with 1-based
+ group ids pg. With multiple threads, the rows are split into chunks with separate sketches, which are merged.
+ Returns the compacted sketches, to be freed with hll_free().
+*/
+static hll *hll_sketch(SEXP x, const size_t off, const int l, const int *pg, const int ng, const int narm, const int p, int nthreads) {
+  const int nd = ng ? ng : 1, tx = TYPEOF(x);
+  if(tx != REALSXP && tx != INTSXP && tx != LGLSXP && tx != STRSXP) error("Not Supported SEXP Type: '%s'", type2char(tx));
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(l < 100000) nthreads = 1; // No gains from multithreading on small data
+  if(nthreads < 1) nthreads = 1;
+
+  const uint64_t *plev = NULL;
+  if(tx == INTSXP && isFactor(x)) { // Hashing the levels once
+    SEXP lev = getAttrib(x, R_LevelsSymbol);
+    const SEXP *pl = SEXPPTR_RO(lev);
+    uint64_t *hlev = (uint64_t *) R_alloc(length(lev) + 1, sizeof(uint64_t));
+    for(int i = 0; i != length(lev); ++i) hlev[i] = hll_hash_string(pl[i]);
+    plev = hlev;
+  }
+
+  const void *px_ = tx == REALSXP ? (const void *)(REAL(x) + off) : tx == STRSXP ? (const void *)(SEXPPTR_RO(x) + off) :
+                                                                       (const void *)(INTEGER(x) + off);
+  hll *hs = (hll*)R_Calloc((size_t)nd * nthreads, hll);
+
+  #pragma omp parallel for num_threads(nthreads)
+  for(int c = 0; c < nthreads; ++c) {
+    const int start = (int)((double)l * c / nthreads), end = (int)((double)l * (c+1) / nthreads);
+    hll *hc = hs + (size_t)c * nd;
+    switch(tx) {
+      case REALSXP: {
+        const double *px = (const double *)px_;
+        HLL_BUILD_LOOP(ISNAN, hll_hash_double);
+        break;
+      }
+      case STRSXP: {
+        const SEXP *px = (const SEXP *)px_;
+        HLL_BUILD_LOOP(ISNA_STR, hll_hash_string);
+        break;
+      }
+      default: {
+        const int *px = (const int *)px_;
+        if(plev) {
+          HLL_BUILD_LOOP(ISNA_INT, HASH_FCT);
+        } else {
+          HLL_BUILD_LOOP(ISNA_INT, hll_hash_int);
+        }
+      }
+    }
+  }
+
+  #pragma omp parallel for num_threads(nthreads)
+  for(int d = 0; d < nd; ++d) {
+    for(int c = 1; c < nthreads; ++c) {
+      hll_merge(hs + d, hs + (size_t)c * nd + d, p);
+      hll_free(hs + (size_t)c * nd + d);
+    }
+    if(!hs[d].reg) hll_compact(hs + d);
+  }
+
+  return hs;
+}
+
+static int hll_precision(SEXP Rp) {
+  const int p = asInteger(Rp);
+  if(p == NA_INTEGER || p < 4 || p > 18) error("precision must be an integer between 4 and 18");
+  return p;
+}
+
+static const int *hll_groups(SEXP g, const int l, int *ng) {
+  *ng = 0;
+  if(isNull(g)) return NULL;
+  if(TYPEOF(g) != VECSXP || !inherits(g, "GRP")) error("g needs to be an object of class 'GRP', see ?GRP");
+  if(length(VECTOR_ELT(g, 1)) != l) error("length(g) must match length(x)");
+  *ng = asInteger(VECTOR_ELT(g, 0));
+  return INTEGER(VECTOR_ELT(g, 1));
+}
+
+// Approximate distinct counts of a column of x by groups, rounded to integer
+static void ndistinct_approx(int *pres, SEXP x, const size_t off, const int l, const int *pg, const int ng,
+                             const int narm, const int p, const int nthreads) {
+  hll *hs = hll_sketch(x, off, l, pg, ng, narm, p, nthreads);
+  for(int d = 0; d != (ng ? ng : 1); ++d) {
+    pres[d] = (int)nearbyint(hll_estimate(hs + d, p));
+    hll_free(hs + d);
+  }
+  R_Free(hs);
+}
+
+SEXP fndistinct_approxC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rp, SEXP Rnthreads) {
+  int l = length(x), ng;
+  const int *pg = hll_groups(g, l, &ng);
+  SEXP res = PROTECT(allocVector(INTSXP, ng ? ng : 1));
+  ndistinct_approx(INTEGER(res), x, 0, l, pg, ng, asLogical(Rnarm), hll_precision(Rp), asInteger(Rnthreads));
+  if(ng) {
+    if(!isObject(x)) copyMostAttrib(x, res);
+    else setAttrib(res, sym_label, getAttrib(x, sym_label));
+  }
+  UNPROTECT(1);
+  return res;
+}
+
+SEXP fndistinct_approxlC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rp, SEXP Rnthreads) {
+  const int l = length(x), narm = asLogical(Rnarm), p = hll_precision(Rp), nthreads = asInteger(Rnthreads);
+  if(l < 1) return ScalarInteger(0);
+  const SEXP *restrict px = SEXPPTR_RO(x);
+  int ng, nrx = length(px[0]);
+  const int *pg = hll_groups(g, nrx, &ng);
+  if(ng == 0 && asLogical(Rdrop)) {
+    SEXP out = PROTECT(allocVector(INTSXP, l));
+    for(int j = 0; j != l; ++j) ndistinct_approx(INTEGER(out) + j, px[j], 0, length(px[j]), NULL, 0, narm, p, nthreads);
+    setAttrib(out, R_NamesSymbol, getAttrib(x, R_NamesSymbol));
+    UNPROTECT(1);
+    return out;
+  }
+  SEXP out = PROTECT(allocVector(VECSXP, l)), *restrict pout = SEXPPTR(out);
+  for(int j = 0; j != l; ++j) {
+    SEXP xj = px[j];
+    if(ng && length(xj) != nrx) error("length(g) must match nrow(x)");
+    SET_VECTOR_ELT(out, j, allocVector(INTSXP, ng ? ng : 1));
+    ndistinct_approx(INTEGER(pout[j]), xj, 0, length(xj), pg, ng, narm, p, nthreads);
+    if(!isObject(xj)) copyMostAttrib(xj, pout[j]);
+    else setAttrib(pout[j], sym_label, getAttrib(xj, sym_label));
+  }
+  DFcopyAttr(out, x, ng);
+  UNPROTECT(1);
+  return out;
+}
+
+SEXP fndistinct_approxmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rp, SEXP Rnthreads) {
+  SEXP dim = getAttrib(x, R_DimSymbol);
+  if(isNull(dim)) error("x is not a matrix");
+  const int l = INTEGER(dim)[0], col = INTEGER(dim)[1], narm = asLogical(Rnarm), p = hll_precision(Rp), nthreads = asInteger(Rnthreads);
+  if(l < 1) return ScalarInteger(0);
+  int ng;
+  const int *pg = hll_groups(g, l, &ng);
+  const int nd = ng ? ng : 1;
+  SEXP res = PROTECT(allocVector(INTSXP, (R_xlen_t)nd * col));
+  for(int j = 0; j != col; ++j) ndistinct_approx(INTEGER(res) + (size_t)j * nd, x, (size_t)j * l, l, pg, ng, narm, p, nthreads);
+  matCopyAttr(res, x, Rdrop, ng);
+  UNPROTECT(1);
+  return res;
+}
+
+// Exports compacted sketches as list(sparse, size, dense): size gives the number of sparse entries of each group, or
+// NA for groups with dense registers, which are concatenated in the raw vector dense.
+static SEXP hll_export(hll *hs, const int nd, const int p) {
+  const int m = 1 << p;
+  double ns = 0.0, ndense = 0.0;
+  for(int d = 0; d != nd; ++d) {
+    if(hs[d].reg) ndense += m;
+    else ns += hs[d].n;
+  }
+  if(ns > INT_MAX) error("Sketch too large");
+  SEXP res = PROTECT(allocVector(VECSXP, 3)), nam = PROTECT(allocVector(STRSXP, 3));
+  SET_VECTOR_ELT(res, 0, allocVector(INTSXP, (int)ns));
+  SET_VECTOR_ELT(res, 1, allocVector(INTSXP, nd));
+  SET_VECTOR_ELT(res, 2, allocVector(RAWSXP, (R_xlen_t)ndense));
+  SET_STRING_ELT(nam, 0, mkChar("sparse"));
+  SET_STRING_ELT(nam, 1, mkChar("size"));
+  SET_STRING_ELT(nam, 2, mkChar("dense"));
+  namesgets(res, nam);
+  int *psp = INTEGER(VECTOR_ELT(res, 0)), *ps = INTEGER(VECTOR_ELT(res, 1));
+  Rbyte *pr = RAW(VECTOR_ELT(res, 2));
+  for(int d = 0; d != nd; ++d) {
+    const hll *h = hs + d;
+    if(h->reg) {
+      ps[d] = NA_INTEGER;
+      memcpy(pr, h->reg, m);
+      pr += m;
+    } else {
+      ps[d] = h->n;
+      memcpy(psp, h->sp, h->n * sizeof(int));
+      psp += h->n;
+    }
+  }
+  UNPROTECT(2);
+  return res;
+}
+
+// Reads sketch d of an exported sketch (without copying). starts holds the offsets of the groups in sparse or dense.
+static inline void hll_view(hll *h, SEXP sketch, const size_t *starts, const int d) {
+  const int n = INTEGER(VECTOR_ELT(sketch, 1))[d];
+  h->cap = 0; // Not owned
+  if(n == NA_INTEGER) {
+    h->reg = RAW(VECTOR_ELT(sketch, 2)) + starts[d];
+    h->sp = NULL;
+    h->n = 0;
+  } else {
+    h->reg = NULL;
+    h->sp = INTEGER(VECTOR_ELT(sketch, 0)) + starts[d];
+    h->n = n;
+  }
+}
+
+static size_t *hll_starts(SEXP sketch, const int p) {
+  if(TYPEOF(sketch) != VECSXP || length(sketch) < 3 || TYPEOF(VECTOR_ELT(sketch, 0)) != INTSXP ||
+     TYPEOF(VECTOR_ELT(sketch, 1)) != INTSXP || TYPEOF(VECTOR_ELT(sketch, 2)) != RAWSXP) error("Invalid sketch, see ?dsketch");
+  SEXP size = VECTOR_ELT(sketch, 1);
+  const int nd = length(size), *ps = INTEGER(size), m = 1 << p, maxe = (m << 6) - 1, maxr = 64 - p + 1;
+  size_t *starts = (size_t *) R_alloc(nd, sizeof(size_t)), s = 0, r = 0;
+  for(int d = 0; d != nd; ++d) {
+    if(ps[d] == NA_INTEGER) {
+      starts[d] = r;
+      r += m;
+    } else {
+      if(ps[d] < 0) error("Invalid sketch, see ?dsketch");
+      starts[d] = s;
+      s += ps[d];
+    }
+  }
+  if(s != (size_t)length(VECTOR_ELT(sketch, 0)) || r != (size_t)xlength(VECTOR_ELT(sketch, 2))) error("Invalid sketch, see ?dsketch");
+  const int *psp = INTEGER(VECTOR_ELT(sketch, 0));
+  for(size_t i = 0; i != s; ++i) if(psp[i] < 0 || psp[i] > maxe || (psp[i] & 63) > maxr) error("Invalid sketch, see ?dsketch");
+  // Register values are used as indices by hll_estimate()
+  const Rbyte *preg = RAW(VECTOR_ELT(sketch, 2));
+  for(size_t i = 0; i != r; ++i) if(preg[i] > maxr) error("Invalid sketch, see ?dsketch");
+  return starts;
+}
+
+SEXP dsketchC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rp, SEXP Rnthreads) {
+  const int l = length(x), p = hll_precision(Rp);
+  int ng;
+  const int *pg = hll_groups(g, l, &ng);
+  const int nd = ng ? ng : 1;
+  hll *hs = hll_sketch(x, 0, l, pg, ng, asLogical(Rnarm), p, asInteger(Rnthreads));
+  SEXP res = hll_export(hs, nd, p);
+  for(int d = 0; d != nd; ++d) hll_free(hs + d);
+  R_Free(hs);
+  return res;
+}
+
+// Merges a list of sketches: maps is a list of integer vectors of length ng, giving for each group of the result
+// the (1-based) group in each sketch, or NA if the group does not occur in it.
+SEXP dsketch_mergeC(SEXP sketches, SEXP maps, SEXP Rng, SEXP Rp, SEXP Rnthreads) {
+  const int ns = length(sketches), ng = asInteger(Rng), p = hll_precision(Rp);
+  int nthreads = asInteger(Rnthreads);
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > ng) nthreads = ng;
+  if(nthreads < 1) nthreads = 1;
+  if(length(maps) != ns) error("length(maps) must match length(sketches)");
+
+  const SEXP *ps = SEXPPTR_RO(sketches), *pmaps = SEXPPTR_RO(maps);
+  const size_t **starts = (const size_t **) R_alloc(ns, sizeof(size_t *));
+  const int **pmap = (const int **) R_alloc(ns, sizeof(int *));
+  for(int s = 0; s != ns; ++s) {
+    starts[s] = hll_starts(ps[s], p);
+    if(TYPEOF(pmaps[s]) != INTSXP || length(pmaps[s]) != ng) error("Internal error: invalid group mapping");
+    pmap[s] = INTEGER(pmaps[s]);
+    for(int d = 0, nds = length(VECTOR_ELT(ps[s], 1)); d != ng; ++d)
+      if(pmap[s][d] != NA_INTEGER && (pmap[s][d] < 1 || pmap[s][d] > nds)) error("Internal error: invalid group mapping");
+  }
+
+  hll *hs = (hll*)R_Calloc(ng, hll);
+  #pragma omp parallel for num_threads(nthreads)
+  for(int d = 0; d < ng; ++d) {
+    hll src;
+    for(int s = 0; s != ns; ++s) {
+      if(pmap[s][d] == NA_INTEGER) continue;
+      hll_view(&src, ps[s], starts[s], pmap[s][d]-1);
+      hll_merge(hs + d, &src, p);
+    }
+    if(!hs[d].reg) hll_compact(hs + d);
+  }
+
+  SEXP res = hll_export(hs, ng, p);
+  for(int d = 0; d != ng; ++d) hll_free(hs + d);
+  R_Free(hs);
+  return res;
+}
+
+// Returns the estimated number of distinct values in each group
+SEXP dsketch_countC(SEXP sketch, SEXP Rp) {
+  const int p = hll_precision(Rp);
+  const size_t *starts = hll_starts(sketch, p);
+  const int nd = length(VECTOR_ELT(sketch, 1));
+  SEXP res = PROTECT(allocVector(REALSXP, nd));
+  double *pres = REAL(res);
+  hll h;
+  for(int d = 0; d != nd; ++d) {
+    hll_view(&h, sketch, starts, d);
+    pres[d] = hll_estimate(&h, p);
+  }
+  UNPROTECT(1);
+  return res;
+}
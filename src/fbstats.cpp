@@ -478,11 +478,13 @@ SEXP fbstatsCpp(const NumericVector& x, bool ext = false, int ng = 0, const Inte
       // memset(groupids, true, sizeof(bool)*ng*npg); // works ? necessary ?
       std::fill(groupids.begin(), groupids.end(), true);
       NumericVector gnpids(ng); // best ?
+      NumericVector wg = weights ? NumericVector(w) : NumericVector(0);
       for(int i = 0; i != l; ++i) {
         if(std::isnan(x[i])) { // important ? right ?
           between[i] = within[i] = NA_REAL; // x[i] ?
         } else {
-          if(groupids(g[i]-1, pg[i]-1)) { // added this part
+          // Panel-ids only count if they have an observation with a valid weight, as in fnobs5pImpl()
+          if(groupids(g[i]-1, pg[i]-1) && (!weights || (wg[i] == wg[i] && wg[i] != 0))) { // added this part
             ++gnpids[g[i]-1];
             groupids(g[i]-1, pg[i]-1) = false;
           }
@@ -0,0 +1,190 @@
+#include "collapse_c.h"
+
+/*
+ Grouped (weighted) covariances and correlations. Each group keeps the state of the weighted Welford recursion used in
+ fvarsdCpp() (fvar_fsd.cpp), extended to two variables: the sum of weights W, the means mx and my, and the co-moments
+ Cxy, Cxx and Cyy. Partial states (of different row chunks) are combined with the pairwise update of Chan, Golub &
+ LeVeque (1979), so a single pair of variables can be processed by several threads. With several pairs (columns),
+ multithreading is across pairs. Without na.rm, a missing value sets W to NA, which propagates to the result.
+*/
+
+typedef struct { double W, mx, my, Cxy, Cxx, Cyy; } comoment;
+
+static inline void cm_add(comoment *restrict s, const double x, const double y, const double w) {
+  s->W += w;
+  const double f = w / s->W, dx = x - s->mx, dy = y - s->my;
+  s->mx += dx * f;
+  s->my += dy * f;
+  s->Cxy += w * dx * (y - s->my);
+  s->Cxx += w * dx * (x - s->mx);
+  s->Cyy += w * dy * (y - s->my);
+}
+
+static inline void cm_merge(comoment *restrict a, const comoment *restrict b) {
+  if(b->W == 0.0) return;
+  if(a->W == 0.0) {
+    *a = *b;
+    return;
+  }
+  const double W = a->W + b->W, f = a->W * b->W / W, dx = b->mx - a->mx, dy = b->my - a->my;
+  a->mx += dx * b->W / W;
+  a->my += dy * b->W / W;
+  a->Cxy += b->Cxy + dx * dy * f;
+  a->Cxx += b->Cxx + dx * dx * f;
+  a->Cyy += b->Cyy + dy * dy * f;
+  a->W = W;
+}
+
+// Covariance with frequency weights (as fvar), or correlation
+static inline double cm_stat(const comoment *s, const int cor, const int diag) {
+  if(s->W == 0.0 || ISNAN(s->W)) return NA_REAL;
+  double res;
+  if(cor) {
+    res = s->Cxy / sqrt(s->Cxx * s->Cyy);
+    if(ISNAN(res)) return NA_REAL;
+    if(diag) return 1.0;
+    return res > 1.0 ? 1.0 : res < -1.0 ? -1.0 : res;
+  }
+  res = s->Cxy / (s->W - 1.0);
+  return ISNAN(res) ? NA_REAL : res;
+}
+
+// Accumulates rows [start, end) into st (of size ng, or 1 if ng = 0). Like fvar, zero weights are skipped.
+static void fcov_rows(comoment *restrict st, const double *restrict px, const double *restrict py, const double *restrict pw,
+                      const int *restrict pg, const int ng, const int start, const int end, const int narm) {
+  for(int i = start; i < end; ++i) {
+    const double x = px[i], y = py[i], w = pw ? pw[i] : 1.0;
+    if(ISNAN(x) || ISNAN(y) || ISNAN(w)) {
+      if(!narm) st[ng ? pg[i]-1 : 0].W = NA_REAL; // Propagates through cm_add() and cm_merge()
+      continue;
+    }
+    if(w == 0.0) continue;
+    cm_add(st + (ng ? pg[i]-1 : 0), x, y, w);
+  }
+}
+
+// Columns of a numeric vector, matrix or list as double pointers: non-double columns are coerced and added to prot
+static const double **fcov_cols(SEXP x, int *l, int *K, SEXP prot) {
+  const double **cols;
+  if(TYPEOF(x) == VECSXP) {
+    *K = length(x);
+    cols = (const double**)R_alloc(*K > 0 ? *K : 1, sizeof(double*));
+    for(int k = 0; k < *K; ++k) {
+      SEXP xk = VECTOR_ELT(x, k);
+      if(k == 0) *l = length(xk);
+      else if(length(xk) != *l) error("All columns of x need to have the same length");
+      if(TYPEOF(xk) != REALSXP) {
+        if(!(TYPEOF(xk) == INTSXP || TYPEOF(xk) == LGLSXP)) error("x needs to be numeric");
+        SET_VECTOR_ELT(prot, k, xk = coerceVector(xk, REALSXP));
+      }
+      cols[k] = REAL(xk);
+    }
+    if(*K == 0) *l = 0;
+    return cols;
+  }
+  if(TYPEOF(x) != REALSXP) {
+    if(!(TYPEOF(x) == INTSXP || TYPEOF(x) == LGLSXP)) error("x needs to be numeric");
+    SET_VECTOR_ELT(prot, 0, x = coerceVector(x, REALSXP));
+  }
+  if(isMatrix(x)) {
+    *l = nrows(x);
+    *K = ncols(x);
+  } else {
+    *l = length(x);
+    *K = 1;
+  }
+  cols = (const double**)R_alloc(*K > 0 ? *K : 1, sizeof(double*));
+  for(int k = 0; k < *K; ++k) cols[k] = REAL(x) + (size_t)k * *l;
+  return cols;
+}
+
+// x: numeric vector, matrix or list of columns. If y is supplied, the statistic of each column of x with y is computed for
+// each group, giving a ng x K matrix (in column-major order). Otherwise, the K x K matrix of each group is computed
+// (K x K x ng array).
+SEXP fcovC(SEXP x, SEXP y, SEXP Rng, SEXP g, SEXP w, SEXP Rcor, SEXP Rnarm, SEXP Rnthreads) {
+  const int ng = asInteger(Rng), cor = asLogical(Rcor), narm = asLogical(Rnarm), ngo = ng ? ng : 1, isy = !isNull(y);
+  int l = 0, K = 0, nthreads = asInteger(Rnthreads), nprotect = 1;
+  SEXP prot = PROTECT(allocVector(VECSXP, TYPEOF(x) == VECSXP ? length(x) + 2 : 3));
+  const double **cols = fcov_cols(x, &l, &K, prot), *py = NULL, *pw = NULL;
+  const int *pg = NULL;
+  if(isy) {
+    if(length(y) != l) error("length(y) must match NROW(x)");
+    if(TYPEOF(y) != REALSXP) {
+      if(!(TYPEOF(y) == INTSXP || TYPEOF(y) == LGLSXP)) error("y needs to be numeric");
+      SET_VECTOR_ELT(prot, length(prot)-2, y = coerceVector(y, REALSXP));
+    }
+    py = REAL(y);
+  }
+  if(!isNull(w)) {
+    if(length(w) != l) error("length(w) must match NROW(x)");
+    if(TYPEOF(w) != REALSXP) {
+      if(!(TYPEOF(w) == INTSXP || TYPEOF(w) == LGLSXP)) error("weights need to be double or integer/logical (internally coerced to double)");
+      SET_VECTOR_ELT(prot, length(prot)-1, w = coerceVector(w, REALSXP));
+    }
+    pw = REAL(w);
+  }
+  if(ng) {
+    if(length(g) != l) error("length(g) must match NROW(x)");
+    pg = INTEGER(g);
+  }
+
+  // Pairs: (k, y) for k in 1..K, or (i, j) with i <= j
+  const int npairs = isy ? K : K * (K + 1) / 2;
+  int *restrict pairs = (int*)R_alloc(2 * (npairs > 0 ? npairs : 1), sizeof(int));
+  if(isy) for(int k = 0; k < K; ++k) pairs[2*k] = pairs[2*k+1] = k;
+  else for(int i = 0, p = 0; i < K; ++i) for(int j = i; j < K; ++j, ++p) {
+    pairs[2*p] = i;
+    pairs[2*p+1] = j;
+  }
+
+  SEXP res = PROTECT(allocVector(REALSXP, isy ? (size_t)ngo * K : (size_t)K * K * ngo)); ++nprotect;
+  double *restrict pres = REAL(res);
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads < 1) nthreads = 1;
+
+#define FCOV_STORE(st, p)                                                              \
+  {                                                                                    \
+    const int i = pairs[2*(p)], j = pairs[2*(p)+1];                                    \
+    if(isy) for(int gr = 0; gr < ngo; ++gr) pres[(size_t)i*ngo + gr] = cm_stat(st + gr, cor, 0); \
+    else for(int gr = 0; gr < ngo; ++gr)                                               \
+      pres[(size_t)gr*K*K + (size_t)j*K + i] = pres[(size_t)gr*K*K + (size_t)i*K + j] = cm_stat(st + gr, cor, i == j); \
+  }
+
+  if(npairs >= nthreads || l < 100000) { // Parallel across pairs
+    if(nthreads > npairs) nthreads = npairs > 0 ? npairs : 1;
+    #pragma omp parallel num_threads(nthreads)
+    {
+      comoment *restrict st = (comoment*)R_Calloc(ngo, comoment);
+      #pragma omp for schedule(dynamic)
+      for(int p = 0; p < npairs; ++p) {
+        memset(st, 0, ngo * sizeof(comoment));
+        fcov_rows(st, cols[pairs[2*p]], isy ? py : cols[pairs[2*p+1]], pw, pg, ng, 0, l, narm);
+        FCOV_STORE(st, p);
+      }
+      R_Free(st);
+    }
+  } else { // Few pairs: parallel across row chunks, merging the states of the chunks in order
+    comoment *restrict st = (comoment*)R_Calloc((size_t)ngo * nthreads, comoment);
+    const int chunk = (l + nthreads - 1) / nthreads;
+    for(int p = 0; p < npairs; ++p) {
+      const double *px = cols[pairs[2*p]], *pyp = isy ? py : cols[pairs[2*p+1]];
+      memset(st, 0, (size_t)ngo * nthreads * sizeof(comoment));
+      #pragma omp parallel for num_threads(nthreads)
+      for(int t = 0; t < nthreads; ++t) {
+        const int start = t * chunk, end = start + chunk < l ? start + chunk : l;
+        if(start < end) fcov_rows(st + (size_t)t * ngo, px, pyp, pw, pg, ng, start, end, narm);
+      }
+      for(int t = 1; t < nthreads; ++t) {
+        const comoment *stt = st + (size_t)t * ngo;
+        for(int gr = 0; gr < ngo; ++gr) cm_merge(st + gr, stt + gr);
+      }
+      FCOV_STORE(st, p);
+    }
+    R_Free(st);
+  }
+
+#undef FCOV_STORE
+
+  UNPROTECT(nprotect);
+  return res;
+}
@@ -1,4 +1,6 @@
 #include <Rcpp/Lighter>
+#include "time_index.h"
+#include <memory>
 using namespace Rcpp;
 
 // Return Options:
@@ -17,6 +19,117 @@ using namespace Rcpp;
 //   return x > 0 ? log(x) : x == 0 ? R_NegInf : R_NaN;
 // }
 
+// Checks diff and returns max(diff)
+inline int checkDiff(const IntegerVector& diff) {
+  int ds = diff.size();
+  if(diff[0] < 1) stop("diff must be a vector of integers > 0");
+  for(int q = 1; q != ds; ++q) if(diff[q] <= diff[q-1]) stop("differences must be passed in ascending order");
+  return diff[ds-1];
+}
+
+// Time variable provided: returns the (0-based) ordering of the data by groups and time if the time series / panel is
+// regular, or an empty vector if it is irregular (in which case LagLeadIndex is used, see time_index.h).
+IntegerVector regularOrder(int ng, const IntegerVector& g, const SEXP& t, int l) {
+  IntegerVector ord = t;
+  if(l != ord.size()) stop("length(x) must match length(t)");
+  if(ng == 0) {
+    int min = INT_MAX, max = INT_MIN, temp;
+    for(int i = 0; i != l; ++i) {
+      if(ord[i] < min) min = ord[i];
+      if(ord[i] > max) max = ord[i];
+    }
+    if(min == NA_INTEGER) stop("Timevar contains missing values");
+    if((double)max - min + 1.0 != l) return IntegerVector(0);
+    IntegerVector omap(l, -1);
+    for(int i = 0; i != l; ++i) {
+      temp = ord[i] - min;
+      if(omap[temp] != -1) stop("Repeated values in timevar");
+      omap[temp] = i;
+    }
+    return omap;
+  }
+  int ngp = ng+1, temp;
+  std::vector<int> min(ngp, INT_MAX), max(ngp, INT_MIN), cgs(ngp);
+  for(int i = 0; i != l; ++i) {
+    temp = g[i];
+    if(ord[i] < min[temp]) min[temp] = ord[i];
+    if(ord[i] > max[temp]) max[temp] = ord[i];
+  }
+  double range = 0.0; // Summed across groups: the panel is regular if range == l
+  for(int i = 1; i != ngp; ++i) {
+    if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
+    if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
+    cgs[i] = range <= l ? (int)range : 0;
+    range += (double)max[i] - min[i] + 1.0;
+  }
+  if(range != l) return IntegerVector(0);
+  IntegerVector omap(l, -1);
+  for(int i = 0; i != l; ++i) {
+    temp = cgs[g[i]] + ord[i] - min[g[i]];
+    if(omap[temp] != -1) stop("Repeated values of timevar within one or more groups");
+    omap[temp] = i;
+  }
+  return omap;
+}
+
+// Computes all lagged / leaded and iterated differences (or growth rates) of px in a single pass through the data.
+// pout holds ds output columns for each element of n (none for n = 0). Groups (pg) must be contiguous, either in the
+// data (po = NULL) or in the ordering po. For each n, a ring buffer holds the last abs(n) values of the differences of
+// order 0 (px) to max(diff)-1 within the current group, so each observation requires one evaluation of FUN per order.
+// Lags are computed in a forward pass and leads in a backward pass. Irregular data (lidx) only
+// supports first differences. The group sizes (gs) previously needed for iterated differences are no longer required.
+template <typename F>
+void fdiffgrowthColumn(double **pout, const double *px, const int *po, LagLeadIndex *lidx, const int *pg, const int l,
+                       const IntegerVector& n, const IntegerVector& diff, const double fill, F FUN) {
+  const int ns = n.size(), ds = diff.size(), *pn = n.begin(), *pdiff = diff.begin();
+  if(lidx) {
+    for(int p = 0; p != ns; ++p) {
+      if(pn[p] == 0) continue;
+      double *outp = pout[p*ds];
+      const int *pidx = (*lidx)[p];
+      for(int i = 0, temp; i != l; ++i) outp[i] = (temp = pidx[i]) ? FUN(px[i], px[temp-1]) : fill;
+    }
+    return;
+  }
+  const int maxd = pdiff[ds-1];
+  std::vector<int> off(ns+1), r(ns), top(ns);
+  for(int p = 0; p != ns; ++p) off[p+1] = off[p] + std::abs(pn[p]) * maxd;
+  std::vector<double> buf(off[ns]), v(maxd+1);
+  for(int back = 0; back != 2; ++back) {
+    bool any = false;
+    for(int p = 0; p != ns; ++p) if(back ? pn[p] < 0 : pn[p] > 0) any = true;
+    if(!any) continue;
+    for(int k = 0, i, gi = 0; k != l; ++k) {
+      i = back ? l-1-k : k;
+      if(po) i = po[i];
+      if(k == 0 || (pg && pg[i] != gi)) { // New group: the ring buffers are refilled from the start
+        std::fill(r.begin(), r.end(), 0);
+        std::fill(top.begin(), top.end(), 0);
+      }
+      if(pg) gi = pg[i];
+      for(int p = 0; p != ns; ++p) {
+        const int np = back ? -pn[p] : pn[p];
+        if(np <= 0) continue;
+        // tp is the highest order available: min(max(diff), number of previous observations in the group / np)
+        const int rp = r[p], tp = top[p];
+        double *b = &buf[off[p]], **outp = pout + p*ds;
+        v[0] = px[i];
+        for(int j = 1; j <= tp; ++j) {
+          double *bj = b + (j-1)*np + rp; // Order j-1 difference np observations ago
+          v[j] = FUN(v[j-1], *bj);
+          *bj = v[j-1];
+        }
+        if(tp < maxd) b[tp*np + rp] = v[tp];
+        for(int q = 0; q != ds; ++q) outp[q][i] = pdiff[q] <= tp ? v[pdiff[q]] : fill;
+        if(++r[p] == np) {
+          r[p] = 0;
+          if(tp < maxd) ++top[p];
+        }
+      }
+    }
+  }
+}
+
 template <typename F>
 NumericVector fdiffgrowthCppImpl(const NumericVector& x, const IntegerVector& n = 1, const IntegerVector& diff = 1,
                                  double fill = NA_REAL, int ng = 0, const IntegerVector& g = 0,
@@ -37,530 +150,53 @@ NumericVector fdiffgrowthCppImpl(const NumericVector& x, const IntegerVector& n
   pos = 0;
   std::string stub2 = names ? "F" + stub : "";
 
-  int ncol = (ns-zeros)*ds+zeros;
+  int ncol = (ns-zeros)*ds+zeros, maxdiff = zeros == ns ? 1 : checkDiff(diff);
   if(ncol == 1) names = false;
   NumericMatrix out = no_init_matrix(l, ncol);
   CharacterVector colnam = names ? no_init_vector(ncol) : no_init_vector(1);
   CharacterVector nc = names ? Rf_coerceVector(absn, STRSXP) : NA_STRING;
   CharacterVector diffc = names ? Rf_coerceVector(diff, STRSXP) : NA_STRING;
-  if(ng == 0) { // No groups
-    if(Rf_isNull(t)) { // Ordered data
-      for(int p = 0; p != ns; ++p) {
-        int np = n[p];
-        if(np>0) { // Positive lagged and iterated differences
-          int d1 = diff[0], end = np*d1;
-          bool L1 = np == 1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          if(end >= l) stop("n * diff needs to be < length(x)");
-          NumericMatrix::Column outp = out( _ , pos);
-          if(names) {
-            if(L1) colnam[pos] = stub + diffc[0];
-            else colnam[pos] = "L" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          for(int i = np; i != l; ++i) outp[i] = FUN(x[i], x[i - np]);
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int start = np*(k+1)-1;
-            for(int i = l-1; i != start; --i) outp[i] = FUN(outp[i], outp[i - np]);
-          }
-          for(int i = end; i--; ) outp[i] = fill;
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1], end = np*dq;
-              if(end >= l) stop("n * diff needs to be < length(x)");
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int start = np*(k+1)-1;
-                for(int i = l-1; i != start; --i) outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-              }
-              for(int i = np*L_dq; i != end; ++i) outtemp[i] = fill;
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(L1) colnam[pos] = stub + diffc[q];
-                else colnam[pos] = "L" + nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else if(np<0) { // (Negative) leaded and iterated differences
-          int d1 = diff[0], end = l+np*d1;
-          bool F1 = np == -1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          if(end <= 0) stop("abs(n * diff) needs to be < length(x)");
-          NumericMatrix::Column outp = out( _ , pos);
-          if(names) {
-            if(F1) colnam[pos] = stub2 + diffc[0];
-            else colnam[pos] = "F" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          for(int i = l+np; i--; ) outp[i] = FUN(x[i], x[i - np]);
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int final = l+np*(k+1);
-            for(int i = 0; i != final; ++i) outp[i] = FUN(outp[i], outp[i - np]);
-          }
-          for(int i = end; i != l; ++i) outp[i] = fill;
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1], end = l+np*dq, start = l+np*L_dq;
-              if(end <= 0) stop("abs(n * diff) needs to be < length(x)");
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int final = l+np*(k+1);
-                for(int i = 0; i != final; ++i) outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-              }
-              for(int i = end; i != start; ++i) outtemp[i] = fill;
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(F1) colnam[pos] = stub2 + diffc[q];
-                else colnam[pos] = "F"+ nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else {
-          out( _ , pos) = x;
-          if(names) colnam[pos] = "--";
-          ++pos;
-        }
-      }
-    } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      int min = INT_MAX, max = INT_MIN, osize, temp;
-      for(int i = 0; i != l; ++i) {
-        if(ord[i] < min) min = ord[i];
-        if(ord[i] > max) max = ord[i];
-      }
-      if(min == NA_INTEGER) stop("Timevar contains missing values");
-      osize = max-min+1;
-      bool regular = osize == l;
-      IntegerVector omap(osize), ord2 = regular ? no_init_vector(1) : no_init_vector(l);
-      if(!regular) { // Irregular time series
-        if(osize > 10000000 && osize > 3 * l) warning("Your time series is very irregular. Need to create an internal ordering vector of length %s to represent it.", osize);
-        if(Rcpp::max(diff) > 1) stop("Iterations are currently only supported for regular time series. See ?seqid to identify the regular sequences in your time series, or just apply this function multiple times.");
-        for(int i = 0; i != l; ++i) {
-          temp = ord[i] - min; // Best ? Or direct assign to ord2[i] ? Also check for panel version..
-          if(omap[temp]) stop("Repeated values in timevar");
-          omap[temp] = i+1;
-          ord2[i] = temp;
-        }
-      } else { // Regular time series
-        for(int i = 0; i != l; ++i) {
-          temp = ord[i] - min;
-          if(omap[temp]) stop("Repeated values in timevar");
-          omap[temp] = i;
-        }
-      }
-      for(int p = 0; p != ns; ++p) {
-        int np = n[p];
-        if(np>0) { // Positive lagged and iterated differences
-          int d1 = diff[0], end = np*d1;
-          bool L1 = np == 1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          if(end >= l) stop("n * diff needs to be < length(x)");
-          NumericMatrix::Column outp = out( _ , pos);
-          if(names) {
-            if(L1) colnam[pos] = stub + diffc[0];
-            else colnam[pos] = "L" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          if(regular) {
-            for(int i = np; i != l; ++i) outp[omap[i]] = FUN(x[omap[i]], x[omap[i - np]]);
-          } else {
-            for(int i = 0; i != l; ++i) { // Smarter solution using while ???
-              if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
-                outp[i] = FUN(x[i], x[temp-1]);
-              } else {
-                outp[i] = fill;
-              }
-            }
-          }
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int start = np*(k+1)-1;
-            for(int i = l-1; i != start; --i) outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-          }
-          if(regular) for(int i = end; i--; ) outp[omap[i]] = fill;
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1], end = np*dq;
-              if(end >= l) stop("n * diff needs to be < length(x)");
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int start = np*(k+1)-1;
-                for(int i = l-1; i != start; --i) outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-              }
-              for(int i = np*L_dq; i != end; ++i) outtemp[omap[i]] = fill;
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(L1) colnam[pos] = stub + diffc[q];
-                else colnam[pos] = "L" + nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else if(np<0) { // (Negative) leaded and iterated differences
-          int d1 = diff[0], end = l+np*d1;
-          bool F1 = np == -1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          if(end <= 0) stop("abs(n * diff) needs to be < length(x)");
-          NumericMatrix::Column outp = out( _ , pos);
-          if(names) {
-            if(F1) colnam[pos] = stub2 + diffc[0];
-            else colnam[pos] = "F" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          if(regular) {
-            for(int i = l+np; i--; ) outp[omap[i]] = FUN(x[omap[i]], x[omap[i - np]]);
-          } else {
-            for(int i = 0, osnp = osize + np; i != l; ++i) { // Smarter solution using while ???
-              if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
-                outp[i] = FUN(x[i], x[temp-1]);
-              } else {
-                outp[i] = fill;
-              }
-            }
-          }
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int final = l+np*(k+1);
-            for(int i = 0; i != final; ++i) outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-          }
-          if(regular) for(int i = end; i != l; ++i) outp[omap[i]] = fill;
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1], end = l+np*dq, start = l+np*L_dq;
-              if(end <= 0) stop("abs(n * diff) needs to be < length(x)");
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int final = l+np*(k+1);
-                for(int i = 0; i != final; ++i) outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-              }
-              for(int i = end; i != start; ++i) outtemp[omap[i]] = fill;
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(F1) colnam[pos] = stub2 + diffc[q];
-                else colnam[pos] = "F"+ nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else {
-          out( _ , pos) = x;
-          if(names) colnam[pos] = "--";
-          ++pos;
-        }
-      }
+  if(ng > 0 && l != g.size()) stop("length(x) must match length(g)");
+  int ags = ng > 0 ? l/ng : 0;
+
+  std::vector<double*> pout(ns*ds);
+  for(int p = 0; p != ns; ++p) {
+    int np = n[p];
+    if(np == 0) {
+      out( _ , pos) = x;
+      if(names) colnam[pos] = "--";
+      ++pos;
+      continue;
     }
-  } else {
-    if(l != g.size()) stop("length(x) must match length(g)");
-    int ags = l/ng, ngp = ng+1, maxdiff = max(diff);
-    if(Rf_isNull(t)) {
-      bool cond = !Rf_isNull(gs);
-      IntegerVector gsv = (cond || maxdiff == 1) ? no_init_vector(1) : IntegerVector(ng);
-      int *pgsv = cond ? INTEGER(gs)-1 : INTEGER(gsv)-1;
-      if(maxdiff != 1) {
-        if(cond) {
-          if(ng != Rf_length(gs)) stop("ng must match length(gs)");
-        } else {
-          for(int i = 0; i != l; ++i) ++pgsv[g[i]];
-        }
-      }
-      // int seen[ngp], memsize = sizeof(int)*(ngp);
-      for(int p = 0; p != ns; ++p) {
-        int np = n[p];
-        if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
-        if(np>0) { // Positive lagged and iterated differences
-          int d1 = diff[0];
-          bool L1 = np == 1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          NumericMatrix::Column outp = out( _ , pos);
-          std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-          if(names) {
-            if(L1) colnam[pos] = stub + diffc[0];
-            else colnam[pos] = "L" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          for(int i = 0; i != l; ++i) {
-            if(seen[g[i]] == np) outp[i] = FUN(x[i], x[i - np]);
-            else {
-              outp[i] = fill;
-              ++seen[g[i]];
-            }
-          }
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int start = np*(k+1);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            for(int i = l; i--; ) {
-              if(seen[g[i]] == pgsv[g[i]]-start) outp[i] = fill;
-              else {
-                outp[i] = FUN(outp[i], outp[i - np]);
-                ++seen[g[i]];
-              }
-            }
-          }
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1];
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int start = np*(k+1); // Right ? -> seems so
-                std::vector<int> seen(ngp); // memset(seen, 0, memsize); // Needed, because it loops from the beginning
-                for(int i = l; i--; ) {
-                  if(seen[g[i]] == pgsv[g[i]]-start) outtemp[i] = fill;
-                  else {
-                    outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                    ++seen[g[i]];
-                  }
-                }
-              }
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(L1) colnam[pos] = stub + diffc[q];
-                else colnam[pos] = "L" + nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else if(np<0) { // (Negative) leaded and iterated differences
-          int d1 = diff[0];
-          bool F1 = np == -1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          NumericMatrix::Column outp = out( _ , pos);
-          std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-          if(names) {
-            if(F1) colnam[pos] = stub2 + diffc[0];
-            else colnam[pos] = "F" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          for(int i = l; i--; ) {
-            if(seen[g[i]] == np) outp[i] = FUN(x[i], x[i - np]);
-            else {
-              outp[i] = fill;
-              --seen[g[i]];
-            }
-          }
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int start = np*(k+1);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            for(int i = 0; i != l; ++i) {
-              if(seen[g[i]] == pgsv[g[i]]+start) outp[i] = fill;
-              else {
-                outp[i] = FUN(outp[i], outp[i - np]);
-                ++seen[g[i]];
-              }
-            }
-          }
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1];
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int start = np*(k+1);
-                std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                for(int i = 0; i != l; ++i) {
-                  if(seen[g[i]] == pgsv[g[i]]+start) outtemp[i] = fill;
-                  else {
-                    outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                    ++seen[g[i]];
-                  }
-                }
-              }
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(F1) colnam[pos] = stub2 + diffc[q];
-                else colnam[pos] = "F"+ nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else {
-          out( _ , pos) = x;
-          if(names) colnam[pos] = "--";
-          ++pos;
-        }
-      }
-    } else { // Unordered data: Timevar Provided
-      IntegerVector ord = t;
-      int temp;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      IntegerVector min(ngp, INT_MAX), max(ngp, INT_MIN), cgs = no_init_vector(ngp);
-      for(int i = 0; i != l; ++i) {
-        temp = g[i];
-        if(ord[i] < min[temp]) min[temp] = ord[i];
-        if(ord[i] > max[temp]) max[temp] = ord[i];
-      }
-      temp = 0;
-      for(int i = 1; i != ngp; ++i) {
-        if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
-        if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
-        cgs[i] = temp; // This needs to b here (for unused factor levels case...)
-        max[i] -= min[i] - 1; // need max[i] which stores the complete group sizes only if p<0 e.g. if computing leads..
-        temp += max[i];
-      }
-      // omap provides the ordering to order the vector (needed to find previous / next values)
-      bool regular = temp == l;
-      IntegerVector omap(temp), ord2 = no_init_vector(l);
-      if(!regular) { // Irregular panel
-        if(temp > 10000000 && temp > 3 * l) warning("Your panel is very irregular. Need to create an internal ordering vector of length %s to represent it.", temp);
-        if(maxdiff > 1) stop("Iterations are currently only supported for regular panels. See ?seqid to identify the regular sequences in your panel, or just apply this function multiple times.");
-        for(int i = 0; i != l; ++i) {
-          ord2[i] = ord[i] - min[g[i]];
-          temp = cgs[g[i]] + ord2[i];
-          if(omap[temp]) stop("Repeated values of timevar within one or more groups");
-          omap[temp] = i+1; // needed to add 1 to distinguish between 0 and gap
-        }
-      } else { // Regular panel
-        for(int i = 0; i != l; ++i) {
-          ord2[i] = ord[i] - min[g[i]];
-          temp = cgs[g[i]] + ord2[i];
-          if(omap[temp]) stop("Repeated values of timevar within one or more groups");
-          omap[temp] = i;
-        }
+    if(ng == 0) {
+      if(absn[p]*maxdiff >= l) stop(np > 0 ? "n * diff needs to be < length(x)" : "abs(n * diff) needs to be < length(x)");
+    } else if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
+    for(int q = 0; q != ds; ++q) {
+      if(names) {
+        if(np == 1) colnam[pos] = stub + diffc[q];
+        else if(np == -1) colnam[pos] = stub2 + diffc[q];
+        else if(np > 0) colnam[pos] = "L" + nc[p] + stub + diffc[q];
+        else colnam[pos] = "F" + nc[p] + stub + diffc[q];
       }
+      pout[p*ds+q] = out.begin() + (size_t)pos * l;
+      ++pos;
+    }
+  }
 
-      for(int p = 0; p != ns; ++p) {
-        int np = n[p];
-        if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
-        if(np>0) { // Positive lagged and iterated differences
-          int d1 = diff[0];
-          bool L1 = np == 1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          NumericMatrix::Column outp = out( _ , pos);
-          if(names) {
-            if(L1) colnam[pos] = stub + diffc[0];
-            else colnam[pos] = "L" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          if(regular) {
-            for(int i = 0; i != l; ++i) {
-              if(ord2[i] >= np) {
-                outp[i] = FUN(x[i], x[omap[cgs[g[i]]+ord2[i]-np]]);
-              } else {
-                outp[i] = fill;
-              }
-            }
-          } else {
-            for(int i = 0; i != l; ++i) {
-              if(ord2[i] >= np && (temp = omap[cgs[g[i]]+ord2[i]-np])) {
-                outp[i] = FUN(x[i], x[temp-1]);
-              } else {
-                outp[i] = fill;
-              }
-            }
-          }
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int start = np*(k+1);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            for(int i = l; i--; ) {
-              if(seen[g[omap[i]]] == max[g[omap[i]]]-start) outp[omap[i]] = fill;
-              else {
-                outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-                ++seen[g[omap[i]]];
-              }
-            }
-          }
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1];
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int start = np*(k+1);
-                std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                for(int i = l; i--; ) {
-                  if(seen[g[omap[i]]] == max[g[omap[i]]]-start) outtemp[omap[i]] = fill;
-                  else {
-                    outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                    ++seen[g[omap[i]]];
-                  }
-                }
-              }
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(L1) colnam[pos] = stub + diffc[q];
-                else colnam[pos] = "L" + nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else if(np<0) { // (Negative) leaded and iterated differences
-          int d1 = diff[0];
-          bool F1 = np == -1;
-          if(d1 < 1) stop("diff must be a vector of integers > 0");
-          NumericMatrix::Column outp = out( _ , pos);
-          if(names) {
-            if(F1) colnam[pos] = stub2 + diffc[0];
-            else colnam[pos] = "F" + nc[p] + stub + diffc[0];
-          }
-          ++pos;
-          if(regular) {
-            for(int i = 0; i != l; ++i) {
-              if(ord2[i] < max[g[i]]+np) {
-                outp[i] = FUN(x[i], x[omap[cgs[g[i]]+ord2[i]-np]]);
-              } else {
-                outp[i] = fill;
-              }
-            }
-          } else {
-            for(int i = 0; i != l; ++i) { // Smarter solution using while ???
-              if(ord2[i] < max[g[i]]+np && (temp = omap[cgs[g[i]]+ord2[i]-np])) {
-                outp[i] = FUN(x[i], x[temp-1]);
-              } else {
-                outp[i] = fill;
-              }
-            }
-          }
-          if(d1 > 1) for(int k = 1; k != d1; ++k) {
-            int start = np*(k+1);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            for(int i = 0; i != l; ++i) {
-              if(seen[g[omap[i]]] == max[g[omap[i]]]+start) outp[omap[i]] = fill;
-              else {
-                outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-                ++seen[g[omap[i]]];
-              }
-            }
-          }
-          if(ds > 1) {
-            NumericVector outtemp = outp;
-            for(int q = 1; q != ds; ++q) {
-              int dq = diff[q], L_dq = diff[q-1];
-              if(dq <= L_dq) stop("differences must be passed in ascending order");
-              for(int k = L_dq; k != dq; ++k) {
-                int start = np*(k+1);
-                std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                for(int i = 0; i != l; ++i) {
-                  if(seen[g[omap[i]]] == max[g[omap[i]]]+start) outtemp[omap[i]] = fill;
-                  else {
-                    outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                    ++seen[g[omap[i]]];
-                  }
-                }
-              }
-              out( _ , pos) = outtemp;
-              if(names) {
-                if(F1) colnam[pos] = stub2 + diffc[q];
-                else colnam[pos] = "F"+ nc[p] + stub + diffc[q];
-              }
-              ++pos;
-            }
-          }
-        } else {
-          out( _ , pos) = x;
-          if(names) colnam[pos] = "--";
-          ++pos;
-        }
+  if(ns != zeros) {
+    IntegerVector omap;
+    std::unique_ptr<LagLeadIndex> lidx;
+    if(!Rf_isNull(t)) { // Unordered data: Timevar provided
+      omap = regularOrder(ng, g, t, l);
+      if(omap.size() == 0) {
+        if(maxdiff > 1) stop(ng == 0 ? "Iterations are currently only supported for regular time series. See ?seqid to identify the regular sequences in your time series, or just apply this function multiple times." :
+                                       "Iterations are currently only supported for regular panels. See ?seqid to identify the regular sequences in your panel, or just apply this function multiple times.");
+        lidx.reset(new LagLeadIndex(n, ng, g, t, l, false));
       }
     }
+    fdiffgrowthColumn(pout.data(), x.begin(), omap.size() ? omap.begin() : NULL, lidx.get(),
+                      ng > 0 ? g.begin() : NULL, l, n, diff, fill, FUN);
   }
-  // Previous Version
-  // if(ncol == 1) SHALLOW_DUPLICATE_ATTRIB(out, x);
-  // else if(names) out.attr("dimnames") = List::create(x.attr("names"), colnam);
 
   SHALLOW_DUPLICATE_ATTRIB(out, x);
   if(ncol != 1) {
@@ -630,548 +266,59 @@ NumericMatrix fdiffgrowthmCppImpl(const NumericMatrix& x, const IntegerVector& n
   pos = 0;
   std::string stub2 = names ? "F" + stub : "";
 
-  int ncol = ((ns-zeros)*ds+zeros)*col;
+  int ncol = ((ns-zeros)*ds+zeros)*col, maxdiff = zeros == ns ? 1 : checkDiff(diff);
   NumericMatrix out = no_init_matrix(l, ncol);
   CharacterVector colnam = names ? no_init_vector(ncol) : no_init_vector(1);
   CharacterVector nc = names ? Rf_coerceVector(absn, STRSXP) : NA_STRING;
   CharacterVector diffc = names ? Rf_coerceVector(diff, STRSXP) : NA_STRING;
   CharacterVector coln = names ? coln_check(colnames(x)) : NA_STRING;
   if(names && coln[0] == NA_STRING) names = false;
+  if(ng > 0 && l != g.size()) stop("nrow(x) must match length(g)");
+  int ags = ng > 0 ? l/ng : 0;
+
+  for(int p = 0; p != ns; ++p) {
+    if(n[p] == 0) continue;
+    if(ng == 0) {
+      if(absn[p]*maxdiff >= l) stop(n[p] > 0 ? "n * diff needs to be < nrow(x)" : "abs(n * diff) needs to be < nrow(x)");
+    } else if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
+  }
 
-  if(ng == 0) { // No groups
-    if(Rf_isNull(t)) { // Ordered data
-      for(int j = 0; j != col; ++j) {
-        NumericMatrix::ConstColumn column = x( _ , j);
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0], end = np*d1;
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end >= l) stop("n * diff needs to be < nrow(x)");
-            NumericMatrix::Column outp = out( _ , pos);
-            if(names) {
-              if(L1) colnam[pos] = stub + diffc[0] + "." + coln[j];
-              else colnam[pos] = "L" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            for(int i = np; i != l; ++i) outp[i] = FUN(column[i], column[i - np]);
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1)-1;
-              for(int i = l-1; i != start; --i) outp[i] = FUN(outp[i], outp[i - np]);
-            }
-            for(int i = end; i--; ) outp[i] = fill;
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = np*dq;
-                if(end >= l) stop("n * diff needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1)-1;
-                  for(int i = l-1; i != start; --i) outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                }
-                for(int i = np*L_dq; i != end; ++i) outtemp[i] = fill;
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(L1) colnam[pos] = stub + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "L" + nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0], end = l+np*d1;
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-            NumericMatrix::Column outp = out( _ , pos);
-            if(names) {
-              if(F1) colnam[pos] = stub2 + diffc[0] + "." + coln[j];
-              else colnam[pos] = "F" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            for(int i = l+np; i--; ) outp[i] = FUN(column[i], column[i - np]);
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int final = l+np*(k+1);
-              for(int i = 0; i != final; ++i) outp[i] = FUN(outp[i], outp[i - np]);
-            }
-            for(int i = end; i != l; ++i) outp[i] = fill;
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = l+np*dq, start = l+np*L_dq;
-                if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int final = l+np*(k+1);
-                  for(int i = 0; i != final; ++i) outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                }
-                for(int i = end; i != start; ++i) outtemp[i] = fill;
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(F1) colnam[pos] = stub2 + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else {
-            out( _ , pos) = column;
-            if(names) colnam[pos] = coln[j];
-            ++pos;
-          }
-        }
-      }
-    } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      int min = INT_MAX, max = INT_MIN, osize, temp;
-      for(int i = 0; i != l; ++i) {
-        if(ord[i] < min) min = ord[i];
-        if(ord[i] > max) max = ord[i];
-      }
-      if(min == NA_INTEGER) stop("Timevar contains missing values");
-      osize = max-min+1;
-      bool regular = osize == l;
-      IntegerVector omap(osize), ord2 = regular ? no_init_vector(1) : no_init_vector(l);
-      if(!regular) { // Irregular time series
-        if(osize > 10000000 && osize > 3 * l) warning("Your time series is very irregular. Need to create an internal ordering vector of length %s to represent it.", osize);
-        if(Rcpp::max(diff) > 1) stop("Iterations are currently only supported for regular time series. See ?seqid to identify the regular sequences in your time series, or just apply this function multiple times.");
-        for(int i = 0; i != l; ++i) {
-          temp = ord[i] - min; // Best ? Or direct assign to ord2[i] ? Also check for panel version..
-          if(omap[temp]) stop("Repeated values in timevar");
-          omap[temp] = i+1;
-          ord2[i] = temp;
-        }
-      } else { // Regular time series
-        for(int i = 0; i != l; ++i) {
-          temp = ord[i] - min;
-          if(omap[temp]) stop("Repeated values in timevar");
-          omap[temp] = i;
-        }
-      }
-      for(int j = 0; j != col; ++j) {
-        NumericMatrix::ConstColumn column = x( _ , j);
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0], end = np*d1;
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end >= l) stop("n * diff needs to be < nrow(x)");
-            NumericMatrix::Column outp = out( _ , pos);
-            if(names) {
-              if(L1) colnam[pos] = stub + diffc[0] + "." + coln[j];
-              else colnam[pos] = "L" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            if(regular) {
-              for(int i = np; i != l; ++i) outp[omap[i]] = FUN(column[omap[i]], column[omap[i - np]]);
-            } else {
-              for(int i = 0; i != l; ++i) { // Smarter solution using while ???
-                if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
-                  outp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1)-1;
-              for(int i = l-1; i != start; --i) outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-            }
-            if(regular) for(int i = end; i--; ) outp[omap[i]] = fill;
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = np*dq;
-                if(end >= l) stop("n * diff needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1)-1;
-                  for(int i = l-1; i != start; --i) outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                }
-                for(int i = np*L_dq; i != end; ++i) outtemp[omap[i]] = fill;
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(L1) colnam[pos] = stub + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "L" + nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0], end = l+np*d1;
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-            NumericMatrix::Column outp = out( _ , pos);
-            if(names) {
-              if(F1) colnam[pos] = stub2 + diffc[0] + "." + coln[j];
-              else colnam[pos] = "F" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            if(regular) {
-              for(int i = l+np; i--; ) outp[omap[i]] = FUN(column[omap[i]], column[omap[i - np]]);
-            } else {
-              for(int i = 0, osnp = osize + np; i != l; ++i) { // Smarter solution using while ???
-                if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
-                  outp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int final = l+np*(k+1);
-              for(int i = 0; i != final; ++i) outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-            }
-            if(regular) for(int i = end; i != l; ++i) outp[omap[i]] = fill;
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = l+np*dq, start = l+np*L_dq;
-                if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int final = l+np*(k+1);
-                  for(int i = 0; i != final; ++i) outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                }
-                for(int i = end; i != start; ++i) outtemp[omap[i]] = fill;
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(F1) colnam[pos] = stub2 + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else {
-            out( _ , pos) = column;
-            if(names) colnam[pos] = coln[j];
-            ++pos;
-          }
-        }
-      }
+  IntegerVector omap;
+  std::unique_ptr<LagLeadIndex> lidx;
+  if(ns != zeros && !Rf_isNull(t)) { // Unordered data: Timevar provided
+    omap = regularOrder(ng, g, t, l);
+    if(omap.size() == 0) {
+      if(maxdiff > 1) stop(ng == 0 ? "Iterations are currently only supported for regular time series. See ?seqid to identify the regular sequences in your time series, or just apply this function multiple times." :
+                                     "Iterations are currently only supported for regular panels. See ?seqid to identify the regular sequences in your panel, or just apply this function multiple times.");
+      lidx.reset(new LagLeadIndex(n, ng, g, t, l, col > 1));
     }
-  } else { // With groups
-    if(l != g.size()) stop("nrow(x) must match length(g)");
-    int ags = l/ng, ngp = ng+1, maxdiff = max(diff);
-    if(Rf_isNull(t)) { // Ordered data
-      bool cond = !Rf_isNull(gs);
-      IntegerVector gsv = (cond || maxdiff == 1) ? no_init_vector(1) : IntegerVector(ng);
-      int *pgsv = cond ? INTEGER(gs)-1 : INTEGER(gsv)-1;
-      if(maxdiff != 1) {
-        if(cond) {
-          if(ng != Rf_length(gs)) stop("ng must match length(gs)");
-        } else {
-          for(int i = 0; i != l; ++i) ++pgsv[g[i]];
-        }
-      }
-      // int seen[ngp], memsize = sizeof(int)*(ngp);
-      for(int j = 0; j != col; ++j) {
-        NumericMatrix::ConstColumn column = x( _ , j);
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0];
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericMatrix::Column outp = out( _ , pos);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            if(names) {
-              if(L1) colnam[pos] = stub + diffc[0] + "." + coln[j];
-              else colnam[pos] = "L" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            for(int i = 0; i != l; ++i) {
-              if(seen[g[i]] == np) outp[i] = FUN(column[i], column[i - np]);
-              else {
-                outp[i] = fill;
-                ++seen[g[i]];
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = l; i--; ) {
-                if(seen[g[i]] == pgsv[g[i]]-start) outp[i] = fill;
-                else {
-                  outp[i] = FUN(outp[i], outp[i - np]);
-                  ++seen[g[i]];
-                }
-              }
-            }
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = l; i--; ) {
-                    if(seen[g[i]] == pgsv[g[i]]-start) outtemp[i] = fill;
-                    else {
-                      outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                      ++seen[g[i]];
-                    }
-                  }
-                }
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(L1) colnam[pos] = stub + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "L" + nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0];
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericMatrix::Column outp = out( _ , pos);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            if(names) {
-              if(F1) colnam[pos] = stub2 + diffc[0] + "." + coln[j];
-              else colnam[pos] = "F" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            for(int i = l; i--; ) {
-              if(seen[g[i]] == np) outp[i] = FUN(column[i], column[i - np]);
-              else {
-                outp[i] = fill;
-                --seen[g[i]];
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = 0; i != l; ++i) {
-                if(seen[g[i]] == pgsv[g[i]]+start) outp[i] = fill;
-                else {
-                  outp[i] = FUN(outp[i], outp[i - np]);
-                  ++seen[g[i]];
-                }
-              }
-            }
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = 0; i != l; ++i) {
-                    if(seen[g[i]] == pgsv[g[i]]+start) outtemp[i] = fill;
-                    else {
-                      outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                      ++seen[g[i]];
-                    }
-                  }
-                }
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(F1) colnam[pos] = stub2 + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else {
-            out( _ , pos) = column;
-            if(names) colnam[pos] = coln[j];
-            ++pos;
-          }
-        }
-      }
-    } else { // Unordered data: Timevar Provided
-      IntegerVector ord = t;
-      int temp;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      IntegerVector min(ngp, INT_MAX), max(ngp, INT_MIN), cgs = no_init_vector(ngp);
-      for(int i = 0; i != l; ++i) {
-        temp = g[i];
-        if(ord[i] < min[temp]) min[temp] = ord[i];
-        if(ord[i] > max[temp]) max[temp] = ord[i];
-      }
-      temp = 0;
-      for(int i = 1; i != ngp; ++i) {
-        if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
-        if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
-        cgs[i] = temp; // This needs to b here (for unused factor levels case...)
-        max[i] -= min[i] - 1; // need max[i] which stores the complete group sizes only if p<0 e.g. if computing leads..
-        temp += max[i];
-      }
-      // omap provides the ordering to order the vector (needed to find previous / next values)
-      bool regular = temp == l;
-      IntegerVector omap(temp), ord2 = no_init_vector(l), index = no_init_vector(l);
-      if(!regular) { // Irregular panel
-        if(temp > 10000000 && temp > 3 * l) warning("Your panel is very irregular. Need to create an internal ordering vector of length %s to represent it.", temp);
-        if(maxdiff > 1) stop("Iterations are currently only supported for regular panels. See ?seqid to identify the regular sequences in your panel, or just apply this function multiple times.");
-        for(int i = 0; i != l; ++i) {
-          ord2[i] = ord[i] - min[g[i]];
-          index[i] = cgs[g[i]] + ord2[i];
-          if(omap[index[i]]) stop("Repeated values of timevar within one or more groups");
-          omap[index[i]] = i+1; // needed to add 1 to distinguish between 0 and gap
-        }
-      } else { // Regular panel
-        for(int i = 0; i != l; ++i) {
-          ord2[i] = ord[i] - min[g[i]];
-          index[i] = cgs[g[i]] + ord2[i];
-          if(omap[index[i]]) stop("Repeated values of timevar within one or more groups");
-          omap[index[i]] = i;
-        }
+  }
+  const int *po = omap.size() ? omap.begin() : NULL, *pg = ng > 0 ? g.begin() : NULL;
+
+  std::vector<double*> pout(ns*ds);
+  for(int j = 0; j != col; ++j) {
+    NumericMatrix::ConstColumn column = x( _ , j);
+    for(int p = 0; p != ns; ++p) {
+      int np = n[p];
+      if(np == 0) {
+        out( _ , pos) = column;
+        if(names) colnam[pos] = coln[j];
+        ++pos;
+        continue;
       }
-
-      for(int j = 0; j != col; ++j) {
-        NumericMatrix::ConstColumn column = x( _ , j);
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0];
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericMatrix::Column outp = out( _ , pos);
-            if(names) {
-              if(L1) colnam[pos] = stub + diffc[0] + "." + coln[j];
-              else colnam[pos] = "L" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            if(regular) {
-              for(int i = 0; i != l; ++i) {
-                if(ord2[i] >= np) {
-                  outp[i] = FUN(column[i], column[omap[index[i]-np]]);
-                } else {
-                  outp[i] = fill;
-                }
-              }
-            } else {
-              for(int i = 0; i != l; ++i) {
-                if(ord2[i] >= np && (temp = omap[index[i]-np])) {
-                  outp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = l; i--; ) {
-                if(seen[g[omap[i]]] == max[g[omap[i]]]-start) outp[omap[i]] = fill;
-                else {
-                  outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-                  ++seen[g[omap[i]]];
-                }
-              }
-            }
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = l; i--; ) {
-                    if(seen[g[omap[i]]] == max[g[omap[i]]]-start) outtemp[omap[i]] = fill;
-                    else {
-                      outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                      ++seen[g[omap[i]]];
-                    }
-                  }
-                }
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(L1) colnam[pos] = stub + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "L" + nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0];
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericMatrix::Column outp = out( _ , pos);
-            if(names) {
-              if(F1) colnam[pos] = stub2 + diffc[0] + "." + coln[j];
-              else colnam[pos] = "F" + nc[p] + stub + diffc[0] + "." + coln[j];
-            }
-            ++pos;
-            if(regular) {
-              for(int i = 0; i != l; ++i) {
-                if(ord2[i] < max[g[i]]+np) {
-                  outp[i] = FUN(column[i], column[omap[index[i]-np]]);
-                } else {
-                  outp[i] = fill;
-                }
-              }
-            } else {
-              for(int i = 0; i != l; ++i) { // Smarter solution using while ???
-                if(ord2[i] < max[g[i]]+np && (temp = omap[index[i]-np])) {
-                  outp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = 0; i != l; ++i) {
-                if(seen[g[omap[i]]] == max[g[omap[i]]]+start) outp[omap[i]] = fill;
-                else {
-                  outp[omap[i]] = FUN(outp[omap[i]], outp[omap[i - np]]);
-                  ++seen[g[omap[i]]];
-                }
-              }
-            }
-            if(ds > 1) {
-              NumericVector outtemp = outp;
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = 0; i != l; ++i) {
-                    if(seen[g[omap[i]]] == max[g[omap[i]]]+start) outtemp[omap[i]] = fill;
-                    else {
-                      outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                      ++seen[g[omap[i]]];
-                    }
-                  }
-                }
-                out( _ , pos) = outtemp;
-                if(names) {
-                  if(F1) colnam[pos] = stub2 + diffc[q] + "." + coln[j];
-                  else colnam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + coln[j];
-                }
-                ++pos;
-              }
-            }
-          } else {
-            out( _ , pos) = column;
-            if(names) colnam[pos] = coln[j];
-            ++pos;
-          }
+      for(int q = 0; q != ds; ++q) {
+        if(names) {
+          if(np == 1) colnam[pos] = stub + diffc[q] + "." + coln[j];
+          else if(np == -1) colnam[pos] = stub2 + diffc[q] + "." + coln[j];
+          else if(np > 0) colnam[pos] = "L" + nc[p] + stub + diffc[q] + "." + coln[j];
+          else colnam[pos] = "F" + nc[p] + stub + diffc[q] + "." + coln[j];
         }
+        pout[p*ds+q] = out.begin() + (size_t)pos * l;
+        ++pos;
       }
     }
+    if(ns != zeros) fdiffgrowthColumn(pout.data(), x.begin() + (size_t)j * l, po, lidx.get(), pg, l, n, diff, fill, FUN);
   }
-  // Previous Solution:
-  // if(names) {
-  //   out.attr("dimnames") = List::create(rownames(x), colnam);
-  // } else {
-  //   if(ns*ds == 1) SHALLOW_DUPLICATE_ATTRIB(out, x);
-  //   // else rownames(out) = rownames(x); // redundant !!
-  // }
 
   SHALLOW_DUPLICATE_ATTRIB(out, x);
   if(ncol != col) Rf_dimgets(out, Dimension(l, ncol));
@@ -1229,7 +376,7 @@ List fdiffgrowthlCppImpl(const List& x, const IntegerVector& n = 1, const Intege
   pos = 0;
   std::string stub2 = names ? "F" + stub : "";
 
-  int ncol = ((ns-zeros)*ds+zeros)*l;
+  int ncol = ((ns-zeros)*ds+zeros)*l, maxdiff = zeros == ns ? 1 : checkDiff(diff);
   List out(ncol);
   CharacterVector nam = names ? no_init_vector(ncol) : no_init_vector(1);
   CharacterVector nc = names ? Rf_coerceVector(absn, STRSXP) : NA_STRING;
@@ -1237,533 +384,56 @@ List fdiffgrowthlCppImpl(const List& x, const IntegerVector& n = 1, const Intege
   CharacterVector na = names ? coln_check(Rf_getAttrib(x, R_NamesSymbol)) : NA_STRING;
   if(names && na[0] == NA_STRING) names = false;
 
-  if(ng == 0) { // No groups
-    if(Rf_isNull(t)) { // Ordered data
-      for(int j = 0; j != l; ++j) {
-        NumericVector column = x[j];
-        int row = column.size();
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0], end = np*d1;
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end >= row) stop("n * diff needs to be < nrow(x)");
-            NumericVector outjp = no_init_vector(row);
-            if(names) {
-              if(L1) nam[pos] = stub + diffc[0] + "." + na[j];
-              else nam[pos] = "L" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            for(int i = np; i != row; ++i) outjp[i] = FUN(column[i], column[i - np]);
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1)-1;
-              for(int i = row-1; i != start; --i) outjp[i] = FUN(outjp[i], outjp[i - np]);
-            }
-            for(int i = end; i--; ) outjp[i] = fill;
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = np*dq;
-                if(end >= row) stop("n * diff needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1)-1;
-                  for(int i = row-1; i != start; --i) outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                }
-                for(int i = np*L_dq; i != end; ++i) outtemp[i] = fill;
-                if(names) {
-                  if(L1) nam[pos] = stub + diffc[q] + "." + na[j];
-                  else nam[pos] = "L" + nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp); // or Rf_copyVector, Rf_shallow_duplicate, Rf_lazy_duplicate  http://mtweb.cs.ucl.ac.uk/mus/bin/install_R/R-3.1.1/src/main/duplicate.c
-              } // https://rlang.r-lib.org/reference/duplicate.html
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0], end = row+np*d1;
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-            NumericVector outjp = no_init_vector(row);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            if(names) {
-              if(F1) nam[pos] = stub2 + diffc[0] + "." + na[j];
-              else nam[pos] = "F" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            for(int i = row+np; i--; ) outjp[i] = FUN(column[i], column[i - np]);
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int final = row+np*(k+1);
-              for(int i = 0; i != final; ++i) outjp[i] = FUN(outjp[i], outjp[i - np]);
-            }
-            for(int i = end; i != row; ++i) outjp[i] = fill;
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = row+np*dq, start = row+np*L_dq;
-                if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int final = row+np*(k+1);
-                  for(int i = 0; i != final; ++i) outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                }
-                for(int i = end; i != start; ++i) outtemp[i] = fill;
-                if(names) {
-                  if(F1) nam[pos] = stub2 + diffc[q] + "." + na[j];
-                  else nam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else {
-            if(names) nam[pos] = na[j];
-            out[pos++] = column;
-          }
-        }
-      }
-    } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
-      int min = INT_MAX, max = INT_MIN, osize, temp, os = ord.size();
-      if(Rf_length(x[0]) != os) stop("length(x) must match length(t)");
-      for(int i = 0; i != os; ++i) {
-        if(ord[i] < min) min = ord[i];
-        if(ord[i] > max) max = ord[i];
-      }
-      if(min == NA_INTEGER) stop("Timevar contains missing values");
-      osize = max-min+1;
-      bool regular = osize == os;
-      IntegerVector omap(osize), ord2 = regular ? no_init_vector(1) : no_init_vector(os);
-      if(!regular) { // Irregular time series
-        if(osize > 10000000 && osize > 3 * os) warning("Your time series is very irregular. Need to create an internal ordering vector of length %s to represent it.", osize);
-        if(Rcpp::max(diff) > 1) stop("Iterations are currently only supported for regular time series. See ?seqid to identify the regular sequences in your time series, or just apply this function multiple times.");
-        for(int i = 0; i != os; ++i) {
-          temp = ord[i] - min; // Best ? Or direct assign to ord2[i] ? Also check for panel version..
-          if(omap[temp]) stop("Repeated values in timevar");
-          omap[temp] = i+1;
-          ord2[i] = temp;
-        }
-      } else { // Regular time series
-        for(int i = 0; i != os; ++i) {
-          temp = ord[i] - min;
-          if(omap[temp]) stop("Repeated values in timevar");
-          omap[temp] = i;
-        }
-      }
+  // With groups or a time variable, all columns need to have the same length gss
+  int gss = ng > 0 ? g.size() : Rf_isNull(t) ? 0 : Rf_length(t), ags = ng > 0 ? gss/ng : 0;
+  if(ng > 0) for(int p = 0; p != ns; ++p) {
+    if(n[p] != 0 && absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
+  }
 
-      for(int j = 0; j != l; ++j) {
-        NumericVector column = x[j];
-        if(os != column.size()) stop("nrow(x) must match length(t)");
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0], end = np*d1;
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end >= os) stop("n * diff needs to be < nrow(x)");
-            NumericVector outjp = no_init_vector(os);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            if(names) {
-              if(L1) nam[pos] = stub + diffc[0] + "." + na[j];
-              else nam[pos] = "L" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            if(regular) {
-              for(int i = np; i != os; ++i) outjp[omap[i]] = FUN(column[omap[i]], column[omap[i - np]]);
-            } else {
-              for(int i = 0; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
-                  outjp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outjp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1)-1;
-              for(int i = os-1; i != start; --i) outjp[omap[i]] = FUN(outjp[omap[i]], outjp[omap[i - np]]);
-            }
-            if(regular) for(int i = end; i--; ) outjp[omap[i]] = fill;
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = np*dq;
-                if(end >= os) stop("n * diff needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1)-1;
-                  for(int i = os-1; i != start; --i) outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                }
-                for(int i = np*L_dq; i != end; ++i) outtemp[omap[i]] = fill;
-                if(names) {
-                  if(L1) nam[pos] = stub + diffc[q] + "." + na[j];
-                  else nam[pos] = "L" + nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0], end = os+np*d1;
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-            NumericVector outjp = no_init_vector(os);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            if(names) {
-              if(F1) nam[pos] = stub2 + diffc[0] + "." + na[j];
-              else nam[pos] = "F" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            if(regular) {
-              for(int i = os+np; i--; ) outjp[omap[i]] = FUN(column[omap[i]], column[omap[i - np]]);
-            } else {
-              for(int i = 0, osnp = osize + np; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
-                  outjp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outjp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int final = os+np*(k+1);
-              for(int i = 0; i != final; ++i) outjp[omap[i]] = FUN(outjp[omap[i]], outjp[omap[i - np]]);
-            }
-            if(regular) for(int i = end; i != os; ++i) outjp[omap[i]] = fill;
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1], end = os+np*dq, start = os+np*L_dq;
-                if(end <= 0) stop("abs(n * diff) needs to be < nrow(x)");
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int final = os+np*(k+1);
-                  for(int i = 0; i != final; ++i) outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                }
-                for(int i = end; i != start; ++i) outtemp[omap[i]] = fill;
-                if(names) {
-                  if(F1) nam[pos] = stub2 + diffc[q] + "." + na[j];
-                  else nam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else {
-            if(names) nam[pos] = na[j];
-            out[pos++] = column;
-          }
-        }
-      }
+  IntegerVector omap;
+  std::unique_ptr<LagLeadIndex> lidx;
+  if(ns != zeros && l > 0 && !Rf_isNull(t)) { // Unordered data: Timevar provided
+    if(Rf_length(x[0]) != gss) stop(ng > 0 ? "nrow(x) must match length(g)" : "length(x) must match length(t)");
+    omap = regularOrder(ng, g, t, gss);
+    if(omap.size() == 0) {
+      if(maxdiff > 1) stop(ng == 0 ? "Iterations are currently only supported for regular time series. See ?seqid to identify the regular sequences in your time series, or just apply this function multiple times." :
+                                     "Iterations are currently only supported for regular panels. See ?seqid to identify the regular sequences in your panel, or just apply this function multiple times.");
+      lidx.reset(new LagLeadIndex(n, ng, g, t, gss, l > 1));
     }
-  } else { // With groups
-    int gss = g.size(), ags = gss/ng, ngp = ng+1, maxdiff = max(diff);
-    if(Rf_isNull(t)) { // Ordered data
-      bool cond = !Rf_isNull(gs);
-      IntegerVector gsv = (cond || maxdiff == 1) ? no_init_vector(1) : IntegerVector(ng);
-      int *pgsv = cond ? INTEGER(gs)-1 : INTEGER(gsv)-1;
-      if(maxdiff != 1) {
-        if(cond) {
-          if(ng != Rf_length(gs)) stop("ng must match length(gs)");
-        } else {
-          for(int i = 0; i != gss; ++i) ++pgsv[g[i]];
-        }
-      }
-      // int seen[ngp], memsize = sizeof(int)*(ngp);
-      for(int j = 0; j != l; ++j) {
-        NumericVector column = x[j];
-        if(gss != column.size()) stop("nrow(x) must match length(g)");
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0];
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericVector outjp = no_init_vector(gss);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            if(names) {
-              if(L1) nam[pos] = stub + diffc[0] + "." + na[j];
-              else nam[pos] = "L" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            for(int i = 0; i != gss; ++i) {
-              if(seen[g[i]] == np) outjp[i] = FUN(column[i], column[i - np]);
-              else {
-                outjp[i] = fill;
-                ++seen[g[i]];
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = gss; i--; ) {
-                if(seen[g[i]] == pgsv[g[i]]-start) outjp[i] = fill;
-                else {
-                  outjp[i] = FUN(outjp[i], outjp[i - np]);
-                  ++seen[g[i]];
-                }
-              }
-            }
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = gss; i--; ) {
-                    if(seen[g[i]] == pgsv[g[i]]-start) outtemp[i] = fill;
-                    else {
-                      outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                      ++seen[g[i]];
-                    }
-                  }
-                }
-                if(names) {
-                  if(L1) nam[pos] = stub + diffc[q] + "." + na[j];
-                  else nam[pos] = "L" + nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0];
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericVector outjp = no_init_vector(gss);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-            if(names) {
-              if(F1) nam[pos] = stub2 + diffc[0] + "." + na[j];
-              else nam[pos] = "F" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            for(int i = gss; i--; ) {
-              if(seen[g[i]] == np) outjp[i] = FUN(column[i], column[i - np]);
-              else {
-                outjp[i] = fill;
-                --seen[g[i]];
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = 0; i != gss; ++i) {
-                if(seen[g[i]] == pgsv[g[i]]+start) outjp[i] = fill;
-                else {
-                  outjp[i] = FUN(outjp[i], outjp[i - np]);
-                  ++seen[g[i]];
-                }
-              }
-            }
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = 0; i != gss; ++i) {
-                    if(seen[g[i]] == pgsv[g[i]]+start) outtemp[i] = fill;
-                    else {
-                      outtemp[i] = FUN(outtemp[i], outtemp[i - np]);
-                      ++seen[g[i]];
-                    }
-                  }
-                }
-                if(names) {
-                  if(F1) nam[pos] = stub2 + diffc[q] + "." + na[j];
-                  else nam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else {
-            if(names) nam[pos] = na[j];
-            out[pos++] = column;
-          }
-        }
-      }
-    } else { // Unordered data: Timevar Provided
-      IntegerVector ord = t;
-      int temp;
-      if(gss != ord.size()) stop("length(x) must match length(t)");
-      IntegerVector min(ngp, INT_MAX), max(ngp, INT_MIN), cgs = no_init_vector(ngp);
-      for(int i = 0; i != gss; ++i) {
-        temp = g[i];
-        if(ord[i] < min[temp]) min[temp] = ord[i];
-        if(ord[i] > max[temp]) max[temp] = ord[i];
-      }
-      temp = 0;
-      for(int i = 1; i != ngp; ++i) {
-        if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
-        if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
-        cgs[i] = temp; // This needs to b here (for unused factor levels case...)
-        max[i] -= min[i] - 1; // need max[i] which stores the complete group sizes only if p<0 e.g. if computing leads..
-        temp += max[i];
-      }
-      // omap provides the ordering to order the vector (needed to find previous / next values)
-      bool regular = temp == gss;
-      IntegerVector omap(temp), ord2 = no_init_vector(gss), index = no_init_vector(gss);
-      if(!regular) { // Irregular panel
-        if(temp > 10000000 && temp > 3 * gss) warning("Your panel is very irregular. Need to create an internal ordering vector of length %s to represent it.", temp);
-        if(maxdiff > 1) stop("Iterations are currently only supported for regular panels. See ?seqid to identify the regular sequences in your panel, or just apply this function multiple times.");
-        for(int i = 0; i != gss; ++i) {
-          ord2[i] = ord[i] - min[g[i]];
-          index[i] = cgs[g[i]] + ord2[i];
-          if(omap[index[i]]) stop("Repeated values of timevar within one or more groups");
-          omap[index[i]] = i+1; // needed to add 1 to distinguish between 0 and gap
-        }
-      } else { // Regular panel
-        for(int i = 0; i != gss; ++i) {
-          ord2[i] = ord[i] - min[g[i]];
-          index[i] = cgs[g[i]] + ord2[i];
-          if(omap[index[i]]) stop("Repeated values of timevar within one or more groups");
-          omap[index[i]] = i;
-        }
+  }
+  const int *po = omap.size() ? omap.begin() : NULL, *pg = ng > 0 ? g.begin() : NULL;
+
+  std::vector<double*> pout(ns*ds);
+  for(int j = 0; j != l; ++j) {
+    NumericVector column = x[j];
+    int row = column.size();
+    if(ng > 0 || !Rf_isNull(t)) {
+      if(gss != row) stop(ng > 0 ? "nrow(x) must match length(g)" : "nrow(x) must match length(t)");
+    }
+    for(int p = 0; p != ns; ++p) {
+      int np = n[p];
+      if(np == 0) {
+        if(names) nam[pos] = na[j];
+        out[pos++] = column;
+        continue;
       }
-
-      for(int j = 0; j != l; ++j) {
-        NumericVector column = x[j];
-        if(gss != column.size()) stop("nrow(x) must match length(g)");
-        for(int p = 0; p != ns; ++p) {
-          int np = n[p];
-          if(absn[p]*maxdiff > ags) warning("abs(n * diff) exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
-          if(np>0) { // Positive lagged and iterated differences
-            int d1 = diff[0];
-            bool L1 = np == 1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericVector outjp = no_init_vector(gss);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            if(names) {
-              if(L1) nam[pos] = stub + diffc[0] + "." + na[j];
-              else nam[pos] = "L" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            if(regular) {
-              for(int i = 0; i != gss; ++i) {
-                if(ord2[i] >= np) {
-                  outjp[i] = FUN(column[i], column[omap[index[i]-np]]);
-                } else {
-                  outjp[i] = fill;
-                }
-              }
-            } else {
-              for(int i = 0; i != gss; ++i) {
-                if(ord2[i] >= np && (temp = omap[index[i]-np])) {
-                  outjp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outjp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = gss; i--; ) {
-                if(seen[g[omap[i]]] == max[g[omap[i]]]-start) outjp[omap[i]] = fill;
-                else {
-                  outjp[omap[i]] = FUN(outjp[omap[i]], outjp[omap[i - np]]);
-                  ++seen[g[omap[i]]];
-                }
-              }
-            }
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = gss; i--; ) {
-                    if(seen[g[omap[i]]] == max[g[omap[i]]]-start) outtemp[omap[i]] = fill;
-                    else {
-                      outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                      ++seen[g[omap[i]]];
-                    }
-                  }
-                }
-                if(names) {
-                  if(L1) nam[pos] = stub + diffc[q] + "." + na[j];
-                  else nam[pos] = "L" + nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else if(np<0) { // (Negative) leaded and iterated differences
-            int d1 = diff[0];
-            bool F1 = np == -1;
-            if(d1 < 1) stop("diff must be a vector of integers > 0");
-            NumericVector outjp = no_init_vector(gss);
-            SHALLOW_DUPLICATE_ATTRIB(outjp, column);
-            if(names) {
-              if(F1) nam[pos] = stub2 + diffc[0] + "." + na[j];
-              else nam[pos] = "F" + nc[p] + stub + diffc[0] + "." + na[j];
-            }
-            if(regular) {
-              for(int i = 0; i != gss; ++i) {
-                if(ord2[i] < max[g[i]]+np) {
-                  outjp[i] = FUN(column[i], column[omap[index[i]-np]]);
-                } else {
-                  outjp[i] = fill;
-                }
-              }
-            } else {
-              for(int i = 0; i != gss; ++i) { // Smarter solution using while ???
-                if(ord2[i] < max[g[i]]+np && (temp = omap[index[i]-np])) {
-                  outjp[i] = FUN(column[i], column[temp-1]);
-                } else {
-                  outjp[i] = fill;
-                }
-              }
-            }
-            if(d1 > 1) for(int k = 1; k != d1; ++k) {
-              int start = np*(k+1);
-              std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-              for(int i = 0; i != gss; ++i) {
-                if(seen[g[omap[i]]] == max[g[omap[i]]]+start) outjp[omap[i]] = fill;
-                else {
-                  outjp[omap[i]] = FUN(outjp[omap[i]], outjp[omap[i - np]]);
-                  ++seen[g[omap[i]]];
-                }
-              }
-            }
-            out[pos++] = outjp;
-            if(ds > 1) {
-              NumericVector outtemp = Rf_shallow_duplicate(outjp);
-              for(int q = 1; q != ds; ++q) {
-                int dq = diff[q], L_dq = diff[q-1];
-                if(dq <= L_dq) stop("differences must be passed in ascending order");
-                for(int k = L_dq; k != dq; ++k) {
-                  int start = np*(k+1);
-                  std::vector<int> seen(ngp); // memset(seen, 0, memsize);
-                  for(int i = 0; i != gss; ++i) {
-                    if(seen[g[omap[i]]] == max[g[omap[i]]]+start) outtemp[omap[i]] = fill;
-                    else {
-                      outtemp[omap[i]] = FUN(outtemp[omap[i]], outtemp[omap[i - np]]);
-                      ++seen[g[omap[i]]];
-                    }
-                  }
-                }
-                if(names) {
-                  if(F1) nam[pos] = stub2 + diffc[q] + "." + na[j];
-                  else nam[pos] = "F"+ nc[p] + stub + diffc[q] + "." + na[j];
-                }
-                out[pos++] = Rf_shallow_duplicate(outtemp);
-              }
-            }
-          } else {
-            if(names) nam[pos] = na[j];
-            out[pos++] = column;
-          }
+      if(ng == 0 && absn[p]*maxdiff >= row) stop(np > 0 ? "n * diff needs to be < nrow(x)" : "abs(n * diff) needs to be < nrow(x)");
+      for(int q = 0; q != ds; ++q) {
+        if(names) {
+          if(np == 1) nam[pos] = stub + diffc[q] + "." + na[j];
+          else if(np == -1) nam[pos] = stub2 + diffc[q] + "." + na[j];
+          else if(np > 0) nam[pos] = "L" + nc[p] + stub + diffc[q] + "." + na[j];
+          else nam[pos] = "F" + nc[p] + stub + diffc[q] + "." + na[j];
         }
+        NumericVector outjp = no_init_vector(row);
+        SHALLOW_DUPLICATE_ATTRIB(outjp, column);
+        pout[p*ds+q] = outjp.begin();
+        out[pos++] = outjp;
       }
     }
+    if(ns != zeros) fdiffgrowthColumn(pout.data(), column.begin(), po, lidx.get(), pg, row, n, diff, fill, FUN);
   }
+
   SHALLOW_DUPLICATE_ATTRIB(out, x);
   if(names) { // best way to code this ?
     Rf_namesgets(out, nam);
@@ -0,0 +1,168 @@
+#include "collapse_c.h"
+
+// Exponentially weighted moving mean and variance: grouped, and with optional (irregular) time variable.
+// The state of each group is the (decayed) sum of weights W and squared weights W2, the weighted mean M, and the
+// weighted sum of squared deviations S, which are updated with West's (1979) weighted incremental algorithm.
+// Decaying all weights by the same factor f = decay^(t_i - t_last) leaves M unchanged and scales W, W2 and S.
+
+static inline double ewm_var(const double W, const double W2, const double S) {
+  const double den = W - W2 / W; // Reliability weights: unbiased estimate
+  return den > 0.0 ? S / den : ISNAN(den) ? den : NA_REAL;
+}
+
+// po (ordering) and pt (time) can be NULL, in which case the data is processed in the order of appearance and
+// time advances by one unit with each observation (including missing values) in a group.
+void fewm_double_impl(double *restrict pout, const double *restrict px, const int ng, const int *restrict pg,
+                      const int *restrict po, const int *restrict pt, const double decay, const int adjust,
+                      const int var, const int narm, const int fill, const int l) {
+  const int ngp = ng+1;
+  double *restrict W = (double*)R_Calloc(4 * ngp, double), *restrict W2 = W + ngp, *restrict M = W2 + ngp, *restrict S = M + ngp;
+  int *restrict tl = (int*)R_Calloc(2 * ngp, int), *restrict tc = tl + ngp;
+
+  for(int k = 0, i, gi, ti; k != l; ++k) {
+    i = po ? po[k]-1 : k;
+    gi = ng ? pg[i] : 0;
+    ti = pt ? pt[i] : ++tc[gi];
+    const double xi = px[i];
+    if(ISNAN(xi)) {
+      if(!narm) pout[i] = W[gi] = M[gi] = S[gi] = NA_REAL; // Propagates to all subsequent values in the group
+      else if(fill && W[gi] != 0.0) pout[i] = var ? ewm_var(W[gi], W2[gi], S[gi]) : M[gi];
+      else pout[i] = xi;
+      continue;
+    }
+    if(W[gi] == 0.0) { // First observation in the group
+      W[gi] = W2[gi] = 1.0;
+      M[gi] = xi;
+      S[gi] = 0.0;
+    } else {
+      const int dt = ti - tl[gi];
+      const double f = dt == 1 ? decay : pow(decay, (double)dt), w = adjust ? 1.0 : 1.0 - f,
+        Wn = W[gi] * f + w, delta = xi - M[gi], mn = M[gi] + delta * w / Wn;
+      S[gi] = S[gi] * f + w * delta * (xi - mn);
+      W2[gi] = W2[gi] * f * f + w * w;
+      W[gi] = Wn;
+      M[gi] = mn;
+    }
+    tl[gi] = ti;
+    pout[i] = var ? ewm_var(W[gi], W2[gi], S[gi]) : M[gi];
+  }
+
+  R_Free(W); R_Free(tl);
+}
+
+// Checks inputs and computes the ordering: returns NULL if no time variable is supplied.
+static int *ewm_setup(SEXP g, SEXP t, const int ng, const int l) {
+  if(ng > 0 && l != length(g)) error("length(g) must match length(x)");
+  if(isNull(t)) return NULL;
+  if(l != length(t)) error("length(x) must match length(t)");
+  if(TYPEOF(t) != INTSXP) error("Internal error: time variable must be integer, please pass it through timeid()");
+  int *po = (int *)R_alloc(l, sizeof(int));
+  switch(order_gt(po, INTEGER(g), INTEGER(t), ng, l)) {
+    case 1: error("Timevar contains missing values");
+    case 2: error(ng ? "Repeated values of timevar within one or more groups" : "Repeated values in timevar");
+  }
+  return po;
+}
+
+static double ewm_decay(SEXP Rdecay) {
+  double decay = asReal(Rdecay);
+  if(ISNAN(decay) || decay < 0.0 || decay >= 1.0) error("alpha must be in (0, 1]");
+  return decay;
+}
+
+// As in TRA(), classed integers (e.g. factors) coerced to double lose their class and levels
+static void ewm_attrib(SEXP out, SEXP x, int coerced) {
+  SHALLOW_DUPLICATE_ATTRIB(out, x);
+  if(coerced && isObject(x)) {
+    classgets(out, R_NilValue);
+    setAttrib(out, R_LevelsSymbol, R_NilValue);
+  }
+}
+
+SEXP fewmaC(SEXP x, SEXP Rng, SEXP g, SEXP t, SEXP Rdecay, SEXP Radjust, SEXP Rvar, SEXP Rnarm, SEXP Rfill) {
+  const int l = length(x), ng = asInteger(Rng), adjust = asLogical(Radjust), var = asLogical(Rvar),
+    narm = asLogical(Rnarm), fill = asLogical(Rfill);
+  if(l < 1) return x;
+  const double decay = ewm_decay(Rdecay);
+  const int *po = ewm_setup(g, t, ng, l), *pt = po ? INTEGER(t) : NULL;
+  int nprotect = 1;
+  if(TYPEOF(x) != REALSXP) {
+    if(TYPEOF(x) != INTSXP && TYPEOF(x) != LGLSXP) error("Unsupported SEXP type: '%s'", type2char(TYPEOF(x)));
+    x = PROTECT(coerceVector(x, REALSXP)); ++nprotect;
+  }
+  SEXP out = PROTECT(allocVector(REALSXP, l));
+  fewm_double_impl(REAL(out), REAL(x), ng, INTEGER(g), po, pt, decay, adjust, var, narm, fill, l);
+  ewm_attrib(out, x, nprotect > 1);
+  UNPROTECT(nprotect);
+  return out;
+}
+
+SEXP fewmamC(SEXP x, SEXP Rng, SEXP g, SEXP t, SEXP Rdecay, SEXP Radjust, SEXP Rvar, SEXP Rnarm, SEXP Rfill, SEXP Rnthreads) {
+  SEXP dim = getAttrib(x, R_DimSymbol);
+  if(isNull(dim)) error("x is not a matrix");
+  const int l = INTEGER(dim)[0], col = INTEGER(dim)[1], ng = asInteger(Rng), adjust = asLogical(Radjust),
+    var = asLogical(Rvar), narm = asLogical(Rnarm), fill = asLogical(Rfill), *pg = INTEGER(g);
+  int nthreads = asInteger(Rnthreads), nprotect = 1;
+  if(l < 1) return x;
+  if(ng > 0 && l != length(g)) error("length(g) must match nrow(x)");
+  const double decay = ewm_decay(Rdecay);
+  const int *po = ewm_setup(g, t, ng, l), *pt = po ? INTEGER(t) : NULL;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > col) nthreads = col;
+  if((double)l * col < 100000) nthreads = 1; // No gains from multithreading on small data
+  if(TYPEOF(x) != REALSXP) {
+    if(TYPEOF(x) != INTSXP && TYPEOF(x) != LGLSXP) error("Unsupported SEXP type: '%s'", type2char(TYPEOF(x)));
+    x = PROTECT(coerceVector(x, REALSXP)); ++nprotect;
+  }
+  SEXP out = PROTECT(allocVector(REALSXP, (R_xlen_t)l * col));
+  const double *px = REAL(x);
+  double *pout = REAL(out);
+  if(nthreads <= 1) {
+    for(int j = 0; j != col; ++j) fewm_double_impl(pout + j*l, px + j*l, ng, pg, po, pt, decay, adjust, var, narm, fill, l);
+  } else {
+    #pragma omp parallel for num_threads(nthreads)
+    for(int j = 0; j < col; ++j) fewm_double_impl(pout + j*l, px + j*l, ng, pg, po, pt, decay, adjust, var, narm, fill, l);
+  }
+  ewm_attrib(out, x, nprotect > 1);
+  UNPROTECT(nprotect);
+  return out;
+}
+
+SEXP fewmalC(SEXP x, SEXP Rng, SEXP g, SEXP t, SEXP Rdecay, SEXP Radjust, SEXP Rvar, SEXP Rnarm, SEXP Rfill, SEXP Rnthreads) {
+  const int l = length(x), ng = asInteger(Rng), adjust = asLogical(Radjust), var = asLogical(Rvar),
+    narm = asLogical(Rnarm), fill = asLogical(Rfill), *pg = INTEGER(g);
+  int nthreads = asInteger(Rnthreads), nprotect = 1;
+  if(l < 1) return x;
+  const int nrx = length(VECTOR_ELT(x, 0));
+  const double decay = ewm_decay(Rdecay);
+  const int *po = ewm_setup(g, t, ng, nrx), *pt = po ? INTEGER(t) : NULL;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > l) nthreads = l;
+  if((double)nrx * l < 100000) nthreads = 1;
+
+  SEXP out = PROTECT(allocVector(VECSXP, l)), *restrict pout = SEXPPTR(out);
+  const SEXP *restrict px = SEXPPTR_RO(x);
+  // Coercion and allocation are not thread safe, so they happen before the parallel loop
+  for(int j = 0, dup = 0; j != l; ++j) {
+    SEXP xj = px[j];
+    const int coerced = TYPEOF(xj) != REALSXP;
+    if(length(xj) != nrx) error("All columns of x need to have the same length");
+    if(coerced) {
+      if(TYPEOF(xj) != INTSXP && TYPEOF(xj) != LGLSXP) error("Unsupported SEXP type: '%s'", type2char(TYPEOF(xj)));
+      if(dup == 0) {x = PROTECT(shallow_duplicate(x)); ++nprotect; dup = 1;}
+      SET_VECTOR_ELT(x, j, coerceVector(xj, REALSXP));
+      px = SEXPPTR_RO(x);
+    }
+    SET_VECTOR_ELT(out, j, allocVector(REALSXP, nrx));
+    ewm_attrib(pout[j], px[j], coerced);
+  }
+  if(nthreads <= 1) {
+    for(int j = 0; j != l; ++j) fewm_double_impl(REAL(pout[j]), REAL(px[j]), ng, pg, po, pt, decay, adjust, var, narm, fill, nrx);
+  } else {
+    #pragma omp parallel for num_threads(nthreads)
+    for(int j = 0; j < l; ++j) fewm_double_impl(REAL(pout[j]), REAL(px[j]), ng, pg, po, pt, decay, adjust, var, narm, fill, nrx);
+  }
+  SHALLOW_DUPLICATE_ATTRIB(out, x);
+  UNPROTECT(nprotect);
+  return out;
+}
@@ -0,0 +1,277 @@
+#include "collapse_c.h"
+#include <float.h>
+
+/*
+ Higher-dimensional (weighted) centering by alternating projections, for fhdwithin() / fhdbetween() with more than one
+ factor or with factor-specific slopes. Each factor (fixed effect) k defines a block of d_k regressors per group: the
+ intercept (unless the slope flag is negative) and |slope.flag[k]| interacted slope variables. Projecting a column on a
+ block is a grouped weighted mean (as in fwithin()) if d_k = 1, and otherwise a small least squares problem per group,
+ solved with Cholesky factors of the per-group cross-product matrices computed once upfront (collinear regressors within
+ a group are dropped). A sweep projects the residuals on all blocks in turn (method of alternating projections), and
+ sweeps are accelerated with the Irons-Tuck (1969) extrapolation step. Columns are distributed across threads.
+*/
+
+typedef struct {
+  const int *pg;      // 1-based group codes
+  const double **z;   // slope variables
+  double *G;          // d = 1 and intercept: inverse group weights, otherwise lower Cholesky factor per group (d x d)
+  int ng, a, s, d;    // groups, intercept (0/1), number of slopes, a + s
+} hdfe;
+
+#define HD_COLLIN 1e-10
+
+// Cross-products of the regressors of each group of factor fe, factorized in place
+static void hdfe_prep(hdfe *fe, const double *pw, const int l) {
+  const int ng = fe->ng, d = fe->d, a = fe->a, *pg = fe->pg;
+  const double **z = fe->z;
+  if(d == 1 && a) {
+    double *restrict sw = fe->G;
+    if(pw) for(int i = 0; i < l; ++i) sw[pg[i]-1] += pw[i];
+    else for(int i = 0; i < l; ++i) sw[pg[i]-1] += 1.0;
+    for(int g = 0; g < ng; ++g) sw[g] = sw[g] > 0.0 ? 1.0 / sw[g] : 0.0;
+    return;
+  }
+  const int dd = d * d;
+  double *restrict G = fe->G, *restrict zi = (double*)R_alloc(d, sizeof(double)), *restrict dg = (double*)R_alloc(d, sizeof(double));
+  if(a) zi[0] = 1.0;
+  for(int i = 0; i < l; ++i) {
+    const double wi = pw ? pw[i] : 1.0;
+    double *restrict Gg = G + (size_t)(pg[i]-1) * dd;
+    for(int p = a; p < d; ++p) zi[p] = z[p-a][i];
+    for(int p = 0; p < d; ++p) {
+      const double wz = wi * zi[p];
+      for(int q = 0; q <= p; ++q) Gg[p*d + q] += wz * zi[q];
+    }
+  }
+  // Cholesky factorization G = L L' per group, zeroing the rows/columns of regressors that are collinear with previous ones
+  for(int g = 0; g < ng; ++g) {
+    double *restrict L = G + (size_t)g * dd;
+    for(int j = 0; j < d; ++j) dg[j] = L[j*d + j];
+    for(int j = 0; j < d; ++j) {
+      double v = L[j*d + j];
+      for(int k = 0; k < j; ++k) v -= L[j*d + k] * L[j*d + k];
+      if(!(dg[j] > 0.0) || v <= HD_COLLIN * dg[j]) {
+        for(int k = 0; k < d; ++k) L[j*d + k] = L[k*d + j] = 0.0;
+        continue;
+      }
+      L[j*d + j] = v = sqrt(v);
+      for(int i = j + 1; i < d; ++i) {
+        double u = L[i*d + j];
+        for(int k = 0; k < j; ++k) u -= L[i*d + k] * L[j*d + k];
+        L[i*d + j] = u / v;
+      }
+    }
+  }
+}
+
+// Replaces r by the residuals from projecting it on the regressors of factor fe, buf has size ng * d
+static void hdfe_project(double *restrict r, double *restrict buf, const hdfe *fe, const double *restrict pw, const int l) {
+  const int ng = fe->ng, d = fe->d, a = fe->a, s = fe->s, *restrict pg = fe->pg;
+  const double **z = fe->z, *restrict G = fe->G;
+  memset(buf, 0, (size_t)ng * d * sizeof(double));
+  if(d == 1 && a) { // Grouped (weighted) mean
+    if(pw) for(int i = 0; i < l; ++i) buf[pg[i]-1] += pw[i] * r[i];
+    else for(int i = 0; i < l; ++i) buf[pg[i]-1] += r[i];
+    for(int g = 0; g < ng; ++g) buf[g] *= G[g];
+    for(int i = 0; i < l; ++i) r[i] -= buf[pg[i]-1];
+    return;
+  }
+  for(int i = 0; i < l; ++i) {
+    double *restrict b = buf + (size_t)(pg[i]-1) * d;
+    const double wr = pw ? pw[i] * r[i] : r[i];
+    if(a) b[0] += wr;
+    for(int k = 0; k < s; ++k) b[a+k] += wr * z[k][i];
+  }
+  const int dd = d * d;
+  for(int g = 0; g < ng; ++g) { // Solve L L' c = b
+    const double *restrict L = G + (size_t)g * dd;
+    double *restrict b = buf + (size_t)g * d;
+    for(int j = 0; j < d; ++j) {
+      if(L[j*d + j] == 0.0) {
+        b[j] = 0.0;
+        continue;
+      }
+      double u = b[j];
+      for(int k = 0; k < j; ++k) u -= L[j*d + k] * b[k];
+      b[j] = u / L[j*d + j];
+    }
+    for(int j = d; j--; ) {
+      if(L[j*d + j] == 0.0) continue;
+      double u = b[j];
+      for(int i = j + 1; i < d; ++i) u -= L[i*d + j] * b[i];
+      b[j] = u / L[j*d + j];
+    }
+  }
+  for(int i = 0; i < l; ++i) {
+    const double *restrict b = buf + (size_t)(pg[i]-1) * d;
+    double v = a ? b[0] : 0.0;
+    for(int k = 0; k < s; ++k) v += b[a+k] * z[k][i];
+    r[i] -= v;
+  }
+}
+
+static inline void hdfe_sweep(double *restrict r, double *restrict buf, const hdfe *fes, const int K, const double *restrict pw, const int l) {
+  for(int k = 0; k < K; ++k) hdfe_project(r, buf, fes + k, pw, l);
+}
+
+// Centers x (length l) in place, returns the number of iterations, or 0 if not converged. GX and GGX are buffers of length l.
+static int hdfe_center(double *restrict x, double *restrict GX, double *restrict GGX, double *restrict buf, const hdfe *fes,
+                       const int K, const double *restrict pw, const int l, const double tol, const int iter) {
+  hdfe_sweep(x, buf, fes, K, pw, l);
+  if(K == 1) return 1; // A single block is projected out exactly
+  double ss = 0.0, dss_prev = DBL_MAX;
+  for(int i = 0; i < l; ++i) ss += x[i] * x[i];
+  if(ss == 0.0) return 1;
+  const double crit = tol * tol * ss;
+  for(int it = 1; it <= iter; ++it) {
+    memcpy(GX, x, l * sizeof(double));
+    hdfe_sweep(GX, buf, fes, K, pw, l);
+    // Convergence: the change from a plain sweep is small relative to the sum of squares after the first sweep
+    double dss = 0.0;
+    for(int i = 0; i < l; ++i) dss += (GX[i] - x[i]) * (GX[i] - x[i]);
+    if(dss <= crit) {
+      memcpy(x, GX, l * sizeof(double));
+      return it;
+    }
+    memcpy(GGX, GX, l * sizeof(double));
+    hdfe_sweep(GGX, buf, fes, K, pw, l);
+    // Irons-Tuck: x <- GGX - (d1'd2 / d2'd2) * d1, with d1 = GGX - GX and d2 = GGX - 2 GX + x. If the previous
+    // extrapolation did not reduce the change of a sweep, a plain step (x <- GGX) is taken instead.
+    double num = 0.0, den = 0.0;
+    if(dss < dss_prev) {
+      for(int i = 0; i < l; ++i) {
+        const double d1 = GGX[i] - GX[i], d2 = d1 - GX[i] + x[i];
+        num += d1 * d2;
+        den += d2 * d2;
+      }
+    }
+    dss_prev = dss;
+    const double c = den > 0.0 ? num / den : 0.0;
+    for(int i = 0; i < l; ++i) x[i] = GGX[i] - c * (GGX[i] - GX[i]);
+  }
+  return 0;
+}
+
+// x: numeric vector, matrix or list of columns, fl: list of factors, slvars: list of slope variables (or NULL), slflag:
+// integer vector of length(fl) giving the number of slope variables of each factor (negative: without the intercept)
+SEXP fhdwithinC(SEXP x, SEXP fl, SEXP slvars, SEXP slflag, SEXP w, SEXP Rtol, SEXP Riter, SEXP Rnthreads) {
+  const int K = length(fl), islist = TYPEOF(x) == VECSXP, iter = asInteger(Riter);
+  const double tol = asReal(Rtol);
+  int nthreads = asInteger(Rnthreads), nprotect = 1, l, ncol;
+  if(TYPEOF(fl) != VECSXP || K == 0) error("fl must be a non-empty list of factors");
+  l = length(VECTOR_ELT(fl, 0));
+  if(islist) {
+    ncol = length(x);
+    for(int j = 0; j < ncol; ++j) if(length(VECTOR_ELT(x, j)) != l) error("NROW(x) must match length(fl[[1]])");
+  } else {
+    ncol = isMatrix(x) ? ncols(x) : 1;
+    if((isMatrix(x) ? nrows(x) : length(x)) != l) error("NROW(x) must match length(fl[[1]])");
+  }
+
+  const double *pw = NULL;
+  if(!isNull(w)) {
+    if(length(w) != l) error("length(w) must match length(fl[[1]])");
+    if(TYPEOF(w) != REALSXP) {
+      if(!(TYPEOF(w) == INTSXP || TYPEOF(w) == LGLSXP)) error("weights need to be double or integer/logical (internally coerced to double)");
+      w = PROTECT(coerceVector(w, REALSXP)); ++nprotect;
+    }
+    pw = REAL(w);
+  }
+
+  int nsl = 0;
+  const int *pflag = NULL;
+  if(!isNull(slflag)) {
+    if(length(slflag) != K) error("length(slope.flag) must match length(fl)");
+    if(TYPEOF(slflag) != INTSXP) {
+      slflag = PROTECT(coerceVector(slflag, INTSXP)); ++nprotect;
+    }
+    pflag = INTEGER(slflag);
+    for(int k = 0; k < K; ++k) nsl += abs(pflag[k]);
+  }
+  if(nsl != (isNull(slvars) ? 0 : length(slvars))) error("The number of slope variables does not match sum(abs(slope.flag))");
+  SEXP prot = PROTECT(allocVector(VECSXP, nsl + (islist ? ncol : 1)));
+
+  // Setup of the factors
+  hdfe *fes = (hdfe*)R_alloc(K, sizeof(hdfe));
+  size_t maxbuf = 1;
+  for(int k = 0, sl = 0; k < K; ++k) {
+    SEXP f = VECTOR_ELT(fl, k);
+    hdfe *fe = fes + k;
+    if(TYPEOF(f) != INTSXP || length(f) != l) error("fl must be a list of factors of equal length");
+    fe->pg = INTEGER(f);
+    fe->ng = isFactor(f) ? nlevels(f) : 0;
+    for(int i = 0, ng = fe->ng; i < l; ++i) {
+      if(fe->pg[i] == NA_INTEGER) error("fl must not contain missing values");
+      if(fe->pg[i] > ng) ng = fe->ng = fe->pg[i]; // Integer codes without levels
+      if(fe->pg[i] < 1) error("fl must be a list of factors or positive integer codes");
+    }
+    fe->s = pflag ? abs(pflag[k]) : 0;
+    fe->a = pflag ? pflag[k] >= 0 : 1;
+    fe->d = fe->a + fe->s;
+    fe->z = (const double**)R_alloc(fe->s > 0 ? fe->s : 1, sizeof(double*));
+    for(int j = 0; j < fe->s; ++j, ++sl) {
+      SEXP zj = VECTOR_ELT(slvars, sl);
+      if(length(zj) != l) error("slope variables must have the same length as the factors");
+      if(TYPEOF(zj) != REALSXP) {
+        if(!(TYPEOF(zj) == INTSXP || TYPEOF(zj) == LGLSXP)) error("slope variables must be numeric");
+        SET_VECTOR_ELT(prot, sl, zj = coerceVector(zj, REALSXP));
+      }
+      fe->z[j] = REAL(zj);
+    }
+    const size_t gsize = (size_t)fe->ng * (fe->d == 1 && fe->a ? 1 : fe->d * fe->d);
+    fe->G = (double*)R_alloc(gsize > 0 ? gsize : 1, sizeof(double));
+    memset(fe->G, 0, gsize * sizeof(double));
+    hdfe_prep(fe, pw, l);
+    if((size_t)fe->ng * fe->d > maxbuf) maxbuf = (size_t)fe->ng * fe->d;
+  }
+
+  // Result: a copy of x (as double) that is centered in place
+  SEXP res;
+  double **cols = (double**)R_alloc(ncol > 0 ? ncol : 1, sizeof(double*));
+  if(islist) {
+    res = PROTECT(allocVector(VECSXP, ncol)); ++nprotect;
+    for(int j = 0; j < ncol; ++j) {
+      SEXP xj = VECTOR_ELT(x, j);
+      if(!(TYPEOF(xj) == REALSXP || TYPEOF(xj) == INTSXP || TYPEOF(xj) == LGLSXP)) error("x needs to be numeric");
+      SET_VECTOR_ELT(res, j, TYPEOF(xj) == REALSXP ? duplicate(xj) : coerceVector(xj, REALSXP));
+      SEXP rj = VECTOR_ELT(res, j);
+      if(ATTRIB(rj) != R_NilValue) SET_ATTRIB(rj, R_NilValue);
+      cols[j] = REAL(rj);
+    }
+  } else {
+    if(!(TYPEOF(x) == REALSXP || TYPEOF(x) == INTSXP || TYPEOF(x) == LGLSXP)) error("x needs to be numeric");
+    res = PROTECT(TYPEOF(x) == REALSXP ? duplicate(x) : coerceVector(x, REALSXP)); ++nprotect;
+    for(int j = 0; j < ncol; ++j) cols[j] = REAL(res) + (size_t)j * l;
+  }
+
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > ncol) nthreads = ncol;
+  if(nthreads < 1) nthreads = 1;
+  int nonconv = 0;
+
+  #pragma omp parallel num_threads(nthreads) reduction(+:nonconv)
+  {
+    double *restrict GX = (double*)R_Calloc(2 * (size_t)l + maxbuf, double), *restrict GGX = GX + l, *restrict buf = GGX + l;
+    #pragma omp for schedule(dynamic)
+    for(int j = 0; j < ncol; ++j) {
+      double *restrict pr = cols[j];
+      int anyNA = 0;
+      for(int i = 0; i < l; ++i) if(ISNAN(pr[i])) {
+        anyNA = 1;
+        break;
+      }
+      if(anyNA) { // Data should be complete: missing values would spread through all groups in the sweeps
+        for(int i = 0; i < l; ++i) pr[i] = NA_REAL;
+        continue;
+      }
+      if(!hdfe_center(pr, GX, GGX, buf, fes, K, pw, l, tol, iter)) ++nonconv;
+    }
+    R_Free(GX);
+  }
+  if(nonconv) warning("Centering did not converge within %d iterations for %d column(s). Consider increasing 'iter' or 'tol'.", iter, nonconv);
+
+  UNPROTECT(nprotect);
+  return res;
+}
+
+#undef HD_COLLIN
@@ -1,4 +1,5 @@
 #include <Rcpp/Lighter>
+#include "time_index.h"
 using namespace Rcpp;
 
 LogicalVector intToLogical(IntegerVector x) {
@@ -56,32 +57,17 @@ Vector<RTYPE> flagleadCppImpl(const Vector<RTYPE>& x, const IntegerVector& n, co
         }
       }
     } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      int min = INT_MAX, max = INT_MIN, osize, temp;
-      for(int i = 0; i != l; ++i) {
-        if(ord[i] < min) min = ord[i];
-        if(ord[i] > max) max = ord[i];
-      }
-      if(min == NA_INTEGER) stop("Timevar contains missing values");
-      osize = max-min+1;
-      if(osize > 10000000 && osize > 3 * l) warning("Your time series is very irregular. Need to create an internal ordering vector of length %s to represent it.", osize);
-      IntegerVector omap(osize), ord2 = no_init_vector(l);
-      for(int i = 0; i != l; ++i) {
-        temp = ord[i] - min; // Best ? Or direct assign to ord2[i] ? Also check for panel version..
-        if(omap[temp]) stop("Repeated values in timevar");
-        omap[temp] = i+1;
-        ord2[i] = temp;
-      }
-      // return as<Vector<RTYPE> >(omap);
+      LagLeadIndex lidx(n, 0, g, t, l, false);
+      int temp;
       for(int p = ns; p--; ) {
         int np = n[p];
         if(absn[p] > l) stop("lag-length exceeds length of vector");
         MatrixColumn<RTYPE> outp = out( _ , p);
         if(np>0) {
           if(names) colnam[p] = "L" + nc[p];
-          for(int i = 0; i != l; ++i) { // Smarter solution using while ???
-            if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
+          const int *pidx = lidx[p];
+          for(int i = 0; i != l; ++i) {
+            if((temp = pidx[i])) {
               outp[i] = x[temp-1];
             } else {
               outp[i] = ff;
@@ -89,8 +75,9 @@ Vector<RTYPE> flagleadCppImpl(const Vector<RTYPE>& x, const IntegerVector& n, co
           }
         } else if(np<0) {
           if(names) colnam[p] = "F" + nc[p];
-          for(int i = 0, osnp = osize+np; i != l; ++i) { // Smarter solution using while ???
-            if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
+          const int *pidx = lidx[p];
+          for(int i = 0; i != l; ++i) {
+            if((temp = pidx[i])) {
               outp[i] = x[temp-1];
             } else {
               outp[i] = ff;
@@ -139,40 +126,17 @@ Vector<RTYPE> flagleadCppImpl(const Vector<RTYPE>& x, const IntegerVector& n, co
         }
       }
     } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
+      LagLeadIndex lidx(n, ng, g, t, l, false);
       int temp;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      IntegerVector min(ngp, INT_MAX), max(ngp, INT_MIN), cgs = no_init_vector(ngp);
-      for(int i = 0; i != l; ++i) {
-        temp = g[i];
-        if(ord[i] < min[temp]) min[temp] = ord[i];
-        if(ord[i] > max[temp]) max[temp] = ord[i];
-      }
-      temp = 0;
-      for(int i = 1; i != ngp; ++i) {
-        if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
-        if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
-        cgs[i] = temp; // This needs to b here (for unused factor levels case...)
-        max[i] -= min[i] - 1; // need max[i] which stores the complete group sizes only if p<0 e.g. if computing leads..
-        temp += max[i];
-      }
-      // omap provides the ordering to order the vector (needed to find previous / next values)
-      if(temp > 10000000 && temp > 3 * l) warning("Your panel is very irregular. Need to create an internal ordering vector of length %s to represent it.", temp);
-      IntegerVector omap(temp), ord2 = no_init_vector(l);
-      for(int i = 0; i != l; ++i) {
-        ord2[i] = ord[i] - min[g[i]];
-        temp = cgs[g[i]] + ord2[i];
-        if(omap[temp]) stop("Repeated values of timevar within one or more groups");
-        omap[temp] = i+1; // needed to add 1 to distinguish between 0 and gap
-      }
       for(int p = ns; p--; ) {
         int np = n[p];
         if(absn[p] > ags) warning("lag-length exceeds average group-size (%i). This could also be a result of unused factor levels. See #25. Use fdroplevels() to remove unused factor levels from your data.", ags);
         MatrixColumn<RTYPE> outp = out( _ , p);
         if(np>0) {
           if(names) colnam[p] = "L" + nc[p];
+          const int *pidx = lidx[p];
           for(int i = 0; i != l; ++i) {
-            if(ord2[i] >= np && (temp = omap[cgs[g[i]]+ord2[i]-np])) {
+            if((temp = pidx[i])) {
               outp[i] = x[temp-1];
             } else {
               outp[i] = ff;
@@ -180,8 +144,9 @@ Vector<RTYPE> flagleadCppImpl(const Vector<RTYPE>& x, const IntegerVector& n, co
           }
         } else if(np<0) {
           if(names) colnam[p] = "F" + nc[p];
+          const int *pidx = lidx[p];
           for(int i = 0; i != l; ++i) {
-            if(ord2[i] < max[g[i]]+np && (temp = omap[cgs[g[i]]+ord2[i]-np])) {
+            if((temp = pidx[i])) {
               outp[i] = x[temp-1];
             } else {
               outp[i] = ff;
@@ -305,23 +270,8 @@ Matrix<RTYPE> flagleadmCppImpl(const Matrix<RTYPE>& x, const IntegerVector& n, c
         }
       }
     } else { // Unordered data: Timevar Provided
-      IntegerVector ord = t;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      int min = INT_MAX, max = INT_MIN, osize, temp;
-      for(int i = 0; i != l; ++i) {
-        if(ord[i] < min) min = ord[i];
-        if(ord[i] > max) max = ord[i];
-      }
-      if(min == NA_INTEGER) stop("Timevar contains missing values");
-      osize = max-min+1;
-      if(osize > 10000000 && osize > 3 * l) warning("Your time series is very irregular. Need to create an internal ordering vector of length %s to represent it.", osize);
-      IntegerVector omap(osize), ord2 = no_init_vector(l);
-      for(int i = 0; i != l; ++i) {
-        temp = ord[i] - min; // Best ? Or direct assign to ord2[i] ? Also check for panel version..
-        if(omap[temp]) stop("Repeated values in timevar");
-        omap[temp] = i+1;
-        ord2[i] = temp;
-      }
+      LagLeadIndex lidx(n, 0, g, t, l, col > 1);
+      int temp;
       for(int j = 0; j != col; ++j) {
         ConstMatrixColumn<RTYPE> column = x( _ , j);
         for(int p = 0; p != ns; ++p) {
@@ -330,8 +280,9 @@ Matrix<RTYPE> flagleadmCppImpl(const Matrix<RTYPE>& x, const IntegerVector& n, c
           MatrixColumn<RTYPE> outj = out( _ , pos);
           if(np>0) {
             if(names) colnam[pos] = "L" + nc[p] + "." + coln[j];
-            for(int i = 0; i != l; ++i) { // Smarter solution using while ???
-              if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
+            const int *pidx = lidx[p];
+            for(int i = 0; i != l; ++i) {
+              if((temp = pidx[i])) {
                 outj[i] = column[temp-1];
               } else {
                 outj[i] = ff;
@@ -339,8 +290,9 @@ Matrix<RTYPE> flagleadmCppImpl(const Matrix<RTYPE>& x, const IntegerVector& n, c
             }
           } else if(np<0) {
             if(names) colnam[pos] = "F" + nc[p] + "." + coln[j];
-            for(int i = 0, osnp = osize+np; i != l; ++i) { // Smarter solution using while ???
-              if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
+            const int *pidx = lidx[p];
+            for(int i = 0; i != l; ++i) {
+              if((temp = pidx[i])) {
                 outj[i] = column[temp-1];
               } else {
                 outj[i] = ff;
@@ -395,32 +347,8 @@ Matrix<RTYPE> flagleadmCppImpl(const Matrix<RTYPE>& x, const IntegerVector& n, c
         }
       }
     } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
+      LagLeadIndex lidx(n, ng, g, t, l, col > 1);
       int temp;
-      if(l != ord.size()) stop("length(x) must match length(t)");
-      IntegerVector min(ngp, INT_MAX), max(ngp, INT_MIN), cgs = no_init_vector(ngp);
-      for(int i = 0; i != l; ++i) {
-        temp = g[i];
-        if(ord[i] < min[temp]) min[temp] = ord[i];
-        if(ord[i] > max[temp]) max[temp] = ord[i];
-      }
-      temp = 0;
-      for(int i = 1; i != ngp; ++i) {
-        if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
-        if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
-        cgs[i] = temp; // This needs to b here (for unused factor levels case...)
-        max[i] -= min[i] - 1; // need max[i] which stores the complete group sizes only if p<0 e.g. if computing leads..
-        temp += max[i];
-      }
-      // omap provides the ordering to order the vector (needed to find previous / next values)
-      if(temp > 10000000 && temp > 3 * l) warning("Your panel is very irregular. Need to create an internal ordering vector of length %s to represent it.", temp);
-      IntegerVector omap(temp), ord2 = no_init_vector(l), index = no_init_vector(l);
-      for(int i = 0; i != l; ++i) {
-        ord2[i] = ord[i] - min[g[i]];
-        index[i] = cgs[g[i]] + ord2[i];
-        if(omap[index[i]]) stop("Repeated values of timevar within one or more groups");
-        omap[index[i]] = i+1; // needed to add 1 to distinguish between 0 and gap
-      }
       for(int j = 0; j != col; ++j) {
         ConstMatrixColumn<RTYPE> column = x( _ , j);
         for(int p = 0; p != ns; ++p) {
@@ -429,8 +357,9 @@ Matrix<RTYPE> flagleadmCppImpl(const Matrix<RTYPE>& x, const IntegerVector& n, c
           MatrixColumn<RTYPE> outj = out( _ , pos);
           if(np>0) {
             if(names) colnam[pos] = "L" + nc[p] + "." + coln[j];
+            const int *pidx = lidx[p];
             for(int i = 0; i != l; ++i) {
-              if(ord2[i] >= np && (temp = omap[index[i]-np])) {
+              if((temp = pidx[i])) {
                 outj[i] = column[temp-1];
               } else {
                 outj[i] = ff;
@@ -438,8 +367,9 @@ Matrix<RTYPE> flagleadmCppImpl(const Matrix<RTYPE>& x, const IntegerVector& n, c
             }
           } else if(np<0) {
             if(names) colnam[pos] = "F" + nc[p] + "." + coln[j];
-            for(int i = 0; i != l; ++i) { // best loop ??
-              if(ord2[i] < max[g[i]]+np && (temp = omap[index[i]-np])) {
+            const int *pidx = lidx[p];
+            for(int i = 0; i != l; ++i) {
+              if((temp = pidx[i])) {
                 outj[i] = column[temp-1];
               } else {
                 outj[i] = ff;
@@ -625,23 +555,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
         }
       }
     } else { // Unordered data: Timevar Provided
-      IntegerVector ord = t;
-      int min = INT_MAX, max = INT_MIN, osize, temp, os = ord.size();
+      int temp, os = Rf_length(t);
       if(Rf_length(x[0]) != os) stop("nrow(x) must match length(t)");
-      for(int i = 0; i != os; ++i) {
-        if(ord[i] < min) min = ord[i];
-        if(ord[i] > max) max = ord[i];
-      }
-      if(min == NA_INTEGER) stop("Timevar contains missing values");
-      osize = max-min+1;
-      if(osize > 10000000 && osize > 3 * os) warning("Your time series is very irregular. Need to create an internal ordering vector of length %s to represent it.", osize);
-      IntegerVector omap(osize), ord2 = no_init_vector(os);
-      for(int i = 0; i != os; ++i) {
-        temp = ord[i] - min; // Best ? Or direct assign to ord2[i] ? Also check for panel version..
-        if(omap[temp]) stop("Repeated values in timevar");
-        omap[temp] = i+1;
-        ord2[i] = temp;
-      }
+      LagLeadIndex lidx(n, 0, g, t, os, l > 1);
       for(int j = 0; j != l; ++j) {
         int txj = TYPEOF(x[j]);
         switch(txj) {
@@ -655,8 +571,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             if(np>0) {
               NumericVector outjp = no_init_vector(os);
               if(names) nam[pos] = "L" + nc[p] + "." + na[j];
-              for(int i = 0; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != os; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -667,8 +584,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             } else if(np<0) {
               NumericVector outjp = no_init_vector(os);
               if(names) nam[pos] = "F" + nc[p] + "." + na[j];
-              for(int i = 0, osnp = osize+np; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != os; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -695,8 +613,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             if(np>0) {
               IntegerVector outjp = no_init_vector(os);
               if(names) nam[pos] = "L" + nc[p] + "." + na[j];
-              for(int i = 0; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != os; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -707,8 +626,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             } else if(np<0) {
               IntegerVector outjp = no_init_vector(os);
               if(names) nam[pos] = "F" + nc[p] + "." + na[j];
-              for(int i = 0, osnp = osize+np; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != os; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -735,8 +655,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             if(np>0) {
               CharacterVector outjp = no_init_vector(os);
               if(names) nam[pos] = "L" + nc[p] + "." + na[j];
-              for(int i = 0; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] >= np && (temp = omap[ord2[i] - np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != os; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -747,8 +668,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             } else if(np<0) {
               CharacterVector outjp = no_init_vector(os);
               if(names) nam[pos] = "F" + nc[p] + "." + na[j];
-              for(int i = 0, osnp = osize+np; i != os; ++i) { // Smarter solution using while ???
-                if(ord2[i] < osnp && (temp = omap[ord2[i] - np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != os; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -910,41 +832,8 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
         }
       }
     } else { // Unordered data: Timevar provided
-      IntegerVector ord = t;
-      if(gss != ord.size()) stop("length(g) must match length(t)");
-      IntegerVector min(ngp, INT_MAX), max(ngp, INT_MIN), cgs = no_init_vector(ngp);
-      // return List::create(min, max); // Note: INT_MIN is the same as NA_INTEGER
-      for(int i = 0; i != gss; ++i) {
-        temp = g[i];
-        if(ord[i] < min[temp]) min[temp] = ord[i];
-        if(ord[i] > max[temp]) max[temp] = ord[i];
-      }
-      temp = 0;
-      for(int i = 1; i != ngp; ++i) {
-        if(min[i] == NA_INTEGER) stop("Timevar contains missing values");
-        if(min[i] == INT_MAX) continue; // Needed in case of unused factor levels (group vector too large)
-        cgs[i] = temp; // This needs to b here (for unused factor levels case...)
-        max[i] -= min[i] - 1; // need max[i] which stores the complete group sizes only if p<0 e.g. if computing leads..
-        temp += max[i]; // + max[i] - min[i] + 1;
-      }
-      // if(min[ng] == NA_INTEGER) stop("Timevar contains missing values");
-      // if(min[ng] != INT_MAX) {
-      //   max[ng] -= min[ng] - 1;
-      //   temp += max[ng];
-      // }
-      // return List::create(cgs, min, max);
-      // index stores the position of the current observation in the ordered vector
-      // omap provides the ordering to order the vector (needed to find previous / next values)
-      if(temp > 10000000 && temp > 3 * gss) warning("Your panel is very irregular. Need to create an internal ordering vector of length %s to represent it.", temp);
-      IntegerVector omap(temp), ord2 = no_init_vector(gss), index = no_init_vector(gss);
-      for(int i = 0; i != gss; ++i) {
-        ord2[i] = ord[i] - min[g[i]]; // Need ord2 can get rid of any part ?? ??
-        // if(ord2[i] >= gsv[g[i]-1]) stop("Gaps in timevar within one or more groups");
-        index[i] = cgs[g[i]] + ord2[i];
-        if(omap[index[i]]) stop("Repeated values of timevar within one or more groups");
-        omap[index[i]] = i+1; // needed to add 1 to distinguish between 0 and gap
-      }
-      // return List::create(cgs, min, max, ord2, index, omap);
+      if(gss != Rf_length(t)) stop("length(g) must match length(t)");
+      LagLeadIndex lidx(n, ng, g, t, gss, l > 1);
       for(int j = 0; j != l; ++j) {
         int txj = TYPEOF(x[j]);
         switch(txj) {
@@ -958,8 +847,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             if(np>0) {
               NumericVector outjp = no_init_vector(gss);
               if(names) nam[pos] = "L" + nc[p] + "." + na[j];
+              const int *pidx = lidx[p];
               for(int i = 0; i != gss; ++i) {
-                if(ord2[i] >= np && (temp = omap[index[i]-np])) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -970,8 +860,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             } else if(np<0) {
               NumericVector outjp = no_init_vector(gss);
               if(names) nam[pos] = "F" + nc[p] + "." + na[j];
-              for(int i = 0; i != gss; ++i) { // best loop ??
-                if(ord2[i] < max[g[i]]+np && (temp = omap[index[i]-np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != gss; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -998,8 +889,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             if(np>0) {
               IntegerVector outjp = no_init_vector(gss);
               if(names) nam[pos] = "L" + nc[p] + "." + na[j];
+              const int *pidx = lidx[p];
               for(int i = 0; i != gss; ++i) {
-                if(ord2[i] >= np && (temp = omap[index[i]-np])) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -1010,8 +902,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             } else if(np<0) {
               IntegerVector outjp = no_init_vector(gss);
               if(names) nam[pos] = "F" + nc[p] + "." + na[j];
-              for(int i = 0; i != gss; ++i) { // best loop ??
-                if(ord2[i] < max[g[i]]+np && (temp = omap[index[i]-np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != gss; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -1038,8 +931,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             if(np>0) {
               CharacterVector outjp = no_init_vector(gss);
               if(names) nam[pos] = "L" + nc[p] + "." + na[j];
+              const int *pidx = lidx[p];
               for(int i = 0; i != gss; ++i) {
-                if(ord2[i] >= np && (temp = omap[index[i]-np])) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
@@ -1050,8 +944,9 @@ List flagleadlCpp(const List& x, const IntegerVector& n = 1, const SEXP& fill =
             } else if(np<0) {
               CharacterVector outjp = no_init_vector(gss);
               if(names) nam[pos] = "F" + nc[p] + "." + na[j];
-              for(int i = 0; i != gss; ++i) { // best loop ??
-                if(ord2[i] < max[g[i]]+np && (temp = omap[index[i]-np])) {
+              const int *pidx = lidx[p];
+              for(int i = 0; i != gss; ++i) {
+                if((temp = pidx[i])) {
                   outjp[i] = column[temp-1];
                 } else {
                   outjp[i] = ff;
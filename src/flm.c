@@ -0,0 +1,320 @@
+#include "collapse_c.h"
+
+/*
+ Weighted least squares via the normal equations, for flm(method = "chol") and flmres(). X'WX and X'WY (for any number
+ of right-hand sides) are accumulated in a single pass over blocks of FLM_BLOCK rows: with weights, the weighted columns
+ of a block are formed in a small per-thread buffer (rather than materializing X * sqrt(w)), and all cross-products of
+ the block are computed while it is in cache. Row chunks are processed by different threads and their cross-products
+ summed. The system is solved with a Cholesky factorization of X'WX. If X is (numerically) rank deficient, R_NilValue is
+ returned, and the R side falls back to the pivoted QR decomposition.
+*/
+
+#define FLM_BLOCK 256
+#define FLM_TOL 1e-9 // Minimum ratio of a Cholesky pivot to the corresponding diagonal element of X'WX
+
+// Adds the cross-products of rows [start, end) to XX (p x p, upper triangle) and XY (p x q)
+static void flm_cross(double *restrict XX, double *restrict XY, double *restrict buf, const double *restrict px, const double **py,
+                      const double *restrict pw, const int n, const int p, const int q, const int start, const int end) {
+  for(int r0 = start; r0 < end; r0 += FLM_BLOCK) {
+    const int r = end - r0 < FLM_BLOCK ? end - r0 : FLM_BLOCK;
+    if(pw) {
+      for(int j = 0; j < p; ++j) {
+        const double *restrict xj = px + (size_t)j*n + r0, *restrict wj = pw + r0;
+        double *restrict bj = buf + (size_t)j*FLM_BLOCK;
+        #pragma omp simd
+        for(int i = 0; i < r; ++i) bj[i] = wj[i] * xj[i];
+      }
+    }
+    for(int j = 0; j < p; ++j) {
+      const double *restrict xwj = pw ? buf + (size_t)j*FLM_BLOCK : px + (size_t)j*n + r0;
+      for(int k = j; k < p; ++k) {
+        const double *restrict xk = px + (size_t)k*n + r0;
+        double s = 0.0;
+        #pragma omp simd reduction(+:s)
+        for(int i = 0; i < r; ++i) s += xwj[i] * xk[i];
+        XX[j + (size_t)k*p] += s;
+      }
+      for(int h = 0; h < q; ++h) {
+        const double *restrict yh = py[h] + r0;
+        double s = 0.0;
+        #pragma omp simd reduction(+:s)
+        for(int i = 0; i < r; ++i) s += xwj[i] * yh[i];
+        XY[j + (size_t)h*p] += s;
+      }
+    }
+  }
+}
+
+// In place Cholesky factorization A = R'R of the upper triangle of A (p x p). Returns 0 if A is not (numerically) positive definite.
+static int flm_chol(double *restrict A, const int p) {
+  for(int k = 0; k < p; ++k) {
+    double *restrict ak = A + (size_t)k*p;
+    const double dk = ak[k];
+    for(int j = 0; j < k; ++j) {
+      const double *restrict aj = A + (size_t)j*p;
+      double s = ak[j];
+      for(int i = 0; i < j; ++i) s -= aj[i] * ak[i];
+      ak[j] = s / aj[j];
+    }
+    double v = dk;
+    for(int i = 0; i < k; ++i) v -= ak[i] * ak[i];
+    if(!(v > FLM_TOL * dk)) return 0;
+    ak[k] = sqrt(v);
+  }
+  return 1;
+}
+
+// X: numeric matrix, y: numeric vector, matrix or list of vectors, w: weights or NULL. Returns the p x q coefficient matrix.
+SEXP flmC(SEXP X, SEXP y, SEXP w, SEXP Rnthreads) {
+  if(!isMatrix(X)) error("X must be a matrix");
+  const int n = nrows(X), p = ncols(X);
+  int nthreads = asInteger(Rnthreads), nprotect = 1, q;
+  SEXP prot = PROTECT(allocVector(VECSXP, TYPEOF(y) == VECSXP ? length(y) + 2 : 3));
+  if(TYPEOF(X) != REALSXP) {
+    if(!(TYPEOF(X) == INTSXP || TYPEOF(X) == LGLSXP)) error("X must be numeric");
+    SET_VECTOR_ELT(prot, 0, X = coerceVector(X, REALSXP));
+  }
+  const double *px = REAL(X), *pw = NULL, **py;
+  if(TYPEOF(y) == VECSXP) {
+    q = length(y);
+    py = (const double**)R_alloc(q > 0 ? q : 1, sizeof(double*));
+    for(int h = 0; h < q; ++h) {
+      SEXP yh = VECTOR_ELT(y, h);
+      if(length(yh) != n) error("NROW(y) must match nrow(X)");
+      if(TYPEOF(yh) != REALSXP) {
+        if(!(TYPEOF(yh) == INTSXP || TYPEOF(yh) == LGLSXP)) error("y must be numeric");
+        SET_VECTOR_ELT(prot, h + 2, yh = coerceVector(yh, REALSXP));
+      }
+      py[h] = REAL(yh);
+    }
+  } else {
+    if(TYPEOF(y) != REALSXP) {
+      if(!(TYPEOF(y) == INTSXP || TYPEOF(y) == LGLSXP)) error("y must be numeric");
+      SET_VECTOR_ELT(prot, 2, y = coerceVector(y, REALSXP));
+    }
+    q = isMatrix(y) ? ncols(y) : 1;
+    if((isMatrix(y) ? nrows(y) : length(y)) != n) error("NROW(y) must match nrow(X)");
+    py = (const double**)R_alloc(q > 0 ? q : 1, sizeof(double*));
+    for(int h = 0; h < q; ++h) py[h] = REAL(y) + (size_t)h*n;
+  }
+  if(!isNull(w)) {
+    if(length(w) != n) error("w must be numeric and length(w) == nrow(X)");
+    if(TYPEOF(w) != REALSXP) {
+      if(!(TYPEOF(w) == INTSXP || TYPEOF(w) == LGLSXP)) error("weights need to be double or integer/logical (internally coerced to double)");
+      SET_VECTOR_ELT(prot, 1, w = coerceVector(w, REALSXP));
+    }
+    pw = REAL(w);
+  }
+
+  if(nthreads > max_threads) nthreads = max_threads;
+  if((double)n * p < 100000.0) nthreads = 1;
+  if(nthreads > n / FLM_BLOCK) nthreads = n / FLM_BLOCK;
+  if(nthreads < 1) nthreads = 1;
+
+  // Cross-products of each thread's chunk of rows, summed into the first
+  const size_t pp = (size_t)p*p, pq = (size_t)p*q, size = pp + pq;
+  double *restrict acc = (double*)R_Calloc(size * nthreads, double);
+  const int chunk = (n + nthreads - 1) / nthreads;
+  #pragma omp parallel for num_threads(nthreads)
+  for(int t = 0; t < nthreads; ++t) {
+    double *buf = pw ? (double*)R_Calloc((size_t)FLM_BLOCK * p, double) : NULL;
+    const int start = t * chunk, end = start + chunk < n ? start + chunk : n;
+    if(start < end) flm_cross(acc + size * t, acc + size * t + pp, buf, px, py, pw, n, p, q, start, end);
+    if(buf) R_Free(buf);
+  }
+  for(int t = 1; t < nthreads; ++t) {
+    const double *restrict at = acc + size * t;
+    for(size_t i = 0; i < size; ++i) acc[i] += at[i];
+  }
+
+  if(!flm_chol(acc, p)) {
+    R_Free(acc);
+    UNPROTECT(nprotect);
+    return R_NilValue;
+  }
+
+  // Solve R'R b = X'Wy for each right-hand side
+  SEXP res = PROTECT(allocMatrix(REALSXP, p, q)); ++nprotect;
+  double *restrict pres = REAL(res);
+  const double *restrict R = acc;
+  memcpy(pres, acc + pp, pq * sizeof(double));
+  #pragma omp parallel for num_threads(q > 100 ? nthreads : 1)
+  for(int h = 0; h < q; ++h) {
+    double *restrict b = pres + (size_t)h*p;
+    for(int j = 0; j < p; ++j) {
+      const double *restrict rj = R + (size_t)j*p;
+      double s = b[j];
+      for(int i = 0; i < j; ++i) s -= rj[i] * b[i];
+      b[j] = s / rj[j];
+    }
+    for(int j = p; j--; ) {
+      double s = b[j];
+      for(int k = j + 1; k < p; ++k) s -= R[j + (size_t)k*p] * b[k];
+      b[j] = s / R[j + (size_t)j*p];
+    }
+  }
+  R_Free(acc);
+  UNPROTECT(nprotect);
+  return res;
+}
+
+/*
+ Grouped least squares: separate regressions of y on X for each group (flm(..., g = ...)). In one pass over the rows, the
+ packed upper triangle of each group's X'WX and X'Wy are accumulated (per-thread accumulators for chunks of rows, summed
+ afterwards). Each group's system is then solved with a Cholesky factorization (in parallel across groups) where columns
+ that are (numerically) collinear with preceding columns are dropped, i.e. their coefficients are NA as with lm().
+ Groups with missing values in X, y or w get NA coefficients.
+*/
+
+// Packed index of element (j, k), j <= k, of an upper triangular matrix
+#define PIDX(j, k) ((size_t)(k)*((k)+1)/2 + (j))
+
+// Solves the normal equations A b = c in place: on exit c holds b with 0 for aliased coefficients. Returns the rank (-1 if NA).
+static int flmg_solve(double *restrict A, double *restrict c, const int p) {
+  const size_t sp = PIDX(0, p);
+  for(size_t i = 0; i < sp; ++i) if(ISNAN(A[i])) return -1;
+  for(int j = 0; j < p; ++j) if(ISNAN(c[j])) return -1;
+  int rank = 0;
+  // Cholesky factorization A = R'R, with zero rows and columns for aliased columns
+  for(int k = 0; k < p; ++k) {
+    double *restrict ak = A + PIDX(0, k);
+    const double dk = ak[k];
+    for(int j = 0; j < k; ++j) {
+      const double *restrict aj = A + PIDX(0, j);
+      if(aj[j] == 0.0) {
+        ak[j] = 0.0;
+        continue;
+      }
+      double s = ak[j];
+      for(int i = 0; i < j; ++i) s -= aj[i] * ak[i];
+      ak[j] = s / aj[j];
+    }
+    double v = dk;
+    for(int i = 0; i < k; ++i) v -= ak[i] * ak[i];
+    if(v > FLM_TOL * dk) {
+      ak[k] = sqrt(v);
+      ++rank;
+    } else memset(ak, 0, (k + 1) * sizeof(double));
+  }
+  // Forward and back substitution
+  for(int j = 0; j < p; ++j) {
+    const double *restrict aj = A + PIDX(0, j);
+    if(aj[j] == 0.0) {
+      c[j] = 0.0;
+      continue;
+    }
+    double s = c[j];
+    for(int i = 0; i < j; ++i) s -= aj[i] * c[i];
+    c[j] = s / aj[j];
+  }
+  for(int j = p; j--; ) {
+    const double rjj = A[PIDX(j, j)];
+    if(rjj == 0.0) continue;
+    double s = c[j];
+    for(int k = j + 1; k < p; ++k) s -= A[PIDX(j, k)] * c[k];
+    c[j] = s / rjj;
+  }
+  return rank;
+}
+
+// X: numeric matrix, y: numeric vector, g: integer group id (1-based) or NULL, w: weights or NULL.
+// TRA: NULL returns the ng x p coefficient matrix, "replace"/"fill" the fitted values and "-" the residuals.
+SEXP flmgC(SEXP X, SEXP y, SEXP Rng, SEXP g, SEXP w, SEXP TRA, SEXP Rnthreads) {
+  if(!isMatrix(X)) error("X must be a matrix");
+  const int n = nrows(X), p = ncols(X), ng = isNull(g) ? 1 : asInteger(Rng),
+    ret = isNull(TRA) ? 0 : TYPEOF(TRA) == STRSXP ? TtI(TRA) : asInteger(TRA);
+  int nthreads = asInteger(Rnthreads), nprotect = 0;
+  if(!isNull(TRA) && (ret < 1 || ret > 3)) error("flm only supports TRA = 'replace' (fitted values) or '-' (residuals)");
+  if(length(y) != n || isMatrix(y)) error("With groups or TRA, y must be a vector with length(y) == nrow(X)");
+  if(!isNull(g) && length(g) != n) error("length(g) must match nrow(X)");
+  if(TYPEOF(X) != REALSXP) {
+    if(!(TYPEOF(X) == INTSXP || TYPEOF(X) == LGLSXP)) error("X must be numeric");
+    X = PROTECT(coerceVector(X, REALSXP)); ++nprotect;
+  }
+  if(TYPEOF(y) != REALSXP) {
+    if(!(TYPEOF(y) == INTSXP || TYPEOF(y) == LGLSXP)) error("y must be numeric");
+    y = PROTECT(coerceVector(y, REALSXP)); ++nprotect;
+  }
+  const double *px = REAL(X), *py = REAL(y), *pw = NULL;
+  const int *pg = isNull(g) ? NULL : INTEGER(g);
+  if(!isNull(w)) {
+    if(length(w) != n) error("w must be numeric and length(w) == nrow(X)");
+    if(TYPEOF(w) != REALSXP) {
+      if(!(TYPEOF(w) == INTSXP || TYPEOF(w) == LGLSXP)) error("weights need to be double or integer/logical (internally coerced to double)");
+      w = PROTECT(coerceVector(w, REALSXP)); ++nprotect;
+    }
+    pw = REAL(w);
+  }
+
+  const size_t sp = PIDX(0, p), s = sp + p, gs = s * ng;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads < 1) nthreads = 1;
+  // Accumulation is split by rows into per-thread accumulators. With many tiny groups, summing them would dominate
+  const int nacc = (double)n * p < 100000.0 || ng > n / 4 ? 1 : nthreads,
+    nsolve = ng < nthreads ? (ng > 1 ? ng : 1) : nthreads; // The per-group solves are parallel over groups
+
+  double *restrict acc = (double*)R_Calloc(gs * nacc, double);
+  const int chunk = (n + nacc - 1) / nacc;
+  #pragma omp parallel for num_threads(nacc)
+  for(int t = 0; t < nacc; ++t) {
+    double *restrict at = acc + gs * t, *restrict xi = (double*)R_Calloc(p, double);
+    const int start = t * chunk, end = start + chunk < n ? start + chunk : n;
+    for(int i = start; i < end; ++i) {
+      double *restrict a = at + (pg ? (size_t)(pg[i]-1) * s : 0), *restrict ak = a;
+      const double wi = pw ? pw[i] : 1.0;
+      if(wi == 0.0) continue; // Zero weights (with possibly missing data) do not affect the fit
+      for(int j = 0; j < p; ++j) xi[j] = px[(size_t)j*n + i];
+      for(int k = 0; k < p; ++k) {
+        const double wxk = wi * xi[k];
+        for(int j = 0; j <= k; ++j) ak[j] += wxk * xi[j];
+        ak += k + 1;
+        a[sp + k] += wxk * py[i];
+      }
+    }
+    R_Free(xi);
+  }
+  if(nacc > 1) {
+    #pragma omp parallel for num_threads(nacc)
+    for(size_t i = 0; i < gs; ++i) {
+      double sum = acc[i];
+      for(int t = 1; t < nacc; ++t) sum += acc[gs * t + i];
+      acc[i] = sum;
+    }
+  }
+
+  SEXP res;
+  if(ret == 0) {
+    res = PROTECT(allocMatrix(REALSXP, ng, p)); ++nprotect;
+    double *restrict pres = REAL(res);
+    #pragma omp parallel for num_threads(nsolve)
+    for(int gr = 0; gr < ng; ++gr) {
+      double *restrict a = acc + (size_t)gr * s;
+      const int rank = flmg_solve(a, a + sp, p);
+      for(int j = 0; j < p; ++j) // Aliased coefficients (and groups with missing values) are NA
+        pres[gr + (size_t)j*ng] = rank < 0 || a[PIDX(j, j)] == 0.0 ? NA_REAL : a[sp + j];
+    }
+  } else {
+    #pragma omp parallel for num_threads(nsolve)
+    for(int gr = 0; gr < ng; ++gr) {
+      double *restrict a = acc + (size_t)gr * s;
+      if(flmg_solve(a, a + sp, p) < 0) for(int j = 0; j < p; ++j) a[sp + j] = NA_REAL;
+    }
+    res = PROTECT(allocVector(REALSXP, n)); ++nprotect;
+    double *restrict pres = REAL(res);
+    #pragma omp parallel for num_threads(nthreads)
+    for(int i = 0; i < n; ++i) {
+      const double *restrict b = acc + (pg ? (size_t)(pg[i]-1) * s : 0) + sp;
+      double fit = 0.0;
+      for(int j = 0; j < p; ++j) fit += px[(size_t)j*n + i] * b[j];
+      pres[i] = ret == 3 ? py[i] - fit : fit;
+    }
+  }
+  R_Free(acc);
+  UNPROTECT(nprotect);
+  return res;
+}
+
+#undef PIDX
+
+#undef FLM_BLOCK
+#undef FLM_TOL
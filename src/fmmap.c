@@ -0,0 +1,180 @@
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include "collapse_c.h"
+#include <R_ext/Altrep.h>
+
+/*
+ Memory-mapped numeric vectors for fmmap(): ALTREP integer and real vectors whose data pointer points into a private
+ (copy-on-write) mapping of a binary file of little-endian 32-bit integers or 64-bit doubles. Since INTEGER() and REAL()
+ return the mapped memory, all C kernels (fsum, fmean, group() etc.) read the file directly by pointer. Pages are loaded
+ on demand by the operating system and can be evicted again under memory pressure, so the data never needs to fit into
+ memory at once. Writing to the vector modifies the private pages only, never the file.
+ data1 is an external pointer to the mapping (unmapped by its finalizer), data2 the file name.
+*/
+
+typedef struct {
+  void *addr;  // Start of the mapping (page aligned)
+  size_t size; // Size of the mapping in bytes
+  char *data;  // Start of the data, i.e. addr + offset within the first page
+  R_xlen_t n;  // Number of elements
+} fmmap_t;
+
+static R_altrep_class_t fmmap_int_class, fmmap_real_class;
+
+static void fmmap_finalizer(SEXP eptr) {
+  fmmap_t *m = (fmmap_t *)R_ExternalPtrAddr(eptr);
+  if(!m) return;
+#ifndef _WIN32
+  if(m->addr) munmap(m->addr, m->size);
+#endif
+  R_Free(m);
+  R_ClearExternalPtr(eptr);
+}
+
+static inline fmmap_t *fmmap_get(SEXP x) {
+  fmmap_t *m = (fmmap_t *)R_ExternalPtrAddr(R_altrep_data1(x));
+  if(!m || !m->addr) error("Invalid memory-mapped vector: mappings are only valid within the current R session");
+  return m;
+}
+
+// ALTREP methods
+static R_xlen_t fmmap_Length(SEXP x) { return fmmap_get(x)->n; }
+
+static void *fmmap_Dataptr(SEXP x, Rboolean writeable) { return fmmap_get(x)->data; }
+
+static const void *fmmap_Dataptr_or_null(SEXP x) { return fmmap_get(x)->data; }
+
+static int fmmap_int_Elt(SEXP x, R_xlen_t i) { return ((const int *)fmmap_get(x)->data)[i]; }
+
+static double fmmap_real_Elt(SEXP x, R_xlen_t i) { return ((const double *)fmmap_get(x)->data)[i]; }
+
+static R_xlen_t fmmap_int_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+  const fmmap_t *m = fmmap_get(x);
+  if(n > m->n - i) n = m->n - i;
+  if(n > 0) memcpy(buf, (const int *)m->data + i, n * sizeof(int));
+  return n;
+}
+
+static R_xlen_t fmmap_real_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+  const fmmap_t *m = fmmap_get(x);
+  if(n > m->n - i) n = m->n - i;
+  if(n > 0) memcpy(buf, (const double *)m->data + i, n * sizeof(double));
+  return n;
+}
+
+static Rboolean fmmap_Inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+  const fmmap_t *m = (const fmmap_t *)R_ExternalPtrAddr(R_altrep_data1(x));
+  Rprintf(" fmmap %s of %s (%s)\n", TYPEOF(x) == REALSXP ? "double" : "integer",
+          CHAR(STRING_ELT(R_altrep_data2(x), 0)), m && m->addr ? "mapped" : "invalid");
+  return TRUE;
+}
+
+// Called from R_init_collapse()
+void fmmap_init(DllInfo *dll) {
+  fmmap_int_class = R_make_altinteger_class("fmmap_integer", "collapse", dll);
+  R_set_altrep_Length_method(fmmap_int_class, fmmap_Length);
+  R_set_altrep_Inspect_method(fmmap_int_class, fmmap_Inspect);
+  R_set_altvec_Dataptr_method(fmmap_int_class, fmmap_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(fmmap_int_class, fmmap_Dataptr_or_null);
+  R_set_altinteger_Elt_method(fmmap_int_class, fmmap_int_Elt);
+  R_set_altinteger_Get_region_method(fmmap_int_class, fmmap_int_Get_region);
+
+  fmmap_real_class = R_make_altreal_class("fmmap_real", "collapse", dll);
+  R_set_altrep_Length_method(fmmap_real_class, fmmap_Length);
+  R_set_altrep_Inspect_method(fmmap_real_class, fmmap_Inspect);
+  R_set_altvec_Dataptr_method(fmmap_real_class, fmmap_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(fmmap_real_class, fmmap_Dataptr_or_null);
+  R_set_altreal_Elt_method(fmmap_real_class, fmmap_real_Elt);
+  R_set_altreal_Get_region_method(fmmap_real_class, fmmap_real_Get_region);
+}
+
+/*
+ file: (expanded) file name, Rdouble: TRUE for doubles, FALSE for integers, Roffset: offset in bytes, Rn: number of elements
+ (NA: until the end of the file), Radvice: 0 = normal, 1 = sequential, 2 = random, 3 = willneed, Rhuge: advise transparent huge pages.
+ The advice is passed to madvise(), and is ignored where not supported.
+*/
+SEXP fmmapC(SEXP file, SEXP Rdouble, SEXP Roffset, SEXP Rn, SEXP Radvice, SEXP Rhuge) {
+#ifdef _WIN32
+  error("Memory-mapping files is not supported on Windows");
+  return R_NilValue;
+#else
+  const int isreal = asLogical(Rdouble), advice = asInteger(Radvice), huge = asLogical(Rhuge);
+  const size_t size = isreal ? sizeof(double) : sizeof(int);
+  const double doff = asReal(Roffset), dn = asReal(Rn);
+  const int one = 1;
+  if(*(const char *)&one != 1) error("Memory-mapping little-endian binary data requires a little-endian platform");
+  if(!isString(file) || length(file) != 1) error("file must be a single character string");
+  if(ISNAN(doff) || doff < 0 || doff != floor(doff)) error("offset must be a non-negative whole number of bytes");
+  if(fmod(doff, (double)size) != 0) error("offset must be a multiple of the element size (%d bytes)", (int)size);
+  if(!ISNAN(dn) && (dn < 0 || dn != floor(dn))) error("n must be a non-negative whole number");
+
+  const char *path = translateChar(STRING_ELT(file, 0));
+  const int fd = open(path, O_RDONLY);
+  if(fd < 0) error("Cannot open file '%s': %s", path, strerror(errno));
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    error("Cannot determine the size of file '%s': %s", path, strerror(errno));
+  }
+  const off_t offset = (off_t)doff;
+  const double avail = (double)st.st_size - doff;
+  if(avail < 0) {
+    close(fd);
+    error("offset exceeds the file size (%.0f bytes)", (double)st.st_size);
+  }
+  const R_xlen_t n = ISNAN(dn) ? (R_xlen_t)(avail / size) : (R_xlen_t)dn;
+  if((double)n * size > avail) {
+    close(fd);
+    error("File '%s' contains only %.0f elements after offset %.0f", path, floor(avail / size), doff);
+  }
+  if(n == 0) {
+    close(fd);
+    return allocVector(isreal ? REALSXP : INTSXP, 0);
+  }
+
+  // The mapping is allocated first, so that it is released by the finalizer if anything fails afterwards
+  fmmap_t *m = R_Calloc(1, fmmap_t);
+  SEXP eptr = PROTECT(R_MakeExternalPtr(m, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(eptr, fmmap_finalizer, TRUE);
+
+  // mmap() requires a page-aligned offset
+  const long page = sysconf(_SC_PAGESIZE);
+  const off_t poff = page > 0 ? offset % page : 0;
+  const size_t mapsize = (size_t)n * size + poff;
+#ifdef MAP_NORESERVE // No swap needs to be reserved for the private copy, as pages are only copied when written to
+  const int flags = MAP_PRIVATE | MAP_NORESERVE;
+#else
+  const int flags = MAP_PRIVATE;
+#endif
+  void *addr = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, flags, fd, offset - poff);
+  const int err = errno;
+  close(fd); // The mapping keeps a reference to the file
+  if(addr == MAP_FAILED) error("Cannot map file '%s': %s", path, strerror(err));
+  m->addr = addr;
+  m->size = mapsize;
+  m->data = (char *)addr + poff;
+  m->n = n;
+
+  // Access pattern advice for the kernel's readahead, errors are ignored as the advice is optional
+#ifdef MADV_SEQUENTIAL
+  if(advice > 0) madvise(addr, mapsize, advice == 1 ? MADV_SEQUENTIAL : advice == 2 ? MADV_RANDOM : MADV_WILLNEED);
+#else
+  (void)advice;
+#endif
+#ifdef MADV_HUGEPAGE
+  if(huge) madvise(addr, mapsize, MADV_HUGEPAGE);
+#else
+  (void)huge;
+#endif
+
+  SEXP res = R_new_altrep(isreal ? fmmap_real_class : fmmap_int_class, eptr, file);
+  UNPROTECT(1);
+  return res;
+#endif
+}
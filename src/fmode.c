@@ -5,21 +5,21 @@
 static double NEG_INF = -1.0/0.0;
 
 // C-implementations for different data types ----------------------------------
-// TODO: outsource and memset hash table and count vector?
-// Problem: does not work in parallel, each thread needs own intermediate vectors
+// The *_noalloc() versions of the unweighted hash-based functions take a zeroed hash table h of size >= hash_size(l), and
+// vectors n (frequencies) and ht (slots used) of length >= l. The used slots are reset before returning, and n is
+// initialized upon insertion, so that these can be reused across groups without clearing (see hscratch in kit.h).
 
-int mode_int(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
+int mode_int_noalloc(const int *restrict px, const int *restrict po, int *restrict h, int *restrict n, int *restrict ht,
+                     const int l, const int sorted, const int narm, const int ret) {
   if(l == 1) return sorted ? px[0] : px[po[0]-1];
   const size_t l2 = 2U * (size_t) l;
   size_t M = 256, id = 0;
-  int K = 8, index = 0, val, mode, max = 1, i = 0, end = l-1,
+  int K = 8, index = 0, nh = 0, val, mode, max = 1, i = 0, end = l-1,
       minm = ret == 1, nfirstm = ret > 0, lastm = ret == 3;
   while(M < l2) {
     M *= 2;
     K++;
   }
-  int *restrict h = (int*)R_Calloc(M, int); // Table to save the hash values
-  int *restrict n = (int*)R_Calloc(l, int); // Table to count frequency of values
 
   if(sorted) {
     mode = px[0];
@@ -34,7 +34,9 @@ int mode_int(const int *restrict px, const int *restrict po, const int l, const
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      index = i; // n[i] = 1;
+      ht[nh++] = id;
+      index = i;
+      n[i] = 0;
       ibls:;
       if(++n[index] >= max) {
         if(lastm || n[index] > max) {
@@ -62,7 +64,9 @@ int mode_int(const int *restrict px, const int *restrict po, const int l, const
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      index = i; // n[i] = 1;
+      ht[nh++] = id;
+      index = i;
+      n[i] = 0;
       ibl:;
       if(++n[index] >= max) {
         if(lastm || n[index] > max) {
@@ -79,11 +83,19 @@ int mode_int(const int *restrict px, const int *restrict po, const int l, const
     }
   }
 
-  R_Free(h);
-  R_Free(n);
+  for(int j = 0; j != nh; ++j) h[ht[j]] = 0;
   return mode;
 }
 
+int mode_int(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
+  if(l == 1) return sorted ? px[0] : px[po[0]-1];
+  const size_t M = hash_size(l);
+  int *h = (int*)R_Calloc(M + 2 * (size_t)l, int);
+  int res = mode_int_noalloc(px, po, h, h + M, h + M + l, l, sorted, narm, ret);
+  R_Free(h);
+  return res;
+}
+
 int w_mode_int(const int *restrict px, const double *restrict pw, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
   if(l == 1) {
     if(sorted) return ISNAN(pw[0]) ? NA_INTEGER : px[0];
@@ -168,59 +180,58 @@ int w_mode_int(const int *restrict px, const double *restrict pw, const int *res
 }
 
 
-int mode_fct_logi(const int *restrict px, const int *restrict po, const int l, const int nlev, const int sorted, const int narm, const int ret) {
-  if(l == 1) return sorted ? px[0] : px[po[0]-1];
-  int val, mode, max = 1, nlevp = nlev + 1, i = 0, end = l-1,
-    minm = ret == 1, nfirstm = ret > 0, lastm = ret == 3;
-  int *restrict n = (int*)R_Calloc(nlevp+1, int); // Table to count frequency of values
+// Factors and logical vectors: two passes using a frequency table n of the integer codes (slot nlev+1 for NA), with the
+// smallest counter type fitting the group size to keep the table in cache. The first pass tabulates and finds the maximum
+// frequency m. The second pass runs backwards, decrementing the counts (which resets n to zero), and meets every value with
+// frequency m at its m'th occurrence: ties = "first" takes the value reaching m first, "last" the one reaching m last.
+#define MODE_FCT_CORE(T, XI)                                                        \
+{                                                                                   \
+  T *restrict nt = (T*)n;                                                           \
+  for(int i = 0, v; i < l; ++i) {                                                   \
+    v = XI;                                                                         \
+    if(v == NA_INTEGER) {                                                           \
+      if(narm) continue;                                                            \
+      v = nlevp;                                                                    \
+    }                                                                               \
+    if(++nt[v] > m) m = nt[v];                                                      \
+  }                                                                                 \
+  for(int i = l, v, xi; i--; ) {                                                    \
+    v = xi = XI;                                                                    \
+    if(v == NA_INTEGER) {                                                           \
+      if(narm) continue;                                                            \
+      v = nlevp;                                                                    \
+    }                                                                               \
+    if(nt[v]-- == m) {                                                              \
+      if(!found || ret == 0 || (ret == 1 && xi < mode) || (ret == 2 && xi > mode))  \
+        mode = xi;                                                                  \
+      found = 1;                                                                    \
+    }                                                                               \
+  }                                                                                 \
+}
 
+#define MODE_FCT_SWITCH(XI)                                                         \
+  if(l < 256) MODE_FCT_CORE(uint8_t, XI)                                            \
+  else if(l < 65536) MODE_FCT_CORE(uint16_t, XI)                                    \
+  else MODE_FCT_CORE(int, XI)
+
+// n needs to be a zeroed table of nlev+2 integers, and is zero again upon return
+int mode_fct_logi_noalloc(const int *restrict px, const int *restrict po, int *restrict n, const int l, const int nlev, const int sorted, const int narm, const int ret) {
+  if(l == 1) return sorted ? px[0] : px[po[0]-1];
+  int mode = NA_INTEGER, m = 0, found = 0, nlevp = nlev + 1;
   if(sorted) {
-    mode = px[0];
-    if(narm) while(mode == NA_INTEGER && i < end) mode = px[++i];
-    for(; i < l; ++i) {
-      val = px[i];
-      if(val == NA_INTEGER) {
-        if(narm) continue;
-        val = nlevp;
-      }
-      if(++n[val] >= max) {
-        if(lastm || n[val] > max) {
-          max = n[val];
-          mode = px[i];
-        } else if(nfirstm) {
-          if(minm) {
-            if(mode > px[i]) mode = px[i];
-          } else {
-            if(mode < px[i]) mode = px[i];
-          }
-        }
-      }
-    }
+    MODE_FCT_SWITCH(px[i]);
   } else {
-    mode = px[po[0]-1];
-    if(narm) while(mode == NA_INTEGER && i < end) mode = px[po[++i]-1];
-    for(int xi; i < l; ++i) {
-      val = xi = px[po[i]-1];
-      if(val == NA_INTEGER) {
-        if(narm) continue;
-        val = nlevp;
-      }
-      if(++n[val] >= max) {
-        if(lastm || n[val] > max) {
-          max = n[val];
-          mode = xi;
-        } else if(nfirstm) {
-          if(minm) {
-            if(mode > xi) mode = xi;
-          } else {
-            if(mode < xi) mode = xi;
-          }
-        }
-      }
-    }
+    MODE_FCT_SWITCH(px[po[i]-1]);
   }
+  return mode;
+}
 
-  R_Free(n);
+int mode_fct_logi(const int *restrict px, const int *restrict po, const int l, const int nlev, const int sorted, const int narm, const int ret) {
+  if(l == 1) return sorted ? px[0] : px[po[0]-1];
+  int nlgl[3] = {0, 0, 0}; // Logical vectors don't need a heap allocation
+  int *restrict n = nlev == 1 ? nlgl : (int*)R_Calloc(nlev+2, int);
+  int mode = mode_fct_logi_noalloc(px, po, n, l, nlev, sorted, narm, ret);
+  if(nlev != 1) R_Free(n);
   return mode;
 }
 
@@ -290,18 +301,17 @@ int w_mode_fct_logi(const int *restrict px, const double *restrict pw, const int
 }
 
 
-double mode_double(const double *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
+double mode_double_noalloc(const double *restrict px, const int *restrict po, int *restrict h, int *restrict n, int *restrict ht,
+                           const int l, const int sorted, const int narm, const int ret) {
   if(l == 1) return sorted ? px[0] : px[po[0]-1];
   const size_t l2 = 2U * (size_t) l;
   size_t M = 256, id = 0;
-  int K = 8, index = 0, max = 1, i = 0, end = l-1,
+  int K = 8, index = 0, nh = 0, max = 1, i = 0, end = l-1,
     minm = ret == 1, nfirstm = ret > 0, lastm = ret == 3;
   while(M < l2) {
     M *= 2;
     K++;
   }
-  int *restrict h = (int*)R_Calloc(M, int); // Table to save the hash values
-  int *restrict n = (int*)R_Calloc(l, int); // Table to count frequency of values
   double val, mode;
   union uno tpv;
 
@@ -319,7 +329,9 @@ double mode_double(const double *restrict px, const int *restrict po, const int
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      index = i; // n[i] = 1;
+      ht[nh++] = id;
+      index = i;
+      n[i] = 0;
       rbls:;
       if(++n[index] >= max) {
         if(lastm || n[index] > max) {
@@ -348,7 +360,9 @@ double mode_double(const double *restrict px, const int *restrict po, const int
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      index = i; // n[i] = 1;
+      ht[nh++] = id;
+      index = i;
+      n[i] = 0;
       rbl:;
       if(++n[index] >= max) {
         if(lastm || n[index] > max) {
@@ -365,11 +379,19 @@ double mode_double(const double *restrict px, const int *restrict po, const int
     }
   }
 
-  R_Free(h);
-  R_Free(n);
+  for(int j = 0; j != nh; ++j) h[ht[j]] = 0;
   return mode;
 }
 
+double mode_double(const double *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
+  if(l == 1) return sorted ? px[0] : px[po[0]-1];
+  const size_t M = hash_size(l);
+  int *h = (int*)R_Calloc(M + 2 * (size_t)l, int);
+  double res = mode_double_noalloc(px, po, h, h + M, h + M + l, l, sorted, narm, ret);
+  R_Free(h);
+  return res;
+}
+
 double w_mode_double(const double *restrict px, const double *restrict pw, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
   if(l == 1) {
     if(sorted) return ISNAN(pw[0]) ? NA_REAL : px[0];
@@ -456,18 +478,17 @@ double w_mode_double(const double *restrict px, const double *restrict pw, const
 }
 
 
-SEXP mode_string(const SEXP *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
+SEXP mode_string_noalloc(const SEXP *restrict px, const int *restrict po, int *restrict h, int *restrict n, int *restrict ht,
+                         const int l, const int sorted, const int narm, const int ret) {
   if(l == 1) return sorted ? px[0] : px[po[0]-1];
   const size_t l2 = 2U * (size_t) l;
   size_t M = 256, id = 0;
-  int K = 8, index = 0, max = 1, i = 0, end = l-1,
+  int K = 8, index = 0, nh = 0, max = 1, i = 0, end = l-1,
     minm = ret == 1, nfirstm = ret > 0, lastm = ret == 3;
   while(M < l2) {
     M *= 2;
     K++;
   }
-  int *restrict h = (int*)R_Calloc(M, int); // Table to save the hash values
-  int *restrict n = (int*)R_Calloc(l, int); // Table to count frequency of values
   SEXP val, mode;
 
   if(sorted) {
@@ -483,7 +504,9 @@ SEXP mode_string(const SEXP *restrict px, const int *restrict po, const int l, c
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      index = i; // n[i] = 1;
+      ht[nh++] = id;
+      index = i;
+      n[i] = 0;
       sbls:;
       if(++n[index] >= max) {
         if(lastm || n[index] > max) {
@@ -511,7 +534,9 @@ SEXP mode_string(const SEXP *restrict px, const int *restrict po, const int l, c
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      index = i; // n[i] = 1;
+      ht[nh++] = id;
+      index = i;
+      n[i] = 0;
       sbl:;
       if(++n[index] >= max) {
         if(lastm || n[index] > max) {
@@ -528,11 +553,19 @@ SEXP mode_string(const SEXP *restrict px, const int *restrict po, const int l, c
     }
   }
 
-  R_Free(h);
-  R_Free(n);
+  for(int j = 0; j != nh; ++j) h[ht[j]] = 0;
   return mode;
 }
 
+SEXP mode_string(const SEXP *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
+  if(l == 1) return sorted ? px[0] : px[po[0]-1];
+  const size_t M = hash_size(l);
+  int *h = (int*)R_Calloc(M + 2 * (size_t)l, int);
+  SEXP res = mode_string_noalloc(px, po, h, h + M, h + M + l, l, sorted, narm, ret);
+  R_Free(h);
+  return res;
+}
+
 SEXP w_mode_string(const SEXP *restrict px, const double *restrict pw, const int *restrict po, const int l, const int sorted, const int narm, const int ret) {
   if(l == 1) {
     if(sorted) return ISNAN(pw[0]) ? NA_STRING : px[0];
@@ -672,10 +705,114 @@ SEXP w_mode_impl(SEXP x, double *pw, int narm, int ret) {
   return res;
 }
 
-SEXP mode_g_impl(SEXP x, int ng, int *pgs, int *po, int *pst, int sorted, int narm, int ret, int nthreads) {
+// Parallel loop over groups using the *_noalloc() functions, with scratch space allocated once per thread
+#define MODE_G_LOOP(FUN, NA, PX, PO, SORTED)                                        \
+  _Pragma("omp parallel num_threads(nthreads)")                                     \
+  {                                                                                 \
+    hscratch s = {NULL, NULL, 0, 2};                                                \
+    _Pragma("omp for")                                                              \
+    for(int gr = 0; gr < ng; ++gr) {                                                \
+      if(pgs[gr] == 0) {                                                            \
+        pres[gr] = NA;                                                              \
+        continue;                                                                   \
+      }                                                                             \
+      hscratch_fit(&s, pgs[gr]);                                                    \
+      pres[gr] = FUN(PX, PO, s.h, s.v, s.v + s.cap, pgs[gr], SORTED, narm, ret);    \
+    }                                                                               \
+    R_Free(s.h);                                                                    \
+  }
+
+// Factors: a frequency table of the levels per thread (see mode_fct_logi_noalloc())
+#define MODE_FCT_G_LOOP(PX, PO, SORTED)                                             \
+  _Pragma("omp parallel num_threads(nthreads)")                                     \
+  {                                                                                 \
+    int *restrict n = (int*)R_Calloc(M+2, int);                                     \
+    _Pragma("omp for")                                                              \
+    for(int gr = 0; gr < ng; ++gr)                                                  \
+      pres[gr] = pgs[gr] == 0 ? NA_INTEGER :                                        \
+        mode_fct_logi_noalloc(PX, PO, n, pgs[gr], M, SORTED, narm, ret);            \
+    R_Free(n);                                                                      \
+  }
+
+// Many tiny groups: modes from runs of identical values within the groups of the ordering pgo of (g, x), where missing
+// values come last. Since the ordering is stable, the last element of a run is the last occurrence of the value, which
+// determines the first (ret = 0) and last (ret = 3) mode as in the hash-based functions: the first mode is the value
+// that first reaches the maximum frequency. pst are the (1-based) group starts in pgo.
+#define MODE_RADIX_LOOP(T, NA, ISNA_T, FALLBACK)                                    \
+  _Pragma("omp parallel for num_threads(nthreads)")                                 \
+  for(int gr = 0; gr < ng; ++gr) {                                                  \
+    const int *restrict pog = pgo + pst[gr]-1, lg = pgs[gr];                        \
+    if(lg == 0) {                                                                   \
+      pres[gr] = NA;                                                                \
+      continue;                                                                     \
+    }                                                                               \
+    FALLBACK;                                                                       \
+    int i = 0, j, max = 0, last = 0;                                                \
+    T val;                                                                          \
+    pres[gr] = NA;                                                                  \
+    while(i < lg) {                                                                 \
+      val = pxm[pog[i]];                                                            \
+      if(narm && ISNA_T(val)) break;                                                \
+      for(j = i+1; j < lg && pxm[pog[j]] == val; ++j);                              \
+      if(j - i > max || (j - i == max && (ret == 0 ? pog[j-1] < last : ret == 3 ? pog[j-1] > last : \
+                                          ret == 1 ? pres[gr] > val : pres[gr] < val))) { \
+        max = j - i;                                                                \
+        pres[gr] = val;                                                             \
+        last = pog[j-1];                                                            \
+      }                                                                             \
+      i = j;                                                                        \
+    }                                                                               \
+  }
+
+#undef ISNA_INT
+#define ISNA_INT(x) ((x) == NA_INTEGER)
+#undef ISNA_STR
+#define ISNA_STR(x) ((x) == NA_STRING)
+
+// po and sorted are only needed for groups of doubles with NA/NaN values (unless narm = 1 and some values are not missing):
+// these are passed to mode_double(), because NA and NaN are distinct values for fmode() but not ordered separately
+static SEXP mode_g_radix_impl(SEXP x, SEXP g, int ng, int *pgs, int *po, int *pst, int sorted, int narm, int ret, int nthreads) {
+  int tx = TYPEOF(x);
+  SEXP o = PROTECT(gx_radixorder(g, x)), res = PROTECT(allocVector(tx, ng));
+  const int *restrict pgo = INTEGER(o);
+  switch(tx) {
+    case REALSXP: {
+      const double *px = REAL(x), *pxm = px-1;
+      double *pres = REAL(res);
+      MODE_RADIX_LOOP(double, NA_REAL, ISNAN,
+        if(ISNAN(pxm[pog[lg-1]]) && (narm == 0 || ISNAN(pxm[pog[0]]))) {
+          pres[gr] = sorted ? mode_double(px + pst[gr]-1, po, lg, 1, narm, ret) : mode_double(px, po + pst[gr]-1, lg, 0, narm, ret);
+          continue;
+        });
+      break;
+    }
+    case INTSXP: {
+      const int *pxm = INTEGER(x)-1;
+      int *pres = INTEGER(res);
+      MODE_RADIX_LOOP(int, NA_INTEGER, ISNA_INT, );
+      break;
+    }
+    case STRSXP: {
+      const SEXP *pxm = SEXPPTR_RO(x)-1;
+      SEXP *pres = SEXPPTR(res);
+      MODE_RADIX_LOOP(SEXP, NA_STRING, ISNA_STR, );
+      break;
+    }
+    default: error("Not Supported SEXP Type: '%s'", type2char(tx));
+  }
+  copyMostAttrib(x, res);
+  UNPROTECT(2);
+  return res;
+}
+
+// g is the group-id vector of the GRP object, used for the radix ordering with many tiny groups
+SEXP mode_g_impl(SEXP x, SEXP g, int ng, int *pgs, int *po, int *pst, int sorted, int narm, int ret, int nthreads) {
 
   int l = length(x), tx = TYPEOF(x);
   if(nthreads > ng) nthreads = ng;
+  if(sorted) po = &l;
+  if(RADIX_GROUPS(l, ng) && (tx == REALSXP || tx == STRSXP || (tx == INTSXP && !(isFactor(x) && FCT_GROUPS(l, nlevels(x))))))
+    return mode_g_radix_impl(x, g, ng, pgs, po, pst, sorted, narm, ret, nthreads);
 
   SEXP res = PROTECT(allocVector(tx, ng));
 
@@ -684,22 +821,16 @@ SEXP mode_g_impl(SEXP x, int ng, int *pgs, int *po, int *pst, int sorted, int na
     switch(tx) {
       case REALSXP: {
         double *px = REAL(x), *pres = REAL(res);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? NA_REAL : mode_double(px + pst[gr]-1, po, pgs[gr], 1, narm, ret);
+        MODE_G_LOOP(mode_double_noalloc, NA_REAL, px + pst[gr]-1, po, 1);
         break;
       }
       case INTSXP: {
         int *px = INTEGER(x), *pres = INTEGER(res);
-        if(isFactor(x) && nlevels(x) < l / ng * 3) {
-          int M = nlevels(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? NA_INTEGER : mode_fct_logi(px + pst[gr]-1, po, pgs[gr], M, 1, narm, ret);
+        if(isFactor(x) && FCT_GROUPS(l, nlevels(x))) {
+          const int M = nlevels(x);
+          MODE_FCT_G_LOOP(px + pst[gr]-1, po, 1);
         } else {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? NA_INTEGER : mode_int(px + pst[gr]-1, po, pgs[gr], 1, narm, ret);
+          MODE_G_LOOP(mode_int_noalloc, NA_INTEGER, px + pst[gr]-1, po, 1);
         }
         break;
       }
@@ -713,9 +844,7 @@ SEXP mode_g_impl(SEXP x, int ng, int *pgs, int *po, int *pst, int sorted, int na
       case STRSXP: {
         const SEXP *px = SEXPPTR_RO(x);
         SEXP *pres = SEXPPTR(res);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? NA_STRING : mode_string(px + pst[gr]-1, po, pgs[gr], 1, narm, ret);
+        MODE_G_LOOP(mode_string_noalloc, NA_STRING, px + pst[gr]-1, po, 1);
         break;
       }
       default: error("Not Supported SEXP Type: '%s'", type2char(tx));
@@ -724,22 +853,16 @@ SEXP mode_g_impl(SEXP x, int ng, int *pgs, int *po, int *pst, int sorted, int na
     switch(tx) {
       case REALSXP: {
         double *px = REAL(x), *pres = REAL(res);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? NA_REAL : mode_double(px, po + pst[gr]-1, pgs[gr], 0, narm, ret);
+        MODE_G_LOOP(mode_double_noalloc, NA_REAL, px, po + pst[gr]-1, 0);
         break;
       }
       case INTSXP: {
         int *px = INTEGER(x), *pres = INTEGER(res);
-        if(isFactor(x) && nlevels(x) < l / ng * 3) {
-          int M = nlevels(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? NA_INTEGER : mode_fct_logi(px, po + pst[gr]-1, pgs[gr], M, 0, narm, ret);
+        if(isFactor(x) && FCT_GROUPS(l, nlevels(x))) {
+          const int M = nlevels(x);
+          MODE_FCT_G_LOOP(px, po + pst[gr]-1, 0);
         } else {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? NA_INTEGER : mode_int(px, po + pst[gr]-1, pgs[gr], 0, narm, ret);
+          MODE_G_LOOP(mode_int_noalloc, NA_INTEGER, px, po + pst[gr]-1, 0);
         }
         break;
       }
@@ -753,9 +876,7 @@ SEXP mode_g_impl(SEXP x, int ng, int *pgs, int *po, int *pst, int sorted, int na
       case STRSXP: {
         const SEXP *px = SEXPPTR_RO(x);
         SEXP *pres = SEXPPTR(res);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? NA_STRING : mode_string(px, po + pst[gr]-1, pgs[gr], 0, narm, ret);
+        MODE_G_LOOP(mode_string_noalloc, NA_STRING, px, po + pst[gr]-1, 0);
         break;
       }
       default: error("Not Supported SEXP Type: '%s'", type2char(tx));
@@ -908,7 +1029,7 @@ SEXP fmodeC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rret, SEXP Rnthreads) {
   // Thomas Kalibera Patch:
   if(nthreads > max_threads) nthreads = max_threads;
   SEXP res;
-  if(nullw) res = mode_g_impl(x, ng, pgs, po, pst, sorted, asLogical(Rnarm), asInteger(Rret), nthreads);
+  if(nullw) res = mode_g_impl(x, pg[1], ng, pgs, po, pst, sorted, asLogical(Rnarm), asInteger(Rret), nthreads);
   else res = w_mode_g_impl(x, pw, ng, pgs, po, pst, sorted, asLogical(Rnarm), asInteger(Rret), nthreads);
   UNPROTECT(nprotect);
   return res;
@@ -973,7 +1094,7 @@ SEXP fmodelC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rret, SEXP Rnthreads) {
         pst = INTEGER(getAttrib(o, sym_starts));
       }
       if(nullw) { // Parallelism at sub-column level
-        for(int j = 0; j < l; ++j) SET_VECTOR_ELT(out, j, mode_g_impl(px[j], ng, pgs, po, pst, sorted, narm, ret, nthreads));
+        for(int j = 0; j < l; ++j) SET_VECTOR_ELT(out, j, mode_g_impl(px[j], pg[1], ng, pgs, po, pst, sorted, narm, ret, nthreads));
       } else { // Parallelism at sub-column level
         for(int j = 0; j < l; ++j) SET_VECTOR_ELT(out, j, w_mode_g_impl(px[j], pw, ng, pgs, po, pst, sorted, narm, ret, nthreads));
       }
@@ -1068,6 +1189,8 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
   int sorted = LOGICAL(pg[5])[1] == 1, ng = INTEGER(pg[0])[0], *restrict pgs = INTEGER(pg[2]), *restrict po, *restrict pst, gl = length(pg[1]);
   if(l != gl) error("length(g) must match nrow(x)");
   SEXP res = PROTECT(allocVector(tx, ng * col));
+  int maxgrpn = 0; // Scratch space per thread for the hash-based functions
+  for(int i = 0; i != ng; ++i) if(pgs[i] > maxgrpn) maxgrpn = pgs[i];
 
   if(isNull(o)) {
     int *cgs = (int *) R_alloc(ng+2, sizeof(int)), *restrict pgv = INTEGER(pg[1]); cgs[1] = 1;
@@ -1090,11 +1213,17 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
       case REALSXP: {
         double *px = REAL(x), *restrict pres = REAL(res);
         if(nullw) {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            double *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_REAL : mode_double(pxj + pst[gr]-1, po, pgs[gr], 1, narm, ret);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 2};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              double *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_REAL : mode_double_noalloc(pxj + pst[gr]-1, po, s.h, s.v, s.v + s.cap, pgs[gr], 1, narm, ret);
+            }
+            R_Free(s.h);
           }
         } else {
           #pragma omp parallel for num_threads(nthreads)
@@ -1109,10 +1238,16 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
       case INTSXP: { // Factor matrix not well defined object...
         int *px = INTEGER(x), *restrict pres = INTEGER(res);
         if(nullw) {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int *pxj = px + j * l, jng = j * ng;
-            for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_INTEGER : mode_int(pxj + pst[gr]-1, po, pgs[gr], 1, narm, ret);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 2};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int *pxj = px + j * l, jng = j * ng;
+              for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_INTEGER : mode_int_noalloc(pxj + pst[gr]-1, po, s.h, s.v, s.v + s.cap, pgs[gr], 1, narm, ret);
+            }
+            R_Free(s.h);
           }
         } else {
           #pragma omp parallel for num_threads(nthreads)
@@ -1144,11 +1279,17 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
         const SEXP *px = SEXPPTR_RO(x);
         SEXP *restrict pres = SEXPPTR(res);
         if(nullw) {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            const SEXP *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_STRING : mode_string(pxj + pst[gr]-1, po, pgs[gr], 1, narm, ret);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 2};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              const SEXP *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_STRING : mode_string_noalloc(pxj + pst[gr]-1, po, s.h, s.v, s.v + s.cap, pgs[gr], 1, narm, ret);
+            }
+            R_Free(s.h);
           }
         } else {
           #pragma omp parallel for num_threads(nthreads)
@@ -1167,11 +1308,17 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
       case REALSXP: {
         double *px = REAL(x), *restrict pres = REAL(res);
         if(nullw) {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            double *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_REAL : mode_double(pxj, po + pst[gr]-1, pgs[gr], 0, narm, ret);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 2};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              double *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_REAL : mode_double_noalloc(pxj, po + pst[gr]-1, s.h, s.v, s.v + s.cap, pgs[gr], 0, narm, ret);
+            }
+            R_Free(s.h);
           }
         } else {
           #pragma omp parallel for num_threads(nthreads)
@@ -1186,10 +1333,16 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
       case INTSXP: {
         int *px = INTEGER(x), *restrict pres = INTEGER(res);
         if(nullw) {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng, *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_INTEGER : mode_int(pxj, po + pst[gr]-1, pgs[gr], 0, narm, ret);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 2};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng, *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_INTEGER : mode_int_noalloc(pxj, po + pst[gr]-1, s.h, s.v, s.v + s.cap, pgs[gr], 0, narm, ret);
+            }
+            R_Free(s.h);
           }
         } else {
           #pragma omp parallel for num_threads(nthreads)
@@ -1221,11 +1374,17 @@ SEXP fmodemC(SEXP x, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, SEXP Rnt
         const SEXP *px = SEXPPTR_RO(x);
         SEXP *restrict pres = SEXPPTR(res);
         if(nullw) {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            const SEXP *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_STRING : mode_string(pxj, po + pst[gr]-1, pgs[gr], 0, narm, ret);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 2};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              const SEXP *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr) pres[jng + gr] = pgs[gr] == 0 ? NA_STRING : mode_string_noalloc(pxj, po + pst[gr]-1, s.h, s.v, s.v + s.cap, pgs[gr], 0, narm, ret);
+            }
+            R_Free(s.h);
           }
         } else {
           #pragma omp parallel for num_threads(nthreads)
@@ -2,10 +2,10 @@
 #include "kit.h"
 
 // C-implementations for different data types ----------------------------------
-// TODO: outsource and memset hash table?
-// Problem: does not work in parallel, each thread needs own hash table...
+// The *_noalloc() versions of the hash-based functions take a zeroed hash table h of size >= hash_size(l) and a vector ht
+// of length >= l, which records the slots used, to reset them before returning. Thus the table can be reused across groups.
 
-int ndistinct_int(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
+int ndistinct_int_noalloc(const int *restrict px, const int *restrict po, int *restrict h, int *restrict ht, const int l, const int sorted, const int narm) {
   if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_INTEGER);
   const size_t l2 = 2U * (size_t) l;
   size_t M = 256, id = 0;
@@ -14,7 +14,6 @@ int ndistinct_int(const int *restrict px, const int *restrict po, const int l, c
     M *= 2;
     K++;
   }
-  int *restrict h = (int*)R_Calloc(M, int); // Table to save the hash values, table has size M
 
   if(sorted) {
     for (int i = 0; i != l; ++i) {
@@ -28,7 +27,7 @@ int ndistinct_int(const int *restrict px, const int *restrict po, const int l, c
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      ++ndist;
+      ht[ndist++] = id;
       ibls:;
     }
   } else {
@@ -44,90 +43,95 @@ int ndistinct_int(const int *restrict px, const int *restrict po, const int l, c
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      ++ndist;
+      ht[ndist++] = id;
       ibl:;
     }
   }
 
-  R_Free(h);
+  for(int i = 0; i != ndist; ++i) h[ht[i]] = 0;
   if(narm == 0) ndist += anyNA;
   return ndist;
 }
 
-int ndistinct_fct(const int *restrict px, const int *restrict po, const int l, const int nlev, const int sorted, const int narm) {
+int ndistinct_int(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
   if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_INTEGER);
-  int *restrict h = (int*)R_Calloc(nlev+1, int);
-  int ndist = 0, anyNA = narm; // Ensures breaking works if narm = TRUE or FALSE
-  if(sorted) {
-    for (int i = 0, xi; i != l; ++i) {
-      xi = px[i];
-      if(xi == NA_INTEGER) {
-        anyNA = 1;
-        continue;
-      }
-      if(h[xi]) continue;
-      ++ndist;
-      if(anyNA && ndist == nlev) break;
-      h[xi] = 1;
+  const size_t M = hash_size(l);
+  int *h = (int*)R_Calloc(M + l, int), res = ndistinct_int_noalloc(px, po, h, h + M, l, sorted, narm);
+  R_Free(h);
+  return res;
+}
+
+// Factors: the levels seen are recorded in a bitset bs of NBITWORDS(nlev) words (bit 0 flags NA), which is filled without
+// branching and counted with popcount. After each block of FCT_BLOCK(nw) elements the count is checked, to exit early once
+// all levels (and NA) were seen. bs needs to be zero and is reset before returning.
+#define FCT_BLOCK(nw) ((nw) < 4 ? 256 : 64 * (int)(nw))
+
+#define NDISTINCT_FCT_FILL(XI)                                     \
+  for(int j = i; j < end; ++j) {                                   \
+    const unsigned int xj = XI == NA_INTEGER ? 0 : (unsigned int)XI; \
+    bs[xj >> 6] |= (uint64_t)1 << (xj & 63);                       \
+  }
+
+int ndistinct_fct_noalloc(const int *restrict px, const int *restrict po, uint64_t *restrict bs, const int l, const int nlev, const int sorted, const int narm) {
+  if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_INTEGER);
+  const int nw = NBITWORDS(nlev), full = nlev + !narm, block = FCT_BLOCK(nw);
+  int i = 0, end = 0, ndist = 0;
+  while(end < l) {
+    end = l - i > block ? i + block : l;
+    if(sorted) {
+      NDISTINCT_FCT_FILL(px[j]);
+    } else {
+      NDISTINCT_FCT_FILL(px[po[j]-1]);
     }
+    ndist = 0;
+    for(int k = 0; k < nw; ++k) ndist += POPCOUNT64(bs[k]);
+    if(narm) ndist -= (int)(bs[0] & 1);
+    if(ndist == full) break;
+    i = end;
+  }
+  // Reset the bitset: by walking the elements processed if these are fewer than the words
+  if(nw <= end) memset(bs, 0, nw * sizeof(uint64_t));
+  else if(sorted) {
+    for(int j = 0; j < end; ++j) bs[(px[j] == NA_INTEGER ? 0 : (unsigned int)px[j]) >> 6] = 0;
   } else {
-    for (int i = 0, xi; i != l; ++i) {
-      xi = px[po[i]-1];
-      if(xi == NA_INTEGER) {
-        anyNA = 1;
-        continue;
-      }
-      if(h[xi]) continue;
-      ++ndist;
-      if(anyNA && ndist == nlev) break;
-      h[xi] = 1;
+    for(int j = 0, xj; j < end; ++j) {
+      xj = px[po[j]-1];
+      bs[(xj == NA_INTEGER ? 0 : (unsigned int)xj) >> 6] = 0;
     }
   }
-  if(narm == 0) ndist += anyNA;
-  R_Free(h);
   return ndist;
 }
 
+int ndistinct_fct(const int *restrict px, const int *restrict po, const int l, const int nlev, const int sorted, const int narm) {
+  if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_INTEGER);
+  uint64_t *restrict bs = (uint64_t*)R_Calloc(NBITWORDS(nlev), uint64_t);
+  int ndist = ndistinct_fct_noalloc(px, po, bs, l, nlev, sorted, narm);
+  R_Free(bs);
+  return ndist;
+}
+
+// Logical: bits 0, 1 and 2 of seen flag FALSE, TRUE and NA
 int ndistinct_logi(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
   if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_LOGICAL);
-  int seenT = 0, seenF = 0, anyNA = narm; // Ensures breaking works if narm = TRUE or FALSE
-  if(sorted) {
-    for (int i = 0, xi; i != l; ++i) {
-      xi = px[i];
-      if(xi == NA_LOGICAL) {
-        anyNA = 1;
-      } else if(xi) {
-        if(seenT) continue;
-        seenT = 1;
-        if(anyNA && seenF) break;
-      } else {
-        if(seenF) continue;
-        seenF = 1;
-        if(anyNA && seenT) break;
-      }
-    }
-  } else {
-    for (int i = 0, xi; i != l; ++i) {
-      xi = px[po[i]-1];
-      if(xi == NA_LOGICAL) {
-        anyNA = 1;
-      } else if(xi) {
-        if(seenT) continue;
-        seenT = 1;
-        if(anyNA && seenF) break;
-      } else {
-        if(seenF) continue;
-        seenF = 1;
-        if(anyNA && seenT) break;
+  const unsigned int full = narm ? 3 : 7;
+  unsigned int seen = 0;
+  for(int i = 0, end = 0; end < l; i = end) {
+    end = l - i > 256 ? i + 256 : l;
+    if(sorted) {
+      for(int j = i; j < end; ++j) seen |= 1U << (px[j] == NA_LOGICAL ? 2 : (px[j] & 1));
+    } else {
+      for(int j = i, xj; j < end; ++j) {
+        xj = px[po[j]-1];
+        seen |= 1U << (xj == NA_LOGICAL ? 2 : (xj & 1));
       }
     }
+    if((seen & full) == full) break;
   }
-
-  if(narm == 0) seenT += anyNA;
-  return seenT + seenF;
+  seen &= full;
+  return (int)(seen & 1) + (int)((seen >> 1) & 1) + (int)(seen >> 2);
 }
 
-int ndistinct_double(const double *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
+int ndistinct_double_noalloc(const double *restrict px, const int *restrict po, int *restrict h, int *restrict ht, const int l, const int sorted, const int narm) {
   if(l == 1) return !(narm && ISNAN(px[sorted ? 0 : po[0]-1]));
   const size_t l2 = 2U * (size_t) l;
   size_t M = 256, id = 0;
@@ -136,7 +140,6 @@ int ndistinct_double(const double *restrict px, const int *restrict po, const in
     M *= 2;
     K++;
   }
-  int *restrict h = (int*)R_Calloc(M, int); // Table to save the hash values, table has size M
   union uno tpv;
   double xi;
 
@@ -153,7 +156,7 @@ int ndistinct_double(const double *restrict px, const int *restrict po, const in
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      ++ndist;
+      ht[ndist++] = id;
       rbls:;
     }
   } else {
@@ -170,18 +173,25 @@ int ndistinct_double(const double *restrict px, const int *restrict po, const in
         if(++id >= M) id %= M; // ++id; id %= M;
       }
       h[id] = i + 1;
-      ++ndist;
+      ht[ndist++] = id;
       rbl:;
     }
   }
 
-
-  R_Free(h);
+  for(int i = 0; i != ndist; ++i) h[ht[i]] = 0;
   if(narm == 0) ndist += anyNA;
   return ndist;
 }
 
-int ndistinct_string(const SEXP *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
+int ndistinct_double(const double *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
+  if(l == 1) return !(narm && ISNAN(px[sorted ? 0 : po[0]-1]));
+  const size_t M = hash_size(l);
+  int *h = (int*)R_Calloc(M + l, int), res = ndistinct_double_noalloc(px, po, h, h + M, l, sorted, narm);
+  R_Free(h);
+  return res;
+}
+
+int ndistinct_string_noalloc(const SEXP *restrict px, const int *restrict po, int *restrict h, int *restrict ht, const int l, const int sorted, const int narm) {
   if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_STRING);
   const size_t l2 = 2U * (size_t) l;
   size_t M = 256, id = 0;
@@ -190,7 +200,6 @@ int ndistinct_string(const SEXP *restrict px, const int *restrict po, const int
     M *= 2;
     K++;
   }
-  int *restrict h = (int*)R_Calloc(M, int); // Table to save the hash values, table has size M
   SEXP xi;
 
   if(sorted) {
@@ -205,7 +214,7 @@ int ndistinct_string(const SEXP *restrict px, const int *restrict po, const int
         if(++id >= M) id %= M; //++id; id %= M;
       }
       h[id] = i + 1;
-      ++ndist;
+      ht[ndist++] = id;
       sbls:;
     }
   } else {
@@ -221,16 +230,24 @@ int ndistinct_string(const SEXP *restrict px, const int *restrict po, const int
         if(++id >= M) id %= M; //++id; id %= M;
       }
       h[id] = i + 1;
-      ++ndist;
+      ht[ndist++] = id;
       sbl:;
     }
   }
 
-  R_Free(h);
+  for(int i = 0; i != ndist; ++i) h[ht[i]] = 0;
   if(narm == 0) ndist += anyNA;
   return ndist;
 }
 
+int ndistinct_string(const SEXP *restrict px, const int *restrict po, const int l, const int sorted, const int narm) {
+  if(l == 1) return !(narm && px[sorted ? 0 : po[0]-1] == NA_STRING);
+  const size_t M = hash_size(l);
+  int *h = (int*)R_Calloc(M + l, int), res = ndistinct_string_noalloc(px, po, h, h + M, l, sorted, narm);
+  R_Free(h);
+  return res;
+}
+
 // Implementations for R vectors -----------------------------------------------
 
 int ndistinct_impl_int(SEXP x, int narm) {
@@ -251,12 +268,87 @@ SEXP ndistinct_impl(SEXP x, int narm) {
   return ScalarInteger(ndistinct_impl_int(x, narm));
 }
 
-// TODO: Optimize grouped distinct value count for logical vectors??
-SEXP ndistinct_g_impl(SEXP x, const int ng, const int *restrict pgs, const int *restrict po, const int *restrict pst, const int sorted, const int narm, int nthreads) {
+// Parallel loop over groups using the *_noalloc() functions, with scratch space allocated once per thread
+#define NDISTINCT_G_LOOP(FUN, PX, PO, SORTED)                         \
+  _Pragma("omp parallel num_threads(nthreads)")                       \
+  {                                                                   \
+    hscratch s = {NULL, NULL, 0, 1};                                  \
+    _Pragma("omp for")                                                \
+    for(int gr = 0; gr < ng; ++gr) {                                  \
+      if(pgs[gr] == 0) {                                              \
+        pres[gr] = 0;                                                 \
+        continue;                                                     \
+      }                                                               \
+      hscratch_fit(&s, pgs[gr]);                                      \
+      pres[gr] = FUN(PX, PO, s.h, s.v, pgs[gr], SORTED, narm);        \
+    }                                                                 \
+    R_Free(s.h);                                                      \
+  }
+
+// Factors: a bitset of the levels per thread (see ndistinct_fct_noalloc())
+#define NDISTINCT_FCT_G_LOOP(PX, PO, SORTED)                                                   \
+  _Pragma("omp parallel num_threads(nthreads)")                                                \
+  {                                                                                            \
+    uint64_t *restrict bs = (uint64_t*)R_Calloc(NBITWORDS(M), uint64_t);                       \
+    _Pragma("omp for")                                                                         \
+    for(int gr = 0; gr < ng; ++gr)                                                             \
+      pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_fct_noalloc(PX, PO, bs, pgs[gr], M, SORTED, narm); \
+    R_Free(bs);                                                                                \
+  }
 
-  SEXP res = PROTECT(allocVector(INTSXP, ng));
-  int l = length(x), *restrict pres = INTEGER(res);
+// Many tiny groups: distinct values are runs of identical values within the groups of the ordering po of (g, x), where
+// missing values come last. pst are the (1-based) group starts in po.
+#define NDISTINCT_RADIX_LOOP(ISNA_T)                                    \
+  _Pragma("omp parallel for num_threads(nthreads)")                     \
+  for(int gr = 0; gr < ng; ++gr) {                                      \
+    const int *restrict pog = po + pst[gr]-1, lg = pgs[gr];             \
+    int i = 0, nd = 0;                                                  \
+    for(; i < lg && !ISNA_T(pxm[pog[i]]); ++i)                          \
+      if(i == 0 || pxm[pog[i]] != pxm[pog[i-1]]) ++nd;                  \
+    pres[gr] = nd + (narm == 0 && i < lg);                              \
+  }
+
+#undef ISNA_INT
+#define ISNA_INT(x) ((x) == NA_INTEGER)
+#undef ISNA_STR
+#define ISNA_STR(x) ((x) == NA_STRING)
+
+static SEXP ndistinct_g_radix_impl(SEXP x, SEXP g, const int ng, const int *restrict pgs, const int *restrict pst, const int narm, const int nthreads) {
+  SEXP o = PROTECT(gx_radixorder(g, x)), res = PROTECT(allocVector(INTSXP, ng));
+  const int *restrict po = INTEGER(o);
+  int *restrict pres = INTEGER(res);
+  switch(TYPEOF(x)) {
+    case REALSXP: {
+      const double *pxm = REAL(x)-1;
+      NDISTINCT_RADIX_LOOP(ISNAN);
+      break;
+    }
+    case INTSXP: {
+      const int *pxm = INTEGER(x)-1;
+      NDISTINCT_RADIX_LOOP(ISNA_INT);
+      break;
+    }
+    case STRSXP: {
+      const SEXP *pxm = SEXPPTR_RO(x)-1;
+      NDISTINCT_RADIX_LOOP(ISNA_STR);
+      break;
+    }
+    default: error("Not Supported SEXP Type!");
+  }
+  UNPROTECT(2);
+  return res;
+}
+
+// g is the group-id vector of the GRP object, used for the radix ordering with many tiny groups
+SEXP ndistinct_g_impl(SEXP x, SEXP g, const int ng, const int *restrict pgs, const int *restrict po, const int *restrict pst, const int sorted, const int narm, int nthreads) {
+
+  int l = length(x), tx = TYPEOF(x);
   if(nthreads > ng) nthreads = ng;
+  if(RADIX_GROUPS(l, ng) && (tx == REALSXP || tx == STRSXP || (tx == INTSXP && !(isFactor(x) && FCT_GROUPS(l, nlevels(x))))))
+    return ndistinct_g_radix_impl(x, g, ng, pgs, pst, narm, nthreads);
+
+  SEXP res = PROTECT(allocVector(INTSXP, ng));
+  int *restrict pres = INTEGER(res);
 
   if(sorted) { // Sorted: could compute cumulative group size (= starts) on the fly... but doesn't work multithreaded...
     po = &l;
@@ -264,22 +356,16 @@ SEXP ndistinct_g_impl(SEXP x, const int ng, const int *restrict pgs, const int *
     switch(TYPEOF(x)) {
       case REALSXP: {
         const double *px = REAL(x);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_double(px + pst[gr]-1, po, pgs[gr], 1, narm);
+        NDISTINCT_G_LOOP(ndistinct_double_noalloc, px + pst[gr]-1, po, 1);
         break;
       }
       case INTSXP: {
         const int *px = INTEGER(x);
-        if(isFactor(x) && nlevels(x) < l / ng * 3) {
-          int M = nlevels(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_fct(px + pst[gr]-1, po, pgs[gr], M, 1, narm);
+        if(isFactor(x) && FCT_GROUPS(l, nlevels(x))) {
+          const int M = nlevels(x);
+          NDISTINCT_FCT_G_LOOP(px + pst[gr]-1, po, 1);
         } else {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_int(px + pst[gr]-1, po, pgs[gr], 1, narm);
+          NDISTINCT_G_LOOP(ndistinct_int_noalloc, px + pst[gr]-1, po, 1);
         }
         break;
       }
@@ -292,9 +378,7 @@ SEXP ndistinct_g_impl(SEXP x, const int ng, const int *restrict pgs, const int *
       }
       case STRSXP: {
         const SEXP *px = SEXPPTR_RO(x);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_string(px + pst[gr]-1, po, pgs[gr], 1, narm);
+        NDISTINCT_G_LOOP(ndistinct_string_noalloc, px + pst[gr]-1, po, 1);
         break;
       }
       default: error("Not Supported SEXP Type!");
@@ -303,22 +387,16 @@ SEXP ndistinct_g_impl(SEXP x, const int ng, const int *restrict pgs, const int *
     switch(TYPEOF(x)) {
       case REALSXP: {
         const double *px = REAL(x);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_double(px, po + pst[gr]-1, pgs[gr], 0, narm);
+        NDISTINCT_G_LOOP(ndistinct_double_noalloc, px, po + pst[gr]-1, 0);
         break;
       }
       case INTSXP: {
         const int *px = INTEGER(x);
-        if(isFactor(x) && nlevels(x) < l / ng * 3) {
-          int M = nlevels(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_fct(px, po + pst[gr]-1, pgs[gr], M, 0, narm);
+        if(isFactor(x) && FCT_GROUPS(l, nlevels(x))) {
+          const int M = nlevels(x);
+          NDISTINCT_FCT_G_LOOP(px, po + pst[gr]-1, 0);
         } else {
-          #pragma omp parallel for num_threads(nthreads)
-          for(int gr = 0; gr < ng; ++gr)
-            pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_int(px, po + pst[gr]-1, pgs[gr], 0, narm);
+          NDISTINCT_G_LOOP(ndistinct_int_noalloc, px, po + pst[gr]-1, 0);
         }
         break;
       }
@@ -331,9 +409,7 @@ SEXP ndistinct_g_impl(SEXP x, const int ng, const int *restrict pgs, const int *
       }
       case STRSXP: {
         const SEXP *px = SEXPPTR_RO(x);
-        #pragma omp parallel for num_threads(nthreads)
-        for(int gr = 0; gr < ng; ++gr)
-          pres[gr] = pgs[gr] == 0 ? 0 : ndistinct_string(px, po + pst[gr]-1, pgs[gr], 0, narm);
+        NDISTINCT_G_LOOP(ndistinct_string_noalloc, px, po + pst[gr]-1, 0);
         break;
       }
       default: error("Not Supported SEXP Type!");
@@ -371,7 +447,7 @@ SEXP fndistinctC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rnthreads) {
     pst = INTEGER(getAttrib(o, sym_starts));
   }
   if(nthreads > max_threads) nthreads = max_threads;
-  PROTECT(res = ndistinct_g_impl(x, ng, pgs, po, pst, sorted, asLogical(Rnarm), nthreads));
+  PROTECT(res = ndistinct_g_impl(x, pg[1], ng, pgs, po, pst, sorted, asLogical(Rnarm), nthreads));
   if(!isObject(x)) copyMostAttrib(x, res);
   else setAttrib(res, sym_label, getAttrib(x, sym_label));
   UNPROTECT(1);
@@ -436,7 +512,7 @@ SEXP fndistinctlC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads) {
       for(int j = 0; j != l; ++j) {
         SEXP xj = px[j];
         if(length(xj) != gl) error("length(g) must match nrow(x)");
-        SET_VECTOR_ELT(out, j, ndistinct_g_impl(xj, ng, pgs, po, pst, sorted, narm, nthreads));
+        SET_VECTOR_ELT(out, j, ndistinct_g_impl(xj, pg[1], ng, pgs, po, pst, sorted, narm, nthreads));
         if(!isObject(xj)) copyMostAttrib(xj, pout[j]);
         else setAttrib(pout[j], sym_label, getAttrib(xj, sym_label));
       }
@@ -502,6 +578,8 @@ SEXP fndistinctmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads) {
     SEXP res = PROTECT(allocVector(INTSXP, col * ng));
     int *restrict pres = INTEGER(res);
     if(nthreads > col) nthreads = col; // column-level sufficient? or do sub-column level??
+    int maxgrpn = 0; // Scratch space per thread for the hash-based functions
+    for(int i = 0; i != ng; ++i) if(pgs[i] > maxgrpn) maxgrpn = pgs[i];
 
     if(isNull(o)) {
       int *cgs = (int *) R_alloc(ng+2, sizeof(int)), *restrict pgv = INTEGER(pg[1]); cgs[1] = 1;
@@ -523,22 +601,34 @@ SEXP fndistinctmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads) {
       switch(TYPEOF(x)) {
         case REALSXP: {
           double *px = REAL(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            double *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr)
-              pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_double(pxj + pst[gr]-1, po, pgs[gr], 1, narm);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 1};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              double *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr)
+                pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_double_noalloc(pxj + pst[gr]-1, po, s.h, s.v, pgs[gr], 1, narm);
+            }
+            R_Free(s.h);
           }
           break;
         }
         case INTSXP: { // Factor matrix not well defined object...
           int *px = INTEGER(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int *pxj = px + j * l, jng = j * ng;
-            for(int gr = 0; gr < ng; ++gr)
-              pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_int(pxj + pst[gr]-1, po, pgs[gr], 1, narm);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 1};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int *pxj = px + j * l, jng = j * ng;
+              for(int gr = 0; gr < ng; ++gr)
+                pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_int_noalloc(pxj + pst[gr]-1, po, s.h, s.v, pgs[gr], 1, narm);
+            }
+            R_Free(s.h);
           }
           break;
         }
@@ -554,12 +644,18 @@ SEXP fndistinctmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads) {
         }
         case STRSXP: {
           const SEXP *px = SEXPPTR_RO(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            const SEXP *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr)
-              pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_string(pxj + pst[gr]-1, po, pgs[gr], 1, narm);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 1};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              const SEXP *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr)
+                pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_string_noalloc(pxj + pst[gr]-1, po, s.h, s.v, pgs[gr], 1, narm);
+            }
+            R_Free(s.h);
           }
           break;
         }
@@ -570,22 +666,34 @@ SEXP fndistinctmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads) {
       switch(TYPEOF(x)) {
         case REALSXP: {
           double *px = REAL(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            double *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr)
-              pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_double(pxj, po + pst[gr]-1, pgs[gr], 0, narm);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 1};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              double *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr)
+                pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_double_noalloc(pxj, po + pst[gr]-1, s.h, s.v, pgs[gr], 0, narm);
+            }
+            R_Free(s.h);
           }
           break;
         }
         case INTSXP: { // Factor matrix not well defined object...
           int *px = INTEGER(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng, *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr)
-              pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_int(pxj, po + pst[gr]-1, pgs[gr], 0, narm);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 1};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng, *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr)
+                pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_int_noalloc(pxj, po + pst[gr]-1, s.h, s.v, pgs[gr], 0, narm);
+            }
+            R_Free(s.h);
           }
           break;
         }
@@ -601,12 +709,18 @@ SEXP fndistinctmC(SEXP x, SEXP g, SEXP Rnarm, SEXP Rdrop, SEXP Rnthreads) {
         }
         case STRSXP: {
           const SEXP *px = SEXPPTR_RO(x);
-          #pragma omp parallel for num_threads(nthreads)
-          for(int j = 0; j < col; ++j) {
-            int jng = j * ng;
-            const SEXP *pxj = px + j * l;
-            for(int gr = 0; gr < ng; ++gr)
-              pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_string(pxj, po + pst[gr]-1, pgs[gr], 0, narm);
+          #pragma omp parallel num_threads(nthreads)
+          {
+            hscratch s = {NULL, NULL, 0, 1};
+            hscratch_fit(&s, maxgrpn);
+            #pragma omp for
+            for(int j = 0; j < col; ++j) {
+              int jng = j * ng;
+              const SEXP *pxj = px + j * l;
+              for(int gr = 0; gr < ng; ++gr)
+                pres[jng + gr] = pgs[gr] == 0 ? 0 : ndistinct_string_noalloc(pxj, po + pst[gr]-1, s.h, s.v, pgs[gr], 0, narm);
+            }
+            R_Free(s.h);
           }
           break;
         }
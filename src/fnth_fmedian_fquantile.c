@@ -138,6 +138,118 @@ double iquickselect_elem(int *x, const int n, const unsigned int elem, double h)
   return (double)a + h*(double)(b-a);
 }
 
+// Histogram (counting) selection for integers: if the range of the data does not exceed its size, the data is counted once
+// into a histogram of the range, and the elements are found by cumulating the counts. This is linear in the data size and
+// does not require copying or reordering the data. Used automatically by nth_int() and the integer quantile functions.
+// Histograms larger than NTH_HIST_MAXR bins (~256kb) are only used if the data is at least 4 times larger than the range.
+#define NTH_HIST_MAXR 65536
+
+// Counts the data into cnt (space for l integers) if its range is small enough, and saves the minimum to pmin. Returns the
+// number of non-missing values n, 0 if narm = 0 and there are missing values, or -1 if the range is too large.
+// If sorted = 0, po contains the (1-based) indices of the elements of px.
+static int int_hist(const int *restrict px, const int *restrict po, int *restrict cnt, const int l, const int sorted, const int narm, int *pmin) {
+  const int *pxm = px-1;
+  int min = INT_MAX, max = INT_MIN, n = l;
+  if(sorted) {
+    for(int i = 0; i != l; ++i) {
+      if(px[i] < min) min = px[i];
+      if(px[i] > max) max = px[i];
+    }
+  } else {
+    for(int i = 0, v; i != l; ++i) {
+      v = pxm[po[i]];
+      if(v < min) min = v;
+      if(v > max) max = v;
+    }
+  }
+  if(min == NA_INTEGER) { // NA_INTEGER is the smallest integer
+    if(narm == 0) return 0;
+    min = INT_MAX; n = 0;
+    for(int i = 0, v; i != l; ++i) {
+      v = sorted ? px[i] : pxm[po[i]];
+      if(v != NA_INTEGER) {
+        if(v < min) min = v;
+        ++n;
+      }
+    }
+    if(n == 0) return 0;
+  }
+  double r = (double)max - (double)min + 1.0;
+  if(r > n || (r > NTH_HIST_MAXR && 4.0 * r > n)) return -1;
+  memset(cnt, 0, sizeof(int) * (int)r);
+  int *pcnt = cnt - min; // r <= n, thus no overflow in v - min
+  if(n == l) {
+    if(sorted) for(int i = 0; i != l; ++i) ++pcnt[px[i]];
+    else for(int i = 0; i != l; ++i) ++pcnt[pxm[po[i]]];
+  } else if(sorted) {
+    for(int i = 0; i != l; ++i) if(px[i] != NA_INTEGER) ++pcnt[px[i]];
+  } else {
+    for(int i = 0, v; i != l; ++i) {
+      v = pxm[po[i]];
+      if(v != NA_INTEGER) ++pcnt[v];
+    }
+  }
+  *pmin = min;
+  return n;
+}
+
+// Finds the bin of the elem'th smallest element. cum is the number of elements in the bins below bin k.
+// The walk can be resumed from k and cum for larger elements (e.g. several quantiles in ascending order).
+static inline int hist_walk(const int *restrict cnt, const unsigned int elem, int *k, unsigned int *cum) {
+  int j = *k;
+  unsigned int c = *cum;
+  while(c + cnt[j] <= elem) c += cnt[j++];
+  *k = j; *cum = c;
+  return j;
+}
+
+// Same return logic as iquickselect(), and as iquickselect_elem() for ret > 3
+static double hist_nth(const int *restrict cnt, const int min, const int n, const unsigned int elem, const double h,
+                       const int ret, int *k, unsigned int *cum) {
+  double a = (double)min + hist_walk(cnt, elem, k, cum);
+  if((ret < 4 && (ret != 1 || n%2 == 1)) || elem == n-1 || h <= 0.0) return a;
+  int kb = *k;
+  unsigned int cb = *cum;
+  double b = (double)min + hist_walk(cnt, elem+1, &kb, &cb);
+  if(ret == 1) return (a+b)/2.0;
+  return a + h*(b-a);
+}
+
+static double hist_select(const int *restrict cnt, const int min, const int n, const int ret, const double Q) {
+  if(n <= 1) return n == 0 ? NA_REAL : (double)min;
+  int k = 0;
+  unsigned int cum = 0, elem;
+  double h = 0.0; /* To avoid -Wmaybe-uninitialized */
+  RETQSWITCH(n);
+  elem = h; h -= elem;
+  return hist_nth(cnt, min, n, elem, h, ret, &k, &cum);
+}
+
+// Several probabilities (in ascending order) in one walk through the histogram, saved to pres[p * stride]
+static void hist_multiselect(const int *restrict cnt, const int min, const int n, const double *probs, const int np,
+                             const int ret, double *pres, const int stride) {
+  if(n <= 1) {
+    const double val = n == 0 ? NA_REAL : (double)min;
+    for(int p = 0; p < np; ++p) pres[p * stride] = val;
+    return;
+  }
+  int k = 0;
+  unsigned int cum = 0, elem;
+  double h = 0.0, Q;
+  for(int p = 0; p < np; ++p) {
+    Q = probs[p];
+    if(Q <= 0.0) {
+      elem = 0; h = 0.0;
+    } else if(Q >= 1.0) {
+      elem = n-1; h = 0.0;
+    } else {
+      RETQSWITCH(n);
+      elem = h; h -= elem;
+    }
+    pres[p * stride] = hist_nth(cnt, min, n, elem, h, ret, &k, &cum);
+  }
+}
+
 #undef FQUANTILE_CORE
 #define FQUANTILE_CORE(QFUN)                                                  \
   double h, Q;                                                                \
@@ -211,9 +323,36 @@ for(int i = 0, k = 0; i < np; ++i) {                  \
 }
 
 
-SEXP fquantileC(SEXP x, SEXP Rprobs, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEXP Rnames, SEXP checko) {
+// Names of the form paste0(round(probs * 100, 1), "%")
+static SEXP quantile_names(const double *probs, const int np) {
+  SEXP names = PROTECT(allocVector(STRSXP, np));
+  char namei[5], nameid[7];
+  for(int i = 0, dig; i < np; ++i) {
+    dig = (int)(probs[i]*1000) % 10;
+    if(dig == 0) {
+      snprintf(namei, 5, "%d%%", (int)(probs[i]*100));
+      SET_STRING_ELT(names, i, mkChar(namei));
+    } else {
+      snprintf(nameid, 7, "%d.%d%%", (int)(probs[i]*100), dig);
+      SET_STRING_ELT(names, i, mkChar(nameid));
+    }
+  }
+  UNPROTECT(1);
+  return names;
+}
 
+static void check_probs(SEXP Rprobs) {
   if(TYPEOF(Rprobs) != REALSXP) error("probs needs to be a numeric vector");
+  const double *probs = REAL(Rprobs);
+  for(int i = 0; i < length(Rprobs); ++i) {
+    if(probs[i] < 0.0 || probs[i] > 1.0) error("probabilities need to be in range [0, 1]");
+    if(i > 0 && probs[i] < probs[i-1]) error("probabilities need to be passed in ascending order");
+  }
+}
+
+SEXP fquantileC(SEXP x, SEXP Rprobs, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEXP Rnames, SEXP checko) {
+
+  check_probs(Rprobs);
   int tx = TYPEOF(x), n = length(x), np = length(Rprobs), narm = asLogical(Rnarm), ret = asInteger(Rtype), nprotect = 1;
   if(tx != REALSXP && tx != INTSXP && tx != LGLSXP) error("x needs to be numeric");
   if(ret < 4 || ret > 9) error("fquantile only supports continuous quantile types 4-9. You requested type: %d", ret);
@@ -228,25 +367,8 @@ SEXP fquantileC(SEXP x, SEXP Rprobs, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEX
   double *probs = REAL(Rprobs), *pres = REAL(res);
   unsigned int l = 0;
 
-  for(int i = 0; i < np; ++i) {
-    if(probs[i] < 0.0 || probs[i] > 1.0) error("probabilities need to be in range [0, 1]");
-    if(i > 0 && probs[i] < probs[i-1]) error("probabilities need to be passed in ascending order");
-  }
-
   if(asLogical(Rnames)) {
-    SEXP names = PROTECT(allocVector(STRSXP, np)); ++nprotect;
-    char namei[5], nameid[7];
-    for(int i = 0, dig; i < np; ++i) {
-      dig = (int)(probs[i]*1000) % 10;
-      if(dig == 0) {
-        snprintf(namei, 5, "%d%%", (int)(probs[i]*100));
-        SET_STRING_ELT(names, i, mkChar(namei));
-      } else {
-        snprintf(nameid, 7, "%d.%d%%", (int)(probs[i]*100), dig);
-        SET_STRING_ELT(names, i, mkChar(nameid));
-      }
-    }
-    namesgets(res, names);
+    namesgets(res, PROTECT(quantile_names(probs, np))); ++nprotect;
   }
 
   // First the trivial case
@@ -295,6 +417,13 @@ SEXP fquantileC(SEXP x, SEXP Rprobs, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEX
       FQUANTILE_CORE(dquickselect_elem);
     } else { // Integers
       int *x_cc = (int *) R_alloc(n, sizeof(int)), *px = INTEGER(x), x_min, x_max;
+      // Histogram selection if the range is small (keeping the previous behavior with missing values and narm = 0)
+      const int nh = int_hist(px, NULL, x_cc, n, 1, narm, &x_min);
+      if(nh > 1) {
+        hist_multiselect(x_cc, x_min, nh, probs, np, ret, pres, 1);
+        UNPROTECT(nprotect);
+        return res;
+      }
       if(narm) {
         for(unsigned int i = 0; i != n; ++i) if(px[i] != NA_INTEGER) x_cc[l++] = px[i];
         if(l <= 1) {
@@ -536,7 +665,14 @@ return (ret == 1) ? (a+b)/2.0 : a + h * (b - a); //  || Q == 0.5
 double nth_int(const int *restrict px, const int *restrict po, const int l, const int sorted, const int narm, const int ret, const double Q) {
   if(l <= 1) return l == 0 ? NA_REAL : sorted ? (double)px[0] : (double)px[po[0]-1];
 
-  int *x_cc = (int *) R_Calloc(l, int), n = 0;
+  int *x_cc = (int *) R_Calloc(l, int), n, min;
+  // Histogram selection if the range is small, using x_cc for the counts
+  if((n = int_hist(px, po, x_cc, l, sorted, narm, &min)) >= 0) {
+    double res = hist_select(x_cc, min, n, ret, Q);
+    R_Free(x_cc);
+    return res;
+  }
+  n = 0;
   if(sorted) {
     // if(narm) {
       for(int i = 0; i != l; ++i) if(px[i] != NA_INTEGER) x_cc[n++] = px[i];
@@ -562,7 +698,9 @@ double nth_int(const int *restrict px, const int *restrict po, const int l, cons
 double nth_int_noalloc(const int *restrict px, const int *restrict po, int *x_cc, const int l, const int sorted, const int narm, const int ret, const double Q) {
   if(l <= 1) return l == 0 ? NA_REAL : sorted ? (double)px[0] : (double)px[po[0]-1];
 
-  int n = 0;
+  int n, min;
+  if((n = int_hist(px, po, x_cc, l, sorted, narm, &min)) >= 0) return hist_select(x_cc, min, n, ret, Q);
+  n = 0;
 
   if(sorted) {
     for(int i = 0; i != l; ++i) if(px[i] != NA_INTEGER) x_cc[n++] = px[i];
@@ -667,7 +805,119 @@ double w_nth_double_ord(const double *restrict px, const double *restrict pw, co
   WNTH_CORE;
 }
 
-// Quicksort versions: only for grouped execution (too slow on bigger vectors compared to radix sort)
+// Weighted quickselect: partitions x, and the weights w along with it, as QUICKSELECT. But instead of a given element, it finds
+// the first element elem (in sorted order) at which the cumulative weight reaches h, i.e. wsum + w[elem] >= h, or > h if strict.
+// wsum, the sum of the weights of all elements before elem, is saved to *pwsum. Upon return, x[0..elem-1] <= x[elem] <= x[elem+1..n-1].
+#undef WQUICKSELECT
+#define WQUICKSELECT(SWAP)                                                            \
+  unsigned int ir = n-1, l = 0, lp, i, j;                                             \
+  double wl = 0.0, ws, wa;                                                            \
+  if(REACHED(0.0)) { /* First element: the minimum */                                 \
+    for(i = 1; i < n; ++i) if(x[i] < x[0]) SWAP(0, i);                                \
+    *pwsum = 0.0;                                                                     \
+    return 0;                                                                         \
+  }                                                                                   \
+  for(;;) { /* Invariant: the weight below l has not reached h */                     \
+    lp = l+1;                                                                         \
+    if(ir <= lp) { /* Active partition contains 1 or 2 elements. */                   \
+      if(ir == lp && x[ir] < x[l]) SWAP(l, ir);                                       \
+      if(ir == l || REACHED(wl + w[l])) {                                             \
+        *pwsum = wl;                                                                  \
+        return l;                                                                     \
+      }                                                                               \
+      *pwsum = wl + w[l];                                                             \
+      return ir;                                                                      \
+    }                                                                                 \
+    unsigned int mid = (l+ir) >> 1;                                                   \
+    SWAP(mid, lp);                                                                    \
+    if(x[l] > x[ir]) SWAP(l, ir);                                                     \
+    if(x[lp] > x[ir]) SWAP(lp, ir);                                                   \
+    if(x[l] > x[lp]) SWAP(l, lp);                                                     \
+    i = lp; j = ir;                                                                   \
+    a = x[lp]; wa = w[lp];                                                            \
+    for(;;) {                                                                         \
+      do i++; while(x[i] < a);                                                        \
+      do j--; while(x[j] > a);                                                        \
+      if(j < i) break;                                                                \
+      SWAP(i, j);                                                                     \
+    }                                                                                 \
+    x[lp] = x[j]; w[lp] = w[j];                                                       \
+    x[j] = a; w[j] = wa;                                                              \
+    ws = wl;                                                                          \
+    for(i = l; i < j; ++i) ws += w[i];                                                \
+    if(REACHED(ws)) ir = j-1; /* In the lower partition (which is not empty) */       \
+    else if(REACHED(ws + wa) || j == ir) { /* j == ir only if h exceeds the total weight */ \
+      *pwsum = ws;                                                                    \
+      return j;                                                                       \
+    } else {                                                                          \
+      wl = ws + wa;                                                                   \
+      l = j+1;                                                                        \
+    }                                                                                 \
+  }
+
+#undef REACHED
+#define REACHED(ws) (strict ? (ws) > h : (ws) >= h)
+#undef WSWAP
+#define WSWAP(i, j) { tmp = x[i]; x[i] = x[j]; x[j] = tmp; wtmp = w[i]; w[i] = w[j]; w[j] = wtmp; }
+
+static unsigned int w_iquickselect(int *x, double *w, const unsigned int n, const double h, const int strict, double *pwsum) {
+  int a, tmp;
+  double wtmp;
+  WQUICKSELECT(WSWAP);
+}
+
+static unsigned int w_dquickselect(double *x, double *w, const unsigned int n, const double h, const int strict, double *pwsum) {
+  double a, tmp, wtmp;
+  WQUICKSELECT(WSWAP);
+}
+
+// Weighted order statistics from quickselect: same results as WNTH_CORE on the sorted data. Neighbouring elements are the
+// maximum of the section below and the minimum of the section above the selected element. x and w are the copied group data.
+#undef WNTH_CORE_QSELECT
+#define WNTH_CORE_QSELECT(tdef, WQSELECT)                                                  \
+double wsum;                                                                               \
+unsigned int elem;                                                                         \
+if(ret < 3) { /* lower (2), or average (1) element*/                                       \
+  elem = WQSELECT(x, w, n, h, 0, &wsum);                                                   \
+  double a = x[elem];                                                                      \
+  if(ret == 2 || wsum + w[elem] > h+eps || elem == n-1) return a;                          \
+  double wb = a, nb = 1.0; /* Average with the following elements up to the first with positive weight */ \
+  for(unsigned int k = elem+1; k < n; ++k) {                                               \
+    for(unsigned int i = k+1; i < n; ++i) if(x[i] < x[k]) WSWAP(k, i);                     \
+    wb += x[k]; ++nb;                                                                      \
+    if(w[k] != 0.0) break;                                                                 \
+  }                                                                                        \
+  return wb / nb;                                                                          \
+}                                                                                          \
+elem = WQSELECT(x, w, n, h + eps, 1, &wsum);                                               \
+if(ret == 3) return x[elem];                                                               \
+h = (double)elem - 1.0 + (h - wsum) / w[elem];                                             \
+RETWQADDM;                                                                                 \
+int j = (int)h; h -= j;                                                                    \
+tdef xj = x[elem], xj1;                                                                    \
+if(j < (int)elem) { /* j = elem - 1: the largest element below */                          \
+  xj1 = xj; xj = x[0];                                                                     \
+  for(unsigned int i = 1; i < elem; ++i) if(x[i] > xj) xj = x[i];                          \
+} else {                                                                                   \
+  if(j >= n-1 || h < eps) return xj;                                                       \
+  xj1 = x[elem+1];                                                                         \
+  for(unsigned int i = elem+2; i < n; ++i) if(x[i] < xj1) xj1 = x[i];                      \
+}                                                                                          \
+return h < eps ? xj : (1 - h) * xj + h * xj1;
+
+static double w_nth_int_qselect(int *x, double *w, const int n, double h, const int ret, const double Q) {
+  int tmp;
+  double wtmp;
+  WNTH_CORE_QSELECT(int, w_iquickselect);
+}
+
+static double w_nth_double_qselect(double *x, double *w, const int n, double h, const int ret, const double Q) {
+  double tmp, wtmp;
+  WNTH_CORE_QSELECT(double, w_dquickselect);
+}
+
+// Versions for grouped execution (too slow on bigger vectors compared to radix sort). These previously sorted each group
+// with R's quicksort (hence the name), and now copy the group's values and weights and apply weighted quickselect.
 // Expects pointer pw to be decremented by 1 if sorted == 0
 double w_nth_int_qsort(const int *restrict px, const double *restrict pw, const int *restrict po, double h,
                        const int l, const int sorted, const int narm, const int ret, const double Q) {
@@ -677,58 +927,34 @@ double w_nth_int_qsort(const int *restrict px, const double *restrict pw, const
     return ISNAN(pw[po[0]]) ? NA_REAL : (double)px[po[0]-1];
   }
 
-  int *x_cc = (int *) R_Calloc(l, int), *i_cc = (int *) R_Calloc(l, int), n = 0; // TODO: alloc i_cc afterwards if narm ??
+  int *x_cc = (int *) R_Calloc(l, int), n = 0;
+  double *w_cc = (double *) R_Calloc(l, double);
 
   if(sorted) { // both the pointers to x and w need to be suitably incremented for grouped execution.
-    // if(narm) {
-      for(int i = 0; i != l; ++i) {
-        if(px[i] != NA_INTEGER) {
-          i_cc[n] = i;
-          x_cc[n++] = px[i];
-        }
+    for(int i = 0; i != l; ++i) {
+      if(px[i] != NA_INTEGER) {
+        w_cc[n] = pw[i];
+        x_cc[n++] = px[i];
       }
-    // } else {
-    //   n = l;
-    //   for(int i = 0; i != l; ++i) {
-    //     i_cc[i] = i;
-    //     x_cc[i] = px[i];
-    //   }
-    // }
+    }
   } else {
     const int *pxm = px-1;
-    // if(narm) {
-      for(int i = 0; i != l; ++i) {
-        if(pxm[po[i]] != NA_INTEGER) {
-          i_cc[n] = po[i];
-          x_cc[n++] = pxm[po[i]];
-        }
+    for(int i = 0; i != l; ++i) {
+      if(pxm[po[i]] != NA_INTEGER) {
+        w_cc[n] = pw[po[i]];
+        x_cc[n++] = pxm[po[i]];
       }
-    // } else {
-    //   n = l;
-    //   for(int i = 0; i != l; ++i) {
-    //     i_cc[i] = po[i];
-    //     x_cc[i] = pxm[po[i]];
-    //   }
-    // }
-  }
-
-  if(narm == 0 && n != l) {
-    R_Free(x_cc); R_Free(i_cc);
-    return NA_REAL;
+    }
   }
 
-  // i_cc is one-indexed
-  R_qsort_int_I(x_cc, i_cc, 1, n);
-
-  if(h == DBL_MIN) h = w_compute_h(pw, i_cc, n, 0, Q);
-  if(ISNAN(h)) {
-    R_Free(x_cc); R_Free(i_cc);
-    return NA_REAL;
+  double res = NA_REAL;
+  if(n > 0 && (narm || n == l)) {
+    if(h == DBL_MIN) h = w_compute_h(w_cc, NULL, n, 1, Q);
+    if(n == 1) res = x_cc[0];
+    else if(NISNAN(h)) res = w_nth_int_qselect(x_cc, w_cc, n, h, ret, Q);
   }
 
-  WNTH_CORE_QSORT;
-
-  R_Free(x_cc); R_Free(i_cc);
+  R_Free(x_cc); R_Free(w_cc);
   return res;
 }
 
@@ -741,62 +967,34 @@ double w_nth_double_qsort(const double *restrict px, const double *restrict pw,
     return ISNAN(pw[po[0]]) ? NA_REAL : px[po[0]-1];
   }
 
-  double *x_cc = (double *) R_Calloc(l, double);
-  int *i_cc = (int *) R_Calloc(l, int), n = 0; // TODO: alloc afterwards if narm ??
+  double *x_cc = (double *) R_Calloc(l, double), *w_cc = (double *) R_Calloc(l, double);
+  int n = 0;
 
   if(sorted) {
-    // if(narm) {
-      for(int i = 0; i != l; ++i) {
-        if(NISNAN(px[i])) {
-          i_cc[n] = i;
-          x_cc[n++] = px[i];
-        }
+    for(int i = 0; i != l; ++i) {
+      if(NISNAN(px[i])) {
+        w_cc[n] = pw[i];
+        x_cc[n++] = px[i];
       }
-    // } else {
-    //   n = l;
-    //   for(int i = 0; i != l; ++i) {
-    //     i_cc[i] = i;
-    //     x_cc[i] = px[i];
-    //   }
-    // }
+    }
   } else {
     const double *pxm = px-1;
-    // if(narm) {
-      for(int i = 0; i != l; ++i) {
-        if(NISNAN(pxm[po[i]])) {
-          i_cc[n] = po[i];
-          x_cc[n++] = pxm[po[i]];
-        }
+    for(int i = 0; i != l; ++i) {
+      if(NISNAN(pxm[po[i]])) {
+        w_cc[n] = pw[po[i]];
+        x_cc[n++] = pxm[po[i]];
       }
-    // } else {
-    //   n = l;
-    //   for(int i = 0; i != l; ++i) {
-    //     i_cc[i] = po[i];
-    //     x_cc[i] = pxm[po[i]];
-    //   }
-    // }
+    }
   }
 
-  if(narm == 0 && n != l) {
-    R_Free(x_cc); R_Free(i_cc);
-    return NA_REAL;
+  double res = NA_REAL;
+  if(n > 0 && (narm || n == l)) {
+    if(h == DBL_MIN) h = w_compute_h(w_cc, NULL, n, 1, Q);
+    if(n == 1) res = x_cc[0];
+    else if(NISNAN(h)) res = w_nth_double_qselect(x_cc, w_cc, n, h, ret, Q);
   }
 
-  // i_cc is one-indexed
-  R_qsort_I(x_cc, i_cc, 1, n);
-
-  if(h == DBL_MIN) h = w_compute_h(pw, i_cc, n, 0, Q);
-
-  if(ISNAN(h)) {
-    R_Free(x_cc);
-    R_Free(i_cc);
-    return NA_REAL;
-  }
-
-  WNTH_CORE_QSORT;
-
-  R_Free(x_cc);
-  R_Free(i_cc);
+  R_Free(x_cc); R_Free(w_cc);
   return res;
 }
 
@@ -1143,7 +1341,7 @@ int Rties2int(SEXP x) {
   int tx = TYPEOF(x);
   if(tx == INTSXP || tx == REALSXP || tx == LGLSXP) {
     int ret = asInteger(x);
-    if(ret < 1 || ret > 9) error("ties must be 1-9, you supplied: %d", ret);
+    if(ret < 1 || ret > 10) error("ties must be 1-10, you supplied: %d", ret);
     return ret;
   }
   if(tx != STRSXP) error("ties must be integer or character");
@@ -1157,6 +1355,7 @@ int Rties2int(SEXP x) {
   if(strcmp(r, "q7") == 0) return 7;
   if(strcmp(r, "q8") == 0) return 8;
   if(strcmp(r, "q9") == 0) return 9;
+  if(strcmp(r, "approx") == 0) return 10; // t-digest, see qsketch.c
   error("Unknown ties option: %s", r);
 }
 
@@ -1166,7 +1365,7 @@ int Rties2int(SEXP x) {
   double Q = asReal(p);                                                                                                                                                          \
   if(ISNAN(Q) || Q <= 0.0 || Q == 1.0) error("n needs to be between 0 and 1, or between 1 and length(x). Use fmin and fmax for minima and maxima.");                             \
   if(Q > 1.0) {                                                                                                                                                                  \
-    ret = 2; /* ties = "min" */                                                                                                                                                    \
+    if(ret != 10) ret = 2; /* ties = "min" */                                                                                                                                      \
     if(nullg) {                                                                                                                                                                  \
       if(Q >= l) error("n needs to be between 0 and 1, or between 1 and length(x). Use fmin and fmax for minima and maxima.");                                                   \
       Q = (Q-1.0)/(l-1);                                                                                                                                                         \
@@ -1235,6 +1434,17 @@ SEXP fnthC(SEXP x, SEXP p, SEXP g, SEXP w, SEXP Rnarm, SEXP Rret, SEXP Rnthreads
   // if(l < 1) return x;
   if(l < 1 || (l == 1 && nullw)) return TYPEOF(x) == REALSXP ? x : l < 1 ? allocVector(REALSXP, 0) : ScalarReal(asReal(x));
 
+  // Approximate quantiles from t-digests: o is not needed
+  if(ret == 10) {
+    double *pw = NULL;
+    if(!nullw) {
+      CHECK_WEIGHTS(l);
+    }
+    SEXP res = nth_approx_impl(x, g, nullw ? NULL : pw+1, narm, Q, asInteger(Rnthreads));
+    UNPROTECT(nprotect);
+    return res;
+  }
+
   // First the simplest case
   if(nullg && nullw && nullo) return nth_impl(x, narm, ret, Q);
 
@@ -1382,6 +1592,20 @@ SEXP fnthlC(SEXP x, SEXP p, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, S
     if(nullg && !narm) h = w_compute_h(pw+1, &l, nrx, 1, Q); // if no missing value removal, h is the same for all columns
   }
 
+  if(ret == 10) { // Approximate quantiles from t-digests: multithreading within columns
+    const double *pwa = nullw ? NULL : pw+1;
+    if(nullg && drop) {
+      double *restrict pout = REAL(out);
+      for(int j = 0; j != l; ++j) pout[j] = REAL(nth_approx_impl(px[j], g, pwa, narm, Q, nthreads))[0];
+      setAttrib(out, R_NamesSymbol, getAttrib(x, R_NamesSymbol));
+    } else {
+      for(int j = 0; j != l; ++j) SET_VECTOR_ELT(out, j, nth_approx_impl(px[j], g, pwa, narm, Q, nthreads));
+      DFcopyAttr(out, x, nullg ? 0 : asInteger(VECTOR_ELT(g, 0)));
+    }
+    UNPROTECT(nprotect);
+    return out;
+  }
+
   if(nullg) { // No groups, multithreading across columns
     if(nthreads > l) nthreads = l;
     if(drop) { // drop dimensions (return vector)
@@ -1559,6 +1783,14 @@ SEXP fnthmC(SEXP x, SEXP p, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, S
     if(nullg && !narm) h = w_compute_h(pw+1, &l, l, 1, Q);
   }
 
+  if(ret == 10) { // Approximate quantiles from t-digests: multithreading within columns
+    int ng;
+    SEXP res = PROTECT(nth_approx_mat(x, g, nullw ? NULL : pw+1, narm, Q, asInteger(Rnthreads), &ng));
+    matCopyAttr(res, x, Rdrop, ng);
+    UNPROTECT(nprotect);
+    return res;
+  }
+
   if(nullg) {
     SEXP res = PROTECT(allocVector(REALSXP, col));
 
@@ -1625,3 +1857,322 @@ SEXP fnthmC(SEXP x, SEXP p, SEXP g, SEXP w, SEXP Rnarm, SEXP Rdrop, SEXP Rret, S
   return res;
 }
 
+
+
+
+// --------------------------------------------------------------------------
+// Grouped quantiles: several probabilities per group in one pass
+// --------------------------------------------------------------------------
+
+// Same as dquickselect(), but for a given element, and odd indicating if the sample size is odd. This allows calling it on
+// the upper section x + offset of the data for nested selection: after selecting element elem, all elements before it are
+// smaller or equal and all elements after it larger or equal, so the next (larger) element can be selected from x + elem.
+static double dquickselect_nested(double *x, const int n, const unsigned int elem, const double h, const int ret, const int odd) {
+  double a, b;
+  QUICKSELECT(dswap);
+  if((ret < 4 && (ret != 1 || odd)) || elem == n-1 || h <= 0.0) return a;
+  b = x[elem+1];
+  for(int i = elem+2; i < n; ++i) if(x[i] < b) b = x[i];
+  if(ret == 1) return (a+b)/2.0;
+  return a + h*(b-a);
+}
+
+static double iquickselect_nested(int *x, const int n, const unsigned int elem, const double h, const int ret, const int odd) {
+  int a, b;
+  QUICKSELECT(iswap);
+  if((ret < 4 && (ret != 1 || odd)) || elem == n-1 || h <= 0.0) return (double)a;
+  b = x[elem+1];
+  for(int i = elem+2; i < n; ++i) if(x[i] < b) b = x[i];
+  if(ret == 1) return ((double)a+(double)b)/2.0;
+  return (double)a + h*(double)(b-a);
+}
+
+// Computes all quantiles (probs in ascending order) of x_cc (without missing values) and saves them to pres[k * stride].
+// Probabilities 0 and 1 are computed ex-post from the sections below the first and above the last selected element.
+#undef MULTISELECT
+#define MULTISELECT(QFUN)                                                          \
+  if(n <= 1) {                                                                     \
+    const double val = n == 0 ? NA_REAL : (double)x_cc[0];                         \
+    for(int k = 0; k < np; ++k) pres[k * stride] = val;                            \
+    return;                                                                        \
+  }                                                                                \
+  double h = 0.0, Q;                                                               \
+  int ih, first = -1, offset = 0, k = 0;                                           \
+  for(; k < np; ++k) {                                                             \
+    Q = probs[k];                                                                  \
+    if(Q <= 0.0 || Q >= 1.0) continue;                                             \
+    RETQSWITCH(n);                                                                 \
+    ih = h; /* h > -1, truncated to 0 if negative */                               \
+    pres[k * stride] = QFUN(x_cc + offset, n - offset, ih - offset, h - ih, ret, n % 2); \
+    if(first < 0) first = ih;                                                      \
+    offset = ih;                                                                   \
+  }                                                                                \
+  if(probs[0] == 0.0) {                                                            \
+    int end = first < 0 ? n : first + 1;                                           \
+    x_min = x_cc[0];                                                               \
+    for(int i = 1; i < end; ++i) if(x_cc[i] < x_min) x_min = x_cc[i];              \
+    for(k = 0; k < np && probs[k] == 0.0; ++k) pres[k * stride] = (double)x_min;   \
+  }                                                                                \
+  if(probs[np-1] == 1.0) {                                                         \
+    x_max = x_cc[offset];                                                          \
+    for(int i = offset+1; i < n; ++i) if(x_cc[i] > x_max) x_max = x_cc[i];         \
+    for(k = np-1; k >= 0 && probs[k] == 1.0; --k) pres[k * stride] = (double)x_max; \
+  }
+
+static void dmultiselect(double *x_cc, const int n, const double *probs, const int np, const int ret, double *pres, const int stride) {
+  double x_min, x_max;
+  MULTISELECT(dquickselect_nested);
+}
+
+static void imultiselect(int *x_cc, const int n, const double *probs, const int np, const int ret, double *pres, const int stride) {
+  int x_min, x_max;
+  MULTISELECT(iquickselect_nested);
+}
+
+// Each group is copied once to x_cc (as in nth_double_noalloc()), followed by nested quickselect
+void nth_double_multi(const double *restrict px, const int *restrict po, double *x_cc, const int l, const int sorted, const int narm,
+                      const int ret, const double *probs, const int np, double *pres, const int stride) {
+  int n = 0;
+  if(sorted) {
+    for(int i = 0; i != l; ++i) if(NISNAN(px[i])) x_cc[n++] = px[i];
+  } else {
+    const double *pxm = px-1;
+    for(int i = 0; i != l; ++i) if(NISNAN(pxm[po[i]])) x_cc[n++] = pxm[po[i]];
+  }
+  dmultiselect(x_cc, (narm == 0 && n != l) ? 0 : n, probs, np, ret, pres, stride);
+}
+
+void nth_int_multi(const int *restrict px, const int *restrict po, int *x_cc, const int l, const int sorted, const int narm,
+                   const int ret, const double *probs, const int np, double *pres, const int stride) {
+  int n, min;
+  if((n = int_hist(px, po, x_cc, l, sorted, narm, &min)) >= 0) {
+    hist_multiselect(x_cc, min, n, probs, np, ret, pres, stride);
+    return;
+  }
+  n = 0;
+  if(sorted) {
+    for(int i = 0; i != l; ++i) if(px[i] != NA_INTEGER) x_cc[n++] = px[i];
+  } else {
+    const int *pxm = px-1;
+    for(int i = 0; i != l; ++i) if(pxm[po[i]] != NA_INTEGER) x_cc[n++] = pxm[po[i]];
+  }
+  imultiselect(x_cc, (narm == 0 && n != l) ? 0 : n, probs, np, ret, pres, stride);
+}
+
+// Weighted: the group is copied and sorted once (as in w_nth_double_qsort()), and the total weight computed once.
+// As in fquantile(), probabilities 0 and 1 give the smallest and largest element with non-zero weight.
+#undef W_MULTI_QSORT_CORE
+#define W_MULTI_QSORT_CORE                                                          \
+  if(narm == 0 && n != l) n = 0;                                                   \
+  double sumw = n == 0 ? 0.0 : w_compute_h(pw, i_cc, n, 0, 1.0);                   \
+  if(n == 0 || sumw < eps) {                                                       \
+    for(int p = 0; p < np; ++p) pres[p * stride] = NA_REAL;                        \
+    return;                                                                        \
+  }                                                                                \
+  for(int p = 0; p < np; ++p) {                                                    \
+    double Q = probs[p], h;                                                        \
+    if(n == 1) {                                                                   \
+      pres[p * stride] = x_cc[0];                                                  \
+    } else if(Q > 0.0 && Q < 1.0) {                                                \
+      h = Q * sumw;                                                                \
+      WNTH_CORE_QSORT;                                                             \
+      pres[p * stride] = res;                                                      \
+    } else {                                                                       \
+      int k = Q == 0.0 ? 0 : n-1;                                                  \
+      if(Q == 0.0) while(pw[i_cc[k]] == 0.0) ++k;                                  \
+      else while(pw[i_cc[k]] == 0.0) --k;                                          \
+      pres[p * stride] = x_cc[k];                                                  \
+    }                                                                              \
+  }
+
+// Expects pointer pw to be decremented by 1 if sorted == 0
+void w_nth_double_multi(const double *restrict px, const double *restrict pw, const int *restrict po, double *x_cc, int *i_cc,
+                        const int l, const int sorted, const int narm, const int ret, const double *probs, const int np,
+                        double *pres, const int stride) {
+  int n = 0;
+  if(sorted) {
+    for(int i = 0; i != l; ++i) {
+      if(NISNAN(px[i])) {
+        i_cc[n] = i;
+        x_cc[n++] = px[i];
+      }
+    }
+  } else {
+    const double *pxm = px-1;
+    for(int i = 0; i != l; ++i) {
+      if(NISNAN(pxm[po[i]])) {
+        i_cc[n] = po[i];
+        x_cc[n++] = pxm[po[i]];
+      }
+    }
+  }
+  if(n > 1) R_qsort_I(x_cc, i_cc, 1, n);
+  W_MULTI_QSORT_CORE;
+}
+
+void w_nth_int_multi(const int *restrict px, const double *restrict pw, const int *restrict po, int *x_cc, int *i_cc,
+                     const int l, const int sorted, const int narm, const int ret, const double *probs, const int np,
+                     double *pres, const int stride) {
+  int n = 0;
+  if(sorted) {
+    for(int i = 0; i != l; ++i) {
+      if(px[i] != NA_INTEGER) {
+        i_cc[n] = i;
+        x_cc[n++] = px[i];
+      }
+    }
+  } else {
+    const int *pxm = px-1;
+    for(int i = 0; i != l; ++i) {
+      if(pxm[po[i]] != NA_INTEGER) {
+        i_cc[n] = po[i];
+        x_cc[n++] = pxm[po[i]];
+      }
+    }
+  }
+  if(n > 1) R_qsort_int_I(x_cc, i_cc, 1, n);
+  W_MULTI_QSORT_CORE;
+}
+
+// With an ordering vector that takes into account the grouping (see fnthC()): no copying or selection required.
+// Expects pointers px and pw to be decremented by 1. pw is ignored if w is 0.
+#undef MULTI_ORD_CORE
+#define MULTI_ORD_CORE(ISNA, NTHFUN, WNTHFUN)                                      \
+  if(l > 0) {                                                                      \
+    if(narm) while(l != 0 && ISNA(px[po[l-1]])) --l;                               \
+    else if(ISNA(px[po[l-1]])) l = 0;                                              \
+  }                                                                                \
+  double sumw = (w && l > 0) ? w_compute_h(pw, po, l, 0, 1.0) : 1.0;              \
+  if(l == 0 || sumw < eps) {                                                       \
+    for(int p = 0; p < np; ++p) pres[p * stride] = NA_REAL;                        \
+    return;                                                                        \
+  }                                                                                \
+  for(int p = 0; p < np; ++p) {                                                    \
+    double Q = probs[p];                                                           \
+    if(Q > 0.0 && Q < 1.0) {                                                       \
+      pres[p * stride] = w ? WNTHFUN(px, pw, po, Q * sumw, l, narm, ret, Q) : NTHFUN(px, po, l, narm, ret, Q); \
+    } else {                                                                       \
+      int k = Q == 0.0 ? 0 : l-1;                                                  \
+      if(w) {                                                                      \
+        if(Q == 0.0) while(pw[po[k]] == 0.0) ++k;                                  \
+        else while(pw[po[k]] == 0.0) --k;                                          \
+      }                                                                            \
+      pres[p * stride] = px[po[k]];                                                \
+    }                                                                              \
+  }
+
+#undef ISNA_INT
+#define ISNA_INT(x) ((x) == NA_INTEGER)
+
+void nth_double_multi_ord(const double *restrict px, const double *restrict pw, const int *restrict po, int l, const int w, const int narm,
+                          const int ret, const double *probs, const int np, double *pres, const int stride) {
+  MULTI_ORD_CORE(ISNAN, nth_double_ord, w_nth_double_ord);
+}
+
+void nth_int_multi_ord(const int *restrict px, const double *restrict pw, const int *restrict po, int l, const int w, const int narm,
+                       const int ret, const double *probs, const int np, double *pres, const int stride) {
+  MULTI_ORD_CORE(ISNA_INT, nth_int_ord, w_nth_int_ord);
+}
+
+/*
+ Grouped version of fquantile(): returns a ng * length(probs) matrix. Each group is processed by one thread, which
+ copies it once to scratch space of size max(GRPN(g)) allocated once per thread, and selects all quantiles in one pass.
+ If o is supplied, it needs to take into account the grouping (see fnthC()).
+*/
+SEXP fquantilegC(SEXP x, SEXP Rprobs, SEXP g, SEXP w, SEXP o, SEXP Rnarm, SEXP Rtype, SEXP Rnames, SEXP checko, SEXP Rnthreads) {
+
+  check_probs(Rprobs);
+  int tx = TYPEOF(x), l = length(x), np = length(Rprobs), narm = asLogical(Rnarm), ret = asInteger(Rtype),
+    nthreads = asInteger(Rnthreads), nullw = isNull(w), nullo = isNull(o), nprotect = 1, ng;
+  if(tx != REALSXP && tx != INTSXP && tx != LGLSXP) error("x needs to be numeric");
+  if(ret < 4 || ret > 9) error("fquantile only supports continuous quantile types 4-9. You requested type: %d", ret);
+  if(nthreads > max_threads) nthreads = max_threads;
+
+  double *pw = &eps, *probs = REAL(Rprobs);
+  int *pxo = &l;
+
+  if(!nullo) {
+    if(length(o) != l || TYPEOF(o) != INTSXP) error("o must be a valid ordering vector, of the same length as x and type integer");
+    pxo = INTEGER(o);
+    if(asLogical(checko)) {
+      for(unsigned int i = 0; i != l; ++i)
+        if(pxo[i] < 1 || pxo[i] > l) error("Some elements in o are outside of range [1, length(x)]");
+    }
+    --pxo;
+  }
+  if(!nullw) {
+    CHECK_WEIGHTS(l);
+  }
+
+  CHECK_GROUPS(l, sorted || !nullo);
+  if(nthreads > ng) nthreads = ng;
+  if(maxgrpn == 0) for(int i = 0; i != ng; ++i) if(pgs[i] > maxgrpn) maxgrpn = pgs[i];
+
+  SEXP res = PROTECT(allocMatrix(REALSXP, ng, np));
+  if(np == 0) { // quantile(x, numeric(0)), as in fquantileC()
+    UNPROTECT(nprotect);
+    return res;
+  }
+  double *pres = REAL(res);
+
+  if(!nullo) {
+    if(tx == REALSXP) {
+      const double *px = REAL(x)-1;
+      #pragma omp parallel for num_threads(nthreads)
+      for(int gr = 0; gr < ng; ++gr)
+        nth_double_multi_ord(px, pw, pxo + pst[gr], pgs[gr], !nullw, narm, ret, probs, np, pres + gr, ng);
+    } else {
+      const int *px = INTEGER(x)-1;
+      #pragma omp parallel for num_threads(nthreads)
+      for(int gr = 0; gr < ng; ++gr)
+        nth_int_multi_ord(px, pw, pxo + pst[gr], pgs[gr], !nullw, narm, ret, probs, np, pres + gr, ng);
+    }
+  } else if(tx == REALSXP) {
+    const double *px = sorted ? REAL(x)-1 : REAL(x);
+    #pragma omp parallel num_threads(nthreads)
+    {
+      double *x_cc = (double *) R_Calloc(maxgrpn, double);
+      int *i_cc = nullw ? NULL : (int *) R_Calloc(maxgrpn, int);
+      #pragma omp for
+      for(int gr = 0; gr < ng; ++gr) {
+        if(nullw) {
+          if(sorted) nth_double_multi(px + pst[gr], po, x_cc, pgs[gr], 1, narm, ret, probs, np, pres + gr, ng);
+          else nth_double_multi(px, po + pst[gr], x_cc, pgs[gr], 0, narm, ret, probs, np, pres + gr, ng);
+        } else {
+          if(sorted) w_nth_double_multi(px + pst[gr], pw + pst[gr], po, x_cc, i_cc, pgs[gr], 1, narm, ret, probs, np, pres + gr, ng);
+          else w_nth_double_multi(px, pw, po + pst[gr], x_cc, i_cc, pgs[gr], 0, narm, ret, probs, np, pres + gr, ng);
+        }
+      }
+      R_Free(x_cc);
+      if(i_cc) R_Free(i_cc);
+    }
+  } else {
+    const int *px = sorted ? INTEGER(x)-1 : INTEGER(x);
+    #pragma omp parallel num_threads(nthreads)
+    {
+      int *x_cc = (int *) R_Calloc(maxgrpn, int);
+      int *i_cc = nullw ? NULL : (int *) R_Calloc(maxgrpn, int);
+      #pragma omp for
+      for(int gr = 0; gr < ng; ++gr) {
+        if(nullw) {
+          if(sorted) nth_int_multi(px + pst[gr], po, x_cc, pgs[gr], 1, narm, ret, probs, np, pres + gr, ng);
+          else nth_int_multi(px, po + pst[gr], x_cc, pgs[gr], 0, narm, ret, probs, np, pres + gr, ng);
+        } else {
+          if(sorted) w_nth_int_multi(px + pst[gr], pw + pst[gr], po, x_cc, i_cc, pgs[gr], 1, narm, ret, probs, np, pres + gr, ng);
+          else w_nth_int_multi(px, pw, po + pst[gr], x_cc, i_cc, pgs[gr], 0, narm, ret, probs, np, pres + gr, ng);
+        }
+      }
+      R_Free(x_cc);
+      if(i_cc) R_Free(i_cc);
+    }
+  }
+
+  if(ANY_ATTRIB(x) && !(isObject(x) && inherits(x, "ts"))) copyMostAttrib(x, res);
+  if(asLogical(Rnames)) {
+    SEXP dn = PROTECT(allocVector(VECSXP, 2)); ++nprotect;
+    SET_VECTOR_ELT(dn, 1, quantile_names(probs, np));
+    dimnamesgets(res, dn);
+  }
+  UNPROTECT(nprotect);
+  return res;
+}
@@ -0,0 +1,211 @@
+#include "collapse_c.h"
+
+/*
+ Mergeable accumulator states for the streaming (chunked) aggregation of numeric data with fstate(). For each group and
+ column, a state holds the number of (non-missing) observations, the (weighted) sum, the mean and the sum of squared
+ deviations from the mean (M2, updated with Welford's / West's algorithm), the extrema and the first and last values.
+ States of different chunks are combined with the pairwise update of Chan et al. (1979), in the order the chunks are
+ supplied, so that the first and last values refer to the first and last chunk containing the group.
+ A state is a list with elements n (rows per group), nobs, [sumw], sum, mean, M2, min, max, first and last, each a
+ ng x k matrix (n is a vector). With na.rm = FALSE a missing value sets sum, mean, M2, min and max of the group to NA,
+ and first / last are the first / last values irrespective of whether they are missing.
+*/
+
+static const char *fstate_names[] = {"n", "nobs", "sumw", "sum", "mean", "M2", "min", "max", "first", "last"};
+
+// Allocates an (empty) state with ng groups and k columns
+static SEXP fstate_alloc(const int ng, const int k, const int weights, SEXP names) {
+  const int nel = 9 + weights;
+  SEXP res = PROTECT(allocVector(VECSXP, nel)), nam = PROTECT(allocVector(STRSXP, nel)),
+    dn = PROTECT(allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(dn, 1, names);
+  SET_VECTOR_ELT(res, 0, allocVector(REALSXP, ng));
+  SET_STRING_ELT(nam, 0, mkChar("n"));
+  memset(REAL(VECTOR_ELT(res, 0)), 0, ng * sizeof(double));
+  for(int e = 1, j = 1; e < 10; ++e) {
+    if(e == 2 && !weights) continue;
+    SEXP m = SET_VECTOR_ELT(res, j, allocMatrix(REALSXP, ng, k));
+    double *pm = REAL(m), init = e == 6 ? R_PosInf : e == 7 ? R_NegInf : e > 7 ? NA_REAL : 0.0;
+    for(R_xlen_t i = 0, n = (R_xlen_t)ng * k; i < n; ++i) pm[i] = init;
+    dimnamesgets(m, dn);
+    SET_STRING_ELT(nam, j++, mkChar(fstate_names[e]));
+  }
+  namesgets(res, nam);
+  UNPROTECT(3);
+  return res;
+}
+
+// Pointers to the elements of a state, with sumw = NULL if unweighted
+typedef struct { double *n, *nobs, *sumw, *sum, *mean, *M2, *min, *max, *first, *last; } fstate_ptr;
+
+static fstate_ptr fstate_pointers(SEXP x, const int weights) {
+  const SEXP *px = SEXPPTR_RO(x);
+  fstate_ptr p;
+  p.n = REAL(px[0]);
+  p.nobs = REAL(px[1]);
+  p.sumw = weights ? REAL(px[2]) : NULL;
+  px += weights;
+  p.sum = REAL(px[2]); p.mean = REAL(px[3]); p.M2 = REAL(px[4]);
+  p.min = REAL(px[5]); p.max = REAL(px[6]); p.first = REAL(px[7]); p.last = REAL(px[8]);
+  return p;
+}
+
+// Accumulates column x into column offset o of the state (unweighted if pw == NULL). With na.rm = FALSE, the first and last
+// values are taken from the first and last rows of each group (fr and lr).
+static void fstate_col(const fstate_ptr *s, const R_xlen_t o, SEXP x, const int *pg, const double *pw, const int l, const int ng,
+                       const int narm, const int *fr, const int *lr) {
+  const int isint = TYPEOF(x) != REALSXP;
+  const int *pxi = isint ? INTEGER(x) : NULL;
+  const double *px = isint ? NULL : REAL(x);
+  double *restrict nobs = s->nobs + o, *restrict sum = s->sum + o, *restrict mean = s->mean + o, *restrict M2 = s->M2 + o,
+    *restrict min = s->min + o, *restrict max = s->max + o, *restrict first = s->first + o, *restrict last = s->last + o;
+  double *restrict W = pw ? s->sumw + o : nobs; // Sum of weights of the observations (nobs if unweighted)
+
+  for(int i = 0; i < l; ++i) {
+    const int gi = pg ? pg[i]-1 : 0;
+    const double xi = isint ? (pxi[i] == NA_INTEGER ? NA_REAL : (double)pxi[i]) : px[i], wi = pw ? pw[i] : 1.0;
+    if(ISNAN(xi) || ISNAN(wi)) {
+      if(!narm) sum[gi] = mean[gi] = M2[gi] = min[gi] = max[gi] = NA_REAL;
+      continue;
+    }
+    if(narm) {
+      if(nobs[gi] == 0.0) first[gi] = xi;
+      last[gi] = xi;
+    }
+    ++nobs[gi];
+    if(xi < min[gi]) min[gi] = xi;
+    if(xi > max[gi]) max[gi] = xi;
+    if(wi == 0.0) continue;
+    if(pw) W[gi] += wi;
+    const double d = xi - mean[gi];
+    sum[gi] += wi * xi;
+    mean[gi] += d * wi / W[gi];
+    M2[gi] += wi * d * (xi - mean[gi]);
+  }
+  if(!narm) {
+    for(int k = 0; k < ng; ++k) {
+      if(fr[k] < 0) continue;
+      first[k] = isint ? (pxi[fr[k]] == NA_INTEGER ? NA_REAL : (double)pxi[fr[k]]) : px[fr[k]];
+      last[k] = isint ? (pxi[lr[k]] == NA_INTEGER ? NA_REAL : (double)pxi[lr[k]]) : px[lr[k]];
+    }
+  }
+}
+
+/*
+ x: list of numeric vectors, g: integer group id (1-based) or NULL, w: numeric weights or NULL. Returns a state with ng groups
+ (1 if g is NULL).
+*/
+SEXP fstateC(SEXP x, SEXP Rng, SEXP g, SEXP w, SEXP Rnarm, SEXP Rnthreads) {
+  if(TYPEOF(x) != VECSXP) error("x must be a list of numeric vectors");
+  const int k = length(x), narm = asLogical(Rnarm), weights = !isNull(w), ng = isNull(g) ? 1 : asInteger(Rng);
+  int nthreads = asInteger(Rnthreads), nprotect = 1;
+  if(k == 0) error("x must contain at least one column");
+  const SEXP *px = SEXPPTR_RO(x);
+  const int l = length(px[0]);
+  for(int j = 0; j < k; ++j) {
+    if(!(TYPEOF(px[j]) == REALSXP || TYPEOF(px[j]) == INTSXP || TYPEOF(px[j]) == LGLSXP)) error("fstate() only supports numeric data");
+    if(length(px[j]) != l) error("All columns of x must have the same length");
+  }
+  if(!isNull(g) && length(g) != l) error("length(g) must match nrow(x)");
+  if(weights) {
+    if(length(w) != l) error("length(w) must match nrow(x)");
+    if(TYPEOF(w) != REALSXP) {
+      w = PROTECT(coerceVector(w, REALSXP)); ++nprotect;
+    }
+  }
+  SEXP res = PROTECT(fstate_alloc(ng, k, weights, getAttrib(x, R_NamesSymbol)));
+  fstate_ptr s = fstate_pointers(res, weights);
+  const int *pg = isNull(g) ? NULL : INTEGER(g);
+  const double *pw = weights ? REAL(w) : NULL;
+
+  if(pg) for(int i = 0; i < l; ++i) ++s.n[pg[i]-1];
+  else s.n[0] = l;
+  // First and last row of each group
+  int *fr = NULL, *lr = NULL;
+  if(!narm) {
+    fr = (int *)R_alloc(ng, sizeof(int));
+    lr = (int *)R_alloc(ng, sizeof(int));
+    for(int k = 0; k < ng; ++k) fr[k] = lr[k] = -1;
+    for(int i = 0; i < l; ++i) {
+      const int gi = pg ? pg[i]-1 : 0;
+      if(fr[gi] < 0) fr[gi] = i;
+      lr[gi] = i;
+    }
+  }
+
+  if(nthreads > k) nthreads = k;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads < 1) nthreads = 1;
+  #pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+  for(int j = 0; j < k; ++j) fstate_col(&s, (R_xlen_t)ng * j, px[j], pg, pw, l, ng, narm, fr, lr);
+
+  UNPROTECT(nprotect);
+  return res;
+}
+
+/*
+ states: list of states (all weighted or unweighted, with k columns), ids: list of integer vectors mapping the groups of each
+ state to the ng groups of the result. States are combined in order.
+*/
+SEXP fstate_mergeC(SEXP states, SEXP ids, SEXP Rng, SEXP Rnarm, SEXP Rnthreads) {
+  const int ns = length(states), ng = asInteger(Rng), narm = asLogical(Rnarm);
+  int nthreads = asInteger(Rnthreads);
+  if(ns == 0 || length(ids) != ns) error("Need to supply at least one state, and group ids for each state");
+  const SEXP *pst = SEXPPTR_RO(states), *pid = SEXPPTR_RO(ids);
+  const int weights = length(pst[0]) == 10, k = ncols(VECTOR_ELT(pst[0], 1));
+  fstate_ptr *sp = (fstate_ptr *)R_alloc(ns, sizeof(fstate_ptr));
+  for(int r = 0; r < ns; ++r) {
+    if(length(pst[r]) != 9 + weights) error("Cannot merge weighted and unweighted states");
+    if(ncols(VECTOR_ELT(pst[r], 1)) != k) error("All states must have the same number of columns");
+    if(length(pid[r]) != length(VECTOR_ELT(pst[r], 0))) error("Group ids must match the number of groups of each state");
+    sp[r] = fstate_pointers(pst[r], weights);
+  }
+  SEXP dn = getAttrib(VECTOR_ELT(pst[0], 1), R_DimNamesSymbol);
+  SEXP res = PROTECT(fstate_alloc(ng, k, weights, isNull(dn) ? R_NilValue : VECTOR_ELT(dn, 1)));
+  fstate_ptr s = fstate_pointers(res, weights);
+
+  for(int r = 0; r < ns; ++r) {
+    const int *pg = INTEGER(pid[r]), ngr = length(pid[r]);
+    for(int i = 0; i < ngr; ++i) s.n[pg[i]-1] += sp[r].n[i];
+  }
+
+  if(nthreads > k) nthreads = k;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads < 1) nthreads = 1;
+  #pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+  for(int j = 0; j < k; ++j) {
+    double *n = (double *)R_Calloc(ng, double); // Rows seen per group (in previous states)
+    const R_xlen_t o = (R_xlen_t)ng * j;
+    for(int r = 0; r < ns; ++r) {
+      const int *pg = INTEGER(pid[r]), ngr = length(pid[r]);
+      const fstate_ptr b = sp[r];
+      const R_xlen_t ob = (R_xlen_t)ngr * j;
+      for(int i = 0; i < ngr; ++i) {
+        const int gi = pg[i]-1;
+        const R_xlen_t a = o + gi, bi = ob + i;
+        if(b.n[i] == 0.0) continue;
+        if(narm ? s.nobs[a] == 0.0 : n[gi] == 0.0) s.first[a] = b.first[bi];
+        if(!narm || b.nobs[bi] > 0.0) s.last[a] = b.last[bi];
+        n[gi] += b.n[i];
+        s.sum[a] += b.sum[bi];
+        if(ISNAN(s.min[a]) || ISNAN(b.min[bi])) s.min[a] = s.max[a] = NA_REAL;
+        else {
+          if(b.min[bi] < s.min[a]) s.min[a] = b.min[bi];
+          if(b.max[bi] > s.max[a]) s.max[a] = b.max[bi];
+        }
+        const double Wa = weights ? s.sumw[a] : s.nobs[a], Wb = weights ? b.sumw[bi] : b.nobs[bi];
+        if(ISNAN(s.mean[a]) || ISNAN(b.mean[bi])) s.mean[a] = s.M2[a] = NA_REAL;
+        else if(Wb > 0.0) {
+          const double W = Wa + Wb, d = b.mean[bi] - s.mean[a];
+          s.mean[a] += d * Wb / W;
+          s.M2[a] += b.M2[bi] + d * d * Wa * Wb / W;
+        }
+        s.nobs[a] += b.nobs[bi];
+        if(weights) s.sumw[a] += b.sumw[bi];
+      }
+    }
+    R_Free(n);
+  }
+  UNPROTECT(1);
+  return res;
+}
@@ -22,3 +22,45 @@
 
 union uno { double d; unsigned int u[2]; };
 
+
+// Size of the hash table for l elements: the smallest power of 2 >= 2*l, and at least 256
+static inline size_t hash_size(const int l) {
+  const size_t l2 = 2U * (size_t) l;
+  size_t M = 256;
+  while(M < l2) M *= 2;
+  return M;
+}
+
+// Per-thread scratch space for hash-based computations on many groups (fndistinct, fmode): a hash table h, which is
+// all zero between calls (the *_noalloc() functions reset the slots they use), followed by nv integer vectors v of
+// length cap. It grows to fit the largest group processed by the thread, avoiding an allocation for every group.
+typedef struct { int *h, *v; int cap, nv; } hscratch;
+
+static inline void hscratch_fit(hscratch *s, const int l) {
+  if(l <= s->cap) return;
+  R_Free(s->h);
+  const size_t M = hash_size(l);
+  s->h = (int*)R_Calloc(M + (size_t)s->nv * l, int);
+  s->v = s->h + M;
+  s->cap = l;
+}
+
+// With many tiny groups (average size below 4), grouped fndistinct and fmode instead use a single radix ordering of (g, x),
+// from which the results follow by scanning runs of identical values within each group (see gx_radixorder()).
+#define RADIX_GROUPS(l, ng) ((l) < 4 * (double)(ng))
+
+// Factors and logical vectors are tabulated directly on their integer codes, using per-thread scratch which the functions
+// reset before returning (bitsets for fndistinct, frequency tables for fmode). This is preferred over hashing unless there
+// are more levels than elements, in which case the scratch would be larger than a hash table.
+#define FCT_GROUPS(l, nlev) ((nlev) <= (l))
+#define NBITWORDS(n) (((size_t)(n) >> 6) + 1) // 64-bit words for a bitset of n+1 bits (0, ..., n)
+#if defined(__GNUC__) || defined(__clang__)
+#define POPCOUNT64(x) __builtin_popcountll(x)
+#else
+static inline int POPCOUNT64(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+#endif
@@ -307,7 +307,7 @@ SEXP setcopyv(SEXP x, SEXP val, SEXP rep, SEXP Rinvert, SEXP Rset, SEXP Rind1) {
   if(set == 0) {
     PROTECT(ans = shallow_duplicate(x)); // Fastest?? // copies attributes ?? -> Yes
     ++nprotect;
-  }
+  } else arrow_check_writeable(x);
 
   #define setcopyvLOOP(e)                                     \
   if(invert) {                                                \
@@ -637,6 +637,7 @@ return(x);
 }
 
 SEXP setop(SEXP x, SEXP val, SEXP op, SEXP roww) {
+  arrow_check_writeable(x); // Checks all columns before any is modified
   // IF x is a list, call function repeatedly..
   if(TYPEOF(x) == VECSXP) {
     const SEXP *px = SEXPPTR_RO(x);
@@ -685,6 +686,7 @@ SEXP replace_outliers(SEXP x, SEXP limits, SEXP value, SEXP single_limit, SEXP s
     clip = 1;
   }
 
+  if(setl) arrow_check_writeable(x);
   SEXP res = setl ? x : PROTECT(allocVector(TYPEOF(x), l));
 
   switch(TYPEOF(x)) {
@@ -755,6 +757,7 @@ SEXP na_locf(SEXP x, SEXP Rset) {
   int n = length(x), copy = asLogical(Rset) == 0;
   if(isMatrix(x)) warning("na_locf() does not (yet) have explicit support for matrices, i.e., it treats a matrix as a single vector. Use dapply(M, na_locf) if column-wise processing is desired");
   if(copy) x = PROTECT(shallow_duplicate(x));
+  else arrow_check_writeable(x);
 
   switch (TYPEOF(x)) {
   case INTSXP:
@@ -821,6 +824,7 @@ SEXP na_focb(SEXP x, SEXP Rset) {
   int n = length(x), copy = asLogical(Rset) == 0;
   if(isMatrix(x)) warning("na_focb() does not (yet) have explicit support for matrices, i.e., it treats a matrix as a single vector. Use dapply(M, na_focb) if column-wise processing is desired");
   if(copy) x = PROTECT(shallow_duplicate(x));
+  else arrow_check_writeable(x);
 
   switch (TYPEOF(x)) {
   case INTSXP:
@@ -1111,10 +1115,173 @@ SEXP frange(SEXP x, SEXP Rnarm, SEXP Rfinite) {
 
 // faster distance matrices
 // base R's version: https://github.com/wch/r-source/blob/79298c499218846d14500255efd622b5021c10ec/src/library/stats/src/distance.c
-SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
+// Methods: 1 - euclidean, 2 - euclidean_squared, 3 - manhattan, 4 - maximum (chebyshev), 5 - minkowski, 6 - cosine.
+// The full distance matrix is computed for tiles of FDIST_TILE x FDIST_TILE rows, distributed across threads. The rows of each
+// tile are copied to contiguous panels, and small blocks of row pairs are accumulated over all columns in registers. Euclidean
+// distances use |a-b|^2 = |a|^2 + |b|^2 - 2a'b on column-centered data, such that the inner loop is a multiply-add. Where this
+// is inaccurate due to cancellation (near-identical rows), the distance is computed directly.
+
+#define FDIST_TILE 64
+#define FDIST_VBLOCK 1024
+#define FDIST_EPS 1e-6
+
+static const char *fdist_names[] = {"euclidean", "euclidean_squared", "manhattan", "maximum", "minkowski", "cosine"};
+
+// Register-blocked kernel: each FDIST_MR x FDIST_NR block of row pairs is accumulated over all columns in local variables.
+// The rows of both tiles are packed into panels of FDIST_MR / FDIST_NR rows (pa, pb), so the kernel reads contiguous memory.
+#define FDIST_MR 4
+#define FDIST_NR 8
+#define FDIST_KERNEL(OP)                                                              \
+for(int i = 0; i < ni; i += FDIST_MR) {                                               \
+  const double *restrict a = pa + (size_t)i * ncol;                                   \
+  const int mi = ni - i < FDIST_MR ? ni - i : FDIST_MR;                               \
+  for(int j = 0; j < nj; j += FDIST_NR) {                                             \
+    const double *restrict b = pb + (size_t)j * ncol;                                 \
+    double s[FDIST_MR][FDIST_NR] = {{0.0}};                                           \
+    for(int c = 0; c < ncol; ++c) {                                                   \
+      for(int r = 0; r < FDIST_MR; ++r) {                                             \
+        const double xi = a[c * FDIST_MR + r];                                        \
+        for(int q = 0; q < FDIST_NR; ++q) OP(s[r][q], xi, b[c * FDIST_NR + q]);       \
+      }                                                                               \
+    }                                                                                 \
+    const int mj = nj - j < FDIST_NR ? nj - j : FDIST_NR;                             \
+    for(int r = 0; r < mi; ++r) memcpy(acc + (size_t)(i + r) * FDIST_TILE + j, s[r], mj * sizeof(double)); \
+  }                                                                                   \
+}
+
+#define FDIST_DOT(s, a, b) s += (a) * (b)
+#define FDIST_ABS(s, a, b) s += fabs((a) - (b))
+#define FDIST_MAX(s, a, b) { double d_ = fabs((a) - (b)); if(d_ > s || d_ != d_) s = d_; } // Propagates NaN
+#define FDIST_POW(s, a, b) s += pow(fabs((a) - (b)), P)
+
+// Packs rows [r0, r1) of x into panels of w rows: element (r, c) is at [((r-r0) / w) * w * ncol + c * w + (r-r0) % w], zero padded
+static void fdist_pack(double *restrict buf, const double *restrict px, const int nrow, const int ncol, const int r0, const int r1, const int w) {
+  const int n = r1 - r0, np = (n + w - 1) / w;
+  memset(buf, 0, sizeof(double) * np * w * ncol);
+  for(int c = 0; c < ncol; ++c) {
+    const double *restrict xc = px + (size_t)c * nrow + r0;
+    for(int r = 0; r < n; ++r) buf[(size_t)(r / w) * w * ncol + c * w + r % w] = xc[r];
+  }
+}
+
+// Computes the tile of ni x nj row pairs from the packed rows pa and pb into acc (dot products for methods 1, 2 and 6)
+static void fdist_tile(double *restrict acc, const double *restrict pa, const double *restrict pb, const int ncol,
+                       const int ni, const int nj, const int ret, const double P) {
+  switch(ret) {
+    case 3: FDIST_KERNEL(FDIST_ABS); break;
+    case 4: FDIST_KERNEL(FDIST_MAX); break;
+    case 5: FDIST_KERNEL(FDIST_POW); break;
+    default: FDIST_KERNEL(FDIST_DOT);
+  }
+}
+
+// Direct squared euclidean distance between rows i and j
+static double fdist_sq(const double *px, const int nrow, const int ncol, const int i, const int j) {
+  double res = 0.0;
+  for(int c = 0; c < ncol; ++c) {
+    double tmp = px[(size_t)c * nrow + i] - px[(size_t)c * nrow + j];
+    res += tmp * tmp;
+  }
+  return res;
+}
+
+// px0 is the original data, and px the column-centered copy for methods 1 and 2
+static void fdist_full(double *restrict pres, const double *px0, const double *px, const double *nrm, const int nrow,
+                       const int ncol, const int ret, const double P, const int nthreads) {
+  const int nb = (nrow + FDIST_TILE - 1) / FDIST_TILE;
+  const double Pinv = 1.0 / P;
+  #pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+  for(int bi = 0; bi < nb; ++bi) {
+    double *acc = (double*)R_Calloc(FDIST_TILE * FDIST_TILE, double),
+           *pa = (double*)R_Calloc((size_t)FDIST_TILE * ncol, double),
+           *pb = (double*)R_Calloc((size_t)FDIST_TILE * ncol, double);
+    const int i0 = bi * FDIST_TILE, i1 = i0 + FDIST_TILE < nrow ? i0 + FDIST_TILE : nrow;
+    fdist_pack(pa, px, nrow, ncol, i0, i1, FDIST_MR);
+    for(int bj = bi; bj < nb; ++bj) {
+      const int j0 = bj * FDIST_TILE, j1 = j0 + FDIST_TILE < nrow ? j0 + FDIST_TILE : nrow;
+      fdist_pack(pb, px, nrow, ncol, j0, j1, FDIST_NR);
+      fdist_tile(acc, pa, pb, ncol, i1 - i0, j1 - j0, ret, P);
+      for(int i = i0; i < i1; ++i) { // Copy pairs (i, j > i) to the lower triangle
+        const double *restrict a = acc + (size_t)(i - i0) * FDIST_TILE;
+        double *restrict pr = pres + (size_t)i * (2 * (size_t)nrow - i - 1) / 2; // Pair (i, i+1)
+        for(int j = j0 > i ? j0 : i + 1; j < j1; ++j) {
+          double d = a[j - j0];
+          switch(ret) {
+            case 1:
+            case 2:
+              d = nrm[i] + nrm[j] - 2.0 * d;
+              if(!(d >= FDIST_EPS * (nrm[i] + nrm[j]))) d = fdist_sq(px0, nrow, ncol, i, j);
+              if(ret == 1) d = sqrt(d);
+              break;
+            case 5: d = pow(d, Pinv); break;
+            case 6: d = 1.0 - d / sqrt(nrm[i] * nrm[j]); break;
+          }
+          pr[j - i - 1] = d;
+        }
+      }
+    }
+    R_Free(acc); R_Free(pa); R_Free(pb);
+  }
+}
+
+// Distances of the rows of x with a vector v: rows are processed in blocks across threads
+static void fdist_vec(double *restrict pres, const double *px, const double *pv, const int nrow, const int ncol,
+                      const int ret, const double P, const int nthreads) {
+  const int nb = (nrow + FDIST_VBLOCK - 1) / FDIST_VBLOCK;
+  double nv = 0.0;
+  if(ret == 6) for(int j = 0; j < ncol; ++j) nv += pv[j] * pv[j];
+  #pragma omp parallel for num_threads(nthreads)
+  for(int b = 0; b < nb; ++b) {
+    const int i0 = b * FDIST_VBLOCK, n = i0 + FDIST_VBLOCK < nrow ? FDIST_VBLOCK : nrow - i0;
+    double *restrict pr = pres + i0, *restrict nx = ret == 6 ? (double*)R_Calloc(n, double) : NULL;
+    for(int j = 0; j < ncol; ++j) {
+      const double *restrict pxj = px + (size_t)j * nrow + i0, v = pv[j];
+      switch(ret) {
+        case 1:
+        case 2:
+          #pragma omp simd
+          for(int i = 0; i < n; ++i) {
+            double tmp = pxj[i] - v;
+            pr[i] += tmp * tmp;
+          }
+          break;
+        case 3:
+          #pragma omp simd
+          for(int i = 0; i < n; ++i) pr[i] += fabs(pxj[i] - v);
+          break;
+        case 4:
+          for(int i = 0; i < n; ++i) {
+            double d = fabs(pxj[i] - v);
+            if(d > pr[i] || d != d) pr[i] = d;
+          }
+          break;
+        case 5:
+          for(int i = 0; i < n; ++i) pr[i] += pow(fabs(pxj[i] - v), P);
+          break;
+        case 6:
+          #pragma omp simd
+          for(int i = 0; i < n; ++i) {
+            pr[i] += pxj[i] * v;
+            nx[i] += pxj[i] * pxj[i];
+          }
+          break;
+      }
+    }
+    switch(ret) {
+      case 1: for(int i = 0; i < n; ++i) pr[i] = sqrt(pr[i]); break;
+      case 5: for(int i = 0; i < n; ++i) pr[i] = pow(pr[i], 1.0 / P); break;
+      case 6:
+        for(int i = 0; i < n; ++i) pr[i] = 1.0 - pr[i] / sqrt(nx[i] * nv);
+        R_Free(nx);
+        break;
+    }
+  }
+}
+
+static SEXP fdist_impl(SEXP x, SEXP vec, SEXP Rret, double P, int nthreads) {
 
   SEXP dim = getAttrib(x, R_DimSymbol);
-  int nrow, ncol, ret, nullv = isNull(vec), nthreads = asInteger(Rnthreads), nprotect = 1;
+  int nrow, ncol, ret, nullv = isNull(vec), nprotect = 1;
   if(nthreads > max_threads) nthreads = max_threads;
   if(TYPEOF(dim) != INTSXP) {
     nrow = 1;
@@ -1128,13 +1295,15 @@ SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
   }
   if(TYPEOF(Rret) == STRSXP) {
     const char *r = CHAR(STRING_ELT(Rret, 0));
-    if(strcmp(r, "euclidean") == 0) ret = 1;
-    else if(strcmp(r, "euclidean_squared") == 0) ret = 2;
-    else error("Unsupported method: %s", r);
+    ret = 0;
+    for(int i = 0; i < 6; ++i) if(strcmp(r, fdist_names[i]) == 0) ret = i + 1;
+    if(strcmp(r, "chebyshev") == 0) ret = 4;
+    if(ret == 0) error("Unsupported method: %s", r);
   } else {
     ret = asInteger(Rret);
-    if(ret < 1 || ret > 2) error("method must be 1 ('euclidean') or 2 ('euclidean_squared')");
+    if(ret < 1 || ret > 6) error("method must be 1 ('euclidean'), 2 ('euclidean_squared'), 3 ('manhattan'), 4 ('maximum'), 5 ('minkowski') or 6 ('cosine')");
   }
+  if(ret == 5 && !(R_FINITE(P) && P > 0)) error("p must be a positive finite number");
 
   size_t l = nrow;
   if(nullv) { // Full distance matrix
@@ -1144,70 +1313,47 @@ SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
 
   SEXP res = PROTECT(allocVector(REALSXP, l));
   double *px = REAL(x), *pres = REAL(res);
-  memset(pres, 0, sizeof(double) * l); // '\0'
 
   if(nullv) { // Full distance matrix
-    if(nthreads > 1) {
-      if(nthreads > nrow-1) nthreads = nrow-1;
-      #pragma omp parallel for num_threads(nthreads)
-      for(int k = 1; k < nrow; ++k) { // Row vectors to compute distances with
-        int nmk = nrow - k;
-        double *presk = pres + l - nmk*(nmk+1)/2, // https://en.wikipedia.org/wiki/1_%2B_2_%2B_3_%2B_4_%2B_%E2%8B%AF
-               *pxj = px + k, v;
-        for(int j = 0; j != ncol; ++j) { // Elements of the row vector at hand
-          v = pxj[-1];
-          #pragma omp simd
-          for(int i = 0; i < nmk; ++i) { // All remaining rows to compute the distance to
-            double tmp = pxj[i] - v;
-            presk[i] += tmp * tmp;
-          }
-          pxj += nrow;
+    int nb = (nrow + FDIST_TILE - 1) / FDIST_TILE;
+    if(nthreads > nb) nthreads = nb;
+    double *xc = NULL, *nrm = NULL;
+    if(ret == 1 || ret == 2 || ret == 6) {
+      nrm = (double*)R_Calloc(nrow, double);
+      if(ret != 6) { // Column-centered copy of x: avoids cancellation in |a|^2 + |b|^2 - 2a'b
+        xc = (double*)R_Calloc((size_t)nrow * ncol, double);
+        #pragma omp parallel for num_threads(nthreads)
+        for(int j = 0; j < ncol; ++j) {
+          const double *pxj = px + (size_t)j * nrow;
+          double *pxcj = xc + (size_t)j * nrow, mu = 0.0;
+          int n = 0;
+          for(int i = 0; i < nrow; ++i) if(isfinite(pxj[i])) { mu += pxj[i]; ++n; }
+          if(n) mu /= n;
+          for(int i = 0; i < nrow; ++i) pxcj[i] = pxj[i] - mu;
         }
+        px = xc;
       }
-    } else {
-      double *presk = pres, *pxj, v;
-      for(int k = 1, nmk = nrow; k != nrow; ++k) { // Row vectors to compute distances with
-        pxj = px + k; --nmk;
-        for(int j = 0; j != ncol; ++j) { // Elements of the row vector at hand
-          v = pxj[-1];
-          #pragma omp simd
-          for(int i = 0; i < nmk; ++i) { // All remaining rows to compute the distance to
-            double tmp = pxj[i] - v;
-            presk[i] += tmp * tmp;
-          }
-          pxj += nrow;
-        }
-        presk += nmk;
+      for(int j = 0; j < ncol; ++j) {
+        const double *pxj = px + (size_t)j * nrow;
+        #pragma omp simd
+        for(int i = 0; i < nrow; ++i) nrm[i] += pxj[i] * pxj[i];
       }
     }
+    fdist_full(pres, REAL(x), px, nrm, nrow, ncol, ret, P, nthreads);
+    if(xc) R_Free(xc);
+    if(nrm) R_Free(nrm);
   } else { // Only a single vector
     if(TYPEOF(vec) != REALSXP) {
       vec = PROTECT(coerceVector(vec, REALSXP)); ++nprotect;
     }
     double *pv = REAL(vec);
+    memset(pres, 0, sizeof(double) * l);
 
     if(nrow > 1) { // x is a matrix
-      if(nthreads > 1) {
-        if(nthreads > nrow) nthreads = nrow;
-        for (int j = 0; j < ncol; ++j) {
-          double *pxj = px + j * nrow, v = pv[j];
-          #pragma omp parallel for simd num_threads(nthreads)
-          for (int i = 0; i < nrow; ++i) {
-            double tmp = pxj[i] - v;
-            pres[i] += tmp * tmp;
-          }
-        }
-      } else {
-        for (int j = 0; j != ncol; ++j) {
-          double *pxj = px + j * nrow, v = pv[j];
-          #pragma omp simd
-          for (int i = 0; i < nrow; ++i) {
-            double tmp = pxj[i] - v;
-            pres[i] += tmp * tmp;
-          }
-        }
-      }
-    } else { // x is a vector
+      int nb = (nrow + FDIST_VBLOCK - 1) / FDIST_VBLOCK;
+      if(nthreads > nb) nthreads = nb;
+      fdist_vec(pres, px, pv, nrow, ncol, ret, P, nthreads);
+    } else if(ret <= 2) { // x is a vector
       double dres = 0.0;
       if(nthreads > 1) {
         if(nthreads > ncol) nthreads = ncol;
@@ -1224,19 +1370,7 @@ SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
         }
       }
       pres[0] = ret == 1 ? sqrt(dres) : dres;
-      ret = 2; // ensures we avoid the square root loop below
-    }
-  }
-
-  // Square Root
-  if(ret == 1) {
-    if(nthreads > 1) {
-      #pragma omp parallel for simd num_threads(nthreads)
-      for (size_t i = 0; i < l; ++i) pres[i] = sqrt(pres[i]);
-    } else {
-      #pragma omp simd
-      for (size_t i = 0; i < l; ++i) pres[i] = sqrt(pres[i]);
-    }
+    } else fdist_vec(pres, px, pv, 1, ncol, ret, P, 1);
   }
 
   if(nullv) { // Full distance matrix object
@@ -1249,7 +1383,8 @@ SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
        setAttrib(res, sym_Labels, VECTOR_ELT(dn, 0));
     setAttrib(res, sym_Diag, ScalarLogical(0));
     setAttrib(res, sym_Upper, ScalarLogical(0));
-    setAttrib(res, sym_method, mkString(ret == 1 ? "euclidean" : "euclidean_squared"));
+    setAttrib(res, sym_method, mkString(fdist_names[ret-1]));
+    if(ret == 5) setAttrib(res, install("p"), ScalarReal(P));
     // Note: Missing "call" attribute
     classgets(res, mkString("dist"));
   }
@@ -1257,3 +1392,23 @@ SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
   UNPROTECT(nprotect);
   return res;
 }
+
+// Also exported in the C API (cp_dist), hence the fixed arguments
+SEXP fdist(SEXP x, SEXP vec, SEXP Rret, SEXP Rnthreads) {
+  return fdist_impl(x, vec, Rret, 2.0, asInteger(Rnthreads));
+}
+
+SEXP fdistpC(SEXP x, SEXP vec, SEXP Rret, SEXP Rp, SEXP Rnthreads) {
+  return fdist_impl(x, vec, Rret, asReal(Rp), asInteger(Rnthreads));
+}
+
+#undef FDIST_TILE
+#undef FDIST_VBLOCK
+#undef FDIST_EPS
+#undef FDIST_MR
+#undef FDIST_NR
+#undef FDIST_KERNEL
+#undef FDIST_DOT
+#undef FDIST_ABS
+#undef FDIST_MAX
+#undef FDIST_POW
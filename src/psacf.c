@@ -0,0 +1,167 @@
+#include "collapse_c.h"
+
+/*
+ Panel auto- and cross-covariances for psacf(), pspacf() and psccf(): cov(x[[a]], flag(y[[b]], l, g, t)) for all series a, b
+ and lags l = lmin, ..., lmax, with pairwise deletion of missing values (as cov(..., use = "pairwise.complete.obs")). Rather
+ than materializing a lagged copy of y for every lag, the observations of each group are ordered by time, and each
+ observation is paired with those within a window of lmax periods before (and -lmin periods after) it. For each lag and
+ pair of series, the number of complete pairs and the sums and cross-products of the (mean-centered) values are
+ accumulated. Groups are distributed across threads, with per-thread accumulators that are summed at the end.
+*/
+
+typedef struct { int t, i; } tidx;
+
+static int tidx_cmp(const void *a, const void *b) {
+  const int ta = ((const tidx *)a)->t, tb = ((const tidx *)b)->t;
+  return (ta > tb) - (ta < tb);
+}
+
+// Adds all pairs of observations p (of x) and q (of y) at lag li (0-based index) to the accumulators
+static inline void psacf_pair(double *restrict acc, const double *restrict bx, const double *restrict by, const int p, const int q,
+                              const int li, const int nl, const int nx, const int ny, const int gn) {
+  for(int b = 0; b < ny; ++b) {
+    const double yq = by[(size_t)b * gn + q];
+    if(ISNAN(yq)) continue;
+    for(int a = 0; a < nx; ++a) {
+      const double xp = bx[(size_t)a * gn + p];
+      if(ISNAN(xp)) continue;
+      double *restrict s = acc + 4 * (li + (size_t)nl * (a + (size_t)nx * b));
+      s[0] += 1.0;
+      s[1] += xp;
+      s[2] += yq;
+      s[3] += xp * yq;
+    }
+  }
+}
+
+// x, y: lists of numeric vectors, g: integer group id (1-based), t: integer (or double) time variable or NULL, Rlag = c(lmin, lmax).
+// Returns an array of dimension c(lmax - lmin + 1, length(x), length(y)).
+SEXP psacfC(SEXP x, SEXP y, SEXP Rng, SEXP g, SEXP t, SEXP Rlag, SEXP Rnthreads) {
+  if(TYPEOF(x) != VECSXP || TYPEOF(y) != VECSXP) error("x and y must be lists of numeric vectors");
+  const int nx = length(x), ny = length(y), ng = asInteger(Rng), lmin = INTEGER(Rlag)[0], lmax = INTEGER(Rlag)[1],
+    nl = lmax - lmin + 1;
+  if(nx == 0 || ny == 0) error("x and y must contain at least one series");
+  const int n = length(VECTOR_ELT(x, 0));
+  if(length(g) != n) error("length(g) must match length(x)");
+  if(!isNull(t) && length(t) != n) error("length(t) must match length(x)");
+  if(lmin > lmax) error("invalid lags");
+  if(TYPEOF(g) != INTSXP) error("g must be integer");
+  if(!isNull(t) && !(TYPEOF(t) == INTSXP || TYPEOF(t) == REALSXP)) error("t must be integer or a factor");
+  int nthreads = asInteger(Rnthreads), nprotect = 1;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > ng) nthreads = ng;
+  if(nthreads < 1) nthreads = 1;
+
+  // Series and their means (used for centering, to avoid cancellation in the sums of cross-products)
+  SEXP prot = PROTECT(allocVector(VECSXP, nx + ny + 1));
+  const double **px = (const double **)R_alloc(nx + ny, sizeof(double *));
+  double *mu = (double *)R_alloc(nx + ny, sizeof(double));
+  for(int k = 0; k < nx + ny; ++k) {
+    SEXP s = k < nx ? VECTOR_ELT(x, k) : VECTOR_ELT(y, k - nx);
+    if(length(s) != n) error("all series must have the same length");
+    if(TYPEOF(s) != REALSXP) {
+      if(!(TYPEOF(s) == INTSXP || TYPEOF(s) == LGLSXP)) error("series must be numeric");
+      SET_VECTOR_ELT(prot, k, s = coerceVector(s, REALSXP));
+    }
+    const double *ps = REAL(s);
+    double m = 0.0;
+    int cnt = 0;
+    for(int i = 0; i < n; ++i) if(!ISNAN(ps[i])) { m += ps[i]; ++cnt; }
+    mu[k] = cnt ? m / cnt : 0.0;
+    px[k] = ps;
+  }
+
+  // Order observations by group (stable counting sort), and within groups by time
+  if(TYPEOF(t) == REALSXP) SET_VECTOR_ELT(prot, nx + ny, t = coerceVector(t, INTSXP));
+  const int *pg = INTEGER(g), *pt = isNull(t) ? NULL : INTEGER(t);
+  int *gs = (int *)R_alloc(ng + 1, sizeof(int)), *tt = (int *)R_alloc(n, sizeof(int)), *o = (int *)R_alloc(n, sizeof(int));
+  memset(gs, 0, (ng + 1) * sizeof(int));
+  for(int i = 0; i < n; ++i) {
+    if(pg[i] < 1 || pg[i] > ng) error("g must be an integer group id in 1:ng");
+    ++gs[pg[i]];
+  }
+  for(int k = 0; k < ng; ++k) gs[k+1] += gs[k];
+  int *cnt = (int *)R_Calloc(ng, int), maxgn = 0;
+  for(int i = 0; i < n; ++i) o[gs[pg[i]-1] + cnt[pg[i]-1]++] = i;
+  R_Free(cnt);
+  for(int k = 0; k < ng; ++k) if(gs[k+1] - gs[k] > maxgn) maxgn = gs[k+1] - gs[k];
+  if(pt) {
+    tidx *ti = (tidx *)R_alloc(n, sizeof(tidx));
+    for(int m = 0; m < n; ++m) {
+      ti[m].i = o[m];
+      ti[m].t = pt[o[m]];
+    }
+    #pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+    for(int k = 0; k < ng; ++k) {
+      int sorted = 1;
+      for(int m = gs[k] + 1; m < gs[k+1]; ++m) if(ti[m].t < ti[m-1].t) { sorted = 0; break; }
+      if(!sorted) qsort(ti + gs[k], gs[k+1] - gs[k], sizeof(tidx), tidx_cmp);
+    }
+    for(int m = 0; m < n; ++m) {
+      o[m] = ti[m].i;
+      tt[m] = ti[m].t;
+    }
+  } else for(int k = 0; k < ng; ++k) for(int m = gs[k]; m < gs[k+1]; ++m) tt[m] = m - gs[k];
+
+  const size_t size = (size_t)4 * nl * nx * ny;
+  double *acc = (double *)R_Calloc(size, double);
+  int dupl = 0;
+
+  #pragma omp parallel num_threads(nthreads)
+  {
+    double *restrict at = (double *)R_Calloc(size, double), *restrict bx = (double *)R_Calloc((size_t)maxgn * (nx + ny) + 1, double);
+    #pragma omp for schedule(dynamic)
+    for(int k = 0; k < ng; ++k) {
+      const int s = gs[k], gn = gs[k+1] - s;
+      const int *restrict tg = tt + s, *restrict og = o + s;
+      // Gather the centered values of the group in time order
+      for(int a = 0; a < nx + ny; ++a) {
+        const double *restrict pa = px[a], ma = mu[a];
+        double *restrict ba = bx + (size_t)a * gn;
+        for(int m = 0; m < gn; ++m) ba[m] = pa[og[m]] - ma;
+      }
+      const double *by = bx + (size_t)gn * nx;
+      for(int p = 0; p < gn; ++p) {
+        if(tg[p] == NA_INTEGER) continue;
+        const long long tp = tg[p];
+        if(lmin <= 0 && lmax >= 0) psacf_pair(at, bx, by, p, p, -lmin, nl, nx, ny, gn);
+        // Lags: y observed lmax or fewer periods before x
+        for(int q = p - 1; q >= 0 && tg[q] != NA_INTEGER && tg[q] >= tp - (lmax > 0 ? lmax : 0); --q) {
+          const int l = (int)(tp - tg[q]);
+          if(l == 0) {
+            #pragma omp atomic write
+            dupl = 1;
+            break;
+          }
+          if(l >= lmin && l <= lmax) psacf_pair(at, bx, by, p, q, l - lmin, nl, nx, ny, gn);
+        }
+        // Leads: y observed -lmin or fewer periods after x
+        if(lmin < 0) for(int q = p + 1; q < gn && tg[q] <= tp - lmin; ++q) {
+          const int l = (int)(tp - tg[q]);
+          if(l >= lmin && l <= lmax && l != 0) psacf_pair(at, bx, by, p, q, l - lmin, nl, nx, ny, gn);
+        }
+      }
+    }
+    #pragma omp critical
+    for(size_t i = 0; i < size; ++i) acc[i] += at[i];
+    R_Free(at);
+    R_Free(bx);
+  }
+  if(dupl) {
+    R_Free(acc);
+    error("Repeated values of t within groups");
+  }
+
+  SEXP res = PROTECT(allocVector(REALSXP, (size_t)nl * nx * ny)); ++nprotect;
+  double *restrict pres = REAL(res);
+  for(size_t i = 0, ni = (size_t)nl * nx * ny; i < ni; ++i) {
+    const double *s = acc + 4 * i;
+    pres[i] = s[0] < 2.0 ? NA_REAL : (s[3] - s[1] * s[2] / s[0]) / (s[0] - 1.0);
+  }
+  R_Free(acc);
+  SEXP dim = PROTECT(allocVector(INTSXP, 3)); ++nprotect;
+  INTEGER(dim)[0] = nl; INTEGER(dim)[1] = nx; INTEGER(dim)[2] = ny;
+  dimgets(res, dim);
+  UNPROTECT(nprotect);
+  return res;
+}
@@ -0,0 +1,181 @@
+#include "collapse_c.h"
+
+/*
+ Panel-series matrices and arrays for psmat(). The position of each observation in the output matrix (groups in the rows and
+ time periods in the columns, or the reverse if transpose = TRUE) is computed once from g and t, and then used to scatter all
+ columns of a list into the slices of a 3D array (or into separate matrices), with columns distributed across threads.
+*/
+
+// Position of each observation in the (transposed) panel-series matrix. Without t, the panel must be balanced and the
+// observations of each group are taken in order of appearance.
+static void psmat_index(R_xlen_t *restrict idx, const int *restrict pg, const int *restrict pt, const int l, const int ng,
+                        const int nt, const int transpose) {
+  if(pt == NULL) {
+    int *seen = (int *)R_Calloc(ng, int);
+    for(int i = 0; i < l; ++i) {
+      const int gi = pg[i]-1;
+      if(seen[gi] == nt) {
+        R_Free(seen);
+        error("Panel not Balanced: Need to supply timevar");
+      }
+      idx[i] = transpose ? (R_xlen_t)gi * nt + seen[gi]++ : (R_xlen_t)(seen[gi]++) * ng + gi;
+    }
+    R_Free(seen);
+  } else if(transpose) {
+    for(int i = 0; i < l; ++i) idx[i] = (R_xlen_t)(pg[i]-1) * nt + pt[i]-1;
+  } else {
+    for(int i = 0; i < l; ++i) idx[i] = (R_xlen_t)(pt[i]-1) * ng + pg[i]-1;
+  }
+}
+
+#define PSMAT_SCATTER(CTYPE, PTRFUN, FILLVAL) {                                 \
+  CTYPE *restrict pout = PTRFUN(out) + off;                                     \
+  const CTYPE *restrict px = PTRFUN(x);                                         \
+  if(dofill) {                                                                  \
+    const CTYPE fv = FILLVAL;                                                   \
+    for(R_xlen_t j = 0; j < size; ++j) pout[j] = fv;                            \
+  }                                                                             \
+  for(int i = 0; i < l; ++i) pout[idx[i]] = px[i];                              \
+  break;                                                                        \
+}
+
+// Writes x into out[off + idx], after filling out[off, off + size) with the first element of fill (if dofill).
+static void psmat_scatter(SEXP out, R_xlen_t off, R_xlen_t size, SEXP x, const R_xlen_t *restrict idx, const int l, SEXP fill, const int dofill) {
+  switch(TYPEOF(out)) {
+    case LGLSXP: PSMAT_SCATTER(int, LOGICAL, LOGICAL(fill)[0])
+    case INTSXP: PSMAT_SCATTER(int, INTEGER, INTEGER(fill)[0])
+    case REALSXP: PSMAT_SCATTER(double, REAL, REAL(fill)[0])
+    case CPLXSXP: PSMAT_SCATTER(Rcomplex, COMPLEX, COMPLEX(fill)[0])
+    case STRSXP: {
+      SEXP *restrict pout = SEXPPTR(out) + off;
+      const SEXP *restrict px = SEXPPTR_RO(x);
+      if(dofill) {
+        const SEXP fv = STRING_ELT(fill, 0);
+        for(R_xlen_t j = 0; j < size; ++j) pout[j] = fv;
+      }
+      for(int i = 0; i < l; ++i) pout[idx[i]] = px[i];
+      break;
+    }
+  }
+}
+
+#undef PSMAT_SCATTER
+
+static SEXP psmat_fill(SEXP fill, SEXPTYPE tx) {
+  if(isNull(fill)) {
+    fill = allocVector(tx, 1);
+    switch(tx) {
+      case LGLSXP:
+      case INTSXP: INTEGER(fill)[0] = NA_INTEGER; break;
+      case REALSXP: REAL(fill)[0] = NA_REAL; break;
+      case CPLXSXP: COMPLEX(fill)[0].r = COMPLEX(fill)[0].i = NA_REAL; break;
+      case STRSXP: SET_STRING_ELT(fill, 0, NA_STRING); break;
+    }
+    return fill;
+  }
+  if(length(fill) < 1) error("fill must be a length 1 atomic vector");
+  return TYPEOF(fill) == tx ? fill : coerceVector(fill, tx);
+}
+
+static void psmat_attrib(SEXP out, SEXP dn, SEXP Rtranspose, const char *cl) {
+  dimnamesgets(out, dn);
+  setAttrib(out, install("transpose"), ScalarLogical(asLogical(Rtranspose)));
+  SEXP cls = PROTECT(allocVector(STRSXP, 2));
+  SET_STRING_ELT(cls, 0, mkChar("psmat"));
+  SET_STRING_ELT(cls, 1, mkChar(cl));
+  classgets(out, cls);
+  UNPROTECT(1);
+}
+
+// x: atomic vector or list of atomic vectors, g: factor, t: factor or NULL. If x is a list, returns a 3D array with one slice
+// per column (array = TRUE), or a list of matrices.
+SEXP psmatC(SEXP x, SEXP g, SEXP t, SEXP Rtranspose, SEXP fill, SEXP Rarray, SEXP Rnthreads) {
+  const int islist = TYPEOF(x) == VECSXP, transpose = asLogical(Rtranspose);
+  const int k = islist ? length(x) : 1;
+  if(k == 0) error("x must contain at least one column");
+  const int l = length(islist ? VECTOR_ELT(x, 0) : x);
+  if(TYPEOF(g) != INTSXP) error("g must be a factor");
+  if(length(g) != l) error("length(g) must match length(x)");
+  SEXP glevs = PROTECT(getAttrib(g, R_LevelsSymbol)), tlevs, dn = PROTECT(allocVector(VECSXP, islist && asLogical(Rarray) ? 3 : 2));
+  const int ng = length(glevs);
+  int nt, nprotect = 3, nthreads = asInteger(Rnthreads);
+  if(ng == 0) error("g must be a factor");
+  if(isNull(t)) {
+    if(l % ng != 0) error("length(x) must be a multiple of length(levels(g))");
+    nt = l / ng;
+    tlevs = PROTECT(allocVector(INTSXP, nt));
+    int *ptl = INTEGER(tlevs);
+    for(int j = 0; j < nt; ++j) ptl[j] = j + 1;
+  } else {
+    if(TYPEOF(t) != INTSXP) error("t must be a factor");
+    if(length(t) != l) error("length(t) must match length(x)");
+    tlevs = PROTECT(getAttrib(t, R_LevelsSymbol));
+    nt = length(tlevs);
+  }
+  SET_VECTOR_ELT(dn, 0, transpose ? tlevs : glevs);
+  SET_VECTOR_ELT(dn, 1, transpose ? glevs : tlevs);
+
+  // Mapping of observations to cells, computed once for all columns
+  const R_xlen_t size = (R_xlen_t)ng * nt;
+  const int dofill = !isNull(t) && size != l;
+  R_xlen_t *idx = (R_xlen_t *)R_alloc(l, sizeof(R_xlen_t));
+  psmat_index(idx, INTEGER(g), isNull(t) ? NULL : INTEGER(t), l, ng, nt, transpose);
+
+  if(!islist) {
+    SEXPTYPE tx = TYPEOF(x);
+    if(!(tx == LGLSXP || tx == INTSXP || tx == REALSXP || tx == CPLXSXP || tx == STRSXP)) error("Not supported SEXP type!");
+    SEXP out = PROTECT(transpose ? allocMatrix(tx, nt, ng) : allocMatrix(tx, ng, nt));
+    SEXP fv = PROTECT(psmat_fill(fill, tx)); nprotect += 2;
+    psmat_scatter(out, 0, size, x, idx, l, fv, dofill);
+    psmat_attrib(out, dn, Rtranspose, "matrix");
+    UNPROTECT(nprotect);
+    return out;
+  }
+
+  if(nthreads > k) nthreads = k;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads < 1) nthreads = 1;
+  const SEXP *px = SEXPPTR_RO(x);
+  SEXPTYPE tx = LGLSXP;
+  for(int j = 0; j < k; ++j) {
+    SEXPTYPE tj = TYPEOF(px[j]);
+    if(!(tj == LGLSXP || tj == INTSXP || tj == REALSXP || tj == CPLXSXP || tj == STRSXP)) error("Not supported SEXP type!");
+    if(length(px[j]) != l) error("All columns of x must have the same length");
+    if(tj > tx) tx = tj; // LGLSXP < INTSXP < REALSXP < CPLXSXP < STRSXP, as for cbind()
+  }
+
+  if(asLogical(Rarray)) {
+    // Columns of a different type are coerced to the common type
+    SEXP xc = PROTECT(allocVector(VECSXP, k)); ++nprotect;
+    for(int j = 0; j < k; ++j) SET_VECTOR_ELT(xc, j, TYPEOF(px[j]) == tx ? px[j] : coerceVector(px[j], tx));
+    SEXP out = PROTECT(allocVector(tx, size * k));
+    SEXP fv = PROTECT(psmat_fill(fill, tx));
+    SEXP dim = PROTECT(allocVector(INTSXP, 3)); nprotect += 3;
+    INTEGER(dim)[0] = transpose ? nt : ng;
+    INTEGER(dim)[1] = transpose ? ng : nt;
+    INTEGER(dim)[2] = k;
+    dimgets(out, dim);
+    SET_VECTOR_ELT(dn, 2, getAttrib(x, R_NamesSymbol));
+    const SEXP *pxc = SEXPPTR_RO(xc);
+    #pragma omp parallel for num_threads(nthreads) schedule(static)
+    for(int j = 0; j < k; ++j) psmat_scatter(out, size * j, size, pxc[j], idx, l, fv, dofill);
+    psmat_attrib(out, dn, Rtranspose, "array");
+    UNPROTECT(nprotect);
+    return out;
+  }
+
+  // List of matrices, each keeping the type of the column
+  SEXP out = PROTECT(allocVector(VECSXP, k)), fvs = PROTECT(allocVector(VECSXP, k)); nprotect += 2;
+  for(int j = 0; j < k; ++j) {
+    SEXPTYPE tj = TYPEOF(px[j]);
+    SEXP mj = SET_VECTOR_ELT(out, j, transpose ? allocMatrix(tj, nt, ng) : allocMatrix(tj, ng, nt));
+    SET_VECTOR_ELT(fvs, j, psmat_fill(fill, tj));
+    psmat_attrib(mj, dn, Rtranspose, "matrix");
+  }
+  const SEXP *pout = SEXPPTR_RO(out), *pfvs = SEXPPTR_RO(fvs);
+  #pragma omp parallel for num_threads(nthreads) schedule(static)
+  for(int j = 0; j < k; ++j) psmat_scatter(pout[j], 0, size, px[j], idx, l, pfvs[j], dofill);
+  namesgets(out, getAttrib(x, R_NamesSymbol));
+  UNPROTECT(nprotect);
+  return out;
+}
@@ -0,0 +1,178 @@
+#include "collapse_c.h"
+
+/*
+ Pairwise-complete (weighted) covariances and correlations of the columns of a numeric matrix, with observation counts.
+ Each column is shifted by its mean to avoid cancellation, and for every pair (i, j) the sums over the rows where x_i,
+ x_j (and the weight) are observed of 1, w, w*x_i, w*x_i^2, w*x_j, w*x_j^2 and w*x_i*x_j are accumulated. Missing
+ values are replaced by 0 with a 0/1 mask, so that these are all branch-free dot products of the columns.
+ Pairs are processed in tiles of PW_TILE x PW_TILE columns: for a chunk of PW_ROWS rows, the (masked and weighted)
+ columns of the tile are prepared once in a per-thread buffer that stays in cache while all pairs of the tile are
+ accumulated. Tiles of the upper triangle are distributed across threads.
+*/
+
+#define PW_TILE 16
+#define PW_ROWS 128
+#define PW_NSUM 7 // n, W, Sx, Sxx, Sy, Syy, Sxy
+
+// Sums of pair (i, j) over r rows: bi holds the prepared columns of the row tile (M, WM, WZ, WZZ), bj those of the column
+// tile (M, Z). M is the 0/1 mask of observed values (and weights), WM = w*M, Z the shifted values (0 if missing), WZ = w*Z.
+static inline void pw_pair(double *restrict acc, const double *restrict bi, const double *restrict bj, const int r) {
+  const double *restrict Mi = bi, *restrict WMi = bi + r, *restrict WZi = bi + 2*r, *restrict WZZi = bi + 3*r,
+               *restrict Mj = bj, *restrict Zj = bj + r;
+  double n = 0.0, W = 0.0, Sx = 0.0, Sxx = 0.0, Sy = 0.0, Syy = 0.0, Sxy = 0.0;
+  #pragma omp simd reduction(+:n,W,Sx,Sxx,Sy,Syy,Sxy)
+  for(int k = 0; k < r; ++k) {
+    n += Mi[k] * Mj[k];
+    W += WMi[k] * Mj[k];
+    Sx += WZi[k] * Mj[k];
+    Sxx += WZZi[k] * Mj[k];
+    Sy += WMi[k] * Zj[k];
+    Syy += WMi[k] * Zj[k] * Zj[k];
+    Sxy += WZi[k] * Zj[k];
+  }
+  acc[0] += n; acc[1] += W; acc[2] += Sx; acc[3] += Sxx;
+  acc[4] += Sy; acc[5] += Syy; acc[6] += Sxy;
+}
+
+// Prepares rows [r0, r0 + r) of column j: the row tile layout (wide = 1) or the column tile layout (wide = 0)
+static inline void pw_prep(double *restrict b, const double *restrict px, const double *restrict pw, const double c, const int r, const int wide) {
+  if(wide) {
+    double *restrict M = b, *restrict WM = b + r, *restrict WZ = b + 2*r, *restrict WZZ = b + 3*r;
+    if(pw) {
+      #pragma omp simd
+      for(int k = 0; k < r; ++k) {
+        const double m = (px[k] == px[k] && pw[k] == pw[k]) ? 1.0 : 0.0, z = m == 1.0 ? px[k] - c : 0.0, wk = m == 1.0 ? pw[k] : 0.0;
+        M[k] = m; WM[k] = wk; WZ[k] = wk * z; WZZ[k] = wk * z * z;
+      }
+    } else {
+      #pragma omp simd
+      for(int k = 0; k < r; ++k) {
+        const double m = px[k] == px[k] ? 1.0 : 0.0, z = m == 1.0 ? px[k] - c : 0.0;
+        M[k] = WM[k] = m; WZ[k] = z; WZZ[k] = z * z;
+      }
+    }
+  } else {
+    double *restrict M = b, *restrict Z = b + r;
+    #pragma omp simd
+    for(int k = 0; k < r; ++k) {
+      const double m = px[k] == px[k] ? 1.0 : 0.0;
+      M[k] = m; Z[k] = m == 1.0 ? px[k] - c : 0.0;
+    }
+  }
+}
+
+// Sums for all pairs (i, j), i in [i0, i1), j in [j0, j1), j >= i, into acc (PW_TILE x PW_TILE x PW_NSUM)
+static void pw_tile(double *restrict acc, double *restrict buf, const double *restrict px, const double *restrict pw,
+                    const double *restrict shift, const int l, const int i0, const int i1, const int j0, const int j1) {
+  double *restrict bI = buf, *restrict bJ = buf + 4 * PW_TILE * PW_ROWS;
+  memset(acc, 0, PW_TILE * PW_TILE * PW_NSUM * sizeof(double));
+  for(int r0 = 0; r0 < l; r0 += PW_ROWS) {
+    const int r = l - r0 < PW_ROWS ? l - r0 : PW_ROWS;
+    for(int i = i0; i < i1; ++i) pw_prep(bI + 4*r*(i-i0), px + (size_t)i*l + r0, pw ? pw + r0 : NULL, shift[i], r, 1);
+    for(int j = j0; j < j1; ++j) pw_prep(bJ + 2*r*(j-j0), px + (size_t)j*l + r0, NULL, shift[j], r, 0);
+    for(int i = i0; i < i1; ++i) {
+      for(int j = i > j0 ? i : j0; j < j1; ++j)
+        pw_pair(acc + PW_NSUM * ((i-i0) * PW_TILE + j-j0), bI + 4*r*(i-i0), bJ + 2*r*(j-j0), r);
+    }
+  }
+}
+
+// Covariance (cor = 0) or correlation (cor = 1) from the sums of a pair. Frequency weights: the covariance divides by W-1.
+static inline double pw_stat(const double *restrict s, const int cor, const int diag) {
+  const double n = s[0], W = s[1];
+  if(n < 2.0 || W <= 0.0) return NA_REAL;
+  const double cxy = s[6] - s[2] * s[4] / W;
+  if(cor == 0) return W > 1.0 ? cxy / (W - 1.0) : NA_REAL;
+  const double vx = s[3] - s[2] * s[2] / W, vy = s[5] - s[4] * s[4] / W;
+  if(!(vx > 0.0 && vy > 0.0)) return NA_REAL;
+  if(diag) return 1.0;
+  const double res = cxy / sqrt(vx * vy);
+  return res > 1.0 ? 1.0 : res < -1.0 ? -1.0 : res;
+}
+
+SEXP pwcorcovC(SEXP X, SEXP w, SEXP Rcor, SEXP RN, SEXP Rnthreads) {
+  SEXP dim = getAttrib(X, R_DimSymbol);
+  if(!isMatrix(X) || length(dim) != 2) error("X must be a matrix or data.frame!");
+  int nprotect = 1, nthreads = asInteger(Rnthreads);
+  const int l = INTEGER(dim)[0], col = INTEGER(dim)[1], cor = asLogical(Rcor), retN = asLogical(RN);
+  switch(TYPEOF(X)) {
+    case REALSXP: break;
+    case INTSXP:
+    case LGLSXP:
+      X = PROTECT(coerceVector(X, REALSXP)); ++nprotect;
+      break;
+    default: error("X must be numeric");
+  }
+  const double *px = REAL(X), *pw = NULL;
+  if(!isNull(w)) {
+    if(length(w) != l) error("length(w) must match nrow(X)");
+    if(TYPEOF(w) != REALSXP) {
+      if(!(TYPEOF(w) == INTSXP || TYPEOF(w) == LGLSXP)) error("weights need to be double or integer/logical (internally coerced to double)");
+      w = PROTECT(coerceVector(w, REALSXP)); ++nprotect;
+    }
+    pw = REAL(w);
+  }
+
+  SEXP res = PROTECT(allocVector(VECSXP, 2)), r = allocMatrix(REALSXP, col, col);
+  SET_VECTOR_ELT(res, 0, r);
+  if(retN) SET_VECTOR_ELT(res, 1, allocMatrix(INTSXP, col, col));
+  double *restrict pr = REAL(r);
+  int *restrict pn = retN ? INTEGER(VECTOR_ELT(res, 1)) : NULL;
+
+  // Shift each column by its mean
+  double *restrict shift = (double*)R_Calloc(col > 0 ? col : 1, double);
+  for(int j = 0; j < col; ++j) {
+    const double *restrict pxj = px + (size_t)j*l;
+    double s = 0.0;
+    int n = 0;
+    for(int k = 0; k < l; ++k) if(NISNAN(pxj[k])) {
+      s += pxj[k];
+      ++n;
+    }
+    shift[j] = n ? s / n : 0.0;
+  }
+
+  // Tiles of the upper triangle
+  const int nb = (col + PW_TILE - 1) / PW_TILE, ntiles = nb * (nb + 1) / 2;
+  int *restrict tiles = (int*)R_Calloc(2 * (ntiles > 0 ? ntiles : 1), int);
+  for(int bi = 0, t = 0; bi < nb; ++bi) for(int bj = bi; bj < nb; ++bj, ++t) {
+    tiles[2*t] = bi;
+    tiles[2*t+1] = bj;
+  }
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > ntiles) nthreads = ntiles;
+  if(nthreads < 1) nthreads = 1;
+
+  #pragma omp parallel num_threads(nthreads)
+  {
+    double *restrict acc = (double*)R_Calloc(PW_TILE * PW_TILE * PW_NSUM + 6 * PW_TILE * PW_ROWS, double),
+           *restrict buf = acc + PW_TILE * PW_TILE * PW_NSUM;
+    #pragma omp for schedule(dynamic)
+    for(int t = 0; t < ntiles; ++t) {
+      const int i0 = tiles[2*t] * PW_TILE, j0 = tiles[2*t+1] * PW_TILE,
+                i1 = i0 + PW_TILE < col ? i0 + PW_TILE : col, j1 = j0 + PW_TILE < col ? j0 + PW_TILE : col;
+      pw_tile(acc, buf, px, pw, shift, l, i0, i1, j0, j1);
+      for(int i = i0; i < i1; ++i) {
+        for(int j = i > j0 ? i : j0; j < j1; ++j) {
+          const double *s = acc + PW_NSUM * ((i-i0) * PW_TILE + j-j0);
+          pr[(size_t)j*col + i] = pr[(size_t)i*col + j] = pw_stat(s, cor, i == j);
+          if(pn) pn[(size_t)j*col + i] = pn[(size_t)i*col + j] = (int)s[0];
+        }
+      }
+    }
+    R_Free(acc);
+  }
+  R_Free(tiles);
+  R_Free(shift);
+
+  SEXP dn = getAttrib(X, R_DimNamesSymbol);
+  if(!isNull(dn) && !isNull(VECTOR_ELT(dn, 1))) {
+    SEXP cn = VECTOR_ELT(dn, 1), dnr = PROTECT(allocVector(VECSXP, 2)); ++nprotect;
+    SET_VECTOR_ELT(dnr, 0, cn);
+    SET_VECTOR_ELT(dnr, 1, cn);
+    setAttrib(r, R_DimNamesSymbol, dnr);
+    if(pn) setAttrib(VECTOR_ELT(res, 1), R_DimNamesSymbol, dnr);
+  }
+  UNPROTECT(nprotect);
+  return res;
+}
@@ -0,0 +1,413 @@
+#include "collapse_c.h"
+
+/*
+ Approximate quantiles from mergeable sketches: the merging t-digest of Dunning & Ertl (2019), with the k1 scale function.
+   https://arxiv.org/abs/1902.04023
+ Each digest keeps at most about compression / 2 centroids (mean and weight) after compression, plus a buffer of incoming
+ values, so memory is bounded regardless of the number of observations. Digests are merged by adding the centroids of
+ one to the buffer of the other. The exact minimum and maximum are kept to interpolate the tails.
+*/
+
+// Compression used by fnth(..., ties = "approx")
+#define QSKETCH_COMPRESSION 100.0
+// Largest compression: the buffer of a digest holds up to 5 * compression values
+#define TD_MAX_DELTA 1e6
+
+typedef struct {
+  double *m, *w, min, max;
+  int n, cap, na;
+} tdigest;
+
+static inline void td_init(tdigest *td) {
+  td->m = td->w = NULL;
+  td->min = R_PosInf;
+  td->max = R_NegInf;
+  td->n = td->cap = td->na = 0;
+}
+
+static inline void td_free(tdigest *td) {
+  if(td->cap) {
+    R_Free(td->m);
+    R_Free(td->w);
+  }
+  td->n = td->cap = 0;
+}
+
+// Maximum buffer size: the digest is compressed when it is full. delta is bounded by td_delta(), the clamp only guards
+// against overflow (this is called on worker threads, so it cannot raise an error)
+static inline int td_maxcap(const double delta) {
+  const double cap = 5.0 * ceil(delta) + 16.0;
+  return cap < (double)INT_MAX ? (int)cap : INT_MAX;
+}
+
+// Largest quantile which may be merged into a centroid starting at quantile q: k1^-1(k1(q) + 1)
+static inline double td_qlimit(const double q, const double delta) {
+  const double k = delta / (2.0 * M_PI) * asin(2.0 * q - 1.0) + 1.0;
+  if(k >= delta / 4.0) return 1.0;
+  return (sin(k * 2.0 * M_PI / delta) + 1.0) / 2.0;
+}
+
+// Sorts the centroids by their means and merges adjacent centroids as far as permitted by the scale function
+static void td_compress(tdigest *td, const double delta) {
+  const int n = td->n;
+  if(n <= 1) return;
+  double *restrict m = td->m, *restrict tw = td->w, *restrict w = (double*)R_Calloc(n, double), sumw = 0.0;
+  int *restrict idx = (int*)R_Calloc(n, int);
+  for(int i = 0; i != n; ++i) idx[i] = i;
+  rsort_with_index(m, idx, n);
+  for(int i = 0; i != n; ++i) sumw += (w[i] = tw[idx[i]]);
+  R_Free(idx);
+
+  // In place: centroid k is written after the values up to i > k have been read
+  double cm = m[0], cw = w[0], wsum = 0.0, qlim = td_qlimit(0.0, delta);
+  int k = 0;
+  for(int i = 1; i != n; ++i) {
+    // Infinite values are kept in their own centroids (one for -Inf and one for Inf), as their means are not defined
+    const int inf = !R_FINITE(cm) || !R_FINITE(m[i]);
+    if(inf ? m[i] == cm : (wsum + cw + w[i]) / sumw <= qlim) {
+      cw += w[i];
+      if(!inf) cm += (m[i] - cm) * w[i] / cw;
+    } else {
+      m[k] = cm;
+      tw[k++] = cw;
+      wsum += cw;
+      qlim = td_qlimit(wsum / sumw, delta);
+      cm = m[i];
+      cw = w[i];
+    }
+  }
+  m[k] = cm;
+  tw[k++] = cw;
+  td->n = k;
+  R_Free(w);
+}
+
+static inline void td_add(tdigest *td, const double x, const double w, const double delta) {
+  if(td->n == td->cap) {
+    const int maxcap = td_maxcap(delta);
+    if(td->cap < maxcap) { // Grow the buffer, starting small as there may be many (small) groups
+      int cap = td->cap ? 2 * td->cap : 16;
+      if(cap > maxcap) cap = maxcap;
+      if(td->cap) {
+        td->m = (double*)R_Realloc(td->m, cap, double);
+        td->w = (double*)R_Realloc(td->w, cap, double);
+      } else {
+        td->m = (double*)R_Calloc(cap, double);
+        td->w = (double*)R_Calloc(cap, double);
+      }
+      td->cap = cap;
+    } else td_compress(td, delta);
+  }
+  td->m[td->n] = x;
+  td->w[td->n++] = w;
+  if(x < td->min) td->min = x;
+  if(x > td->max) td->max = x;
+}
+
+// Adds the centroids of src to dst
+static void td_merge(tdigest *dst, const tdigest *src, const double delta) {
+  if(src->na) dst->na = 1;
+  if(dst->na) return;
+  for(int i = 0; i != src->n; ++i) td_add(dst, src->m[i], src->w[i], delta);
+  if(src->min < dst->min) dst->min = src->min;
+  if(src->max > dst->max) dst->max = src->max;
+}
+
+// (1 - h) * a + h * b for h in [0, 1], also if a or b is infinite (the limit, which is the infinite end point for h in (0, 1))
+static inline double td_interp(const double a, const double b, const double h) {
+  if(R_FINITE(a) && R_FINITE(b)) return a + (b - a) * h;
+  if(a == b) return a;
+  if(!R_FINITE(a) && !R_FINITE(b)) return h < 0.5 ? a : b;
+  return R_FINITE(a) ? (h > 0.0 ? b : a) : (h < 1.0 ? a : b);
+}
+
+// Expects a compressed digest: the quantile is interpolated between the midpoints (in terms of cumulative weight) of
+// adjacent centroids, and between the extrema and the first / last centroid in the tails. With unit weights and no
+// merged centroids, this gives quantile type 5.
+static double td_quantile(const tdigest *td, const double Q) {
+  const int n = td->n;
+  if(td->na || n == 0) return NA_REAL;
+  if(Q <= 0.0) return td->min;
+  if(Q >= 1.0) return td->max;
+  const double *m = td->m, *w = td->w;
+  double sumw = 0.0;
+  for(int i = 0; i != n; ++i) sumw += w[i];
+  const double t = Q * sumw;
+  if(t <= w[0] / 2.0) return td_interp(td->min, m[0], t / (w[0] / 2.0));
+  if(t >= sumw - w[n-1] / 2.0) return td_interp(m[n-1], td->max, (t - sumw + w[n-1] / 2.0) / (w[n-1] / 2.0));
+  double cum = w[0] / 2.0, dw; // Cumulative weight at the midpoint of centroid i
+  for(int i = 0; i != n-1; ++i) {
+    dw = (w[i] + w[i+1]) / 2.0;
+    if(t <= cum + dw) return td_interp(m[i], m[i+1], (t - cum) / dw);
+    cum += dw;
+  }
+  return m[n-1];
+}
+
+#undef TD_BUILD_LOOP
+#define TD_BUILD_LOOP(ISNA)                                           \
+  for(int i = start; i < end; ++i) {                                  \
+    tdigest *t = ng ? tdc + pg[i]-1 : tdc;                            \
+    if(ISNA(px[i])) {                                                 \
+      if(!narm) t->na = 1;                                            \
+      continue;                                                       \
+    }                                                                 \
+    if(t->na || (pw && pw[i] == 0.0)) continue;                       \
+    td_add(t, (double)px[i], pw ? pw[i] : 1.0, delta);                \
+  }
+
+#undef ISNA_INT
+#define ISNA_INT(x) ((x) == NA_INTEGER)
+
+/*
+ Computes ng digests (one if ng = 0) from the double (tx = REALSXP) or integer data in px, with 1-based group ids pg and
+ optional weights pw. With multiple threads, the rows are split into chunks with separate digests, which are merged.
+ Returns the compressed digests, to be freed with td_free().
+*/
+static tdigest *td_sketch(const void *px_, const int tx, const int l, const double *pw, const int *pg, const int ng,
+                          const int narm, const double delta, int nthreads) {
+  const int nd = ng ? ng : 1;
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(l < 100000) nthreads = 1; // No gains from multithreading on small data
+  if(nthreads < 1) nthreads = 1;
+
+  if(pw) { // Checking weights in the main thread
+    const double *pxd = (const double *)px_;
+    const int *pxi = (const int *)px_;
+    for(int i = 0; i != l; ++i) {
+      if(ISNAN(pw[i])) {
+        if(tx == REALSXP ? NISNAN(pxd[i]) : pxi[i] != NA_INTEGER)
+          error("Missing weights in order statistics are currently only supported if x is also missing");
+      } else if(pw[i] < 0.0) error("Weights must be positive or zero");
+    }
+  }
+
+  tdigest *td = (tdigest*)R_Calloc((size_t)nd * nthreads, tdigest);
+  for(size_t i = 0; i != (size_t)nd * nthreads; ++i) td_init(td + i);
+
+  #pragma omp parallel for num_threads(nthreads)
+  for(int c = 0; c < nthreads; ++c) {
+    const int start = (int)((double)l * c / nthreads), end = (int)((double)l * (c+1) / nthreads);
+    tdigest *tdc = td + (size_t)c * nd;
+    if(tx == REALSXP) {
+      const double *px = (const double *)px_;
+      TD_BUILD_LOOP(ISNAN);
+    } else {
+      const int *px = (const int *)px_;
+      TD_BUILD_LOOP(ISNA_INT);
+    }
+  }
+
+  #pragma omp parallel for num_threads(nthreads)
+  for(int d = 0; d < nd; ++d) {
+    for(int c = 1; c < nthreads; ++c) {
+      td_merge(td + d, td + (size_t)c * nd + d, delta);
+      td_free(td + (size_t)c * nd + d);
+    }
+    td_compress(td + d, delta);
+  }
+
+  return td;
+}
+
+static const int *td_groups(SEXP g, const int l, int *ng) {
+  *ng = 0;
+  if(isNull(g)) return NULL;
+  if(TYPEOF(g) != VECSXP || !inherits(g, "GRP")) error("g needs to be an object of class 'GRP', see ?GRP");
+  if(length(VECTOR_ELT(g, 1)) != l) error("length(g) must match length(x)");
+  *ng = asInteger(VECTOR_ELT(g, 0));
+  return INTEGER(VECTOR_ELT(g, 1));
+}
+
+static double td_delta(SEXP Rdelta) {
+  const double delta = asReal(Rdelta);
+  if(ISNAN(delta) || delta < 10.0 || delta > TD_MAX_DELTA) error("compression must be a number between 10 and %g", TD_MAX_DELTA);
+  return delta;
+}
+
+// Approximate quantile Q of a column of x by groups (ng = 0 for no groups): used by fnth() with ties = "approx"
+void nth_approx(double *pres, const void *px, const int tx, const int l, const double *pw, const int *pg, const int ng,
+                const int narm, const double Q, const int nthreads) {
+  tdigest *td = td_sketch(px, tx, l, pw, pg, ng, narm, QSKETCH_COMPRESSION, nthreads);
+  for(int d = 0; d != (ng ? ng : 1); ++d) {
+    pres[d] = td_quantile(td + d, Q);
+    td_free(td + d);
+  }
+  R_Free(td);
+}
+
+// Vector version, pw is not decremented
+SEXP nth_approx_impl(SEXP x, SEXP g, const double *pw, const int narm, const double Q, const int nthreads) {
+  int l = length(x), ng, tx = TYPEOF(x);
+  if(tx != REALSXP && tx != INTSXP && tx != LGLSXP) error("Not Supported SEXP Type: '%s'", type2char(tx));
+  const int *pg = td_groups(g, l, &ng);
+  SEXP res = PROTECT(allocVector(REALSXP, ng ? ng : 1));
+  nth_approx(REAL(res), tx == REALSXP ? (const void *)REAL(x) : (const void *)INTEGER(x), tx == REALSXP ? REALSXP : INTSXP, l, pw, pg, ng, narm, Q, nthreads);
+  if(ANY_ATTRIB(x) && !(isObject(x) && inherits(x, "ts"))) copyMostAttrib(x, res);
+  UNPROTECT(1);
+  return res;
+}
+
+// Matrix version: returns a (ng or 1) * ncol(x) matrix without attributes, and the number of groups in ng
+SEXP nth_approx_mat(SEXP x, SEXP g, const double *pw, const int narm, const double Q, const int nthreads, int *ng) {
+  SEXP dim = getAttrib(x, R_DimSymbol);
+  int tx = TYPEOF(x), l = INTEGER(dim)[0], col = INTEGER(dim)[1];
+  if(tx != REALSXP && tx != INTSXP && tx != LGLSXP) error("Not Supported SEXP Type: '%s'", type2char(tx));
+  const int *pg = td_groups(g, l, ng), nd = *ng ? *ng : 1;
+  SEXP res = PROTECT(allocVector(REALSXP, (R_xlen_t)nd * col));
+  double *pres = REAL(res);
+  if(tx == REALSXP) {
+    const double *px = REAL(x);
+    for(int j = 0; j != col; ++j) nth_approx(pres + (size_t)j * nd, px + (size_t)j * l, REALSXP, l, pw, pg, *ng, narm, Q, nthreads);
+  } else {
+    const int *px = INTEGER(x);
+    for(int j = 0; j != col; ++j) nth_approx(pres + (size_t)j * nd, px + (size_t)j * l, INTSXP, l, pw, pg, *ng, narm, Q, nthreads);
+  }
+  UNPROTECT(1);
+  return res;
+}
+
+// Exports compressed digests as list(mean, weight, size, min, max): the centroids of all groups are concatenated.
+// Groups with missing values (if na.rm = FALSE) have size 0 and missing min and max, empty groups infinite ones.
+static SEXP td_export(tdigest *td, const int nd) {
+  double K = 0.0;
+  for(int d = 0; d != nd; ++d) if(!td[d].na) K += td[d].n;
+  if(K > INT_MAX) error("Sketch too large");
+  SEXP res = PROTECT(allocVector(VECSXP, 5)), nam = PROTECT(allocVector(STRSXP, 5));
+  SET_VECTOR_ELT(res, 0, allocVector(REALSXP, (int)K));
+  SET_VECTOR_ELT(res, 1, allocVector(REALSXP, (int)K));
+  SET_VECTOR_ELT(res, 2, allocVector(INTSXP, nd));
+  SET_VECTOR_ELT(res, 3, allocVector(REALSXP, nd));
+  SET_VECTOR_ELT(res, 4, allocVector(REALSXP, nd));
+  SET_STRING_ELT(nam, 0, mkChar("mean"));
+  SET_STRING_ELT(nam, 1, mkChar("weight"));
+  SET_STRING_ELT(nam, 2, mkChar("size"));
+  SET_STRING_ELT(nam, 3, mkChar("min"));
+  SET_STRING_ELT(nam, 4, mkChar("max"));
+  namesgets(res, nam);
+  double *pm = REAL(VECTOR_ELT(res, 0)), *pw = REAL(VECTOR_ELT(res, 1)),
+    *pmin = REAL(VECTOR_ELT(res, 3)), *pmax = REAL(VECTOR_ELT(res, 4));
+  int *ps = INTEGER(VECTOR_ELT(res, 2));
+  for(int d = 0, k = 0; d != nd; ++d) {
+    const tdigest *t = td + d;
+    if(t->na) {
+      ps[d] = 0;
+      pmin[d] = pmax[d] = NA_REAL;
+      continue;
+    }
+    ps[d] = t->n;
+    pmin[d] = t->min;
+    pmax[d] = t->max;
+    for(int i = 0; i != t->n; ++i, ++k) {
+      pm[k] = t->m[i];
+      pw[k] = t->w[i];
+    }
+  }
+  UNPROTECT(2);
+  return res;
+}
+
+// Reads digest d of an exported sketch (without copying). starts are the 0-based offsets of the groups' centroids.
+static inline void td_view(tdigest *td, SEXP sketch, const int *starts, const int d) {
+  const double min = REAL(VECTOR_ELT(sketch, 3))[d];
+  td->cap = 0; // Not owned
+  td->na = ISNAN(min);
+  td->n = td->na ? 0 : INTEGER(VECTOR_ELT(sketch, 2))[d];
+  td->m = REAL(VECTOR_ELT(sketch, 0)) + starts[d];
+  td->w = REAL(VECTOR_ELT(sketch, 1)) + starts[d];
+  td->min = min;
+  td->max = REAL(VECTOR_ELT(sketch, 4))[d];
+}
+
+static int *td_starts(SEXP sketch) {
+  if(TYPEOF(sketch) != VECSXP || length(sketch) < 5) error("Invalid sketch, see ?qsketch");
+  SEXP size = VECTOR_ELT(sketch, 2);
+  const int nd = length(size), *ps = INTEGER(size);
+  int *starts = (int *) R_alloc(nd + 1, sizeof(int));
+  starts[0] = 0;
+  for(int d = 0; d != nd; ++d) starts[d+1] = starts[d] + ps[d];
+  if(starts[nd] != length(VECTOR_ELT(sketch, 0)) || starts[nd] != length(VECTOR_ELT(sketch, 1)) ||
+     length(VECTOR_ELT(sketch, 3)) != nd || length(VECTOR_ELT(sketch, 4)) != nd) error("Invalid sketch, see ?qsketch");
+  return starts;
+}
+
+SEXP qsketchC(SEXP x, SEXP g, SEXP w, SEXP Rdelta, SEXP Rnarm, SEXP Rnthreads) {
+  const int l = length(x), narm = asLogical(Rnarm), tx = TYPEOF(x);
+  const double delta = td_delta(Rdelta);
+  int ng, nprotect = 0;
+  if(tx != REALSXP && tx != INTSXP && tx != LGLSXP) error("x needs to be numeric");
+  const int *pg = td_groups(g, l, &ng);
+  const double *pw = NULL;
+  if(!isNull(w)) {
+    if(length(w) != l) error("length(w) must match length(x)");
+    if(TYPEOF(w) != REALSXP) {
+      if(!(TYPEOF(w) == INTSXP || TYPEOF(w) == LGLSXP)) error("weights need to be double or integer/logical (internally coerced to double)");
+      w = PROTECT(coerceVector(w, REALSXP)); ++nprotect;
+    }
+    pw = REAL(w);
+  }
+  const int nd = ng ? ng : 1;
+  tdigest *td = td_sketch(tx == REALSXP ? (const void *)REAL(x) : (const void *)INTEGER(x), tx == REALSXP ? REALSXP : INTSXP, l, pw, pg, ng, narm, delta, asInteger(Rnthreads));
+  SEXP res = td_export(td, nd);
+  for(int d = 0; d != nd; ++d) td_free(td + d);
+  R_Free(td);
+  UNPROTECT(nprotect);
+  return res;
+}
+
+// Merges a list of sketches: maps is a list of integer vectors of length ng, giving for each group of the result
+// the (1-based) group in each sketch, or NA if the group does not occur in it.
+SEXP qsketch_mergeC(SEXP sketches, SEXP maps, SEXP Rng, SEXP Rdelta, SEXP Rnthreads) {
+  const int ns = length(sketches), ng = asInteger(Rng);
+  const double delta = td_delta(Rdelta);
+  int nthreads = asInteger(Rnthreads);
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads > ng) nthreads = ng;
+  if(nthreads < 1) nthreads = 1;
+  if(length(maps) != ns) error("length(maps) must match length(sketches)");
+
+  const SEXP *ps = SEXPPTR_RO(sketches), *pmaps = SEXPPTR_RO(maps);
+  const int **starts = (const int **) R_alloc(ns, sizeof(int *)), **pmap = (const int **) R_alloc(ns, sizeof(int *));
+  for(int s = 0; s != ns; ++s) {
+    starts[s] = td_starts(ps[s]);
+    if(TYPEOF(pmaps[s]) != INTSXP || length(pmaps[s]) != ng) error("Internal error: invalid group mapping");
+    pmap[s] = INTEGER(pmaps[s]);
+    for(int d = 0, nds = length(VECTOR_ELT(ps[s], 2)); d != ng; ++d)
+      if(pmap[s][d] != NA_INTEGER && (pmap[s][d] < 1 || pmap[s][d] > nds)) error("Internal error: invalid group mapping");
+  }
+
+  tdigest *td = (tdigest*)R_Calloc(ng, tdigest);
+  #pragma omp parallel for num_threads(nthreads)
+  for(int d = 0; d < ng; ++d) {
+    tdigest src;
+    td_init(td + d);
+    for(int s = 0; s != ns; ++s) {
+      if(pmap[s][d] == NA_INTEGER) continue;
+      td_view(&src, ps[s], starts[s], pmap[s][d]-1);
+      td_merge(td + d, &src, delta);
+    }
+    td_compress(td + d, delta);
+  }
+
+  SEXP res = td_export(td, ng);
+  for(int d = 0; d != ng; ++d) td_free(td + d);
+  R_Free(td);
+  return res;
+}
+
+// Returns a length(size) * length(probs) matrix of quantiles
+SEXP qsketch_quantileC(SEXP sketch, SEXP Rprobs) {
+  if(TYPEOF(Rprobs) != REALSXP) error("probs needs to be a numeric vector");
+  const int *starts = td_starts(sketch), nd = length(VECTOR_ELT(sketch, 2)), np = length(Rprobs);
+  const double *probs = REAL(Rprobs);
+  for(int i = 0; i != np; ++i) if(ISNAN(probs[i]) || probs[i] < 0.0 || probs[i] > 1.0) error("probabilities need to be in range [0, 1]");
+  SEXP res = PROTECT(allocMatrix(REALSXP, nd, np));
+  double *pres = REAL(res);
+  tdigest td;
+  for(int d = 0; d != nd; ++d) {
+    td_view(&td, sketch, starts, d);
+    for(int i = 0; i != np; ++i) pres[d + (size_t)i * nd] = td_quantile(&td, probs[i]);
+  }
+  UNPROTECT(1);
+  return res;
+}
@@ -0,0 +1,354 @@
+#include "collapse_c.h"
+
+/*
+ Fused panel decomposition for qsu(x, pid = ...): overall, between and within statistics (N/T, [WeightSum], Mean, SD, Min,
+ Max, [Skew, Kurt]) of numeric columns, in two passes over the data. The first pass accumulates the overall moments and the
+ (weighted) sums and counts of each panel-id (or of each group-id pair, if g is supplied). The second pass accumulates the
+ moments of the within-transformed data x - mean(x | pid) + mean(x) and, with groups, of the between-transformed data
+ mean(x | pid). Moments are kept in mergeable (weighted) central-moment accumulators (Pebay, 2008), so that chunks of rows can
+ be processed on different threads and combined afterwards. Columns are distributed across threads, or, if there are fewer
+ columns than threads, chunks of rows of each column. The results are the same as those of fbstatsCpp() / fbstatslCpp()
+ with array = TRUE in fbstats.cpp (using the numerically stable algorithm).
+*/
+
+typedef struct { double n, w, mean, M2, M3, M4, min, max; } qmom;
+
+// Adds an observation x with weight w
+static inline void qmom_add(qmom *restrict m, const double x, const double w, const int ext) {
+  if(m->n == 0.0) {
+    m->n = 1.0;
+    m->w = w;
+    m->mean = m->min = m->max = x;
+    m->M2 = m->M3 = m->M4 = 0.0;
+    return;
+  }
+  const double wa = m->w, W = wa + w, d = x - m->mean, dw = d * w / W, t = d * dw * wa;
+  if(ext) {
+    const double dw2 = dw * dw;
+    m->M4 += t * d * d * (wa * wa - wa * w + w * w) / (W * W) + 6.0 * dw2 * m->M2 - 4.0 * dw * m->M3;
+    m->M3 += t * d * (wa - w) / W - 3.0 * dw * m->M2;
+  }
+  m->M2 += t;
+  m->mean += dw;
+  m->w = W;
+  ++m->n;
+  if(x < m->min) m->min = x;
+  if(x > m->max) m->max = x;
+}
+
+// Combines the moments of b into a
+static void qmom_merge(qmom *restrict a, const qmom *restrict b, const int ext) {
+  if(b->n == 0.0) return;
+  if(a->n == 0.0) {
+    *a = *b;
+    return;
+  }
+  const double wa = a->w, wb = b->w, W = wa + wb, d = b->mean - a->mean, dW = d / W, t = d * dW * wa * wb;
+  if(ext) {
+    a->M4 += b->M4 + t * dW * dW * (wa * wa - wa * wb + wb * wb) + 6.0 * dW * dW * (wa * wa * b->M2 + wb * wb * a->M2) +
+             4.0 * dW * (wa * b->M3 - wb * a->M3);
+    a->M3 += b->M3 + t * dW * (wa - wb) + 3.0 * dW * (wa * b->M2 - wb * a->M2);
+  }
+  a->M2 += b->M2 + t;
+  a->mean += dW * wb;
+  a->w = W;
+  a->n += b->n;
+  if(b->min < a->min) a->min = b->min;
+  if(b->max > a->max) a->max = b->max;
+}
+
+// Writes N, [WeightSum], Mean, SD, Min, Max, [Skew, Kurt] to out, with stride s
+static void qmom_write(double *restrict out, const R_xlen_t s, const qmom *restrict m, const int weights, const int ext) {
+  out[0] = m->n;
+  if(weights) out[s] = m->w;
+  out += s * (1 + weights);
+  if(m->n == 0.0) {
+    for(int j = 0; j < 4 + 2 * ext; ++j) out[s * j] = NA_REAL;
+    return;
+  }
+  double sd = sqrt(m->M2 / (m->w - 1.0));
+  out[0] = m->mean;
+  out[s] = ISNAN(sd) ? NA_REAL : sd;
+  out[2*s] = m->min;
+  out[3*s] = m->max;
+  if(ext) {
+    out[4*s] = sqrt(m->w) * m->M3 / sqrt(m->M2 * m->M2 * m->M2); // Skewness
+    out[5*s] = m->w * m->M4 / (m->M2 * m->M2); // Kurtosis
+  }
+}
+
+// Scratch space of a thread / chunk of rows
+typedef struct {
+  double *psum, *pn, *pw, *pm, *pden, *gnp; // Per pair: sum(w*x), count, sum(w); per pid: mean and sum of weights; per group: pids
+  qmom *ov, *be, *wi; // Per group: overall, between and within moments
+} qsu_acc;
+
+static void qsu_acc_alloc(qsu_acc *a, const int npairs, const int npg, const int ng) {
+  a->psum = (double *)R_Calloc(3 * (size_t)npairs + 2 * (size_t)npg + ng, double);
+  a->pn = a->psum + npairs;
+  a->pw = a->pn + npairs;
+  a->pm = a->pw + npairs;
+  a->pden = a->pm + npg;
+  a->gnp = a->pden + npg;
+  a->ov = (qmom *)R_Calloc(3 * (size_t)ng, qmom);
+  a->be = a->ov + ng;
+  a->wi = a->be + ng;
+}
+
+static void qsu_acc_zero(qsu_acc *a, const int npairs, const int npg, const int ng) {
+  memset(a->psum, 0, (3 * (size_t)npairs + 2 * (size_t)npg + ng) * sizeof(double));
+  memset(a->ov, 0, 3 * (size_t)ng * sizeof(qmom));
+}
+
+static void qsu_acc_free(qsu_acc *a) {
+  R_Free(a->psum);
+  R_Free(a->ov);
+}
+
+static inline double qsu_val(const double *px, const int *pxi, const int i) {
+  return px ? px[i] : pxi[i] == NA_INTEGER ? NA_REAL : (double)pxi[i];
+}
+
+/*
+ Panel statistics for one column (px or pxi), written to out. pg: pid (1-based), g: group id (1-based) or NULL, pair: 0-based
+ id of the group-pid combination of each row (NULL without groups), pairpid / pairg: pid and group of each pair. acc: nch
+ accumulators; rows are split into nch chunks processed in parallel.
+*/
+static void qsu_panel_col(double *restrict out, const double *px, const int *pxi, const int l, const int *pg, const int *g,
+                          const int *pair, const int *pairpid, const int *pairg, const int npairs, const int npg, const int ng,
+                          const double *pw, const int ext, qsu_acc *acc, const int nch) {
+
+  const int ngs = g ? ng : 1, weights = pw != NULL, d = 5 + weights + 2 * ext;
+  for(int c = 0; c < nch; ++c) qsu_acc_zero(acc + c, npairs, npg, ngs);
+
+  // Pass 1: overall moments and sums per pair
+  #pragma omp parallel for num_threads(nch) if(nch > 1)
+  for(int c = 0; c < nch; ++c) {
+    const int start = (int)((double)l * c / nch), end = (int)((double)l * (c + 1) / nch);
+    double *restrict psum = acc[c].psum, *restrict pn = acc[c].pn, *restrict psw = acc[c].pw;
+    qmom *restrict ov = acc[c].ov;
+    for(int i = start; i < end; ++i) {
+      const double xi = qsu_val(px, pxi, i);
+      if(ISNAN(xi)) continue;
+      const double wi = weights ? pw[i] : 1.0;
+      if(ISNAN(wi) || wi == 0.0) continue;
+      const int p = pair ? pair[i] : pg[i]-1, gi = g ? g[i]-1 : 0;
+      ++pn[p];
+      psum[p] += wi * xi;
+      psw[p] += wi;
+      qmom_add(ov + gi, xi, wi, ext);
+    }
+  }
+  qsu_acc *a = acc;
+  for(int c = 1; c < nch; ++c) {
+    for(int p = 0; p < npairs; ++p) {
+      a->psum[p] += acc[c].psum[p];
+      a->pn[p] += acc[c].pn[p];
+      a->pw[p] += acc[c].pw[p];
+    }
+    for(int k = 0; k < ngs; ++k) qmom_merge(a->ov + k, acc[c].ov + k, ext);
+  }
+
+  // Means of the panel-ids and overall mean
+  double *restrict pm = a->pm, *restrict pden = a->pden, osum = 0.0, oden = 0.0;
+  const double *den = weights ? a->pw : a->pn;
+  if(pair) {
+    for(int p = 0; p < npairs; ++p) {
+      pm[pairpid[p]] += a->psum[p];
+      pden[pairpid[p]] += den[p];
+    }
+  } else {
+    memcpy(pm, a->psum, npg * sizeof(double));
+    memcpy(pden, den, npg * sizeof(double));
+  }
+  for(int p = 0; p < npg; ++p) {
+    osum += pm[p];
+    oden += pden[p];
+    pm[p] = pden[p] > 0.0 ? pm[p] / pden[p] : NA_REAL;
+  }
+  osum /= oden;
+
+  // Pass 2: within (and, with groups, between) moments
+  #pragma omp parallel for num_threads(nch) if(nch > 1)
+  for(int c = 0; c < nch; ++c) {
+    const int start = (int)((double)l * c / nch), end = (int)((double)l * (c + 1) / nch);
+    qmom *restrict be = acc[c].be, *restrict wi = acc[c].wi;
+    for(int i = start; i < end; ++i) {
+      const double xi = qsu_val(px, pxi, i), wgt = weights ? pw[i] : 1.0;
+      if(ISNAN(xi) || ISNAN(wgt) || wgt == 0.0) continue;
+      const double mp = pm[pg[i]-1];
+      const int gi = g ? g[i]-1 : 0;
+      qmom_add(wi + gi, xi - mp + osum, wgt, ext);
+      if(g) qmom_add(be + gi, mp, wgt, ext);
+    }
+  }
+  for(int c = 1; c < nch; ++c) {
+    for(int k = 0; k < ngs; ++k) {
+      qmom_merge(a->wi + k, acc[c].wi + k, ext);
+      qmom_merge(a->be + k, acc[c].be + k, ext);
+    }
+  }
+
+  if(g == NULL) { // Between statistics computed on the means of the panel-ids (weighted by their sum of weights)
+    for(int p = 0; p < npg; ++p) if(pden[p] > 0.0) qmom_add(a->be, pm[p], weights ? pden[p] : 1.0, ext);
+    const double nb = a->be->n;
+    for(int r = 0; r < 3; ++r) qmom_write(out + r, 3, r == 0 ? a->ov : r == 1 ? a->be : a->wi, weights, ext);
+    if(weights) out[4] = nb; // Between WeightSum
+    out[2] /= nb; // Within N/T
+    if(weights) out[5] /= nb;
+  } else { // Between statistics computed on the data expanded to the panel, T = number of panel-ids in group
+    double *restrict gnp = a->gnp;
+    for(int p = 0; p < npairs; ++p) if(a->pn[p] > 0.0) ++gnp[pairg[p]];
+    const R_xlen_t sr = (R_xlen_t)ng * d;
+    for(int k = 0; k < ng; ++k) {
+      qmom_write(out + k, ng, a->ov + k, weights, ext);
+      qmom_write(out + sr + k, ng, a->be + k, weights, ext);
+      qmom_write(out + 2 * sr + k, ng, a->wi + k, weights, ext);
+      out[sr + k] = gnp[k];
+      out[2 * sr + k] /= gnp[k];
+      if(weights) {
+        out[sr + ng + k] = gnp[k];
+        out[2 * sr + ng + k] /= gnp[k];
+      }
+    }
+  }
+}
+
+// Dense ids for the group-pid combinations occurring in the data (rows are visited by pid using a counting sort)
+static int qsu_pairs(int *restrict pair, int **pairpid, int **pairg, const int *pg, const int *g, const int l, const int npg, const int ng) {
+  int *cnt = (int *)R_Calloc(npg + 1, int), *o = (int *)R_Calloc(l, int), *stamp = (int *)R_Calloc(ng, int), *id = (int *)R_Calloc(ng, int);
+  for(int i = 0; i < l; ++i) ++cnt[pg[i]];
+  for(int p = 0; p < npg; ++p) cnt[p+1] += cnt[p];
+  for(int i = 0; i < l; ++i) o[cnt[pg[i]-1]++] = i; // cnt[p] is now the end of pid p+1
+  int npairs = 0;
+  for(int p = 0, m = 0; p < npg; ++p) {
+    for(; m < cnt[p]; ++m) {
+      const int i = o[m], gi = g[i]-1;
+      if(stamp[gi] != p + 1) {
+        stamp[gi] = p + 1;
+        id[gi] = npairs++;
+      }
+      pair[i] = id[gi];
+    }
+  }
+  *pairpid = (int *)R_alloc(npairs, sizeof(int));
+  *pairg = (int *)R_alloc(npairs, sizeof(int));
+  for(int i = 0; i < l; ++i) {
+    (*pairpid)[pair[i]] = pg[i]-1;
+    (*pairg)[pair[i]] = g[i]-1;
+  }
+  R_Free(cnt); R_Free(o); R_Free(stamp); R_Free(id);
+  return npairs;
+}
+
+static SEXP qsu_statnames(const int weights, const int ext) {
+  const char *nam[8] = {"N/T", "WeightSum", "Mean", "SD", "Min", "Max", "Skew", "Kurt"};
+  SEXP res = PROTECT(allocVector(STRSXP, 5 + weights + 2 * ext));
+  for(int j = 0, k = 0; j < 8; ++j) {
+    if((j == 1 && !weights) || (j > 5 && !ext)) continue;
+    SET_STRING_ELT(res, k++, mkChar(nam[j]));
+  }
+  UNPROTECT(1);
+  return res;
+}
+
+/*
+ x: numeric vector or list of numeric vectors. Returns the statistics in the format of fbstatsCpp() (x atomic) or fbstatslCpp()
+ (x a list) with array = TRUE. Returns NULL if x is a list containing non-numeric or classed columns (which are handled by
+ fbstatslCpp()).
+*/
+SEXP qsu_panelC(SEXP x, SEXP Rext, SEXP Rng, SEXP g, SEXP Rnpg, SEXP pg, SEXP w, SEXP gn, SEXP Rnthreads) {
+  const int islist = TYPEOF(x) == VECSXP, k = islist ? length(x) : 1, ext = asLogical(Rext), npg = asInteger(Rnpg),
+    weights = !isNull(w), ngs = asInteger(Rng), d = 5 + weights + 2 * ext;
+  int nthreads = asInteger(Rnthreads), nprotect = 0;
+  const int ng = ngs > 0 ? ngs : 1;
+  const SEXP *px = islist ? SEXPPTR_RO(x) : &x;
+
+  if(k == 0) return R_NilValue;
+  for(int j = 0; j < k; ++j) {
+    const int tj = TYPEOF(px[j]);
+    if(islist && (OBJECT(px[j]) || !(tj == REALSXP || tj == INTSXP))) return R_NilValue;
+    if(!(tj == REALSXP || tj == INTSXP || tj == LGLSXP)) error("Not supported SEXP type!");
+  }
+  const int l = length(px[0]);
+  for(int j = 1; j < k; ++j) if(length(px[j]) != l) error("All columns of x must have the same length");
+  if(length(pg) != l) error("length(pid) must match nrow(X)");
+  if(ngs > 0 && length(g) != l) error("length(g) must match nrow(X)");
+  if(weights && length(w) != l) error("length(w) must match length(x)");
+  if(weights && TYPEOF(w) != REALSXP) {
+    w = PROTECT(coerceVector(w, REALSXP)); ++nprotect;
+  }
+  const int *ppg = INTEGER(pg), *pgg = ngs > 0 ? INTEGER(g) : NULL;
+  const double *pw = weights ? REAL(w) : NULL;
+
+  // Group-pid combinations, only needed with groups
+  int *pair = NULL, *pairpid = NULL, *pairg = NULL, npairs = npg;
+  if(pgg) {
+    pair = (int *)R_alloc(l, sizeof(int));
+    npairs = qsu_pairs(pair, &pairpid, &pairg, ppg, pgg, l, npg, ng);
+  }
+
+  SEXP res = PROTECT(allocVector(REALSXP, (R_xlen_t)3 * d * ng * k)); ++nprotect;
+  double *pres = REAL(res);
+  const R_xlen_t size = (R_xlen_t)3 * d * ng;
+
+  if(nthreads > max_threads) nthreads = max_threads;
+  if(nthreads < 1) nthreads = 1;
+  if(l < 100000) nthreads = k < nthreads ? k : nthreads; // Splitting rows is not worth it on small data
+
+  if(k >= nthreads) { // Columns across threads
+    #pragma omp parallel num_threads(nthreads)
+    {
+      qsu_acc acc;
+      qsu_acc_alloc(&acc, npairs, npg, ng);
+      #pragma omp for schedule(dynamic)
+      for(int j = 0; j < k; ++j) {
+        SEXP xj = px[j];
+        qsu_panel_col(pres + size * j, TYPEOF(xj) == REALSXP ? REAL(xj) : NULL, TYPEOF(xj) == REALSXP ? NULL : INTEGER(xj), l,
+                      ppg, pgg, pair, pairpid, pairg, npairs, npg, ngs, pw, ext, &acc, 1);
+      }
+      qsu_acc_free(&acc);
+    }
+  } else { // Chunks of rows across threads
+    qsu_acc *acc = (qsu_acc *)R_alloc(nthreads, sizeof(qsu_acc));
+    for(int c = 0; c < nthreads; ++c) qsu_acc_alloc(acc + c, npairs, npg, ng);
+    for(int j = 0; j < k; ++j) {
+      SEXP xj = px[j];
+      qsu_panel_col(pres + size * j, TYPEOF(xj) == REALSXP ? REAL(xj) : NULL, TYPEOF(xj) == REALSXP ? NULL : INTEGER(xj), l,
+                    ppg, pgg, pair, pairpid, pairg, npairs, npg, ngs, pw, ext, acc, nthreads);
+    }
+    for(int c = 0; c < nthreads; ++c) qsu_acc_free(acc + c);
+  }
+
+  // Attributes, as in fbstatsCpp() / fbstatslCpp()
+  SEXP obw = PROTECT(allocVector(STRSXP, 3)), dim, dn, cl = PROTECT(allocVector(STRSXP, 3)); nprotect += 2;
+  SET_STRING_ELT(obw, 0, mkChar("Overall"));
+  SET_STRING_ELT(obw, 1, mkChar("Between"));
+  SET_STRING_ELT(obw, 2, mkChar("Within"));
+  const int nd = (ngs > 0 ? 3 : 2) + islist;
+  dim = PROTECT(allocVector(INTSXP, nd));
+  dn = PROTECT(allocVector(VECSXP, nd)); nprotect += 2;
+  int *pdim = INTEGER(dim);
+  if(ngs > 0) {
+    pdim[0] = ng; pdim[1] = d; pdim[2] = 3;
+    SET_VECTOR_ELT(dn, 0, gn);
+    SET_VECTOR_ELT(dn, 1, qsu_statnames(weights, ext));
+    SET_VECTOR_ELT(dn, 2, obw);
+  } else {
+    pdim[0] = 3; pdim[1] = d;
+    SET_VECTOR_ELT(dn, 0, obw);
+    SET_VECTOR_ELT(dn, 1, qsu_statnames(weights, ext));
+  }
+  if(islist) {
+    pdim[nd-1] = k;
+    SET_VECTOR_ELT(dn, nd-1, getAttrib(x, R_NamesSymbol));
+  }
+  dimgets(res, dim);
+  dimnamesgets(res, dn);
+  SET_STRING_ELT(cl, 0, mkChar("qsu"));
+  SET_STRING_ELT(cl, 1, mkChar(nd == 2 ? "matrix" : "array"));
+  SET_STRING_ELT(cl, 2, mkChar("table"));
+  classgets(res, cl);
+  UNPROTECT(nprotect);
+  return res;
+}
@@ -0,0 +1,134 @@
+#include "collapse_c.h"
+#include "time_index.h"
+
+// Sort-based indexing of (irregular) time series and panels: used by fewmean() / fewvar(), and by flag() / fdiff()
+// if the range of the time variable is sparse relative to the length of the data, in which case a dense ordering
+// vector of length max(t) - min(t) + 1 (per group) would be (very) large.
+
+// Computes the 1-based ordering of the data by groups and time in po. Time is radix-ordered, followed by a stable
+// counting sort on the groups. Returns 1 if time contains missing values, 2 if it is repeated (within groups), else 0.
+// Errors are left to the caller, as this is also called from C++ code.
+int order_gt(int *po, const int *pg, const int *pt, const int ng, const int l) {
+  for(int i = 0; i != l; ++i) if(pt[i] == NA_INTEGER) return 1;
+  if(ng == 0) {
+    iradixsort(po, TRUE, FALSE, l, (int *)pt);
+    for(int i = 1; i < l; ++i) if(pt[po[i]-1] == pt[po[i-1]-1]) return 2;
+    return 0;
+  }
+  int *ot = (int*)R_Calloc(l, int), *cgs = (int*)R_Calloc(ng+2, int);
+  iradixsort(ot, TRUE, FALSE, l, (int *)pt);
+  for(int i = 0; i != l; ++i) ++cgs[pg[i]+1];
+  for(int i = 1; i <= ng; ++i) cgs[i+1] += cgs[i];
+  for(int i = 0, oi; i != l; ++i) {
+    oi = ot[i];
+    po[cgs[pg[oi-1]]++] = oi;
+  }
+  R_Free(ot); R_Free(cgs);
+  for(int i = 1; i < l; ++i) {
+    if(pg[po[i]-1] == pg[po[i-1]-1] && pt[po[i]-1] == pt[po[i-1]-1]) return 2;
+  }
+  return 0;
+}
+
+// Given the ordering po from order_gt(), writes to pidx[i] the 1-based index of the observation in the same group
+// at time pt[i] - n, or 0 if there is no such observation. Since time is unique within groups, the target time is
+// monotonic in the ordering, so a second pointer finds all matches in a single pass: O(l) for any lag or lead n.
+void time_lag_index(int *pidx, const int *po, const int *pg, const int *pt, const int ng, const int n, const int l) {
+  if(n == 0) {
+    for(int i = 0; i != l; ++i) pidx[i] = i+1;
+  } else if(n > 0) { // Lags: pointer trails behind
+    for(int k = 0, j = 0, ok, target; k != l; ++k) {
+      ok = po[k]-1;
+      if(ng && k && pg[ok] != pg[po[k-1]-1]) j = k; // New group
+      target = pt[ok] - n;
+      while(j < k && pt[po[j]-1] < target) ++j;
+      pidx[ok] = (j < k && pt[po[j]-1] == target) ? po[j] : 0;
+    }
+  } else { // Leads: pointer runs ahead
+    for(int k = l, j = l-1, ok, target; k--; ) {
+      ok = po[k]-1;
+      if(ng && k != l-1 && pg[ok] != pg[po[k+1]-1]) j = k;
+      target = pt[ok] - n;
+      while(j > k && pt[po[j]-1] > target) --j;
+      pidx[ok] = (j > k && pt[po[j]-1] == target) ? po[j] : 0;
+    }
+  }
+}
+
+// Irregular time series and panels: computes the index of the data by groups and time once, from which lag_index_get()
+// computes, for any lag / lead, the 1-based index of the lagged / leaded value of each observation, or 0 if it is not
+// available (a gap). If the range of the time variable (summed across groups) exceeds 100000 and 4 times the data
+// length, the sort-based index above is used instead of a dense ordering vector with one slot per time period (e.g. for
+// second or millisecond timestamps). Returns an error code as order_gt(), in which case nothing is allocated.
+int lag_index_init(lag_index_t *idx, const int *pg, const int *pt, const int ng, const int l) {
+  const int ngp = ng+1;
+  idx->pg = pg; idx->pt = pt; idx->ng = ng; idx->l = l;
+  idx->po = idx->cgs = idx->omap = NULL;
+  int *min = idx->min = (int*)R_Calloc(2 * ngp, int), *max = idx->max = min + ngp;
+  for(int i = 0; i != ngp; ++i) {
+    min[i] = INT_MAX;
+    max[i] = INT_MIN;
+  }
+  for(int i = 0, gi; i != l; ++i) {
+    gi = ng ? pg[i] : 0;
+    if(pt[i] < min[gi]) min[gi] = pt[i];
+    if(pt[i] > max[gi]) max[gi] = pt[i];
+  }
+  double range = 0.0;
+  for(int i = 0; i != ngp; ++i) {
+    if(min[i] == NA_INTEGER) {
+      lag_index_free(idx);
+      return 1;
+    }
+    if(min[i] != INT_MAX) range += (double)max[i] - min[i] + 1.0;
+  }
+
+  if(range > 100000.0 && range > 4.0 * l) { // Sparse: sort-based index
+    R_Free(idx->min);
+    idx->po = (int*)R_Calloc(l, int);
+    int ret = order_gt(idx->po, pg, pt, ng, l);
+    if(ret) lag_index_free(idx);
+    return ret;
+  }
+
+  // Dense: omap maps (group offset + time - min) to the 1-based index of the observation, 0 indicates a gap
+  int *cgs = idx->cgs = (int*)R_Calloc(ngp, int), *omap = idx->omap = (int*)R_Calloc((size_t)range, int);
+  for(int i = 0, s = 0; i != ngp; ++i) {
+    if(min[i] == INT_MAX) continue; // Unused factor levels
+    cgs[i] = s;
+    max[i] -= min[i] - 1; // Now the size of the time range of the group
+    s += max[i];
+  }
+  for(int i = 0, gi, tmp; i != l; ++i) {
+    gi = ng ? pg[i] : 0;
+    tmp = cgs[gi] + pt[i] - min[gi];
+    if(omap[tmp]) {
+      lag_index_free(idx);
+      return 2;
+    }
+    omap[tmp] = i+1;
+  }
+  return 0;
+}
+
+// Writes the l indices for lag / lead n to pidx: O(l) for any n
+void lag_index_get(int *pidx, const lag_index_t *idx, const int n) {
+  const int *pg = idx->pg, *pt = idx->pt, ng = idx->ng, l = idx->l;
+  if(idx->po) {
+    time_lag_index(pidx, idx->po, pg, pt, ng, n, l);
+    return;
+  }
+  const int *min = idx->min, *max = idx->max, *cgs = idx->cgs, *omap = idx->omap;
+  for(int i = 0, gi, tmp; i != l; ++i) {
+    gi = ng ? pg[i] : 0;
+    tmp = pt[i] - min[gi] - n;
+    pidx[i] = (tmp >= 0 && tmp < max[gi]) ? omap[cgs[gi] + tmp] : 0;
+  }
+}
+
+void lag_index_free(lag_index_t *idx) {
+  if(idx->po) R_Free(idx->po);
+  if(idx->min) R_Free(idx->min);
+  if(idx->cgs) R_Free(idx->cgs);
+  if(idx->omap) R_Free(idx->omap);
+}
@@ -0,0 +1,62 @@
+#ifndef TIME_INDEX_H
+#define TIME_INDEX_H
+
+// Index of an irregular time series or panel, see time_index.c. Either po (sparse time range) or min, max, cgs and
+// omap (dense time range) are allocated.
+typedef struct {
+  const int *pg, *pt;
+  int ng, l;
+  int *po, *min, *max, *cgs, *omap;
+} lag_index_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int lag_index_init(lag_index_t *idx, const int *pg, const int *pt, const int ng, const int l);
+void lag_index_get(int *pidx, const lag_index_t *idx, const int n);
+void lag_index_free(lag_index_t *idx);
+#ifdef __cplusplus
+}
+
+#include <Rcpp/Lighter>
+#include <vector>
+
+// Used by flag.cpp and fdiff_fgrowth.cpp: the 1-based indices of the lagged / leaded values of x for n[p] (0 if there
+// is a gap). The time index is computed once. With all = FALSE, the indices are computed for one lag at a time when
+// requested, so only l integers are stored. Otherwise (several columns), they are computed upfront for all lags.
+class LagLeadIndex {
+  Rcpp::IntegerVector t_;
+  lag_index_t idx_;
+  std::vector<int> buf_;
+  const int *pn_;
+  int l_, last_;
+  bool all_;
+
+public:
+  LagLeadIndex(const Rcpp::IntegerVector& n, int ng, const Rcpp::IntegerVector& g, const SEXP& t, int l, bool all) :
+    t_(t), pn_(n.begin()), l_(l), last_(-1), all_(all && n.size() > 1) {
+    if(l != t_.size()) Rcpp::stop("length(x) must match length(t)");
+    const int ns = all_ ? n.size() : 1;
+    buf_.resize((size_t)ns * l);
+    switch(lag_index_init(&idx_, g.begin(), t_.begin(), ng, l)) {
+      case 1: Rcpp::stop("Timevar contains missing values");
+      case 2: Rcpp::stop(ng == 0 ? "Repeated values in timevar" : "Repeated values of timevar within one or more groups");
+    }
+    if(all_) for(int p = 0; p != ns; ++p) lag_index_get(&buf_[(size_t)p * l], &idx_, pn_[p]);
+  }
+  ~LagLeadIndex() { lag_index_free(&idx_); }
+  LagLeadIndex(const LagLeadIndex&) = delete;
+  LagLeadIndex& operator=(const LagLeadIndex&) = delete;
+
+  const int *operator[](int p) {
+    if(all_) return &buf_[(size_t)p * l_];
+    if(p != last_) {
+      lag_index_get(buf_.data(), &idx_, pn_[p]);
+      last_ = p;
+    }
+    return buf_.data();
+  }
+};
+#endif
+
+#endif